@@ -43,6 +43,11 @@
  * If you know that the file will never be compressed and you absolutely need
  * to freely seek, simply use the standard fopen() function.
  * 
+ * Uncompressed assets stored in DragonFS are loaded by #asset_load (and the
+ * other loading functions) with a single DMA transfer straight into the
+ * destination buffer. Large read-only uncompressed assets can also be accessed
+ * in place, without loading them, via #asset_map_rom.
+ * 
  * ## Asset compression
  * 
  * To compress your own data files, you can use the mkasset tool.
@@ -66,6 +71,8 @@
  */
 
 #include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
 
 #ifdef N64
 #include "debug.h"
@@ -229,6 +236,120 @@ bool asset_loadf_into(FILE *f, int *sz, void *buf, int *buf_size);
  */
 FILE *asset_fopen(const char *fn, int *sz);
 
+/**
+ * @brief Map an uncompressed asset in ROM, without loading it
+ * 
+ * This function returns a pointer to the contents of an uncompressed asset
+ * (compression level 0) directly in the cartridge address space, without
+ * copying it into RDRAM. It is useful for large read-only tables that are
+ * accessed sparsely, where loading the whole file would waste memory.
+ * 
+ * The returned memory is read-only and uncached, and it is accessed through
+ * the PI bus, so each access is much slower than RDRAM. Moreover, only
+ * 32-bit aligned loads are reliable, and the CPU must not access it while a
+ * PI DMA is in progress (or the console might hang). Use #io_read for safe
+ * random access, or #dma_read to copy chunks of it into RDRAM.
+ * 
+ * @param fn        Filename to map (must be in DragonFS, eg: "rom:/table.bin")
+ * @param sz        If not NULL, this will be filled with the size of the asset
+ * @return          Pointer to the asset in ROM, or NULL if the asset is compressed
+ *                  (and thus must be loaded with #asset_load).
+ */
+const void *asset_map_rom(const char *fn, int *sz);
+
+/** @brief A background asset prefetch operation (see #asset_prefetch) */
+typedef struct asset_prefetch_s asset_prefetch_t;
+
+/** @brief An asset to load in background with #asset_prefetch */
+typedef struct {
+    const char *fn;         ///< Filename to load (including filesystem prefix, eg: "rom:/foo.dat")
+    void *buf;              ///< [in/out] Destination buffer, or NULL to allocate it (see #asset_prefetch)
+    int buf_size;           ///< [in/out] Size of the destination buffer (changed to the required size on failure)
+    int size;               ///< [out] Uncompressed size of the asset, or -1 if the buffer was too small
+} asset_prefetch_item_t;
+
+/** @brief Optional parameters for #asset_prefetch */
+typedef struct {
+    void *arena;            ///< Memory arena where to allocate the assets without a destination buffer (NULL = use malloc)
+    int arena_size;         ///< Size of the arena in bytes
+    int8_t priority;        ///< Priority of the loading thread (default: 0, same as the main thread)
+} asset_prefetch_parms_t;
+
+/**
+ * @brief Start loading a list of assets in background
+ * 
+ * This function starts a kernel thread that loads (and decompresses, if
+ * needed) the specified assets one after the other, while the caller keeps
+ * running. This can be used to avoid a full stall during level transitions:
+ * the game can keep rendering a loading screen (or the end of the previous
+ * level), and can start using the first assets as soon as they are ready,
+ * while the following ones are still being loaded.
+ * 
+ * Each asset is loaded into:
+ * 
+ *  * The buffer specified in #asset_prefetch_item_t::buf, if not NULL. If the buffer
+ *    is too small, the asset is not loaded: #asset_prefetch_item_t::size is set to -1
+ *    and #asset_prefetch_item_t::buf_size to the required size (like #asset_loadf_into).
+ *  * Otherwise, the next free space in the arena, if one was specified in
+ *    the parameters. The arena must be large enough for all the assets.
+ *  * Otherwise, a newly allocated buffer, that must be freed with free().
+ * 
+ * The items array is filled in by the loading thread, and must stay valid
+ * until all the assets are loaded. The caller can access an item only after
+ * #asset_prefetch_next returned it. Assets are loaded in order.
+ * 
+ * This function requires the kernel to be initialized (#kernel_init). Notice
+ * that the loading thread can only run when higher or equal priority threads
+ * are blocked or yield, so use a priority higher than the main thread if the
+ * main thread is always busy (eg: it never waits for vblank).
+ * 
+ * @code{.c}
+ *      asset_prefetch_item_t items[] = {
+ *          { .fn = "rom:/level2/map.bin" },
+ *          { .fn = "rom:/level2/tiles.sprite" },
+ *      };
+ *      asset_prefetch_t *pf = asset_prefetch(items, 2, NULL);
+ * 
+ *      // ... keep drawing the loading screen ...
+ * 
+ *      int idx;
+ *      while ((idx = asset_prefetch_next(pf, true)) >= 0)
+ *          debugf("%s ready: %d bytes\n", items[idx].fn, items[idx].size);
+ *      asset_prefetch_free(pf);
+ * @endcode
+ * 
+ * @param items         Assets to load
+ * @param num_items     Number of assets to load
+ * @param parms         Optional parameters (can be NULL)
+ * @return              Prefetch operation, to use with #asset_prefetch_next
+ */
+asset_prefetch_t *asset_prefetch(asset_prefetch_item_t *items, int num_items, const asset_prefetch_parms_t *parms);
+
+/**
+ * @brief Return the next asset loaded by a prefetch operation
+ * 
+ * Assets are returned in the same order as they were specified, and each
+ * asset is returned only once.
+ * 
+ * @param pf            Prefetch operation
+ * @param wait          If true, wait for the next asset to be loaded. If false,
+ *                      return immediately if it is not loaded yet.
+ * @return              Index of the loaded asset in the items array, or -1 if
+ *                      all the assets were already returned (or, if wait is false,
+ *                      the next asset is not loaded yet).
+ */
+int asset_prefetch_next(asset_prefetch_t *pf, bool wait);
+
+/**
+ * @brief Wait for a prefetch operation to finish, and release it
+ * 
+ * This waits for all the assets to be loaded, and then releases the
+ * resources of the prefetch operation. The loaded assets are not freed.
+ * 
+ * @param pf            Prefetch operation
+ */
+void asset_prefetch_free(asset_prefetch_t *pf);
+
 #ifdef __cplusplus
 }
 #endif
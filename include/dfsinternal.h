@@ -15,13 +15,30 @@
 #define ROOT_FLAGS      0xFFFFFFFF
 /** @brief The special ID value in #directory_entry::next_entry defining the root sector */
 #define ROOT_NEXT_ENTRY 0xDEADBEEF
-/** @brief Special path value in #directory_entry::path defining the root sector */
-#define ROOT_PATH       "DragonFS 2.0"
+/** @brief Special path value in #directory_entry::path defining the root sector (DFS v2) */
+#define ROOT_PATH_V2    "DragonFS 2.0"
+/** @brief Special path value in #directory_entry::path defining the root sector (DFS v3) */
+#define ROOT_PATH_V3    "DragonFS 3.0"
+/** @brief Special path value in #directory_entry::path written by mkdfs by default */
+#define ROOT_PATH       ROOT_PATH_V3
 
-/** @brief The size of a sector */
+/** @brief The size of a sector (root sector and directory entries) */
 #define SECTOR_SIZE     256
-/** @brief The size of a sector payload */
-#define SECTOR_PAYLOAD  252
+
+/**
+ * @brief Alignment of all extents in a DFS v3 image
+ *
+ * In DFS v2, every extent (directory entry, file contents, lookup table)
+ * starts on a #SECTOR_SIZE boundary, so every small file wastes up to 255
+ * bytes of ROM. DFS v3 packs extents one after the other, only aligning
+ * them to 8 bytes: this is enough for PI DMA to transfer a whole file in
+ * a single transaction straight into any 8-byte aligned buffer.
+ *
+ * The root sector is still #SECTOR_SIZE bytes and the first directory
+ * entry of the root directory still follows it, so the same reader code
+ * works for both versions.
+ */
+#define DFS_V3_ALIGN    8
 
 /** @brief Prime number used for hash lookups */
 #define DFS_LOOKUP_PRIME 31
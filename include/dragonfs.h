@@ -39,12 +39,21 @@
  * Files can be opened using both sets of API calls simultaneously as long as no more than
  * four files are open at any one time.
  * 
+ * Files are stored as contiguous extents in ROM, so reading a file (or a large
+ * chunk of it) is performed with a single PI DMA transfer. Images built by
+ * current versions of mkdfs (DFS v3) align each file to 8 bytes without any
+ * sector padding; images in the older DFS v2 format (256-byte sectors) can
+ * still be read.
+ *
  * DragonFS does not support file compression; if you want to compress your assets,
  * use the asset API (#asset_load / #asset_fopen).
  * 
  * @{
  */
 
+#include <stdint.h>
+#include <stdbool.h>
+
 #ifdef N64
 
 #include "ioctl.h"
@@ -190,6 +199,108 @@ int dfs_open(const char * const path);
  */
 int dfs_read(void * const buf, int size, int count, uint32_t handle);
 
+/** @cond */
+struct kqueue_s;
+/** @endcond */
+
+/**
+ * @brief An asynchronous read request
+ *
+ * This structure describes a read started with #dfs_read_async. It is
+ * allocated by the caller, which can optionally fill in the completion
+ * fields (#callback, #queue, #user) before starting the read. The structure
+ * must stay valid until the read is complete.
+ */
+typedef struct dfs_aio_s {
+    /** 
+     * @brief Optional function to call when the read is complete.
+     * 
+     * The callback is called in interrupt context (typically, from the PI
+     * interrupt handler), so it must be quick and must not block.
+     */
+    void (*callback)(struct dfs_aio_s *aio);
+    /**
+     * @brief Optional kernel queue where to put the request once complete.
+     * 
+     * This allows a thread to wait for multiple reads with #kqueue_get. It
+     * requires the kernel to be initialized (#kernel_init). The request is
+     * put into the queue by a short-lived helper thread, which exits once
+     * all pending requests have been delivered; the queue must be large
+     * enough or drained, otherwise the helper thread blocks.
+     */
+    struct kqueue_s *queue;
+    /** @brief User data, not touched by DragonFS */
+    void *user;
+    /** @brief Number of bytes being read (filled by #dfs_read_async) */
+    int size;
+    /** @brief True once the data has been written into the buffer */
+    volatile bool done;
+
+    ///@cond
+    struct dfs_aio_s *next;         ///< Next request in the PI queue
+    void *dma_buf;                  ///< RDRAM address of the DMA transfer
+    uint32_t dma_rom;               ///< PI address of the DMA transfer
+    int dma_len;                    ///< Length of the DMA transfer (0 = no transfer)
+    ///@endcond
+} dfs_aio_t;
+
+/**
+ * @brief Start reading data from a file asynchronously
+ * 
+ * This is the asynchronous version of #dfs_read. The read is queued and
+ * the function returns immediately, while the PI DMA transfers the data
+ * into the buffer in background. Multiple reads (even from different files)
+ * can be queued: they are performed in order, back to back, without any
+ * CPU intervention. This allows streaming code to overlap cartridge I/O
+ * with CPU and RSP work.
+ * 
+ * The file position is advanced immediately, so a following #dfs_read or
+ * #dfs_read_async continues after the requested data.
+ * 
+ * Completion can be detected in several ways:
+ * 
+ *  * Polling the dfs_aio_t::done field.
+ *  * Calling #dfs_aio_wait, which blocks (yielding to other threads if the
+ *    kernel is initialized) until the read is complete.
+ *  * Setting dfs_aio_t::callback, which is called in interrupt context.
+ *  * Setting dfs_aio_t::queue, where the request will be put on completion.
+ * 
+ * The buffer must not be accessed until the read is complete. If the buffer
+ * and the file position have a different 2-byte phase, the read cannot be
+ * performed via DMA: in this case, it is performed synchronously (using
+ * a bounce buffer like #dfs_read), and the request is completed before
+ * this function returns.
+ * 
+ * The buffer should be 16-byte aligned, with a size multiple of 16 bytes.
+ * Otherwise, the partial data cache lines at its start and end are shared
+ * with neighbouring data: they are written back and invalidated before the
+ * transfer, but if the CPU touches that neighbouring data while the
+ * transfer is in progress, the cache lines are reloaded and will later be
+ * written back over the bytes transferred by DMA, corrupting them.
+ * 
+ * @param[out] buf
+ *             Buffer to read into
+ * @param[in]  size
+ *             Size of each element to read
+ * @param[in]  count
+ *             Number of elements to read
+ * @param[in]  handle
+ *             A valid file handle as returned from #dfs_open.
+ * @param[in]  aio
+ *             Request structure, which must stay valid until the read is complete.
+ *
+ * @return The number of bytes that will be read or a negative value on failure.
+ */
+int dfs_read_async(void * const buf, int size, int count, uint32_t handle, dfs_aio_t *aio);
+
+/**
+ * @brief Wait until an asynchronous read is complete
+ * 
+ * @param[in] aio       Request started with #dfs_read_async
+ * @return The number of bytes read
+ */
+int dfs_aio_wait(dfs_aio_t *aio);
+
 /**
  * @brief Seek to an offset in the file
  *
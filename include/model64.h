@@ -15,6 +15,18 @@ typedef enum {
     MODEL64_ANIM_SLOT_3 = 3
 } model64_anim_slot_t;
 
+/**
+ * @brief How the animation in a slot is combined with the lower slots.
+ * 
+ * Slots are applied in order, starting from #MODEL64_ANIM_SLOT_0.
+ */
+typedef enum {
+    /** @brief Cross-fade from the pose of the lower slots to this animation, by the slot weight */
+    MODEL64_ANIM_BLEND_OVERRIDE = 0,
+    /** @brief Add the difference between this animation and the rest pose, scaled by the slot weight */
+    MODEL64_ANIM_BLEND_ADDITIVE = 1
+} model64_anim_blend_t;
+
 struct model64_s;
 typedef struct model64_s model64_t;
 
@@ -119,6 +131,20 @@ void model64_draw_node(model64_t *model, model64_node_t *node);
  */
 void model64_draw_primitive(primitive_t *primitive);
 
+/**
+ * @brief Enable or disable frustum culling and LOD selection for a model.
+ * 
+ * When enabled (the default), #model64_draw and #model64_draw_node test the bounding
+ * spheres of the model, of each node and of each primitive against the frustum defined
+ * by the current GL projection and modelview matrices, and skip those that are not
+ * visible. Nodes that have LOD meshes are drawn with the level matching their
+ * projected size on screen.
+ * 
+ * Disable it when drawing the model into a display list that will be called with
+ * different matrices.
+ */
+void model64_set_culling(model64_t *model, bool enabled);
+
 void model64_anim_play(model64_t *model, const char *anim, model64_anim_slot_t slot, bool paused, float start_time);
 void model64_anim_stop(model64_t *model, model64_anim_slot_t slot);
 float model64_anim_get_length(model64_t *model, const char *anim);
@@ -127,6 +153,42 @@ float model64_anim_set_time(model64_t *model, model64_anim_slot_t slot, float ti
 float model64_anim_set_speed(model64_t *model, model64_anim_slot_t slot, float speed);
 bool model64_anim_set_loop(model64_t *model, model64_anim_slot_t slot, bool loop);
 bool model64_anim_set_pause(model64_t *model, model64_anim_slot_t slot, bool paused);
+
+/**
+ * @brief Set the blending weight of an animation slot, and return the old one.
+ * 
+ * A weight of 1 (the default) fully applies the animation, a weight of 0 disables it
+ * (the nodes it animates go back to their rest pose, unless other slots animate them).
+ * Changing the weight over time allows to cross-fade between animations in different slots.
+ */
+float model64_anim_set_weight(model64_t *model, model64_anim_slot_t slot, float weight);
+
+/**
+ * @brief Set how an animation slot is blended with the lower slots, and return the old mode.
+ * 
+ * The default is #MODEL64_ANIM_BLEND_OVERRIDE.
+ */
+model64_anim_blend_t model64_anim_set_blend_mode(model64_t *model, model64_anim_slot_t slot, model64_anim_blend_t mode);
+
+/**
+ * @brief Enable or disable an animation slot for a node and all of its descendants.
+ * 
+ * This allows to play an animation only on a part of the model (for example the upper body).
+ * If node is NULL, the slot is enabled or disabled for all the nodes. By default, a slot
+ * applies to all the nodes. Nodes that are not animated by any slot anymore go back to
+ * their rest pose on the next update.
+ */
+void model64_anim_set_node_mask(model64_t *model, model64_anim_slot_t slot, model64_node_t *node, bool enabled);
+
+/**
+ * @brief Advance the animations of a model and update the pose of its nodes.
+ * 
+ * Keyframe decoding, pose blending and the node hierarchy are evaluated on the CPU,
+ * because the resulting matrices are needed there (for culling, LOD selection and
+ * #model64_get_node_world_mtx). The skinning matrices are computed here once, and
+ * reused by every draw of the model. If nothing changed the pose, for example because
+ * all the animations are paused, the update is skipped.
+ */
 void model64_update(model64_t *model, float deltatime);
 #ifdef __cplusplus
 }
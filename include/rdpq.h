@@ -182,6 +182,7 @@ enum {
     RDPQ_CMD_SET_SCISSOR_EX             = 0x12,
     RDPQ_CMD_SET_PRIM_COLOR_COMPONENT   = 0x13,
     RDPQ_CMD_MODIFY_OTHER_MODES         = 0x14,
+    RDPQ_CMD_TRIANGLE_INDEXED           = 0x15,
     RDPQ_CMD_SET_FILL_COLOR_32          = 0x16,
     RDPQ_CMD_SET_BLENDING_MODE          = 0x18,
     RDPQ_CMD_SET_FOG_MODE               = 0x19,
@@ -227,6 +228,8 @@ enum {
 #define RDPQ_CFG_AUTOSYNCTILE   (1 << 2)     ///< Configuration flag: enable automatic generation of SYNC_TILE commands
 #define RDPQ_CFG_AUTOSCISSOR    (1 << 3)     ///< Configuration flag: enable automatic generation of SET_SCISSOR commands on render target change
 #define RDPQ_CFG_DEFAULT        (0xFFFF)     ///< Configuration flag: default configuration
+#define RDPQ_CFG_OPTIMIZE_BLOCKS (1 << 16)   ///< Configuration flag: run a peephole optimizer on RDP commands recorded in blocks (not in default configuration)
+#define RDPQ_CFG_TMEM_CACHE     (1 << 17)    ///< Configuration flag: skip texture uploads of data already resident in TMEM (see #rdpq_tex_upload, not in default configuration)
 
 ///@cond
 // Used in inline functions as part of the autosync engine. Not part of public API.
@@ -31,6 +31,9 @@
 #define RDPQ_BLOCK_MIN_SIZE   64    ///< RDPQ block minimum size (in 32-bit words)
 #define RDPQ_BLOCK_MAX_SIZE   4192  ///< RDPQ block minimum size (in 32-bit words)
 
+/** @brief Number of vertices cached in DMEM by the RSP triangle code (see #rdpq_triangle_list) */
+#define RDPQ_TRI_VTX_CACHE_SIZE    8
+
 /** @brief Set to 1 for the reference implementation of RDPQ_TRIANGLE (on CPU) */
 #define RDPQ_TRIANGLE_REFERENCE    0
 
@@ -21,9 +21,13 @@ extern "C" {
 ///@cond
 typedef struct sprite_s sprite_t;
 typedef struct rdpq_texparms_s rdpq_texparms_t;
+typedef struct rspq_block_s rspq_block_t;
 typedef struct rdpq_blitparms_s rdpq_blitparms_t;
 ///@endcond
 
+/** @brief A batch of sprite blits (opaque structure, see #rdpq_spritebatch_new) */
+typedef struct rdpq_spritebatch_s rdpq_spritebatch_t;
+
 /**
  * @brief Upload a sprite to TMEM, making it ready for drawing
  * 
@@ -120,6 +124,116 @@ int rdpq_sprite_upload(rdpq_tile_t tile, sprite_t *sprite, const rdpq_texparms_t
  */
 void rdpq_sprite_blit(sprite_t *sprite, float x0, float y0, const rdpq_blitparms_t *parms);
 
+/**
+ * @brief Allocate a new sprite batch
+ * 
+ * A sprite batch collects many sprite blits (see #rdpq_spritebatch_blit), and then
+ * draws them all at once (see #rdpq_spritebatch_flush). Before drawing, blits are
+ * sorted so that those using the same texture are drawn together: each texture is
+ * uploaded into TMEM only once per batch, and then all its blits become plain
+ * texture rectangles, without any further TMEM load. This is much faster than
+ * calling #rdpq_sprite_blit for each sprite when drawing many small sprites
+ * that share a few textures (or a few atlases), like particles or tilemaps.
+ * 
+ * Since blits are reordered, the batch must be used only when the drawing order
+ * does not matter, or only matters across groups of sprites. In the latter case,
+ * assign a layer to each group (see #rdpq_spritebatch_set_layer): layers are
+ * drawn in increasing order, and blits are reordered only within the same layer.
+ * 
+ * @code{.c}
+ *      rdpq_spritebatch_t *batch = rdpq_spritebatch_new();
+ * 
+ *      // Every frame
+ *      rdpq_set_mode_standard();
+ *      rdpq_mode_alphacompare(1);
+ *      for (int i=0; i<num_particles; i++)
+ *          rdpq_spritebatch_blit(batch, particles[i].sprite, particles[i].x, particles[i].y, NULL);
+ *      rdpq_spritebatch_flush(batch);
+ * @endcode
+ * 
+ * The render mode must be configured by the caller, as with #rdpq_sprite_blit.
+ * The batch only changes the TLUT mode, depending on the format of each sprite.
+ * Blits that need a different render mode can be added to the same batch after
+ * calling #rdpq_spritebatch_set_mode.
+ * 
+ * @return      The new sprite batch
+ * 
+ * @see #rdpq_spritebatch_free
+ */
+rdpq_spritebatch_t* rdpq_spritebatch_new(void);
+
+/**
+ * @brief Free a sprite batch
+ * 
+ * @param batch     Batch to free
+ */
+void rdpq_spritebatch_free(rdpq_spritebatch_t *batch);
+
+/**
+ * @brief Set the layer for the next blits added to the batch
+ * 
+ * Blits in lower layers are drawn before those in higher layers. Within
+ * the same layer, blits are drawn in the order that minimizes TMEM loads.
+ * The layer is reset to 0 by #rdpq_spritebatch_flush.
+ * 
+ * @param batch     Sprite batch
+ * @param layer     Layer for the next blits
+ */
+void rdpq_spritebatch_set_layer(rdpq_spritebatch_t *batch, int layer);
+
+/**
+ * @brief Set the render mode for the next blits added to the batch
+ * 
+ * The render mode is specified as a block that changes the render mode
+ * configured by the caller, recorded with rdpq_mode_* functions. For instance:
+ * 
+ * @code{.c}
+ *      rspq_block_begin();
+ *          rdpq_mode_blender(RDPQ_BLENDER_ADDITIVE);
+ *      rspq_block_t *additive = rspq_block_end();
+ * 
+ *      rdpq_spritebatch_set_mode(batch, additive);
+ * @endcode
+ * 
+ * Within the same layer, blits are sorted by render mode first, so that each
+ * block is run once per layer. Each block is applied on top of the render mode
+ * active when #rdpq_spritebatch_flush is called, which is restored at the end
+ * (see #rdpq_mode_push). The block must stay valid until then.
+ * 
+ * The mode is reset to NULL (the caller's render mode) by #rdpq_spritebatch_flush.
+ * 
+ * @param batch     Sprite batch
+ * @param mode      Block that configures the render mode, or NULL
+ */
+void rdpq_spritebatch_set_mode(rdpq_spritebatch_t *batch, rspq_block_t *mode);
+
+/**
+ * @brief Add a sprite blit to the batch
+ * 
+ * This function records a blit with the same semantic of #rdpq_sprite_blit,
+ * but the actual drawing is deferred to #rdpq_spritebatch_flush. The sprite
+ * must stay valid until then.
+ * 
+ * @param batch     Sprite batch
+ * @param sprite    Sprite to blit
+ * @param x0        X coordinate on the framebuffer where to draw the surface
+ * @param y0        Y coordinate on the framebuffer where to draw the surface
+ * @param parms     Parameters for the blit operation (or NULL for default). The
+ *                  structure is copied, so it can be a temporary.
+ */
+void rdpq_spritebatch_blit(rdpq_spritebatch_t *batch, sprite_t *sprite, float x0, float y0, const rdpq_blitparms_t *parms);
+
+/**
+ * @brief Draw all the blits in the batch, and empty it
+ * 
+ * Blits are sorted by layer, then by render mode, TLUT mode, palette and texture. Each
+ * texture that fits in TMEM is uploaded once, and all its blits are drawn
+ * from TMEM. Textures that do not fit are drawn as #rdpq_sprite_blit would.
+ * 
+ * @param batch     Sprite batch
+ */
+void rdpq_spritebatch_flush(rdpq_spritebatch_t *batch);
+
 #ifdef __cplusplus
 }
 #endif
@@ -14,6 +14,9 @@
 typedef struct surface_s surface_t;
 ///@endcond
 
+/** @brief A precomputed blit of a large surface (opaque structure, see #rdpq_blitplan_new) */
+typedef struct rdpq_blitplan_s rdpq_blitplan_t;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -107,6 +110,15 @@ int tex_loader_calc_max_height(tex_loader_t *tload, int width);
  * #surface_make_sub and pass it to #rdpq_tex_upload. See #rdpq_tex_upload_sub
  * for an example of both techniques.
  * 
+ * If the TMEM residency cache is enabled (via `rdpq_config_enable(RDPQ_CFG_TMEM_CACHE)`),
+ * uploading the same region of the same surface at the same TMEM address
+ * that is already in TMEM will skip the actual load, and just reconfigure
+ * the tile descriptor. The cache is invalidated by any other TMEM write
+ * (eg: #rdpq_load_tile or running a rspq block), but it cannot know when
+ * the contents of a surface are modified: in that case, call
+ * #rdpq_tex_cache_invalidate. The cache is not used during multi-texture
+ * uploads (#rdpq_tex_multi_begin) and while recording a rspq block.
+ * 
  * @param tile       Tile descriptor that will be initialized with this texture
  * @param tex        Surface containing the texture to load
  * @param parms      All optional parameters on where to load the texture and how to sample it. Refer to #rdpq_texparms_t for more information.
@@ -250,6 +262,18 @@ int rdpq_tex_reuse_sub(rdpq_tile_t tile, const rdpq_texparms_t *parms, int s0, i
  */
 int rdpq_tex_reuse(rdpq_tile_t tile, const rdpq_texparms_t *parms);
 
+/**
+ * @brief Invalidate the TMEM residency cache
+ * 
+ * When the TMEM residency cache is enabled (#RDPQ_CFG_TMEM_CACHE), this function
+ * must be called after modifying the contents of a surface that was previously
+ * uploaded via #rdpq_tex_upload, or after TMEM was written by a RSP ucode
+ * other than rdpq, so that the next upload is not skipped.
+ * 
+ * @see #rdpq_tex_upload
+ */
+void rdpq_tex_cache_invalidate(void);
+
 /**
  * @brief Begin a multi-texture upload
  * 
@@ -401,6 +425,95 @@ typedef struct rdpq_blitparms_s {
  */
 void rdpq_tex_blit(const surface_t *surf, float x0, float y0, const rdpq_blitparms_t *parms);
 
+/**
+ * @brief Create a precomputed blit plan for a surface
+ * 
+ * #rdpq_tex_blit splits surfaces that do not fit TMEM into horizontal strips,
+ * and computes the slicing and the TMEM load commands on every call. When the
+ * same blit is repeated every frame (eg: a fullscreen background), a blit plan
+ * can be used instead: it caches the load commands of each strip in a small
+ * block, and the whole blit in a block that is simply run again when nothing
+ * changed since the previous frame.
+ * 
+ * The plan also supports scrolling the source rectangle within the surface
+ * (see #rdpq_blitplan_scroll), keeping the destination fixed on screen, which
+ * is what parallax layers normally do. When scrolling, only the strips whose
+ * TMEM loads changed are recorded again: strips are aligned to the surface
+ * so vertical scrolling only affects the strips on the edges, while horizontal
+ * scrolling affects all of them.
+ * 
+ * @code{.c}
+ *      // Show a 320x240 window of a larger background
+ *      rdpq_blitplan_t *bg = rdpq_blitplan_new(background, 0, 0, &(rdpq_blitparms_t){
+ *          .width = 320, .height = 240,
+ *      });
+ * 
+ *      while (1) {
+ *          // [...]
+ *          rdpq_set_mode_copy(false);
+ *          rdpq_blitplan_scroll(bg, camera_x, camera_y);
+ *          rdpq_blitplan_run(bg);
+ *      }
+ * @endcode
+ * 
+ * The plan holds a reference to the surface pixels, which must stay valid
+ * until the plan is freed. If the pixels are modified, the plan does not
+ * need to be recreated, as the load commands just reference the memory.
+ * 
+ * @param surf           Surface to draw
+ * @param x0             X coordinate on the framebuffer where to draw the surface
+ * @param y0             Y coordinate on the framebuffer where to draw the surface
+ * @param parms          Parameters for the blit operation (or NULL for default).
+ *                       The structure is copied, so it can be a temporary.
+ * @return               The new blit plan
+ * 
+ * @see #rdpq_blitplan_run
+ * @see #rdpq_blitplan_free
+ */
+rdpq_blitplan_t* rdpq_blitplan_new(const surface_t *surf, float x0, float y0, const rdpq_blitparms_t *parms);
+
+/**
+ * @brief Free a blit plan
+ * 
+ * The blocks of the plan are freed only after the RDP has finished using them,
+ * so it is safe to free a plan that was just run.
+ * 
+ * @param plan           Plan to free
+ */
+void rdpq_blitplan_free(rdpq_blitplan_t *plan);
+
+/**
+ * @brief Scroll the source rectangle of a blit plan
+ * 
+ * Changes the top-left corner of the rectangle of the surface that is drawn
+ * (the s0 and t0 fields of #rdpq_blitparms_t), keeping its size. The new
+ * rectangle must be fully contained in the surface. The plan is updated at
+ * the next #rdpq_blitplan_run.
+ * 
+ * @param plan           Blit plan
+ * @param s0             New horizontal offset of the source rectangle within the surface
+ * @param t0             New vertical offset of the source rectangle within the surface
+ */
+void rdpq_blitplan_scroll(rdpq_blitplan_t *plan, int s0, int t0);
+
+/**
+ * @brief Draw a blit plan
+ * 
+ * Draws the surface as #rdpq_tex_blit would do, using the current render mode.
+ * The first time after the plan was created or scrolled, the commands are
+ * enqueued directly; if the plan did not change since the previous run, the
+ * cached blocks are used instead.
+ * 
+ * @note This function cannot be called while recording a block, as the plan
+ *       might need to record its own blocks.
+ * 
+ * @note Blocks of strips that changed after scrolling are freed via
+ *       #rdpq_call_deferred, once the RDP has finished using them.
+ * 
+ * @param plan           Plan to draw
+ */
+void rdpq_blitplan_run(rdpq_blitplan_t *plan);
+
 ///@cond
 __attribute__((deprecated("use rdpq_tex_upload instead")))
 static inline int rdpq_tex_load(rdpq_tile_t tile, surface_t *tex, const rdpq_texparms_t *parms) {
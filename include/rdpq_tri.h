@@ -246,6 +246,82 @@ extern const rdpq_trifmt_t TRIFMT_ZBUF_SHADE_TEX;
  */
 void rdpq_triangle(const rdpq_trifmt_t *fmt, const float *v1, const float *v2, const float *v3);
 
+/**
+ * @brief Draw a list of indexed triangles
+ * 
+ * This function draws a batch of triangles whose vertices are taken from a vertex buffer,
+ * via an index buffer. Each group of three consecutive indices forms a triangle.
+ * 
+ * Compared to calling #rdpq_triangle for each triangle, vertices shared among triangles
+ * are converted and sent to RSP only once: RSP keeps a small cache of vertices
+ * (#RDPQ_TRI_VTX_CACHE_SIZE) in DMEM, and each triangle just references the cached
+ * vertices. This makes a large difference for meshes (or 2D quads) where most vertices
+ * are shared by two or more triangles, as long as the index buffer references them
+ * with good locality.
+ * 
+ * Triangles where two indices are equal (degenerate triangles) are skipped.
+ * 
+ * @code
+ *      // Draw a textured quad as two triangles sharing an edge
+ *      float vtx[4][5] = {
+ *          { 10, 10,   0,  0, 1 },
+ *          { 42, 10,  32,  0, 1 },
+ *          { 42, 42,  32, 32, 1 },
+ *          { 10, 42,   0, 32, 1 },
+ *      };
+ *      uint16_t idx[6] = { 0, 1, 2,  0, 2, 3 };
+ *      rdpq_triangle_list(&TRIFMT_TEX, &vtx[0][0], 5, idx, 6);
+ * @endcode
+ * 
+ * @note If the format specifies flat shading (@ref rdpq_trifmt_t::shade_flat), the shade
+ *       of each vertex depends on the triangle it is used by, so vertices are not cached.
+ * 
+ * @param fmt            Format of the triangles being drawn (see #rdpq_triangle)
+ * @param vertices       Vertex buffer. Each vertex is an array of components, as described
+ *                       by @p fmt.
+ * @param stride         Distance between two consecutive vertices in the buffer (number of floats)
+ * @param indices        Index buffer. If NULL, vertices are used in order (0, 1, 2, ...).
+ * @param num_indices    Number of indices in the index buffer (must be a multiple of 3)
+ * 
+ * @see #rdpq_triangle_strip
+ * @see #rdpq_triangle_fan
+ */
+void rdpq_triangle_list(const rdpq_trifmt_t *fmt, const float *vertices, int stride, const uint16_t *indices, int num_indices);
+
+/**
+ * @brief Draw a strip of indexed triangles
+ * 
+ * This function is similar to #rdpq_triangle_list, but the indices describe a triangle
+ * strip: the first three indices form the first triangle, and then each following index
+ * forms a new triangle with the previous two. A strip of N indices draws N-2 triangles.
+ * 
+ * Since the RDP does not perform back-face culling, the winding of each triangle
+ * is irrelevant. Multiple strips can be joined in a single call by repeating indices,
+ * as the resulting degenerate triangles are skipped.
+ * 
+ * @param fmt            Format of the triangles being drawn (see #rdpq_triangle)
+ * @param vertices       Vertex buffer (see #rdpq_triangle_list)
+ * @param stride         Distance between two consecutive vertices in the buffer (number of floats)
+ * @param indices        Index buffer. If NULL, vertices are used in order (0, 1, 2, ...).
+ * @param num_indices    Number of indices in the index buffer
+ */
+void rdpq_triangle_strip(const rdpq_trifmt_t *fmt, const float *vertices, int stride, const uint16_t *indices, int num_indices);
+
+/**
+ * @brief Draw a fan of indexed triangles
+ * 
+ * This function is similar to #rdpq_triangle_list, but the indices describe a triangle
+ * fan: all triangles share the first vertex, and each following index forms a new
+ * triangle with the previous one. A fan of N indices draws N-2 triangles.
+ * 
+ * @param fmt            Format of the triangles being drawn (see #rdpq_triangle)
+ * @param vertices       Vertex buffer (see #rdpq_triangle_list)
+ * @param stride         Distance between two consecutive vertices in the buffer (number of floats)
+ * @param indices        Index buffer. If NULL, vertices are used in order (0, 1, 2, ...).
+ * @param num_indices    Number of indices in the index buffer
+ */
+void rdpq_triangle_fan(const rdpq_trifmt_t *fmt, const float *vertices, int stride, const uint16_t *indices, int num_indices);
+
 #ifdef __cplusplus
 }
 #endif
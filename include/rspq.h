@@ -792,6 +792,128 @@ void rspq_block_run(rspq_block_t *block);
  */
 void rspq_block_free(rspq_block_t *block);
 
+/**
+ * @brief Begin a patchable slot within the block being created.
+ *
+ * A slot is a sequence of commands within a block that can be later
+ * re-recorded in place with different arguments, via #rspq_block_patch_begin
+ * and #rspq_block_patch_end. This allows to reuse a block whose contents
+ * are mostly static, but that contains a few parameters that change
+ * every frame (eg: a color or a matrix), without having to record it
+ * again from scratch.
+ *
+ * Slots are identified by an index chosen by the caller. Each slot can be
+ * defined only once per block. Slots cannot be nested.
+ *
+ * @code{.c}
+ *      rspq_block_begin();
+ *      // ... static commands ...
+ *      rspq_block_slot_begin(0);
+ *      rdpq_set_prim_color(RGBA32(255, 0, 0, 255));
+ *      rspq_block_slot_end();
+ *      // ... static commands ...
+ *      rspq_block_t *block = rspq_block_end();
+ *
+ *      // Later, change the color and run the block again
+ *      rspq_block_patch_begin(block, 0);
+ *      rdpq_set_prim_color(RGBA32(0, 255, 0, 255));
+ *      rspq_block_patch_end();
+ *      rspq_block_run(block);
+ * @endcode
+ *
+ * @param slot   Index of the slot
+ *
+ * @see #rspq_block_slot_end
+ * @see #rspq_block_patch_begin
+ */
+void rspq_block_slot_begin(int slot);
+
+/**
+ * @brief Finish the slot started by #rspq_block_slot_begin.
+ */
+void rspq_block_slot_end(void);
+
+/**
+ * @brief Begin re-recording a slot of a block.
+ *
+ * After this call, all commands written (via #rspq_write, or higher level
+ * libraries like rdpq) overwrite the contents of the specified slot, in place.
+ * Call #rspq_block_patch_end when done.
+ *
+ * The new commands must have the very same layout of the commands that were
+ * recorded in the slot: typically, this means calling the same functions
+ * with different arguments. The rdpq tracking state (eg: autosync) is
+ * restored to the one at the beginning of the slot, so that the same
+ * sequence of RDP commands is generated. A mismatch is detected by
+ * #rspq_block_patch_end, which asserts.
+ *
+ * Block memory is uncached, so the new contents are immediately visible
+ * to RSP and RDP, with no need for cache writebacks.
+ *
+ * @note It is invalid to patch a block which might still be executed by
+ *       the RSP (eg: a block run in the previous frame, if the RSP might
+ *       not have finished it yet). Use a syncpoint to make sure the block
+ *       was processed, or double-buffer the block.
+ *
+ * @param block  The block to patch
+ * @param slot   Index of the slot to patch
+ *
+ * @see #rspq_block_patch_end
+ */
+void rspq_block_patch_begin(rspq_block_t *block, int slot);
+
+/**
+ * @brief Finish patching a slot.
+ *
+ * This function checks that the new contents of the slot match the
+ * layout of the recorded ones, and then resumes writing to the RSP queue.
+ */
+void rspq_block_patch_end(void);
+
+/**
+ * @brief Begin recording a command stream on the current thread.
+ *
+ * The RSP queue is normally written by a single thread: #rspq_write (and
+ * thus all the rdpq functions and other RSP-based libraries) append commands
+ * directly to the queue, without any locking. Streams allow other kernel
+ * threads to generate commands concurrently, without a global mutex.
+ *
+ * After calling this function, all commands written by the current thread
+ * are recorded into a private buffer (the "stream"), exactly like during
+ * block creation (see #rspq_block_begin). Other threads are not affected:
+ * the thread that drives the queue keeps writing into it, and other threads
+ * can record their own streams at the same time. The kernel switches the
+ * active stream on every context switch, so the recording thread can be
+ * preempted at any time.
+ *
+ * Call #rspq_stream_end to close the stream and submit it. Submitted streams
+ * are merged into the RSP queue in submission order, the next time the
+ * thread driving the queue calls #rspq_flush or #rspq_wait.
+ *
+ * @note This requires the multi-threading kernel (see #kernel_init).
+ * @note The same restrictions of block creation apply: syncpoints and
+ *       highpri mode cannot be used while recording a stream, and a thread
+ *       cannot record a block while it is recording a stream.
+ * @note A thread must not exit while it is recording a stream.
+ *
+ * @see #rspq_stream_end
+ */
+void rspq_stream_begin(void);
+
+/**
+ * @brief Finish recording a command stream and submit it.
+ *
+ * This function closes the stream started by #rspq_stream_begin on the
+ * current thread, and appends it to the list of streams pending submission.
+ * The stream is freed automatically after the RSP has run it.
+ *
+ * After this function returns, the current thread goes back to writing
+ * directly into the RSP queue.
+ *
+ * @see #rspq_stream_begin
+ */
+void rspq_stream_end(void);
+
 /**
  * @brief Start building a high-priority queue.
  * 
@@ -81,4 +81,17 @@
 #define RSPQ_PROFILE_CSLOT_COUNT                    5
 #define RSPQ_PROFILE_SLOT_COUNT                     (RSPQ_MAX_OVERLAYS+5)
 
+/** Size of the DMEM buffer used to collect profiler trace events (in bytes, 8 bytes per event) */
+#define RSPQ_PROFILE_TRACE_SIZE                     128
+
+// Kinds of profiler trace events. The first ones match the order of the common
+// profile slots in DMEM (see RSPQ_PROFILE_DATA in rsp_queue.inc).
+#define RSPQ_PROFILE_TRACE_KIND_WAIT_CPU                0   ///< RSP idle, waiting for new commands
+#define RSPQ_PROFILE_TRACE_KIND_WAIT_RDP                1   ///< RSP waiting for RDP
+#define RSPQ_PROFILE_TRACE_KIND_WAIT_RDP_SYNCFULL       2   ///< RSP waiting for a RDP SYNC_FULL
+#define RSPQ_PROFILE_TRACE_KIND_WAIT_RDP_SYNCFULL_MULTI 3   ///< RSP waiting for multiple RDP SYNC_FULL
+#define RSPQ_PROFILE_TRACE_KIND_OVL_SWITCH              4   ///< Overlay switch
+#define RSPQ_PROFILE_TRACE_KIND_BUILTIN                 5   ///< Builtin rspq command
+#define RSPQ_PROFILE_TRACE_KIND_OVERLAY                 6   ///< Overlay command
+
 #endif
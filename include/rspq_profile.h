@@ -21,6 +21,13 @@ typedef struct rspq_profile_data_s {
     uint64_t total_ticks;                                   ///< The total elapsed rcp ticks since the last reset
     uint64_t rdp_busy_ticks;                                ///< The accumulated ticks sampled from DP_BUSY
     uint64_t frame_count;                                   ///< The number of recorded frames since the last reset
+    uint64_t rdp_clock_ticks;                               ///< The accumulated ticks sampled from DP_CLOCK by the CPU
+    uint64_t rdp_pipe_busy_ticks;                           ///< The accumulated ticks sampled from DP_PIPE_BUSY
+    uint64_t rdp_tmem_busy_ticks;                           ///< The accumulated ticks sampled from DP_TMEM_BUSY
+    uint64_t cpu_total_ticks;                               ///< The elapsed CPU ticks (see #TICKS_READ) since the last reset
+    uint64_t cpu_wait_ticks;                                ///< The CPU ticks spent waiting for RSP/RDP (rspq_wait, display_get, ...)
+    rspq_profile_slot_t commands[256];                      ///< Per-command data, indexed by command ID (name is always NULL)
+    uint64_t overflow_frames;                               ///< Number of frames whose per-command data was incomplete
 } rspq_profile_data_t;
 
 /** @brief Start the rspq profiler */
@@ -35,12 +42,55 @@ void rspq_profile_reset(void);
 /** @brief Mark the start of the next frame to the rspq profiler */
 void rspq_profile_next_frame(void);
 
-/** @brief Dump the recorded data to the console */
+/**
+ * @brief Dump the recorded data to the console
+ * 
+ * Besides the time spent in each overlay and command, the dump reports the
+ * average utilization of CPU, RSP and RDP over a frame, and tries to classify
+ * which of them is the bottleneck:
+ * 
+ *  * CPU: the time not spent waiting for RSP/RDP to finish (eg: in #rspq_wait
+ *    or #display_get).
+ *  * RSP: the time not spent waiting for new commands or for the RDP.
+ *  * RDP: the time in which DP_BUSY was counting. DP_PIPE_BUSY and DP_TMEM_BUSY
+ *    are also reported to tell rasterization and texture loads apart.
+ * 
+ * The RDP counters are only 24-bit wide, so they are sampled both at frame
+ * boundaries and at each SYNC_FULL, to avoid missing a wraparound.
+ */
 void rspq_profile_dump(void);
 
 /** @brief Copy the recorded data */
 void rspq_profile_get_data(rspq_profile_data_t *data);
 
+/**
+ * @brief Start recording a timeline of the RSP activity
+ * 
+ * While the profiler is running, the RSP records an event for each command
+ * it executes (and for each wait on CPU or RDP, and each overlay switch),
+ * with its timestamp and duration. These events are used to compute the
+ * per-command statistics, and normally discarded afterwards.
+ * 
+ * This function keeps the events of the next @p max_frames frames in memory,
+ * so that they can be later exported via #rspq_profile_trace_dump.
+ * 
+ * Notice that the duration of a command does not include the time it spent
+ * waiting for the RDP, which is recorded as a separate event.
+ * 
+ * @param max_frames    Number of frames to record
+ */
+void rspq_profile_trace_start(int max_frames);
+
+/**
+ * @brief Dump the recorded timeline to the debug channel, and discard it
+ * 
+ * The timeline is printed as a sequence of lines starting with "RSPQTRACE".
+ * The rspqtrace tool can extract them from the debug log and convert them
+ * into a trace in the Chrome JSON format, which can be opened in
+ * chrome://tracing or https://ui.perfetto.dev.
+ */
+void rspq_profile_trace_dump(void);
+
 #ifdef __cplusplus
 }
 #endif
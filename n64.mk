@@ -3,6 +3,8 @@ SOURCE_DIR ?= .
 
 # Override this if your project uses a different directory for your DFS filesystem root
 N64_MKDFS_ROOT ?= filesystem
+# Extra flags for mkdfs (eg: "-j 0 -i" to read files in parallel and update the image in place)
+N64_MKDFS_FLAGS ?=
 
 N64_ROM_TITLE = "Made with libdragon" # Override this with the name of your game or project
 N64_ROM_CATEGORY = # Set an N64 Media Category code in the ROM header (N, D, C, E, Z)
@@ -17,6 +19,12 @@ N64_ROM_CONTROLLER2 = # Sets the type of Controller 2 in the Advanced Homebrew H
 N64_ROM_CONTROLLER3 = # Sets the type of Controller 3 in the Advanced Homebrew Header. This could influence emulator behaviour such as Ares'
 N64_ROM_CONTROLLER4 = # Sets the type of Controller 4 in the Advanced Homebrew Header. This could influence emulator behaviour such as Ares'
 
+# Set this to a directory to enable the asset conversion cache. mksprite, mkfont,
+# mkmodel and audioconv64 will then skip conversions whose input files, flags
+# and tool version match a previous run, and restore the output from the cache.
+N64_ASSET_CACHE ?=
+export N64_ASSET_CACHE
+
 # Override this to use a different file prefix for the debug symbols. This is
 # useful when building multiple projects in the same directory and you can set
 # this to the project name to differentiate between similar paths. Example:
@@ -138,7 +146,7 @@ RSPASFLAGS+=-MMD
 %.dfs:
 	@mkdir -p $(dir $@)
 	@echo "    [DFS] $@"
-	$(N64_MKDFS) $@ "$(N64_MKDFS_ROOT)" >/dev/null
+	$(N64_MKDFS) $(N64_MKDFS_FLAGS) $@ "$(N64_MKDFS_ROOT)" >/dev/null
 
 # Assembly rule. We use .S for both RSP and MIPS assembly code, and we differentiate
 # using the prefix of the filename: if it starts with "rsp", it is RSP ucode, otherwise
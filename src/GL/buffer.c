@@ -35,6 +35,19 @@ void glBindBufferARB(GLenum target, GLuint buffer)
     }
 }
 
+void gl_buffer_discard_rsp_vertices(gl_buffer_object_t *obj)
+{
+    if (obj->rsp_vertices.data == NULL) {
+        return;
+    }
+
+    // The RSP might still be fetching vertices from the old data
+    rspq_call_deferred(free_uncached, obj->rsp_vertices.data);
+    obj->rsp_vertices.data = NULL;
+    obj->rsp_vertices.size = 0;
+    obj->rsp_vertex_count = 0;
+}
+
 void gl_unbind_buffer(gl_buffer_object_t *obj, gl_buffer_object_t **binding)
 {
     if (*binding == obj) {
@@ -78,6 +91,8 @@ void glDeleteBuffersARB(GLsizei n, const GLuint *buffers)
             free_uncached(obj->storage.data);
         }
 
+        gl_buffer_discard_rsp_vertices(obj);
+
         free(obj);
     }
 }
@@ -156,6 +171,8 @@ void glBufferDataARB(GLenum target, GLsizeiptrARB size, const GLvoid *data, GLen
         memcpy(obj->storage.data, data, size);
     }
 
+    gl_buffer_discard_rsp_vertices(obj);
+
     obj->usage = usage;
     obj->access = GL_READ_WRITE_ARB;
     obj->mapped = false;
@@ -187,6 +204,7 @@ void glBufferSubDataARB(GLenum target, GLintptrARB offset, GLsizeiptrARB size, c
     }
 
     memcpy(obj->storage.data + offset, data, size);
+    gl_buffer_discard_rsp_vertices(obj);
 }
 
 void glGetBufferSubDataARB(GLenum target, GLintptrARB offset, GLsizeiptrARB size, GLvoid *data)
@@ -240,6 +258,10 @@ GLvoid * glMapBufferARB(GLenum target, GLenum access)
         return NULL;
     }
 
+    if (access != GL_READ_ONLY_ARB) {
+        gl_buffer_discard_rsp_vertices(obj);
+    }
+
     obj->access = access;
     obj->mapped = true;
     obj->pointer = obj->storage.data;
@@ -793,6 +793,7 @@ void gl_read_attrib(gl_array_type_t array_type, const void *value, GLenum type,
     if (array_type != ATTRIB_MTX_INDEX) {
         gl_fill_attrib_defaults(array_type, size);
     }
+    gl_attrib_mark_written(array_type);
 }
 
 static void gl_cpu_vertex(const void *value, GLenum type, uint32_t size)
@@ -226,6 +226,7 @@ void gl_set_flag2(GLenum target, bool value)
     case GL_DEPTH_TEST:
         gl_set_flag(GL_UPDATE_NONE, FLAG_DEPTH_TEST, value);
         state->depth_test = value;
+        gl_state_written(state->depth_test);
         break;
     case GL_BLEND:
         gl_set_flag(GL_UPDATE_NONE, FLAG_BLEND, value);
@@ -239,6 +240,7 @@ void gl_set_flag2(GLenum target, bool value)
     case GL_FOG:
         gl_set_flag(GL_UPDATE_NONE, FLAG_FOG, value);
         state->fog = value;
+        gl_state_written(state->fog);
         break;
     case GL_MULTISAMPLE_ARB:
         gl_set_flag_word2(GL_UPDATE_NONE, FLAG2_MULTISAMPLE, value);
@@ -246,18 +248,22 @@ void gl_set_flag2(GLenum target, bool value)
     case GL_TEXTURE_1D:
         gl_set_flag(GL_UPDATE_NONE, FLAG_TEXTURE_1D, value);
         state->texture_1d = value;
+        gl_state_written(state->texture_1d);
         break;
     case GL_TEXTURE_2D:
         gl_set_flag(GL_UPDATE_NONE, FLAG_TEXTURE_2D, value);
         state->texture_2d = value;
+        gl_state_written(state->texture_2d);
         break;
     case GL_CULL_FACE:
         gl_set_flag(GL_UPDATE_NONE, FLAG_CULL_FACE, value);
         state->cull_face = value;
+        gl_state_written(state->cull_face);
         break;
     case GL_LIGHTING:
         gl_set_flag(GL_UPDATE_NONE, FLAG_LIGHTING, value);
         state->lighting = value;
+        gl_state_written(state->lighting);
         set_can_use_rsp_dirty();
         break;
     case GL_LIGHT0:
@@ -271,10 +277,12 @@ void gl_set_flag2(GLenum target, bool value)
         uint32_t light_index = target - GL_LIGHT0;
         gl_set_flag(GL_UPDATE_NONE, FLAG_LIGHT0 << light_index, value);
         state->lights[light_index].enabled = value;
+        gl_state_written(state->lights[light_index].enabled);
         break;
     case GL_COLOR_MATERIAL:
         gl_set_flag(GL_UPDATE_NONE, FLAG_COLOR_MATERIAL, value);
         state->color_material = value;
+        gl_state_written(state->color_material);
         break;
     case GL_TEXTURE_GEN_S:
     case GL_TEXTURE_GEN_T:
@@ -283,19 +291,23 @@ void gl_set_flag2(GLenum target, bool value)
         uint32_t tex_gen_index = target - GL_TEXTURE_GEN_S;
         gl_set_flag(GL_UPDATE_NONE, FLAG_TEX_GEN_S << tex_gen_index, value);
         state->tex_gen[tex_gen_index].enabled = value;
+        gl_state_written(state->tex_gen[tex_gen_index].enabled);
         set_can_use_rsp_dirty();
         break;
     case GL_NORMALIZE:
         gl_set_flag(GL_UPDATE_NONE, FLAG_NORMALIZE, value);
         state->normalize = value;
+        gl_state_written(state->normalize);
         break;
     case GL_MATRIX_PALETTE_ARB:
         gl_set_flag(GL_UPDATE_NONE, FLAG_MATRIX_PALETTE, value);
         state->matrix_palette_enabled = value;
+        gl_state_written(state->matrix_palette_enabled);
         break;
     case GL_TEXTURE_FLIP_T_N64:
         gl_set_flag_word2(GL_UPDATE_NONE, FLAG2_TEX_FLIP_T, value);
         state->tex_flip_t = value;
+        gl_state_written(state->tex_flip_t);
         break;
     case GL_CLIP_PLANE0:
     case GL_CLIP_PLANE1:
@@ -547,3 +559,4 @@ extern inline void gl_cmd_stream_put_byte(gl_cmd_stream_t *s, uint8_t v);
 extern inline void gl_cmd_stream_put_half(gl_cmd_stream_t *s, uint16_t v);
 extern inline void gl_cmd_stream_end(gl_cmd_stream_t *s);
 extern inline void glpipe_set_vtx_cmd_size(uint16_t patched_cmd_descriptor, uint16_t *cmd_descriptor);
+extern inline void glpipe_load_prim_vtx(int cache_index, const void *attributes);
@@ -185,4 +185,6 @@
 #define PRIM_VTX_TRCODE            44    // trivial-reject clipping flags (against -w/+w)
 #define PRIM_VTX_SIZE              45
 
+#define PRIM_VTX_DMA_SIZE          32    // Maximum size of the attributes of a vertex (see GLP_CMD_LOAD_PRIM_VTX)
+
 #endif
@@ -61,6 +61,13 @@
     true; \
 })
 
+/**
+ * Record that a field of the CPU-side state was set. Display lists store the
+ * final value of all fields that were set while they were being recorded,
+ * even if it did not change.
+ */
+#define gl_state_written(field) ({ if (state->current_list != 0) gl_list_mark_written(&(field), sizeof(field)); })
+
 #define gl_assert_no_display_list() assertf(state->current_list == 0, "%s cannot be recorded into a display list", __func__)
 
 typedef int16_t int16u_t __attribute__((aligned(1)));
@@ -109,6 +116,7 @@ typedef enum {
     GLP_CMD_SET_BYTE            = 0x5,
     GLP_CMD_SET_WORD            = 0x6,
     GLP_CMD_SET_LONG            = 0x7,
+    GLP_CMD_LOAD_PRIM_VTX       = 0x8,
 } glp_command_t;
 
 typedef enum {
@@ -274,12 +282,30 @@ typedef struct {
     uint32_t size;
 } gl_storage_t;
 
+typedef struct {
+    struct {
+        GLenum type;
+        uint32_t offset;
+        uint16_t stride;
+        uint8_t size;
+        bool enabled;
+    } attribs[ATTRIB_COUNT];
+    GLint vertex_shift;
+    GLint texcoord_shift;
+} gl_rsp_vtx_layout_t;
+
 typedef struct {
     GLenum usage;
     GLenum access;
     GLvoid *pointer;
     gl_storage_t storage;
     bool mapped;
+
+    // Contents pre-converted for the RSP pipeline (GL_STATIC_DRAW only)
+    gl_storage_t rsp_vertices;
+    gl_rsp_vtx_layout_t rsp_layout;
+    uint32_t rsp_vertex_count;
+    uint32_t rsp_vertex_stride;
 } gl_buffer_object_t;
 
 typedef struct {
@@ -580,6 +606,16 @@ gl_matrix_t * gl_matrix_stack_get_matrix(gl_matrix_stack_t *stack);
 
 void gl_update_matrix_targets();
 
+typedef struct gl_matrix_op_s gl_matrix_op_t;
+
+void gl_matrix_list_reset();
+gl_matrix_op_t * gl_matrix_list_take_ops(uint32_t *count);
+void gl_matrix_list_replay(const gl_matrix_op_t *ops, uint32_t count);
+
+void gl_list_mark_written(const void *ptr, uint32_t size);
+void gl_list_fold_state_op(uint32_t cmd_id, uint32_t arg0, uint32_t flag, uint32_t size);
+void gl_attrib_mark_written(gl_array_type_t array_type);
+
 void gl_matrix_mult(GLfloat *d, const gl_matrix_t *m, const GLfloat *v);
 void gl_matrix_mult3x3(GLfloat *d, const gl_matrix_t *m, const GLfloat *v);
 void gl_matrix_mult4x2(GLfloat *d, const gl_matrix_t *m, const GLfloat *v);
@@ -598,6 +634,8 @@ bool gl_storage_alloc(gl_storage_t *storage, uint32_t size);
 void gl_storage_free(gl_storage_t *storage);
 bool gl_storage_resize(gl_storage_t *storage, uint32_t new_size);
 
+void gl_buffer_discard_rsp_vertices(gl_buffer_object_t *obj);
+
 void set_can_use_rsp_dirty();
 
 void gl_update_array_pointers(gl_array_object_t *obj);
@@ -724,11 +762,24 @@ inline int gl_get_rdpcmds_for_update_func(gl_update_func_t update_func)
     __builtin_unreachable();
 }
 
+/**
+ * While a display list is being recorded, a state command that sets the same
+ * field as the previous command of the list replaces it (see #gl_list_fold_state_op).
+ * Commands whose update function generates RDP commands are never folded.
+ */
+#define gl_fold_state_op(update_func, cmd_id, arg0, flag, size) ({ \
+    extern rspq_block_t *rspq_block; \
+    if (gl_get_rdpcmds_for_update_func(update_func) == 0 && __builtin_expect(rspq_block != NULL, 0)) \
+        gl_list_fold_state_op(cmd_id, arg0, flag, size); \
+})
+
 __attribute__((always_inline))
 inline void gl_set_flag_raw(gl_update_func_t update_func, uint32_t offset, uint32_t flag, bool value)
 {
+    uint32_t arg0 = _carg(update_func, 0x7FF, 13) | _carg(offset, 0xFFC, 0);
+    gl_fold_state_op(update_func, GL_CMD_SET_FLAG, arg0, flag, 2);
     gl_write_rdp(gl_get_rdpcmds_for_update_func(update_func),
-        GL_CMD_SET_FLAG, _carg(update_func, 0x7FF, 13) | _carg(offset, 0xFFC, 0) | _carg(value, 0x1, 0), value ? flag : ~flag);
+        GL_CMD_SET_FLAG, arg0 | _carg(value, 0x1, 0), value ? flag : ~flag);
 }
 
 __attribute__((always_inline))
@@ -746,29 +797,37 @@ inline void gl_set_flag_word2(gl_update_func_t update_func, uint32_t flag, bool
 __attribute__((always_inline))
 inline void gl_set_byte(gl_update_func_t update_func, uint32_t offset, uint8_t value)
 {
+    uint32_t arg0 = _carg(update_func, 0x7FF, 13) | _carg(offset, 0xFFF, 0);
+    gl_fold_state_op(update_func, GL_CMD_SET_BYTE, arg0, 0, 2);
     gl_write_rdp(gl_get_rdpcmds_for_update_func(update_func),
-        GL_CMD_SET_BYTE, _carg(update_func, 0x7FF, 13) | _carg(offset, 0xFFF, 0), value);
+        GL_CMD_SET_BYTE, arg0, value);
 }
 
 __attribute__((always_inline))
 inline void gl_set_short(gl_update_func_t update_func, uint32_t offset, uint16_t value)
 {
+    uint32_t arg0 = _carg(update_func, 0x7FF, 13) | _carg(offset, 0xFFF, 0);
+    gl_fold_state_op(update_func, GL_CMD_SET_SHORT, arg0, 0, 2);
     gl_write_rdp(gl_get_rdpcmds_for_update_func(update_func),
-        GL_CMD_SET_SHORT, _carg(update_func, 0x7FF, 13) | _carg(offset, 0xFFF, 0), value);
+        GL_CMD_SET_SHORT, arg0, value);
 }
 
 __attribute__((always_inline))
 inline void gl_set_word(gl_update_func_t update_func, uint32_t offset, uint32_t value)
 {
+    uint32_t arg0 = _carg(update_func, 0x7FF, 13) | _carg(offset, 0xFFF, 0);
+    gl_fold_state_op(update_func, GL_CMD_SET_WORD, arg0, 0, 2);
     gl_write_rdp(gl_get_rdpcmds_for_update_func(update_func),
-        GL_CMD_SET_WORD, _carg(update_func, 0x7FF, 13) | _carg(offset, 0xFFF, 0), value);
+        GL_CMD_SET_WORD, arg0, value);
 }
 
 __attribute__((always_inline))
 inline void gl_set_long(gl_update_func_t update_func, uint32_t offset, uint64_t value)
 {
+    uint32_t arg0 = _carg(update_func, 0x7FF, 13) | _carg(offset, 0xFFF, 0);
+    gl_fold_state_op(update_func, GL_CMD_SET_LONG, arg0, 0, 3);
     gl_write_rdp(gl_get_rdpcmds_for_update_func(update_func),
-        GL_CMD_SET_LONG, _carg(update_func, 0x7FF, 13) | _carg(offset, 0xFFF, 0), value >> 32, value & 0xFFFFFFFF);
+        GL_CMD_SET_LONG, arg0, value >> 32, value & 0xFFFFFFFF);
 }
 
 __attribute__((always_inline))
@@ -883,6 +942,11 @@ inline void glpipe_set_vtx_cmd_size(uint16_t patched_cmd_descriptor, uint16_t *c
     glp_write(GLP_CMD_SET_VTX_CMD_SIZE, patched_cmd_descriptor, PhysicalAddr(cmd_descriptor));
 }
 
+inline void glpipe_load_prim_vtx(int cache_index, const void *attributes)
+{
+    glp_write(GLP_CMD_LOAD_PRIM_VTX, cache_index * PRIM_VTX_SIZE, PhysicalAddr(attributes));
+}
+
 #define TEX_SCALE   32.0f
 #define OBJ_SCALE   32.0f
 
@@ -268,6 +268,7 @@ void gl_set_color_cpu(GLfloat *dst, GLfloat r, GLfloat g, GLfloat b, GLfloat a)
     dst[1] = g;
     dst[2] = b;
     dst[3] = a;
+    if (state->current_list != 0) gl_list_mark_written(dst, sizeof(GLfloat) * 4);
 }
 
 void gl_set_color(GLfloat *dst, uint32_t offset, GLfloat r, GLfloat g, GLfloat b, GLfloat a)
@@ -306,6 +307,7 @@ void gl_set_material_emissive(GLfloat r, GLfloat g, GLfloat b, GLfloat a)
 void gl_set_material_shininess(GLfloat param)
 {    
     state->material.shininess = param;
+    gl_state_written(state->material.shininess);
     gl_set_short(GL_UPDATE_NONE, offsetof(gl_server_state_t, mat_shininess), param * 32.f);
 }
 
@@ -486,6 +488,7 @@ void gl_light_set_specular(gl_light_t *light, uint32_t offset, GLfloat r, GLfloa
 void gl_light_set_position(gl_light_t *light, uint32_t offset, const GLfloat *pos)
 {
     gl_matrix_mult(light->position, gl_matrix_stack_get_matrix(&state->modelview_stack), pos);
+    gl_state_written(light->position);
 
     int16_t x, y, z, w;
 
@@ -515,6 +518,7 @@ void gl_light_set_position(gl_light_t *light, uint32_t offset, const GLfloat *po
 void gl_light_set_direction(gl_light_t *light, uint32_t offset, const GLfloat *dir)
 {
     gl_matrix_mult3x3(light->direction, gl_matrix_stack_get_matrix(&state->modelview_stack), dir);
+    gl_state_written(light->direction);
 
 /*
     int16_t x = dir[0] * 0x7FFF;
@@ -531,12 +535,14 @@ void gl_light_set_direction(gl_light_t *light, uint32_t offset, const GLfloat *d
 void gl_light_set_spot_exponent(gl_light_t *light, uint32_t offset, float param)
 {
     light->spot_exponent = param;
+    gl_state_written(light->spot_exponent);
     //gl_set_byte(GL_UPDATE_NONE, offset + offsetof(gl_light_srv_t, spot_exponent), param);
 }
 
 void gl_light_set_spot_cutoff(gl_light_t *light, uint32_t offset, float param)
 {
     light->spot_cutoff_cos = cosf(RADIANS(param));
+    gl_state_written(light->spot_cutoff_cos);
     //gl_set_short(GL_UPDATE_NONE, offset + offsetof(gl_light_srv_t, spot_cutoff_cos), light->spot_cutoff_cos * 0x7FFF);
     set_can_use_rsp_dirty();
 }
@@ -544,6 +550,7 @@ void gl_light_set_spot_cutoff(gl_light_t *light, uint32_t offset, float param)
 void gl_light_set_constant_attenuation(gl_light_t *light, uint32_t offset, float param)
 {
     light->constant_attenuation = param;
+    gl_state_written(light->constant_attenuation);
     // Shifted right by 1 to compensate for vrcp
     uint32_t fx = param * (1<<15);
     gl_set_short(GL_UPDATE_NONE, offset + offsetof(gl_lights_soa_t, attenuation_int) + 0, fx >> 16);
@@ -553,6 +560,7 @@ void gl_light_set_constant_attenuation(gl_light_t *light, uint32_t offset, float
 void gl_light_set_linear_attenuation(gl_light_t *light, uint32_t offset, float param)
 {
     light->linear_attenuation = param;
+    gl_state_written(light->linear_attenuation);
     // Shifted right by 4 to compensate for various precision shifts (see rsp_gl_lighting.inc)
     // Shifted right by 1 to compensate for vrcp
     // Result: Shifted right by 5
@@ -564,6 +572,7 @@ void gl_light_set_linear_attenuation(gl_light_t *light, uint32_t offset, float p
 void gl_light_set_quadratic_attenuation(gl_light_t *light, uint32_t offset, float param)
 {
     light->quadratic_attenuation = param;
+    gl_state_written(light->quadratic_attenuation);
     // Shifted left by 6 to compensate for various precision shifts (see rsp_gl_lighting.inc)
     // Shifted right by 1 to compensate for vrcp
     // Result: Shifted left by 5
@@ -732,6 +741,7 @@ void glLightfv(GLenum light, GLenum pname, const GLfloat *params)
 void gl_set_light_model_local_viewer(bool param)
 {
     state->light_model_local_viewer = param;
+    gl_state_written(state->light_model_local_viewer);
 }
 
 void gl_set_light_model_ambient(GLfloat r, GLfloat g, GLfloat b, GLfloat a)
@@ -838,6 +848,7 @@ void glColorMaterial(GLenum face, GLenum mode)
 
     gl_set_long(GL_UPDATE_NONE, offsetof(gl_server_state_t, mat_color_target), color_target);
     state->material.color_target = mode;
+    gl_state_written(state->material.color_target);
 }
 
 void glShadeModel(GLenum mode)
@@ -849,6 +860,7 @@ void glShadeModel(GLenum mode)
     case GL_SMOOTH:
         gl_set_short(GL_UPDATE_NONE, offsetof(gl_server_state_t, shade_model), mode);
         state->shade_model = mode;
+        gl_state_written(state->shade_model);
         set_can_use_rsp_dirty();
         break;
     default:
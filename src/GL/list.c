@@ -1,22 +1,166 @@
 #include "gl_internal.h"
 #include "rspq.h"
+#include <string.h>
 
-#define EMPTY_LIST ((rspq_block_t*)1)
+#define EMPTY_LIST ((gl_list_t*)1)
 
 extern gl_state_t *state;
 
 typedef GLuint (*read_list_id_func)(const GLvoid*, GLsizei);
 
-inline bool is_non_empty_list(rspq_block_t *block)
+/**
+ * A compiled display list.
+ * 
+ * Besides the RSP commands, a list also stores the changes it makes to the
+ * CPU-side state, so that they can be applied when the list is called. The
+ * fields set by the list are stored as a sequence of (offset, size, bytes)
+ * records within #gl_state_t, each one padded to 4 bytes. Matrices are
+ * handled separately, by replaying the matrix operations (see #gl_matrix_op_t).
+ */
+typedef struct {
+    rspq_block_t *block;
+    uint8_t *state_delta;
+    uint32_t state_delta_size;
+    gl_matrix_op_t *matrix_ops;
+    uint32_t matrix_ops_count;
+} gl_list_t;
+
+typedef struct { uint32_t start, end; } list_state_range_t;
+
+/** Ranges of #gl_state_t that are modified by display lists (pipeline state) */
+static const list_state_range_t list_state_ranges[] = {
+    { 0, offsetof(gl_state_t, begin_end_active) },
+    { offsetof(gl_state_t, texture_1d_object), offsetof(gl_state_t, prim_size) },
+};
+
+/** Ranges of #gl_state_t that are stored in the state delta (all of the above except matrices) */
+static const list_state_range_t list_delta_ranges[] = {
+    { 0, offsetof(gl_state_t, matrix_mode) },
+    { offsetof(gl_state_t, texture_1d_object), offsetof(gl_state_t, prim_size) },
+};
+
+/** CPU-side state at the beginning of the list being recorded */
+static gl_state_t *list_saved_state;
+/** Bytes of #gl_state_t that were set while recording the current list */
+static uint8_t *list_written;
+/** Compilation mode of the list being recorded */
+static GLenum list_mode;
+
+/** Last state command recorded in the current list (see #gl_list_fold_state_op) */
+static struct {
+    volatile uint32_t *start;   ///< Position of the command in the list
+    volatile uint32_t *end;     ///< End of the command in the list
+    uint32_t cmd;               ///< Command ID and first argument (without the value bit of GL_CMD_SET_FLAG)
+    uint32_t flag;              ///< Bits changed by GL_CMD_SET_FLAG
+} list_state_op;
+
+inline bool is_non_empty_list(gl_list_t *list)
 {
-    return block != NULL && block != EMPTY_LIST;
+    return list != NULL && list != EMPTY_LIST;
 }
 
-void block_free_safe(rspq_block_t *block)
+void list_free_safe(gl_list_t *list)
 {
     // Silently ignore NULL and EMPTY_LIST
-    if (!is_non_empty_list(block)) return;
-    rdpq_call_deferred((void (*)(void*))rspq_block_free, block);
+    if (!is_non_empty_list(list)) return;
+    rdpq_call_deferred((void (*)(void*))rspq_block_free, list->block);
+    free(list->state_delta);
+    free(list->matrix_ops);
+    free(list);
+}
+
+void gl_list_mark_written(const void *ptr, uint32_t size)
+{
+    uint32_t offset = (const uint8_t*)ptr - (const uint8_t*)state;
+    assertf(offset + size <= sizeof(gl_state_t), "Not a field of the GL state: %p", ptr);
+    memset(list_written + offset, 1, size);
+}
+
+/**
+ * Called before a state command of @p size words is written into the list
+ * being recorded. If the previous command in the list sets the same field
+ * (or the same flags), its effect is entirely overwritten by the new one,
+ * so it is removed by rewinding the write pointer.
+ */
+void gl_list_fold_state_op(uint32_t cmd_id, uint32_t arg0, uint32_t flag, uint32_t size)
+{
+    extern volatile uint32_t *rspq_cur_pointer;
+
+    // Other blocks might be recorded by the application
+    if (state->current_list == 0) return;
+
+    uint32_t cmd = (cmd_id << 24) | arg0;
+    if (list_state_op.end == rspq_cur_pointer && list_state_op.cmd == cmd && list_state_op.flag == flag) {
+        rspq_cur_pointer = list_state_op.start;
+    }
+
+    list_state_op.start = rspq_cur_pointer;
+    list_state_op.end = rspq_cur_pointer + size;
+    list_state_op.cmd = cmd;
+    list_state_op.flag = flag;
+}
+
+static void list_compute_state_delta(gl_list_t *list, const gl_state_t *old)
+{
+    const uint8_t *a = (const uint8_t*)old;
+    const uint8_t *b = (const uint8_t*)state;
+    const uint8_t *w = list_written;
+
+    uint32_t capacity = 0;
+    list->state_delta = NULL;
+    list->state_delta_size = 0;
+
+    // Any byte that was set by the list must be stored, even if the value did
+    // not change: the list might be called when the state is different.
+    // Bytes that were not set must not be stored, or they would overwrite
+    // the state current at the time of the call with a stale value.
+    for (uint32_t r = 0; r < sizeof(list_delta_ranges) / sizeof(list_delta_ranges[0]); r++)
+    {
+        uint32_t i = list_delta_ranges[r].start;
+        uint32_t end = list_delta_ranges[r].end;
+        while (i < end) {
+            if (!w[i] && a[i] == b[i]) { i++; continue; }
+
+            uint32_t start = i;
+            while (++i < end && (w[i] || a[i] != b[i])) {}
+            uint32_t size = i - start;
+
+            uint32_t needed = list->state_delta_size + 8 + ROUND_UP(size, 4);
+            if (needed > capacity) {
+                capacity = MAX(needed, capacity * 2);
+                list->state_delta = realloc(list->state_delta, capacity);
+            }
+
+            uint8_t *rec = list->state_delta + list->state_delta_size;
+            ((uint32_t*)rec)[0] = start;
+            ((uint32_t*)rec)[1] = size;
+            memcpy(rec + 8, b + start, size);
+            list->state_delta_size = needed;
+        }
+    }
+}
+
+static void list_apply_state_delta(const gl_list_t *list)
+{
+    uint8_t *dst = (uint8_t*)state;
+    const uint8_t *rec = list->state_delta;
+    const uint8_t *end = list->state_delta + list->state_delta_size;
+    while (rec < end) {
+        uint32_t start = ((const uint32_t*)rec)[0];
+        uint32_t size = ((const uint32_t*)rec)[1];
+        memcpy(dst + start, rec + 8, size);
+        if (state->current_list != 0) {
+            // Calling a list within another list sets the same fields
+            gl_list_mark_written(dst + start, size);
+        }
+        rec += 8 + ROUND_UP(size, 4);
+    }
+
+    if (list->state_delta_size > 0) {
+        set_can_use_rsp_dirty();
+    }
+
+    gl_matrix_list_replay(list->matrix_ops, list->matrix_ops_count);
 }
 
 void gl_list_init()
@@ -30,10 +174,15 @@ void gl_list_close()
 {
     obj_map_iter_t list_iter = obj_map_iterator(&state->list_objects);
     while (obj_map_iterator_next(&list_iter)) {
-        block_free_safe((rspq_block_t*)list_iter.value);
+        list_free_safe((gl_list_t*)list_iter.value);
     }
 
     obj_map_free(&state->list_objects);
+
+    free(list_saved_state);
+    free(list_written);
+    list_saved_state = NULL;
+    list_written = NULL;
 }
 
 void glNewList(GLuint n, GLenum mode)
@@ -47,9 +196,7 @@ void glNewList(GLuint n, GLenum mode)
 
     switch (mode) {
     case GL_COMPILE:
-        break;
     case GL_COMPILE_AND_EXECUTE:
-        assertf(0, "Compile and execute is not supported!");
         break;
     default:
         gl_set_error(GL_INVALID_ENUM, "%#04lx is not a valid display list compilation mode", mode);
@@ -62,7 +209,20 @@ void glNewList(GLuint n, GLenum mode)
     }
 
     state->current_list = n;
+    list_mode = mode;
+
+    // Commands within the list are executed on the CPU-side state while
+    // recording. Save it, so that we can calculate the changes made by the
+    // list, and restore it in GL_COMPILE mode.
+    if (!list_saved_state) {
+        list_saved_state = malloc(sizeof(gl_state_t));
+        list_written = malloc(sizeof(gl_state_t));
+    }
+    memcpy(list_saved_state, state, sizeof(gl_state_t));
+    memset(list_written, 0, sizeof(gl_state_t));
 
+    gl_matrix_list_reset();
+    list_state_op.start = list_state_op.end = NULL;
     rspq_block_begin();
 }
 
@@ -75,12 +235,29 @@ void glEndList(void)
         return;
     }
 
-    rspq_block_t *block = rspq_block_end();
+    gl_list_t *list = malloc(sizeof(gl_list_t));
+    list->block = rspq_block_end();
+    list_compute_state_delta(list, list_saved_state);
+    list->matrix_ops = gl_matrix_list_take_ops(&list->matrix_ops_count);
+
+    if (list_mode == GL_COMPILE_AND_EXECUTE) {
+        // The CPU-side state is already the one after the list: just run the commands
+        rspq_block_run(list->block);
+    } else {
+        // The list was not executed: undo the changes to the CPU-side state
+        for (uint32_t r = 0; r < sizeof(list_state_ranges) / sizeof(list_state_ranges[0]); r++)
+        {
+            uint32_t start = list_state_ranges[r].start;
+            memcpy((uint8_t*)state + start, (uint8_t*)list_saved_state + start, list_state_ranges[r].end - start);
+        }
+        set_can_use_rsp_dirty();
+    }
 
-    block = obj_map_set(&state->list_objects, state->current_list, block);
-    block_free_safe(block);
+    list = obj_map_set(&state->list_objects, state->current_list, list);
+    list_free_safe(list);
 
     state->current_list = 0;
+    gl_matrix_list_reset();
 }
 
 void glCallList(GLuint n)
@@ -89,10 +266,13 @@ void glCallList(GLuint n)
     // During display list recording, we cannot anticipate whether it will be called within a glBegin/glEnd pair or not.
     assertf(!state->begin_end_active, "glCallList between glBegin/glEnd is not supported!");
 
-    rspq_block_t *block = obj_map_get(&state->list_objects, n);
+    gl_list_t *list = obj_map_get(&state->list_objects, n);
     // Silently ignore NULL and EMPTY_LIST
-    if (is_non_empty_list(block)) {
-        rspq_block_run(block);
+    if (is_non_empty_list(list)) {
+        rspq_block_run(list->block);
+        // Apply the CPU-side state changes. If we are recording another list,
+        // they become part of the changes of that list as well.
+        list_apply_state_delta(list);
     }
 }
 
@@ -237,7 +417,7 @@ void glDeleteLists(GLuint list, GLsizei range)
     
     for (GLuint i = 0; i < range; i++)
     {
-        rspq_block_t *block = obj_map_remove(&state->list_objects, list + i);
-        block_free_safe(block);
+        gl_list_t *obj = obj_map_remove(&state->list_objects, list + i);
+        list_free_safe(obj);
     }
 }
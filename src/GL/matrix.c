@@ -130,6 +130,63 @@ void gl_update_current_matrix_stack()
     gl_update_current_matrix();
 }
 
+typedef enum {
+    GL_MATRIX_OP_MODE,
+    GL_MATRIX_OP_PALETTE_INDEX,
+    GL_MATRIX_OP_LOAD,
+    GL_MATRIX_OP_MULT,
+    GL_MATRIX_OP_PUSH,
+    GL_MATRIX_OP_POP,
+    GL_MATRIX_OP_COPY,
+} gl_matrix_op_type_t;
+
+/**
+ * A matrix operation recorded in a display list.
+ * 
+ * Display lists do not store the matrices themselves, because operations like
+ * glTranslate are relative to the matrix that is current when the list is
+ * called. Instead, the operations are replayed on the CPU-side matrices.
+ */
+struct gl_matrix_op_s {
+    gl_matrix_op_type_t type;
+    uint32_t arg;
+    gl_matrix_t m;
+};
+
+/** Matrix operations recorded in the current display list */
+static gl_matrix_op_t *list_ops;
+static uint32_t list_ops_count;
+static uint32_t list_ops_capacity;
+
+static void list_log_matrix_op(gl_matrix_op_type_t type, uint32_t arg, const GLfloat *m)
+{
+    if (state->current_list == 0) return;
+
+    if (list_ops_count == list_ops_capacity) {
+        list_ops_capacity = MAX(list_ops_capacity * 2, 8);
+        list_ops = realloc(list_ops, list_ops_capacity * sizeof(gl_matrix_op_t));
+    }
+
+    gl_matrix_op_t *op = &list_ops[list_ops_count++];
+    op->type = type;
+    op->arg = arg;
+    if (m) memcpy(&op->m, m, sizeof(gl_matrix_t));
+}
+
+static void gl_matrix_mode_cpu(GLenum mode)
+{
+    state->matrix_mode = mode;
+    gl_update_current_matrix_stack();
+    list_log_matrix_op(GL_MATRIX_OP_MODE, mode, NULL);
+}
+
+static void gl_current_palette_matrix_cpu(uint32_t index)
+{
+    state->current_palette_matrix = index;
+    gl_update_current_matrix_stack();
+    list_log_matrix_op(GL_MATRIX_OP_PALETTE_INDEX, index, NULL);
+}
+
 void glMatrixMode(GLenum mode)
 {
     if (!gl_ensure_no_begin_end()) return;
@@ -139,14 +196,13 @@ void glMatrixMode(GLenum mode)
     case GL_PROJECTION:
     case GL_TEXTURE:
     case GL_MATRIX_PALETTE_ARB:
-        state->matrix_mode = mode;
         break;
     default:
         gl_set_error(GL_INVALID_ENUM, "%#04lx is not a valid matrix mode", mode);
         return;
     }
 
-    gl_update_current_matrix_stack();
+    gl_matrix_mode_cpu(mode);
 
     gl_set_short(GL_UPDATE_NONE, offsetof(gl_server_state_t, matrix_mode), mode);
 }
@@ -160,8 +216,7 @@ void glCurrentPaletteMatrixARB(GLint index)
         return;
     }
 
-    state->current_palette_matrix = index;
-    gl_update_current_matrix_stack();
+    gl_current_palette_matrix_cpu(index);
     gl_set_palette_idx(index);
 }
 
@@ -190,7 +245,38 @@ static inline void gl_matrix_write(rspq_write_t *w, const GLfloat *m)
     write_shorts(w, fraction, 16);
 }
 
-static inline void gl_matrix_load_rsp(const GLfloat *m, bool multiply)
+/**
+ * Last matrix command recorded in the current display list.
+ * 
+ * While recording a list, consecutive loads/multiplications of the same matrix
+ * are collapsed into a single command, by rewinding the command buffer.
+ */
+static struct {
+    volatile uint32_t *start;
+    volatile uint32_t *end;
+    gl_matrix_t *target;
+    bool multiply;
+    gl_matrix_t matrix;
+} list_matrix_op;
+
+void gl_matrix_list_reset()
+{
+    list_matrix_op.start = list_matrix_op.end = NULL;
+    list_ops_count = 0;
+}
+
+gl_matrix_op_t * gl_matrix_list_take_ops(uint32_t *count)
+{
+    *count = list_ops_count;
+    if (list_ops_count == 0) return NULL;
+
+    gl_matrix_op_t *ops = malloc(list_ops_count * sizeof(gl_matrix_op_t));
+    memcpy(ops, list_ops, list_ops_count * sizeof(gl_matrix_op_t));
+    list_ops_count = 0;
+    return ops;
+}
+
+static inline void gl_matrix_write_cmd(const GLfloat *m, bool multiply)
 {
     rspq_write_t w = rspq_write_begin(gl_overlay_id, GL_CMD_MATRIX_LOAD, 17);
     rspq_write_arg(&w, multiply ? 1 : 0);
@@ -198,6 +284,47 @@ static inline void gl_matrix_load_rsp(const GLfloat *m, bool multiply)
     rspq_write_end(&w);
 }
 
+static void gl_matrix_load_rsp(const GLfloat *m, bool multiply)
+{
+    extern volatile uint32_t *rspq_cur_pointer;
+
+    if (state->current_list == 0) {
+        gl_matrix_write_cmd(m, multiply);
+        return;
+    }
+
+    // If the previous command in the list was an operation on the same matrix,
+    // remove it and emit a single command with the same overall effect.
+    if (list_matrix_op.end == rspq_cur_pointer && list_matrix_op.target == state->current_matrix) {
+        rspq_cur_pointer = list_matrix_op.start;
+        if (!multiply || !list_matrix_op.multiply) {
+            // load+load, load+mult: the result is a load of the current matrix
+            // mult+load: the result is a plain load
+            multiply = multiply && list_matrix_op.multiply;
+            m = multiply ? m : state->current_matrix->m[0];
+        }
+        if (multiply) {
+            // mult+mult: multiply by the product of both matrices
+            gl_matrix_t tmp = list_matrix_op.matrix;
+            gl_matrix_mult_full(&list_matrix_op.matrix, &tmp, (const gl_matrix_t*)m);
+            m = list_matrix_op.matrix.m[0];
+        }
+    }
+
+    if (multiply && m != list_matrix_op.matrix.m[0]) {
+        memcpy(&list_matrix_op.matrix, m, sizeof(gl_matrix_t));
+    }
+
+    // Take the position before writing: if the command fills the current
+    // buffer, the write pointer moves to the next one.
+    list_matrix_op.start = rspq_cur_pointer;
+    list_matrix_op.end = rspq_cur_pointer + 17;
+    gl_matrix_write_cmd(m, multiply);
+
+    list_matrix_op.target = state->current_matrix;
+    list_matrix_op.multiply = multiply;
+}
+
 static void gl_mark_matrix_target_dirty()
 {
     if (state->current_matrix_target != NULL) {
@@ -211,10 +338,16 @@ static void gl_mark_matrix_target_dirty()
     }
 }
 
-void gl_load_matrix(const GLfloat *m)
+static void gl_load_matrix_cpu(const GLfloat *m)
 {
     memcpy(state->current_matrix, m, sizeof(gl_matrix_t));
     gl_mark_matrix_target_dirty();
+    list_log_matrix_op(GL_MATRIX_OP_LOAD, 0, m);
+}
+
+void gl_load_matrix(const GLfloat *m)
+{
+    gl_load_matrix_cpu(m);
     gl_matrix_load_rsp(m, false);
 }
 
@@ -236,12 +369,17 @@ void glLoadMatrixd(const GLdouble *m)
     gl_load_matrix(tmp);
 }
 
-void gl_mult_matrix(const GLfloat *m)
+static void gl_mult_matrix_cpu(const GLfloat *m)
 {
     gl_matrix_t tmp = *state->current_matrix;
     gl_matrix_mult_full(state->current_matrix, &tmp, (gl_matrix_t*)m);
     gl_mark_matrix_target_dirty();
+    list_log_matrix_op(GL_MATRIX_OP_MULT, 0, m);
+}
 
+void gl_mult_matrix(const GLfloat *m)
+{
+    gl_mult_matrix_cpu(m);
     gl_matrix_load_rsp(m, true);
 }
 
@@ -388,73 +526,124 @@ void glOrtho(GLdouble l, GLdouble r, GLdouble b, GLdouble t, GLdouble n, GLdoubl
     gl_mult_matrix(ortho.m[0]);
 }
 
-void glPushMatrix(void)
+static bool gl_push_matrix_cpu()
 {
-    if (!gl_ensure_no_begin_end()) return;
-    
     gl_matrix_stack_t *stack = state->current_matrix_stack;
 
     int32_t new_depth = stack->cur_depth + 1;
     if (new_depth >= stack->size) {
         gl_set_error(GL_STACK_OVERFLOW, "The current matrix stack has already reached the maximum depth of %ld", stack->size);
-        return;
+        return false;
     }
 
     stack->cur_depth = new_depth;
     memcpy(&stack->storage[new_depth], &stack->storage[new_depth-1], sizeof(gl_matrix_t));
 
     gl_update_current_matrix();
-
-    gl_write(GL_CMD_MATRIX_PUSH);
+    list_log_matrix_op(GL_MATRIX_OP_PUSH, 0, NULL);
+    return true;
 }
 
-void glPopMatrix(void)
+static bool gl_pop_matrix_cpu()
 {
-    if (!gl_ensure_no_begin_end()) return;
-    
     gl_matrix_stack_t *stack = state->current_matrix_stack;
 
     int32_t new_depth = stack->cur_depth - 1;
     if (new_depth < 0) {
         gl_set_error(GL_STACK_UNDERFLOW, "The current matrix stack is already at depth 0");
-        return;
+        return false;
     }
 
     stack->cur_depth = new_depth;
 
     gl_update_current_matrix();
     gl_mark_matrix_target_dirty();
+    list_log_matrix_op(GL_MATRIX_OP_POP, 0, NULL);
+    return true;
+}
+
+void glPushMatrix(void)
+{
+    if (!gl_ensure_no_begin_end()) return;
+    if (!gl_push_matrix_cpu()) return;
+
+    gl_write(GL_CMD_MATRIX_PUSH);
+}
+
+void glPopMatrix(void)
+{
+    if (!gl_ensure_no_begin_end()) return;
+    if (!gl_pop_matrix_cpu()) return;
 
     gl_write(GL_CMD_MATRIX_POP);
 }
 
+static void gl_copy_matrix_cpu(int src_id)
+{
+    gl_matrix_stack_t *stacks[] = { &state->modelview_stack, &state->projection_stack, &state->texture_stack };
+    memcpy(state->current_matrix, gl_matrix_stack_get_matrix(stacks[src_id]), sizeof(gl_matrix_t));
+    gl_mark_matrix_target_dirty();
+    list_log_matrix_op(GL_MATRIX_OP_COPY, src_id, NULL);
+}
+
 void glCopyMatrixN64(GLenum source)
 {
     if (!gl_ensure_no_begin_end()) return;
     int src_id;
-    gl_matrix_stack_t *matrix_stack;
     switch(source)
     {
         case GL_MODELVIEW:
             src_id = 0;
-            matrix_stack = &state->modelview_stack;
             break;
             
         case GL_PROJECTION:
             src_id = 1;
-            matrix_stack = &state->projection_stack;
             break;
             
         case GL_TEXTURE:
             src_id = 2;
-            matrix_stack = &state->texture_stack;
             break;
             
         default:
             gl_set_error(GL_INVALID_ENUM, "%#04lx is not a valid matrix source for copying matrices", source);
             return;
     }
-    memcpy(state->current_matrix, gl_matrix_stack_get_matrix(matrix_stack), sizeof(gl_matrix_t));
-    gl_mark_matrix_target_dirty();
+    gl_copy_matrix_cpu(src_id);
     gl_write(GL_CMD_MATRIX_COPY, src_id << 6);
-}
\ No newline at end of file
+}
+
+void gl_matrix_list_replay(const gl_matrix_op_t *ops, uint32_t count)
+{
+    // Only the CPU-side matrices are updated here: the RSP commands are part
+    // of the list itself. If another list is being recorded, the operations
+    // are logged into it as well.
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const gl_matrix_op_t *op = &ops[i];
+        switch (op->type) {
+        case GL_MATRIX_OP_MODE:
+            gl_matrix_mode_cpu(op->arg);
+            break;
+        case GL_MATRIX_OP_PALETTE_INDEX:
+            gl_current_palette_matrix_cpu(op->arg);
+            break;
+        case GL_MATRIX_OP_LOAD:
+            gl_load_matrix_cpu(op->m.m[0]);
+            break;
+        case GL_MATRIX_OP_MULT:
+            gl_mult_matrix_cpu(op->m.m[0]);
+            break;
+        case GL_MATRIX_OP_PUSH:
+            gl_push_matrix_cpu();
+            break;
+        case GL_MATRIX_OP_POP:
+            gl_pop_matrix_cpu();
+            break;
+        case GL_MATRIX_OP_COPY:
+            gl_copy_matrix_cpu(op->arg);
+            break;
+        }
+    }
+
+    gl_update_current_matrix();
+}
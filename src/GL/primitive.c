@@ -304,6 +304,7 @@ void gl_load_attribs(const gl_array_t *arrays, uint32_t index)
         const void *src = gl_get_attrib_element(array, index);
 
         array->cpu_read_func(dst, src, array->size);
+        gl_attrib_mark_written(i);
     }
 }
 
@@ -326,6 +327,21 @@ void gl_fill_attrib_defaults(gl_array_type_t array_type, uint32_t size)
     memcpy(dst, src, (4 - size) * element_size);
 }
 
+void gl_attrib_mark_written(gl_array_type_t array_type)
+{
+    if (state->current_list == 0) return;
+
+    gl_obj_attributes_t *attribs = &state->current_attributes;
+    switch (array_type) {
+    case ATTRIB_VERTEX:     gl_list_mark_written(attribs->position, sizeof(attribs->position)); break;
+    case ATTRIB_COLOR:      gl_list_mark_written(attribs->color, sizeof(attribs->color)); break;
+    case ATTRIB_TEXCOORD:   gl_list_mark_written(attribs->texcoord, sizeof(attribs->texcoord)); break;
+    case ATTRIB_NORMAL:     gl_list_mark_written(attribs->normal, sizeof(attribs->normal)); break;
+    case ATTRIB_MTX_INDEX:  gl_list_mark_written(attribs->mtx_index, sizeof(attribs->mtx_index)); break;
+    default: break;
+    }
+}
+
 void gl_fill_all_attrib_defaults(const gl_array_t *arrays)
 {
     // There are no default values for the matrix index because it is always specified fully.
@@ -770,6 +786,7 @@ void glPointSize(GLfloat size)
     }
 
     state->point_size = size;
+    gl_state_written(state->point_size);
     gl_set_short(GL_UPDATE_NONE, offsetof(gl_server_state_t, point_size), size*4);
 }
 
@@ -783,6 +800,7 @@ void glLineWidth(GLfloat width)
     }
 
     state->line_width = width;
+    gl_state_written(state->line_width);
     gl_set_short(GL_UPDATE_NONE, offsetof(gl_server_state_t, line_width), width*4);
 }
 
@@ -814,6 +832,7 @@ void glPolygonMode(GLenum face, GLenum mode)
 
     gl_set_short(GL_UPDATE_NONE, offsetof(gl_server_state_t, polygon_mode), (uint16_t)mode);
     state->polygon_mode = mode;
+    gl_state_written(state->polygon_mode);
     set_can_use_rsp_dirty();
 }
 
@@ -823,6 +842,8 @@ void glDepthRange(GLclampd n, GLclampd f)
     
     state->current_viewport.scale[2] = (f - n) * 0.5f;
     state->current_viewport.offset[2] = n + (f - n) * 0.5f;
+    gl_state_written(state->current_viewport.scale[2]);
+    gl_state_written(state->current_viewport.offset[2]);
 
     gl_set_short(GL_UPDATE_NONE, 
         offsetof(gl_server_state_t, viewport_scale) + sizeof(int16_t) * 2, 
@@ -842,6 +863,10 @@ void glViewport(GLint x, GLint y, GLsizei w, GLsizei h)
     state->current_viewport.scale[1] = h * -0.5f;
     state->current_viewport.offset[0] = x + w * 0.5f;
     state->current_viewport.offset[1] = fbh - y - h * 0.5f;
+    gl_state_written(state->current_viewport.scale[0]);
+    gl_state_written(state->current_viewport.scale[1]);
+    gl_state_written(state->current_viewport.offset[0]);
+    gl_state_written(state->current_viewport.offset[1]);
 
     // Screen coordinates are s13.2
     #define SCREEN_XY_SCALE   4.0f
@@ -901,6 +926,7 @@ void gl_tex_gen_set_mode(gl_tex_gen_t *gen, GLenum coord, GLint param)
 
     gl_set_short(GL_UPDATE_NONE, offsetof(gl_server_state_t, tex_gen) + offsetof(gl_tex_gen_soa_t, mode) + coord_offset, param);
     gen->mode = param;
+    gl_state_written(gen->mode);
     
     set_can_use_rsp_dirty();
 }
@@ -946,6 +972,8 @@ void gl_tex_gen_set_plane(GLenum coord, GLenum pname, const GLfloat *plane)
 
     uint32_t coord_size = TEX_GEN_COUNT * TEX_GEN_PLANE_COUNT * sizeof(uint16_t);
 
+    if (state->current_list != 0) gl_list_mark_written(plane, sizeof(GLfloat) * TEX_COORD_COUNT);
+
     for (uint32_t i = 0; i < TEX_COORD_COUNT; i++)
     {
         int32_t fixed = plane[i] * (1 << 16);
@@ -1067,6 +1095,7 @@ void glCullFace(GLenum mode)
     case GL_FRONT:
     case GL_FRONT_AND_BACK:
         state->cull_face_mode = mode;
+        gl_state_written(state->cull_face_mode);
         gl_set_short(GL_UPDATE_NONE, offsetof(gl_server_state_t, cull_mode), mode);
         break;
     default:
@@ -1083,6 +1112,7 @@ void glFrontFace(GLenum dir)
     case GL_CW:
     case GL_CCW:
         state->front_face = dir;
+        gl_state_written(state->front_face);
         gl_set_short(GL_UPDATE_NONE, offsetof(gl_server_state_t, front_face), dir);
         break;
     default:
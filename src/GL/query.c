@@ -92,6 +92,31 @@ static const conversion_t from_i32 = (conversion_t){
     }
 };
 
+static void convert_float_to_boolean(GLboolean *dst, const float *src, uint32_t count)
+{
+   for (uint32_t i = 0; i < count; i++) { dst[i] = src[i] == 0.0f ? GL_FALSE : GL_TRUE; }
+}
+static void convert_float_to_integer(GLint *dst, const float *src, uint32_t count)
+{
+   for (uint32_t i = 0; i < count; i++) { dst[i] = roundf(src[i]); }
+}
+static void convert_float_to_float(GLfloat *dst, const float *src, uint32_t count)
+{
+   for (uint32_t i = 0; i < count; i++) { dst[i] = src[i]; }
+}
+static void convert_float_to_double(GLdouble *dst, const float *src, uint32_t count)
+{
+   for (uint32_t i = 0; i < count; i++) { dst[i] = src[i]; }
+}
+static const conversion_t from_float = (conversion_t){
+    .funcs = {
+        (convert_func)convert_float_to_boolean,
+        (convert_func)convert_float_to_integer,
+        (convert_func)convert_float_to_float,
+        (convert_func)convert_float_to_double,
+    }
+};
+
 static bool gl_query_get_value_source(GLenum value, const void **src, uint32_t *count, const conversion_t **conversion)
 {
     #define SET_RESULT(s, cnt, cnv) ({ \
@@ -224,6 +249,15 @@ static bool gl_query_get_value_source(GLenum value, const void **src, uint32_t *
     case GL_VERTEX_ARRAY_BINDING:
         SET_RESULT(&state->array_object, 1, &from_u32);
         break;
+    case GL_MODELVIEW_MATRIX:
+        SET_RESULT(gl_matrix_stack_get_matrix(&state->modelview_stack)->m, 16, &from_float);
+        break;
+    case GL_PROJECTION_MATRIX:
+        SET_RESULT(gl_matrix_stack_get_matrix(&state->projection_stack)->m, 16, &from_float);
+        break;
+    case GL_TEXTURE_MATRIX:
+        SET_RESULT(gl_matrix_stack_get_matrix(&state->texture_stack)->m, 16, &from_float);
+        break;
     case GL_UNPACK_ALIGNMENT:
         SET_RESULT(&state->unpack_alignment, 1, &from_i32);
         break;
@@ -370,7 +404,6 @@ static bool gl_query_get_value_source(GLenum value, const void **src, uint32_t *
     case GL_MAX_EVAL_ORDER:
     case GL_MAX_NAME_STACK_DEPTH:
     case GL_MAX_VIEWPORT_DIMS:
-    case GL_MODELVIEW_MATRIX:
     case GL_MODELVIEW_STACK_DEPTH:
     case GL_NAME_STACK_DEPTH:
     case GL_NORMALIZE:
@@ -399,7 +432,6 @@ static bool gl_query_get_value_source(GLenum value, const void **src, uint32_t *
     case GL_POLYGON_SMOOTH:
     case GL_POLYGON_SMOOTH_HINT:
     case GL_POLYGON_STIPPLE:
-    case GL_PROJECTION_MATRIX:
     case GL_PROJECTION_STACK_DEPTH:
     case GL_READ_BUFFER:
     case GL_RED_BIAS:
@@ -436,7 +468,6 @@ static bool gl_query_get_value_source(GLenum value, const void **src, uint32_t *
     case GL_TEXTURE_GEN_R:
     case GL_TEXTURE_GEN_S:
     case GL_TEXTURE_GEN_T:
-    case GL_TEXTURE_MATRIX:
     case GL_TEXTURE_STACK_DEPTH:
     case GL_VIEWPORT:
     case GL_ZOOM_X:
@@ -91,6 +91,8 @@ void gl_update_fog()
     // start == end is undefined, so disable fog by setting the factor to 0
     state->fog_factor = fabsf(fog_diff) < FLT_MIN ? 0.0f : 1.0f / fog_diff;
     state->fog_offset = state->fog_start;
+    gl_state_written(state->fog_factor);
+    gl_state_written(state->fog_offset);
 
     // Convert to s15.16 and premultiply with 1.15 conversion factor
     int32_t factor_fx = state->fog_factor * (1<<(16 + 7 + (8 - VTX_SHIFT)));
@@ -107,12 +109,14 @@ void gl_update_fog()
 void gl_set_fog_start(GLfloat param)
 {
     state->fog_start = param;
+    gl_state_written(state->fog_start);
     gl_update_fog();
 }
 
 void gl_set_fog_end(GLfloat param)
 {
     state->fog_end = param;
+    gl_state_written(state->fog_end);
     gl_update_fog();
 }
 
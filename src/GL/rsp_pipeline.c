@@ -1,4 +1,5 @@
 #include <limits.h>
+#include <string.h>
 
 #include "gl_internal.h"
 #include "gl_rsp_asm.h"
@@ -325,6 +326,141 @@ static void draw_vertex_from_arrays(const gl_array_t *arrays, uint32_t id, uint3
     submit_vertex(cache_index);
 }
 
+static void draw_vertex_from_buffer(const gl_buffer_object_t *obj, uint32_t id, uint32_t index)
+{
+    uint8_t cache_index;
+    if (gl_get_cache_index(id, &cache_index))
+    {
+        glpipe_load_prim_vtx(cache_index, obj->rsp_vertices.data + index * obj->rsp_vertex_stride);
+    }
+
+    submit_vertex(cache_index);
+}
+
+static bool get_rsp_vtx_layout(const gl_array_t *arrays, gl_buffer_object_t **obj, gl_rsp_vtx_layout_t *layout)
+{
+    memset(layout, 0, sizeof(*layout));
+    *obj = NULL;
+
+    for (uint32_t i = 0; i < ATTRIB_COUNT; i++)
+    {
+        const gl_array_t *array = &arrays[i];
+        if (!array->enabled) {
+            continue;
+        }
+
+        // All enabled arrays must be sourced from the same buffer object
+        if (array->binding == NULL || (*obj != NULL && array->binding != *obj)) {
+            return false;
+        }
+        *obj = array->binding;
+
+        layout->attribs[i].enabled = true;
+        layout->attribs[i].type = array->type;
+        layout->attribs[i].size = array->size;
+        layout->attribs[i].stride = array->final_stride;
+        layout->attribs[i].offset = (uint32_t)array->pointer;
+    }
+
+    layout->vertex_shift = state->vertex_halfx_precision.shift_amount;
+    layout->texcoord_shift = state->texcoord_halfx_precision.shift_amount;
+    return *obj != NULL;
+}
+
+static uint32_t get_buffer_vertex_count(const gl_buffer_object_t *obj, const gl_array_t *arrays)
+{
+    static const uint8_t type_size[] = { 1, 1, 2, 2, 4, 4, 4, 8, 2 };
+
+    uint32_t count = UINT32_MAX;
+    for (uint32_t i = 0; i < ATTRIB_COUNT; i++)
+    {
+        const gl_array_t *array = &arrays[i];
+        if (!array->enabled) {
+            continue;
+        }
+
+        uint32_t offset = (uint32_t)array->pointer;
+        uint32_t elem_size = array->size * type_size[gl_type_to_index(array->type)];
+        if (offset + elem_size > obj->storage.size) {
+            return 0;
+        }
+        count = MIN(count, (obj->storage.size - offset - elem_size) / array->final_stride + 1);
+    }
+    return count;
+}
+
+/**
+ * Returns the buffer object whose contents have been pre-converted in the
+ * format expected by GLP_CMD_LOAD_PRIM_VTX, if all the enabled arrays are
+ * sourced from the same GL_STATIC_DRAW buffer. The conversion is done once,
+ * the first time the buffer is drawn with a given array layout, so that
+ * static geometry does not need to be converted by the CPU every frame.
+ */
+static const gl_buffer_object_t* get_rsp_vertices(const gl_array_t *arrays)
+{
+    gl_buffer_object_t *obj;
+    gl_rsp_vtx_layout_t layout;
+    if (!get_rsp_vtx_layout(arrays, &obj, &layout)) {
+        return NULL;
+    }
+
+    if (obj->usage != GL_STATIC_DRAW_ARB || obj->mapped) {
+        return NULL;
+    }
+
+    // Display lists must capture the vertex data at compile time. The
+    // converted data can be discarded while the list is still alive, so
+    // the list cannot refer to it.
+    if (state->current_list != 0) {
+        return NULL;
+    }
+
+    if (obj->rsp_vertices.data != NULL && memcmp(&obj->rsp_layout, &layout, sizeof(layout)) == 0) {
+        return obj;
+    }
+
+    gl_buffer_discard_rsp_vertices(obj);
+
+    uint32_t count = get_buffer_vertex_count(obj, arrays);
+    if (count == 0) {
+        return NULL;
+    }
+
+    // The vertex attributes are stored as they would be in GLP_CMD_SET_PRIM_VTX
+    // (minus the first word), aligned so that the RSP can DMA them. Some padding
+    // is added at the end, as the RSP always transfers PRIM_VTX_DMA_SIZE bytes.
+    uint32_t stride = ROUND_UP(vtx_cmd_size - 4, 8);
+    if (!gl_storage_alloc(&obj->rsp_vertices, count * stride + PRIM_VTX_DMA_SIZE)) {
+        return NULL;
+    }
+
+    for (uint32_t v = 0; v < count; v++)
+    {
+        gl_cmd_stream_t s = {
+            .w.pointer = obj->rsp_vertices.data + v * stride,
+        };
+
+        for (uint32_t i = 0; i < ATTRIB_COUNT; i++)
+        {
+            const gl_array_t *array = &arrays[i];
+            if (!array->enabled) {
+                continue;
+            }
+
+            array->rsp_read_func(&s, gl_get_attrib_element(array, v), array->size);
+        }
+
+        if (s.buffer_head > 0) {
+            gl_cmd_stream_commit(&s);
+        }
+    }
+
+    obj->rsp_layout = layout;
+    obj->rsp_vertex_count = count;
+    obj->rsp_vertex_stride = stride;
+    return obj;
+}
+
 static void gl_asm_vtx_loader(const gl_array_t *arrays)
 {
     extern uint8_t rsp_gl_pipeline_text_start[];
@@ -540,9 +676,18 @@ static void gl_rsp_draw_arrays(uint32_t first, uint32_t count)
 {
     if (state->array_object->arrays[ATTRIB_VERTEX].enabled) {
         gl_prepare_vtx_cmd(state->array_object->arrays);
-        for (uint32_t i = 0; i < count; i++)
-        {
-            draw_vertex_from_arrays(state->array_object->arrays, next_prim_id(), first + i);
+
+        const gl_buffer_object_t *obj = get_rsp_vertices(state->array_object->arrays);
+        if (obj != NULL && first + count <= obj->rsp_vertex_count) {
+            for (uint32_t i = 0; i < count; i++)
+            {
+                draw_vertex_from_buffer(obj, next_prim_id(), first + i);
+            }
+        } else {
+            for (uint32_t i = 0; i < count; i++)
+            {
+                draw_vertex_from_arrays(state->array_object->arrays, next_prim_id(), first + i);
+            }
         }
     }
 
@@ -555,10 +700,16 @@ static void gl_rsp_draw_elements(uint32_t count, const void* indices, read_index
 
     if (state->array_object->arrays[ATTRIB_VERTEX].enabled) {
         gl_prepare_vtx_cmd(state->array_object->arrays);
+
+        const gl_buffer_object_t *obj = get_rsp_vertices(state->array_object->arrays);
         for (uint32_t i = 0; i < count; i++)
         {
             uint32_t index = read_index(indices, i);
-            draw_vertex_from_arrays(state->array_object->arrays, index, index);
+            if (obj != NULL && index < obj->rsp_vertex_count) {
+                draw_vertex_from_buffer(obj, index, index);
+            } else {
+                draw_vertex_from_arrays(state->array_object->arrays, index, index);
+            }
         }
     }
 
@@ -623,6 +623,8 @@ void glBindTexture(GLenum target, GLuint texture)
         *target_obj = obj;
     }
 
+    gl_state_written(*target_obj);
+
     gl_bind_texture(target, *target_obj);
 }
 
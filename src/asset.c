@@ -21,6 +21,10 @@
 #include "n64sys.h"
 #include "dma.h"
 #include "dragonfs.h"
+#include "kernel.h"
+#include "ksemaphore.h"
+#include "kernel/kernel_internal.h"
+#include "utils.h"
 #else
 #include <stdlib.h>
 #include <assert.h>
@@ -101,7 +105,68 @@ FILE *must_fopen(const char *fn)
     return fdopen(must_open(fn), "rb");
 }
 
-static bool decompress_inplace(asset_compression_t *algo, int fd, size_t cmp_size, size_t size, int margin, void *buf, int *buf_size)
+static asset_block_table_t *asset_read_block_table(int fd, int *table_size)
+{
+    asset_block_table_t hdr;
+    read(fd, &hdr, sizeof(hdr));
+    #ifndef N64
+    hdr.block_size = __builtin_bswap32(hdr.block_size);
+    hdr.num_blocks = __builtin_bswap32(hdr.num_blocks);
+    #endif
+
+    int size = sizeof(asset_block_table_t) + hdr.num_blocks * sizeof(asset_block_t);
+    asset_block_table_t *table = malloc(size);
+    *table = hdr;
+    read(fd, table->blocks, hdr.num_blocks * sizeof(asset_block_t));
+    #ifndef N64
+    for (int i=0; i<hdr.num_blocks; i++) {
+        table->blocks[i].cmp_offset = __builtin_bswap32(table->blocks[i].cmp_offset);
+        table->blocks[i].cmp_size = __builtin_bswap32(table->blocks[i].cmp_size);
+    }
+    #endif
+    if (table_size) *table_size = size;
+    return table;
+}
+
+static void decompress_blocks_inplace(asset_compression_t *algo, asset_block_table_t *table, const uint8_t *in, size_t size, uint8_t *out)
+{
+    // Blocks are decompressed in order. The inplace margin computed by the
+    // compressor guarantees that the output of each block never reaches the
+    // compressed data of the same or any later block.
+    for (int i=0; i<table->num_blocks; i++) {
+        int offset = i * table->block_size;
+        int dec_size = (size - offset < table->block_size) ? size - offset : table->block_size;
+        int n = algo->decompress_full_inplace(in + table->blocks[i].cmp_offset, 
+            table->blocks[i].cmp_size, out + offset, dec_size); (void)n;
+        assertf(n == dec_size, "asset: decompression error in block %d: corrupted? (%d/%d)", i, n, dec_size);
+    }
+}
+
+static bool decompress_blocks_full(asset_compression_t *algo, int fd, size_t cmp_size, size_t size, int margin, void *buf, int *buf_size)
+{
+    // Use the same buffer size of in-place decompression. This leaves enough
+    // room for decompressors that write past the end of each block.
+    int bufsize = asset_buf_size(size, cmp_size, margin, NULL);
+    if (buf == NULL || *buf_size < bufsize) {
+        *buf_size = bufsize;
+        return false;
+    }
+
+    off_t table_pos = lseek(fd, 0, SEEK_CUR);
+    asset_block_table_t *table = asset_read_block_table(fd, NULL);
+    for (int i=0; i<table->num_blocks; i++) {
+        int offset = i * table->block_size;
+        int dec_size = (size - offset < table->block_size) ? size - offset : table->block_size;
+        int blk_buf_size = *buf_size - offset;
+        lseek(fd, table_pos + table->blocks[i].cmp_offset, SEEK_SET);
+        bool ok = algo->decompress_full(fd, table->blocks[i].cmp_size, dec_size, (uint8_t*)buf + offset, &blk_buf_size); (void)ok;
+        assertf(ok, "asset: decompression error in block %d", i);
+    }
+    free(table);
+    return true;
+}
+
+static bool decompress_inplace(asset_compression_t *algo, int fd, size_t cmp_size, size_t size, int margin, bool blocks, void *buf, int *buf_size)
 {
     // Consistency check on input data
     assert(margin >= 0);
@@ -118,6 +183,14 @@ static bool decompress_inplace(asset_compression_t *algo, int fd, size_t cmp_siz
     void *s = buf;
     int n;
 
+    // For block-compressed assets, read the block table first, as it would be
+    // overwritten by the decompressed data. The compressed blocks are loaded
+    // at the same position they would have if the table was part of the buffer.
+    asset_block_table_t *table = NULL;
+    int table_size = 0;
+    if (blocks)
+        table = asset_read_block_table(fd, &table_size);
+
     #ifdef N64
     uint32_t rom_addr = 0;
     if (ioctl(fd, IODFS_GET_ROM_BASE, &rom_addr) >= 0) {
@@ -131,21 +204,23 @@ static bool decompress_inplace(asset_compression_t *algo, int fd, size_t cmp_siz
         // Start an asynchronous DMA transfer, so that we can start decompressing as the
         // data flows in.
         uint32_t addr = rom_addr+lseek(fd, 0, SEEK_CUR);
-        dma_read_async(s+cmp_offset, addr, cmp_size);
-
-        // Run the decompression racing with the DMA.
-        n = algo->decompress_full_inplace(s+cmp_offset, cmp_size, s, size); (void)n;
+        dma_read_async(s+cmp_offset+table_size, addr, cmp_size-table_size);
     #else
     if (false) {
     #endif
     } else {
         // Standard loading via stdio. We have to wait for the whole file to be read.
-        read(fd, s+cmp_offset, cmp_size);
+        read(fd, s+cmp_offset+table_size, cmp_size-table_size);
+    }
 
-        // Run the decompression.
+    // Run the decompression (on ROM, racing with the DMA).
+    if (table) {
+        decompress_blocks_inplace(algo, table, s+cmp_offset, size, s);
+        free(table);
+    } else {
         n = algo->decompress_full_inplace(s+cmp_offset, cmp_size, s, size); (void)n;
+        assertf(n == size, "asset: decompression error: corrupted? (%d/%d)", n, size);
     }
-    assertf(n == size, "asset: decompression error: corrupted? (%d/%d)", n, size);
     return true;
 }
 
@@ -185,8 +260,11 @@ static bool asset_read(int fd, asset_header_t *header, int *sz, void *buf, int *
     if(!memcmp(header->magic, ASSET_MAGIC, 3)) {
         bool ret;
 
+        bool blocks = header->flags & ASSET_FLAG_BLOCKS;
         if ((header->flags & ASSET_FLAG_INPLACE) && algos[header->algo-1].decompress_full_inplace)
-            ret = decompress_inplace(&algos[header->algo-1], fd, header->cmp_size, header->orig_size, header->inplace_margin, buf, buf_size);
+            ret = decompress_inplace(&algos[header->algo-1], fd, header->cmp_size, header->orig_size, header->inplace_margin, blocks, buf, buf_size);
+        else if (blocks)
+            ret = decompress_blocks_full(&algos[header->algo-1], fd, header->cmp_size, header->orig_size, header->inplace_margin, buf, buf_size);
         else
             ret = algos[header->algo-1].decompress_full(fd, header->cmp_size, header->orig_size, buf, buf_size);
         if(ret) {
@@ -209,6 +287,24 @@ static bool asset_read(int fd, asset_header_t *header, int *sz, void *buf, int *
         // to the beginning of the file.
         if (lseek(fd, -((off_t)sizeof(asset_header_t)), SEEK_CUR) == -1 && errno == EINVAL)
             lseek(fd, 0, SEEK_SET);
+        #ifdef N64
+        // Fast path for files in DragonFS: transfer the whole asset with a
+        // single DMA straight into the destination buffer, bypassing the
+        // filesystem layers.
+        uint32_t rom_addr; int size = *sz;
+        if (size > 0 && ioctl(fd, IODFS_GET_ROM_BASE, &rom_addr) >= 0) {
+            rom_addr += lseek(fd, 0, SEEK_CUR);
+            if ((((uint32_t)buf ^ rom_addr) & 1) == 0) {
+                if ((((uint32_t)buf | size) & 15) == 0)
+                    data_cache_hit_invalidate(buf, size);
+                else
+                    data_cache_hit_writeback_invalidate(buf, size);
+                dma_read(buf, rom_addr, size);
+                lseek(fd, size, SEEK_CUR);
+                return true;
+            }
+        }
+        #endif
         read(fd, buf, *sz);
         return true;
     }
@@ -379,6 +475,8 @@ FILE *asset_fopen(const char *fn, int *sz)
             "asset: compression level %d not initialized. Call asset_init_compression(%d) at initialization time", header.algo, header.algo);
         assertf(algos[header.algo-1].decompress_init, 
             "asset: compression level %d does not currently support asset_fopen()", header.algo);
+        assertf(!(header.flags & ASSET_FLAG_BLOCKS),
+            "asset: block-compressed assets do not support asset_fopen(), use asset_load()");
 
         int winsize = asset_winsize_from_flags(header.flags);
         cookie = malloc(sizeof(cookie_cmp_t) + algos[header.algo-1].state_size + winsize);
@@ -403,4 +501,105 @@ FILE *asset_fopen(const char *fn, int *sz)
     return funopen(cookie, readfn_none, NULL, seekfn_none, closefn_none);
 }
 
+const void *asset_map_rom(const char *fn, int *sz)
+{
+    assertf(strncmp(fn, "rom:/", 5) == 0, "asset_map_rom: only files in DragonFS (rom:/) can be mapped: %s", fn);
+    uint32_t rom_addr = dfs_rom_addr(fn+5);
+    assertf(rom_addr, "asset_map_rom: file not found: %s", fn);
+    int size = dfs_rom_size(fn+5);
+
+    // Compressed assets cannot be accessed in place
+    if (size >= sizeof(asset_header_t) && (io_read(rom_addr) >> 8) == ((ASSET_MAGIC[0] << 16) | (ASSET_MAGIC[1] << 8) | ASSET_MAGIC[2]))
+        return NULL;
+
+    if (sz) *sz = size;
+    return (const void*)(rom_addr | 0xA0000000);
+}
+
+/** @brief A background asset prefetch operation */
+typedef struct asset_prefetch_s {
+    asset_prefetch_item_t *items;   ///< Assets to load
+    int num_items;                  ///< Number of assets to load
+    int next;                       ///< Next item to return in asset_prefetch_next
+    uint8_t *arena;                 ///< Next free byte in the arena (NULL if none)
+    uint8_t *arena_end;             ///< End of the arena
+    ksemaphore_t loaded;            ///< Posted every time an asset is loaded
+    kthread_t *thread;              ///< Loading thread
+} asset_prefetch_t;
+
+static int prefetch_thread(void *arg)
+{
+    asset_prefetch_t *pf = arg;
+
+    for (int i=0; i<pf->num_items; i++) {
+        asset_prefetch_item_t *item = &pf->items[i];
+        int fd = must_open(item->fn);
+        struct stat stat;
+        fstat(fd, &stat);
+        int size = stat.st_size;
+
+        asset_header_t header;
+        int buf_size = asset_read_header(fd, &header, &size);
+        void *buf = item->buf;
+        if (buf) {
+            buf_size = item->buf_size;
+        } else if (pf->arena) {
+            buf = (void*)ROUND_UP((uint32_t)pf->arena, ASSET_ALIGNMENT);
+            assertf((uint8_t*)buf + buf_size <= pf->arena_end,
+                "asset_prefetch: arena too small to load %s", item->fn);
+            pf->arena = (uint8_t*)buf + buf_size;
+        } else {
+            buf = memalign(ASSET_ALIGNMENT, buf_size);
+        }
+
+        if (asset_read(fd, &header, &size, buf, &buf_size)) {
+            item->buf = buf;
+            item->size = size;
+        } else {
+            item->size = -1;
+        }
+        item->buf_size = buf_size;
+        close(fd);
+
+        ksemaphore_post(&pf->loaded);
+    }
+    return 0;
+}
+
+asset_prefetch_t *asset_prefetch(asset_prefetch_item_t *items, int num_items, const asset_prefetch_parms_t *parms)
+{
+    assertf(__kernel, "asset_prefetch requires the kernel: call kernel_init() first");
+    asset_prefetch_parms_t default_parms = {0};
+    if (!parms) parms = &default_parms;
+
+    asset_prefetch_t *pf = calloc(1, sizeof(asset_prefetch_t));
+    pf->items = items;
+    pf->num_items = num_items;
+    if (parms->arena) {
+        pf->arena = parms->arena;
+        pf->arena_end = pf->arena + parms->arena_size;
+    }
+    ksemaphore_init(&pf->loaded, 0);
+    pf->thread = kthread_new("asset_prefetch", 8192, parms->priority, prefetch_thread, pf);
+    return pf;
+}
+
+int asset_prefetch_next(asset_prefetch_t *pf, bool wait)
+{
+    if (pf->next == pf->num_items)
+        return -1;
+    if (wait)
+        ksemaphore_wait(&pf->loaded);
+    else if (!ksemaphore_try_wait(&pf->loaded, 0))
+        return -1;
+    return pf->next++;
+}
+
+void asset_prefetch_free(asset_prefetch_t *pf)
+{
+    kthread_join(pf->thread);
+    ksemaphore_destroy(&pf->loaded);
+    free(pf);
+}
+
 #endif /* N64 */
@@ -17,6 +17,7 @@
 #define ASSET_FLAG_WINSIZE_128K     0x0006  ///< 128 KiB window size
 #define ASSET_FLAG_WINSIZE_256K     0x0007  ///< 256 KiB window size
 #define ASSET_FLAG_INPLACE          0x0100  ///< Decompress in-place
+#define ASSET_FLAG_BLOCKS           0x0200  ///< Compressed data is split in independent blocks (see #asset_block_table_t)
 #define ASSET_ALIGNMENT             32      ///< Aligned to instruction cacheline
 
 __attribute__((used))
@@ -78,6 +79,29 @@ typedef struct {
 
 _Static_assert(sizeof(asset_header_t) == 20, "invalid sizeof(asset_header_t)");
 
+/** @brief A block of a block-compressed asset */
+typedef struct {
+    uint32_t cmp_offset;    ///< Offset of the compressed block (relative to the block table)
+    uint32_t cmp_size;      ///< Size of the compressed block in bytes
+} asset_block_t;
+
+/** 
+ * @brief Block table of a block-compressed asset (#ASSET_FLAG_BLOCKS)
+ * 
+ * When the flag is set, the compressed data starts with this table, followed by
+ * the compressed blocks. Each block is an independent compressed stream that
+ * decompresses to block_size bytes (except the last one, that can be shorter),
+ * so blocks can be compressed in parallel. Blocks are decompressed sequentially
+ * and the inplace margin in the header covers all of them.
+ */
+typedef struct {
+    uint32_t block_size;    ///< Decompressed size of each block
+    uint32_t num_blocks;    ///< Number of blocks
+    asset_block_t blocks[]; ///< Blocks
+} asset_block_table_t;
+
+_Static_assert(sizeof(asset_block_table_t) == 8, "invalid sizeof(asset_block_table_t)");
+
 /** @brief A decompression algorithm used by the asset library */
 typedef struct {
     int state_size;     ///< Basic size of the decompression state (without ringbuffer)
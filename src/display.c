@@ -19,6 +19,8 @@
 #include "surface.h"
 #include "rsp.h"
 #include "kirq.h"
+#include "rspq.h"
+#include "rspq/rspq_internal.h"
 
 /** @brief Maximum number of video backbuffers */
 #define NUM_BUFFERS         32
@@ -522,6 +524,10 @@ surface_t* display_get(void)
     // have finished processing the previous frame's commands.
     surface_t* disp;
 
+    #if RSPQ_PROFILE
+    uint32_t t0 = TICKS_READ();
+    #endif
+
     kirq_wait_t kirq = kirq_begin_wait_vi();
     RSP_WAIT_LOOP(200) {
          if ((disp = display_try_get())) {
@@ -529,6 +535,10 @@ surface_t* display_get(void)
          }
          kirq_wait(&kirq);
     }
+
+    #if RSPQ_PROFILE
+    __rspq_profile_cpu_wait += TICKS_SINCE(t0);
+    #endif
     return disp;
 }
 
@@ -26,6 +26,14 @@
 /** @brief Structure used to interact with the PI registers */
 static volatile struct PI_regs_s * const PI_regs = (struct PI_regs_s *)0xa4600000;
 
+/**
+ * @brief Number of PI DMA transfers started so far
+ * 
+ * This is used by asynchronous readers (see #dfs_read_async) to tell whether
+ * their transfer is finished, even when the PI is busy again with a new one.
+ */
+volatile uint32_t __dma_counter = 0;
+
 static volatile int __dma_busy(void)
 {
     return PI_regs->status & (PI_STATUS_DMA_BUSY | PI_STATUS_IO_BUSY);
@@ -77,6 +85,7 @@ void dma_read_raw_async(void * ram_address, unsigned long pi_address, unsigned l
     MEMORY_BARRIER();
     PI_regs->write_length = len-1;
     MEMORY_BARRIER();
+    __dma_counter++;
 
     enable_interrupts();
 }
@@ -95,6 +104,7 @@ void dma_write_raw_async(const void * ram_address, unsigned long pi_address, uns
     MEMORY_BARRIER();
     PI_regs->read_length = len-1;
     MEMORY_BARRIER();
+    __dma_counter++;
 
     enable_interrupts();
 }
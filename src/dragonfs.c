@@ -14,6 +14,11 @@
 #include "n64sys.h"
 #include "dma.h"
 #include "debug.h"
+#include "interrupt.h"
+#include "kernel.h"
+#include "kirq.h"
+#include "kqueue.h"
+#include "kernel/kernel_internal.h"
 #include "system.h"
 #include "dfsinternal.h"
 #include "rompak_internal.h"
@@ -79,57 +84,6 @@ static inline void grab_sector(void *cart_loc, void *ram_loc)
     dma_read((void *)(((uint32_t)ram_loc) & 0x1FFFFFFF), (uint32_t)cart_loc, SECTOR_SIZE);
 }
 
-/**
- * @brief Look up a sector number based on offset
- *
- * Given a byte offset from the start of a filesystem, this
- * function will return the sector that this byte offset falls
- * into.
- * 
- * @param[in] loc
- *            Offset in bytes
- *
- * @return The sector number corresponding to the offset
- */
-static inline int sector_from_loc(uint32_t loc)
-{
-    return (loc / SECTOR_PAYLOAD);
-}
-
-/**
- * @brief Look up a byte offset into a sector
- *
- * Given a byte offset from the start of a filesystem, this
- * function will return the offset into the current sector.
- * This essentially clamps the ouput from 0 to #SECTOR_PAYLOAD.
- *
- * @param[in] loc
- *            Offset in bytes
- *
- * @return The offset into a sector
- */
-static inline int offset_into_sector(uint32_t loc)
-{
-    return loc % SECTOR_PAYLOAD;
-}
-
-/**
- * @brief Look up the remaining data size in a sector
- *
- * Given a byte offset from the start of a filesystem, this
- * function will return the number of bytes from the current
- * location to the end of the sector.
- *
- * @param[in] loc
- *            Offset in bytes
- *
- * @return The number of bytes left in a sector based on an offset
- */
-static inline int data_left_in_sector(uint32_t loc)
-{
-    return SECTOR_PAYLOAD - offset_into_sector(loc);
-}
-
 /**
  * @brief Return the file flags given a directory entry
  *
@@ -579,7 +533,8 @@ static int __dfs_init(uint32_t base_fs_loc)
     directory_entry_t id_node;
     grab_sector((void *)base_fs_loc, &id_node);
 
-    if(id_node.flags == ROOT_FLAGS && !strcmp(id_node.path, ROOT_PATH))
+    if(id_node.flags == ROOT_FLAGS &&
+       (!strcmp(id_node.path, ROOT_PATH_V3) || !strcmp(id_node.path, ROOT_PATH_V2)))
     {
         /* Passes, set up the FS */
         base_ptr = base_fs_loc;
@@ -755,7 +710,7 @@ static dfs_lookup_file_t *lookup_file(const char *const path)
         return NULL;
     }
     uint32_t src_path_len = strlen(path)+1;
-    for(int32_t i=index; lookup->files[i].path_hash == hash; i++) {
+    for(int32_t i=index; i<lookup->num_files && lookup->files[i].path_hash == hash; i++) {
         uint32_t path_ofs = lookup->files[i].path_ofs;
         uint32_t path_len = path_ofs >> 20;
         if(src_path_len != path_len) {
@@ -1002,6 +957,237 @@ int dfs_read(void * const buf, int size, int count, uint32_t handle)
     return (void*)data - buf;
 }
 
+/** @brief Counter of PI DMA transfers started (see dma.c) */
+extern volatile uint32_t __dma_counter;
+
+/** @brief Queue of pending asynchronous reads (head is being transferred) */
+static dfs_aio_t *aio_head, *aio_tail;
+/** @brief Value of __dma_counter when the transfer of aio_head was started */
+static uint32_t aio_dma_counter;
+/** @brief True if the transfer of aio_head is in progress */
+static bool aio_inflight;
+/** @brief Completed requests that must be put into their kqueue */
+static dfs_aio_t *aio_deliver_head, *aio_deliver_tail;
+/** @brief Condition variable used to wake up the delivery thread */
+static kcond_t aio_deliver_cond;
+/** @brief True while the thread that puts completed requests into their kqueue is running */
+static bool aio_deliver_running;
+/** @brief Number of requests with a kqueue that were not delivered yet */
+static int aio_deliver_pending;
+/** @brief True while the PI interrupt handler is running */
+static bool aio_in_isr;
+
+/**
+ * @brief Complete a request
+ * 
+ * @note Must be called with interrupts disabled.
+ */
+static void aio_complete(dfs_aio_t *aio)
+{
+    aio->done = true;
+    if (aio->callback)
+        aio->callback(aio);
+    if (aio->queue) {
+        /* kqueue_put cannot be called from an interrupt: defer it to the
+           delivery thread. */
+        aio->next = NULL;
+        if (aio_deliver_tail) aio_deliver_tail->next = aio;
+        else aio_deliver_head = aio;
+        aio_deliver_tail = aio;
+        if (aio_in_isr) __kcond_broadcast_isr(&aio_deliver_cond);
+        else kcond_broadcast(&aio_deliver_cond);
+    }
+}
+
+/**
+ * @brief Advance the queue of asynchronous reads
+ * 
+ * Check whether the current transfer is finished, and start the next one.
+ * This is called from the PI interrupt, but it is safe to call it anytime
+ * (spurious calls are harmless).
+ * 
+ * @note Must be called with interrupts disabled.
+ */
+static void aio_service(void)
+{
+    while (aio_head)
+    {
+        if (aio_inflight)
+        {
+            /* The transfer is finished if the PI is idle, or if somebody
+               else managed to start another DMA after it (which is possible
+               only after ours is finished). */
+            if ((*PI_STATUS & 3) && __dma_counter == aio_dma_counter)
+                return;
+            aio_inflight = false;
+        }
+        else if (aio_head->dma_len)
+        {
+            dma_read_raw_async(aio_head->dma_buf, aio_head->dma_rom, aio_head->dma_len);
+            aio_dma_counter = __dma_counter;
+            aio_inflight = true;
+            continue;
+        }
+
+        dfs_aio_t *aio = aio_head;
+        aio_head = aio->next;
+        if (!aio_head) aio_tail = NULL;
+        aio_complete(aio);
+    }
+}
+
+/** @brief PI interrupt handler */
+static void aio_pi_handler(void)
+{
+    aio_in_isr = true;
+    aio_service();
+    aio_in_isr = false;
+}
+
+/**
+ * @brief Thread that moves completed requests into their kqueue
+ * 
+ * The thread is started by #dfs_read_async when needed, and exits as soon as
+ * there are no more requests to deliver, so that it does not outlive the
+ * reads (and #kernel_close can be called afterwards).
+ */
+static int aio_deliver_main(void *arg)
+{
+    kthread_detach(NULL);
+    while (1)
+    {
+        disable_interrupts();
+        if (!aio_deliver_pending)
+        {
+            aio_deliver_running = false;
+            enable_interrupts();
+            break;
+        }
+        while (!aio_deliver_head)
+            kcond_wait(&aio_deliver_cond, NULL);
+        dfs_aio_t *aio = aio_deliver_head;
+        aio_deliver_head = aio->next;
+        if (!aio_deliver_head) aio_deliver_tail = NULL;
+        enable_interrupts();
+
+        kqueue_put(aio->queue, aio);
+
+        disable_interrupts();
+        aio_deliver_pending--;
+        enable_interrupts();
+    }
+    return 0;
+}
+
+int dfs_read_async(void * const buf, int size, int count, uint32_t handle, dfs_aio_t *aio)
+{
+    dfs_open_file_t *file = HANDLE_TO_OPENFILE(handle);
+
+    if(!file)
+    {
+        return DFS_EBADHANDLE;
+    }
+
+    if(!buf || !aio)
+    {
+        return DFS_EBADINPUT;
+    }
+
+    static bool aio_init = false;
+    if (!aio_init)
+    {
+        aio_init = true;
+        kcond_init(&aio_deliver_cond);
+        register_PI_handler(aio_pi_handler);
+        set_PI_interrupt(1);
+    }
+    if (aio->queue)
+    {
+        assertf(__kernel, "dfs_read_async: completion through kqueue requires kernel_init()");
+        disable_interrupts();
+        aio_deliver_pending++;
+        bool spawn = !aio_deliver_running;
+        aio_deliver_running = true;
+        enable_interrupts();
+        if (spawn)
+            kthread_new("dfs_aio", 2048, 1, aio_deliver_main, NULL);
+    }
+
+    int to_read = size * count;
+    if(file->loc + to_read > file->size)
+        to_read = file->size - file->loc;
+
+    aio->size = to_read;
+    aio->done = false;
+    aio->next = NULL;
+    aio->dma_len = 0;
+
+    uint8_t *data = buf;
+    uint32_t rom_address = file->cart_start_loc + file->loc;
+
+    if (to_read && (((uint32_t)data ^ rom_address) & 1))
+    {
+        /* Different 2-byte phase: DMA is impossible, so read synchronously
+           (dfs_read will use a bounce buffer). */
+        dfs_read(buf, 1, to_read, handle);
+    }
+    else if (to_read)
+    {
+        if ((((uint32_t)data | to_read) & 15) == 0)
+            data_cache_hit_invalidate(data, to_read);
+        else
+            data_cache_hit_writeback_invalidate(data, to_read);
+
+        /* Raw DMA transfers require an 8-byte aligned RDRAM address and an
+           even length. Transfer the few misaligned bytes at the start and at
+           the end synchronously (dma_read uses the CPU for them). */
+        int len = to_read;
+        int head = MIN((8 - ((uint32_t)data & 7)) & 7, len);
+        if (head)
+        {
+            dma_read(data, rom_address, head);
+            data += head; rom_address += head; len -= head;
+        }
+        if (len & 1)
+        {
+            dma_read(data + len - 1, rom_address + len - 1, 1);
+            len -= 1;
+        }
+
+        aio->dma_buf = UncachedAddr(data);
+        aio->dma_rom = (rom_address | 0x10000000) & 0x1FFFFFFF;
+        aio->dma_len = len;
+        file->loc += to_read;
+    }
+
+    /* Enqueue the request. Even requests that need no transfer go through
+       the queue, so that requests always complete in order. */
+    disable_interrupts();
+    if (aio_tail) aio_tail->next = aio;
+    else aio_head = aio;
+    aio_tail = aio;
+    aio_service();
+    enable_interrupts();
+
+    return to_read;
+}
+
+int dfs_aio_wait(dfs_aio_t *aio)
+{
+    kirq_wait_t w = kirq_begin_wait_pi();
+    while (!aio->done)
+    {
+        /* Service the queue also here, in case interrupts are disabled */
+        disable_interrupts();
+        aio_service();
+        enable_interrupts();
+        if (aio->done)
+            break;
+        kirq_wait(&w);
+    }
+    return aio->size;
+}
+
 int dfs_size(uint32_t handle)
 {
     dfs_open_file_t *file = HANDLE_TO_OPENFILE(handle);
@@ -60,6 +60,8 @@ static int th_count;
 bool __kernel = false;
 /** @brief True if a context switch must be done at the end of current interrupt. */
 bool __isr_force_schedule = false;
+/** @brief Hook to switch rspq stream on context switch (installed by rspq) */
+void (*__kthread_rspq_switch)(void *stream) = NULL;
 /* Global current interrupt depth (defined in interrupt.c) */ 
 extern int __interrupt_depth;
 extern int __interrupt_sr;
@@ -325,6 +327,10 @@ reg_block_t* __kthread_syscall_schedule(reg_block_t *stack_state)
 	__interrupt_sr = th_cur->tls.interrupt_sr;
     
 	th_cur_tp = th_cur->tp_value;
+
+	// Activate the rspq stream of the new thread (if rspq streams are in use).
+	if (__kthread_rspq_switch)
+		__kthread_rspq_switch(th_cur->tls.rspq_stream);
     
 	#ifdef __NEWLIB__
 	_REENT = th_cur->tls.reent_ptr;
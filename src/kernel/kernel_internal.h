@@ -57,6 +57,8 @@ typedef struct __attribute__((aligned (8))) kthread_s
 		int interrupt_depth;
 		/** Mirror of __interrupt_sr  */
 		int interrupt_sr;
+		/** rspq stream being recorded by this thread (see #rspq_stream_begin) */
+		void *rspq_stream;
 		#ifdef __NEWLIB__
 		/** Newlib reentrancy */
 		struct _reent *reent_ptr;
@@ -97,6 +99,15 @@ extern char __tls_base[];
 extern char __tls_end[];
 
 
+/**
+ * @brief Hook called by the scheduler to activate the rspq stream of the new thread.
+ * 
+ * This is installed by #rspq_stream_begin, so that the kernel does not depend
+ * on rspq. It is called with the value of the rspq_stream field of the thread
+ * being scheduled.
+ */
+extern void (*__kthread_rspq_switch)(void *stream);
+
 extern kcond_t __kirq_cond_sp;      ///< Condition variable for SP interrupt
 extern kcond_t __kirq_cond_dp;      ///< Condition variable for DP interrupt
 extern kcond_t __kirq_cond_si;      ///< Condition variable for SI interrupt
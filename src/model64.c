@@ -174,6 +174,7 @@ static model64_data_t *load_model_data_buf(void *buf, int sz, const char* prefix
         assertf(0, "Trying to load already loaded model data (buf=%p, sz=%08x)", buf, sz);
     }
     assertf(model->magic == MODEL64_MAGIC, "invalid model data (magic: %08lx)", model->magic);
+    assertf(model->version == MODEL64_VERSION, "unsupported model64 version %ld (expected %d), please convert the model again with mkmodel", model->version, MODEL64_VERSION);
     model->nodes = PTR_DECODE(model, model->nodes);
     model->meshes = PTR_DECODE(model, model->meshes);
     model->skins = PTR_DECODE(model, model->skins);
@@ -214,6 +215,9 @@ static model64_data_t *load_model_data_buf(void *buf, int sz, const char* prefix
     for (uint32_t i = 0; i < model->num_meshes; i++)
     {
         model->meshes[i].primitives = PTR_DECODE(model, model->meshes[i].primitives);
+        if (model->meshes[i].lod) {
+            model->meshes[i].lod = PTR_DECODE(model, model->meshes[i].lod);
+        }
         for (uint32_t j = 0; j < model->meshes[i].num_primitives; j++)
         {
             primitive_t *primitive = &model->meshes[i].primitives[j];
@@ -259,7 +263,13 @@ static model64_data_t *load_model_data_buf(void *buf, int sz, const char* prefix
 
 static size_t get_model_instance_size(model64_data_t *model_data)
 {
-    return sizeof(model64_t)+(model_data->num_nodes*sizeof(node_transform_state_t));
+    size_t size = sizeof(model64_t)+(model_data->num_nodes*sizeof(node_transform_state_t));
+    for(uint32_t i=0; i<model_data->num_nodes; i++) {
+        if(model_data->nodes[i].skin) {
+            size += model_data->nodes[i].skin->num_joints*16*sizeof(float);
+        }
+    }
+    return size;
 }
 
 static void multiply_node_mtx(float parent[16], float child[16])
@@ -336,19 +346,115 @@ static void calc_node_world_matrix(model64_t *model, uint32_t node)
     model64_node_t *node_ptr = model64_get_node(model, node);
     node_transform_state_t *xform = &model->transforms[node];
     mtx_copy(xform->world_mtx, xform->transform.mtx);
-    uint32_t parent_node = node_ptr->parent;
-    
-    while(parent_node != model->data->num_nodes) {
-        model64_node_t *parent_ptr = model64_get_node(model, parent_node);
-        node_transform_state_t *parent_xform = &model->transforms[parent_node];
-        multiply_node_mtx(parent_xform->transform.mtx, xform->world_mtx);
-        parent_node = parent_ptr->parent;
+    if(node_ptr->parent != model->data->num_nodes) {
+        multiply_node_mtx(model->transforms[node_ptr->parent].world_mtx, xform->world_mtx);
+    }
+
+    // Children are updated after their parent, so that each world matrix
+    // only requires a single multiplication.
+    for(uint32_t i=0; i<node_ptr->num_children; i++) {
+        calc_node_world_matrix(model, node_ptr->children[i]);
+    }
+}
+
+static float mtx_max_scale(const float mtx[16])
+{
+    float max_scale2 = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        float scale2 = mtx[i*4+0]*mtx[i*4+0] + mtx[i*4+1]*mtx[i*4+1] + mtx[i*4+2]*mtx[i*4+2];
+        if (scale2 > max_scale2) max_scale2 = scale2;
+    }
+    return sqrtf(max_scale2);
+}
+
+static void sphere_transform(float dst[4], const float mtx[16], const float center[3], float radius)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        dst[i] = mtx[i] * center[0] + mtx[4+i] * center[1] + mtx[8+i] * center[2] + mtx[12+i];
+    }
+    dst[3] = radius * mtx_max_scale(mtx);
+}
+
+static void sphere_merge(float dst[4], const float src[4])
+{
+    if (dst[3] < 0) {
+        memcpy(dst, src, 4*sizeof(float));
+        return;
+    }
+    float d[3] = { src[0] - dst[0], src[1] - dst[1], src[2] - dst[2] };
+    float dist = sqrtf(d[0]*d[0] + d[1]*d[1] + d[2]*d[2]);
+    if (dist + src[3] <= dst[3]) return;
+    if (dist + dst[3] <= src[3]) {
+        memcpy(dst, src, 4*sizeof(float));
+        return;
+    }
+    float radius = (dist + dst[3] + src[3]) * 0.5f;
+    float t = (radius - dst[3]) / dist;
+    for (int i = 0; i < 3; i++) dst[i] += d[i] * t;
+    dst[3] = radius;
+}
+
+static void calc_node_bounds(model64_t *model, uint32_t node)
+{
+    model64_node_t *node_ptr = model64_get_node(model, node);
+    float *bounds = model->transforms[node].bounds;
+    mesh_t *mesh = node_ptr->mesh;
+
+    if (!node_ptr->skin) {
+        sphere_transform(bounds, model->transforms[node].world_mtx, mesh->bounds_center, mesh->bounds_radius);
+        return;
+    }
+
+    // Skinned meshes are rigidly attached to the joints: each vertex lies within
+    // the mesh bounds transformed by the matrix of its own joint.
+    bounds[3] = -1;
+    for (uint32_t i = 0; i < node_ptr->skin->num_joints; i++)
+    {
+        float joint_bounds[4];
+        sphere_transform(joint_bounds, model->transforms[node].skin_mtx[i], mesh->bounds_center, mesh->bounds_radius);
+        sphere_merge(bounds, joint_bounds);
     }
 }
+
+static void calc_node_skin_matrices(model64_t *model, uint32_t node)
+{
+    model64_skin_t *skin = model->data->nodes[node].skin;
+    float (*skin_mtx)[16] = model->transforms[node].skin_mtx;
+    for (uint32_t i = 0; i < skin->num_joints; i++)
+    {
+        model64_joint_t *joint = &skin->joints[i];
+        mtx_copy(skin_mtx[i], joint->inverse_bind_mtx);
+        multiply_node_mtx(model->transforms[joint->node_idx].world_mtx, skin_mtx[i]);
+    }
+}
+
+/**
+ * @brief Calculate the world and skinning matrices and the bounds of all nodes.
+ * 
+ * This runs on the CPU, and is not moved to the RSP: the results are needed on
+ * the CPU before drawing (to cull nodes, select LODs, and for
+ * #model64_get_node_world_mtx), and reading back from the RSP would stall until
+ * the queue is flushed.
+ */
 static void update_node_matrices(model64_t *model)
 {
     for(uint32_t i=0; i<model->data->num_nodes; i++) {
-        calc_node_world_matrix(model, i);
+        if(model->data->nodes[i].parent == model->data->num_nodes) {
+            calc_node_world_matrix(model, i);
+        }
+    }
+
+    model->bounds[3] = -1;
+    for(uint32_t i=0; i<model->data->num_nodes; i++) {
+        if(model->data->nodes[i].skin) {
+            calc_node_skin_matrices(model, i);
+        }
+        if(model->data->nodes[i].mesh) {
+            calc_node_bounds(model, i);
+            sphere_merge(model->bounds, model->transforms[i].bounds);
+        }
     }
 }
 
@@ -366,6 +472,14 @@ static model64_t *make_model_instance(model64_data_t *model_data)
     model64_t *instance = calloc(1, get_model_instance_size(model_data));
     instance->data = model_data;
     instance->transforms = (node_transform_state_t *)&instance[1];
+    float (*skin_mtx)[16] = (float (*)[16])&instance->transforms[model_data->num_nodes];
+    for(uint32_t i=0; i<model_data->num_nodes; i++) {
+        if(model_data->nodes[i].skin) {
+            instance->transforms[i].skin_mtx = skin_mtx;
+            skin_mtx += model_data->nodes[i].skin->num_joints;
+        }
+    }
+    instance->culling = true;
     init_model_transforms(instance);
     return instance;
 }
@@ -450,6 +564,9 @@ static void unload_model_data(model64_data_t *model)
             primitive->shared_texture = TEXTURE_INDEX_MISSING;
         }
         model->meshes[i].primitives = PTR_ENCODE(model, model->meshes[i].primitives);
+        if (model->meshes[i].lod) {
+            model->meshes[i].lod = PTR_ENCODE(model, model->meshes[i].lod);
+        }
     }
     for(uint32_t i=0; i<model->num_skins; i++)
     {
@@ -690,46 +807,180 @@ void model64_draw_mesh(mesh_t *mesh)
     }
 }
 
-void model64_draw_node(model64_t *model, model64_node_t *node)
+/** @brief Result of testing a bounding sphere against the view frustum */
+typedef enum {
+    CULL_OUTSIDE,       ///< The sphere is completely outside of the frustum
+    CULL_INTERSECT,     ///< The sphere intersects the frustum boundaries
+    CULL_INSIDE,        ///< The sphere is completely inside the frustum
+} cull_result_t;
+
+/** @brief Current GL view, used to cull the nodes of a model and select their LOD */
+typedef struct {
+    float planes[6][4];     ///< Frustum planes in model space (normalized, pointing inwards)
+    float clip_w[4];        ///< Row of the clip matrix that calculates the W coordinate
+    float lod_scale;        ///< Converts a radius divided by W into a fraction of the viewport height
+} model64_view_t;
+
+static void get_view(model64_view_t *view)
 {
-    uint32_t node_idx = get_node_idx(model, node);
-    assertf(node_idx < model->data->num_nodes, "Drawing invalid node.");
-    if(node->mesh)
+    float proj[16], mv[16], clip[16];
+    glGetFloatv(GL_PROJECTION_MATRIX, proj);
+    glGetFloatv(GL_MODELVIEW_MATRIX, mv);
+
+    for (int i = 0; i < 4; i++)
     {
-        if(node->skin)
+        for (int j = 0; j < 4; j++)
         {
-            glMatrixMode(GL_MATRIX_PALETTE_ARB);
-            for(uint32_t i=0; i<node->skin->num_joints; i++)
-            {
-                glCurrentPaletteMatrixARB(i);
-                glCopyMatrixN64(GL_MODELVIEW); //Copy matrix at top of modelview stack to matrix palette
-                glMultMatrixf(model->transforms[node->skin->joints[i].node_idx].world_mtx);
-                glMultMatrixf(node->skin->joints[i].inverse_bind_mtx);
-            }
-            glEnable(GL_MATRIX_PALETTE_ARB);
-            model64_draw_mesh(node->mesh);
-            glDisable(GL_MATRIX_PALETTE_ARB);
-            glMatrixMode(GL_MODELVIEW);
+            clip[i*4+j] = proj[j] * mv[i*4+0] + proj[4+j] * mv[i*4+1] + proj[8+j] * mv[i*4+2] + proj[12+j] * mv[i*4+3];
+        }
+    }
+
+    // Extract the frustum planes from the rows of the clip matrix
+    for (int i = 0; i < 4; i++) view->clip_w[i] = clip[i*4+3];
+    for (int p = 0; p < 6; p++)
+    {
+        float sign = (p & 1) ? -1.0f : 1.0f;
+        float *plane = view->planes[p];
+        for (int i = 0; i < 4; i++) plane[i] = view->clip_w[i] + sign * clip[i*4 + p/2];
+        float inv_len = 1.0f / sqrtf(plane[0]*plane[0] + plane[1]*plane[1] + plane[2]*plane[2]);
+        for (int i = 0; i < 4; i++) plane[i] *= inv_len;
+    }
+
+    view->lod_scale = proj[5] * mtx_max_scale(mv);
+}
+
+static cull_result_t view_test_sphere(const model64_view_t *view, const float bounds[4])
+{
+    cull_result_t result = CULL_INSIDE;
+    for (int p = 0; p < 6; p++)
+    {
+        const float *plane = view->planes[p];
+        float dist = plane[0] * bounds[0] + plane[1] * bounds[1] + plane[2] * bounds[2] + plane[3];
+        if (dist < -bounds[3]) return CULL_OUTSIDE;
+        if (dist < bounds[3]) result = CULL_INTERSECT;
+    }
+    return result;
+}
+
+static mesh_t *view_select_lod(const model64_view_t *view, mesh_t *mesh, const float bounds[4])
+{
+    if (!mesh->lod) return mesh;
+
+    float w = view->clip_w[0] * bounds[0] + view->clip_w[1] * bounds[1] + view->clip_w[2] * bounds[2] + view->clip_w[3];
+    // If the camera is within the sphere, always use the most detailed mesh
+    if (w <= bounds[3]) return mesh;
+
+    float size = bounds[3] * view->lod_scale / w;
+    while (mesh->lod && size < mesh->lod_min_size) {
+        mesh = mesh->lod;
+    }
+    return mesh;
+}
+
+static void draw_mesh_culled(model64_t *model, uint32_t node_idx, mesh_t *mesh, const model64_view_t *view)
+{
+    // Test each primitive only if the mesh has more than one and the node is
+    // not skinned (otherwise the primitive bounds cannot be transformed)
+    if (mesh->num_primitives == 1 || model->data->nodes[node_idx].skin) {
+        model64_draw_mesh(mesh);
+        return;
+    }
+
+    float *world_mtx = model->transforms[node_idx].world_mtx;
+    for (uint32_t i = 0; i < model64_get_primitive_count(mesh); i++)
+    {
+        primitive_t *primitive = model64_get_primitive(mesh, i);
+        float bounds[4];
+        sphere_transform(bounds, world_mtx, primitive->bounds_center, primitive->bounds_radius);
+        if (view_test_sphere(view, bounds) != CULL_OUTSIDE) {
+            model64_draw_primitive(primitive);
+        }
+    }
+}
+
+static void draw_node(model64_t *model, uint32_t node_idx, const model64_view_t *view, bool cull)
+{
+    model64_node_t *node = &model->data->nodes[node_idx];
+    mesh_t *mesh = node->mesh;
+    if (!mesh) return;
+
+    if (view) {
+        float *bounds = model->transforms[node_idx].bounds;
+        if (cull) {
+            cull_result_t result = view_test_sphere(view, bounds);
+            if (result == CULL_OUTSIDE) return;
+            cull = result == CULL_INTERSECT;
         }
-        else
+        mesh = view_select_lod(view, mesh, bounds);
+    }
+
+    if(node->skin)
+    {
+        glMatrixMode(GL_MATRIX_PALETTE_ARB);
+        for(uint32_t i=0; i<node->skin->num_joints; i++)
         {
-            glMatrixMode(GL_MODELVIEW);
-            glPushMatrix();
-            glMultMatrixf(model->transforms[node_idx].world_mtx);
-            model64_draw_mesh(node->mesh);
-            glPopMatrix();
+            glCurrentPaletteMatrixARB(i);
+            glCopyMatrixN64(GL_MODELVIEW); //Copy matrix at top of modelview stack to matrix palette
+            glMultMatrixf(model->transforms[node_idx].skin_mtx[i]);
+        }
+        glEnable(GL_MATRIX_PALETTE_ARB);
+        model64_draw_mesh(mesh);
+        glDisable(GL_MATRIX_PALETTE_ARB);
+        glMatrixMode(GL_MODELVIEW);
+    }
+    else
+    {
+        glMatrixMode(GL_MODELVIEW);
+        glPushMatrix();
+        glMultMatrixf(model->transforms[node_idx].world_mtx);
+        if (view && cull) {
+            draw_mesh_culled(model, node_idx, mesh, view);
+        } else {
+            model64_draw_mesh(mesh);
         }
+        glPopMatrix();
+    }
+}
+
+void model64_draw_node(model64_t *model, model64_node_t *node)
+{
+    uint32_t node_idx = get_node_idx(model, node);
+    assertf(node_idx < model->data->num_nodes, "Drawing invalid node.");
+
+    model64_view_t view, *pview = NULL;
+    if (model->culling && node->mesh) {
+        get_view(&view);
+        pview = &view;
     }
+    draw_node(model, node_idx, pview, true);
 }
 
 void model64_draw(model64_t *model)
 {
+    model64_view_t view, *pview = NULL;
+    bool cull = false;
+
+    if (model->culling && model->bounds[3] >= 0) {
+        // Test the whole model first, so that nodes are tested only if it
+        // intersects the frustum boundaries.
+        get_view(&view);
+        cull_result_t result = view_test_sphere(&view, model->bounds);
+        if (result == CULL_OUTSIDE) return;
+        cull = result == CULL_INTERSECT;
+        pview = &view;
+    }
+
     for (uint32_t i = 0; i < model64_get_node_count(model); i++)
     {
-        model64_draw_node(model, model64_get_node(model, i));
+        draw_node(model, i, pview, cull);
     }
 }
 
+void model64_set_culling(model64_t *model, bool enabled)
+{
+    model->culling = enabled;
+}
+
 static int32_t search_anim_index(model64_t *model, const char *name)
 {
     if(!name) {
@@ -749,12 +1000,18 @@ static void alloc_anim_slot(model64_t *model, model64_anim_slot_t slot)
     uint32_t num_tracks = model->data->max_tracks;
     state_size += (num_tracks*4)*sizeof(decoded_keyframe_t);
     state_size += sizeof(model64_keyframe_t);
+    uint32_t mask_size = ((model->data->num_nodes+31)/32)*sizeof(uint32_t);
+    state_size += mask_size;
     anim_state_t *anim_state = calloc(1, state_size);
     anim_state->frames = PTR_DECODE(anim_state, sizeof(anim_state_t));
     anim_state->curr_frame = PTR_DECODE(anim_state->frames, (num_tracks*4)*sizeof(decoded_keyframe_t));
+    anim_state->node_mask = PTR_DECODE(anim_state->curr_frame, sizeof(model64_keyframe_t));
+    memset(anim_state->node_mask, 0xFF, mask_size);
     anim_state->index = -1;
     anim_state->paused = true;
     anim_state->speed = 1.0f;
+    anim_state->weight = 1.0f;
+    anim_state->blend_mode = MODEL64_ANIM_BLEND_OVERRIDE;
     model->active_anims[slot] = anim_state;
 }
 
@@ -788,6 +1045,7 @@ void model64_anim_stop(model64_t *model, model64_anim_slot_t slot)
         alloc_anim_slot(model, slot);
     }
     model->active_anims[slot]->index = -1;
+    model->anim_pose_dirty = true;
 }
 
 float model64_anim_get_length(model64_t *model, const char *anim)
@@ -855,6 +1113,62 @@ bool model64_anim_set_pause(model64_t *model, model64_anim_slot_t slot, bool pau
     return old_pause;
 }
 
+float model64_anim_set_weight(model64_t *model, model64_anim_slot_t slot, float weight)
+{
+    assertf(is_anim_slot_valid(slot), "Invalid animation ID");
+    assertf(weight >= 0 && weight <= 1, "Weight must be between 0 and 1");
+    if(!model->active_anims[slot]) {
+        alloc_anim_slot(model, slot);
+    }
+    float old_weight = model->active_anims[slot]->weight;
+    model->active_anims[slot]->weight = weight;
+    model->anim_pose_dirty = true;
+    return old_weight;
+}
+
+model64_anim_blend_t model64_anim_set_blend_mode(model64_t *model, model64_anim_slot_t slot, model64_anim_blend_t mode)
+{
+    assertf(is_anim_slot_valid(slot), "Invalid animation ID");
+    assertf(mode == MODEL64_ANIM_BLEND_OVERRIDE || mode == MODEL64_ANIM_BLEND_ADDITIVE, "Invalid blend mode");
+    if(!model->active_anims[slot]) {
+        alloc_anim_slot(model, slot);
+    }
+    model64_anim_blend_t old_mode = model->active_anims[slot]->blend_mode;
+    model->active_anims[slot]->blend_mode = mode;
+    model->anim_pose_dirty = true;
+    return old_mode;
+}
+
+static void set_node_mask(model64_t *model, uint32_t *mask, uint32_t node, bool enabled)
+{
+    if(enabled) {
+        mask[node/32] |= 1 << (node%32);
+    } else {
+        mask[node/32] &= ~(1 << (node%32));
+    }
+    model64_node_t *node_ptr = &model->data->nodes[node];
+    for(uint32_t i=0; i<node_ptr->num_children; i++) {
+        set_node_mask(model, mask, node_ptr->children[i], enabled);
+    }
+}
+
+void model64_anim_set_node_mask(model64_t *model, model64_anim_slot_t slot, model64_node_t *node, bool enabled)
+{
+    assertf(is_anim_slot_valid(slot), "Invalid animation ID");
+    if(!model->active_anims[slot]) {
+        alloc_anim_slot(model, slot);
+    }
+    uint32_t *mask = model->active_anims[slot]->node_mask;
+    if(!node) {
+        memset(mask, enabled ? 0xFF : 0, ((model->data->num_nodes+31)/32)*sizeof(uint32_t));
+    } else {
+        uint32_t node_idx = get_node_idx(model, node);
+        assertf(node_idx < model->data->num_nodes, "Setting animation mask of invalid node.");
+        set_node_mask(model, mask, node_idx, enabled);
+    }
+    model->anim_pose_dirty = true;
+}
+
 static void vec_normalize(float *vec, size_t count)
 {
     float mag2 = 0.0f;
@@ -863,10 +1177,22 @@ static void vec_normalize(float *vec, size_t count)
     }
     float scale = 1.0f/sqrtf(mag2);
     for(size_t i=0; i<count; i++) {
-        mag2 *= scale;
+        vec[i] *= scale;
     }
 }
-static void quat_lerp(float *out, float *in1, float *in2, float time)
+static void quat_mul(float *out, const float *a, const float *b)
+{
+    float x = a[3]*b[0] + a[0]*b[3] + a[1]*b[2] - a[2]*b[1];
+    float y = a[3]*b[1] - a[0]*b[2] + a[1]*b[3] + a[2]*b[0];
+    float z = a[3]*b[2] + a[0]*b[1] - a[1]*b[0] + a[2]*b[3];
+    float w = a[3]*b[3] - a[0]*b[0] - a[1]*b[1] - a[2]*b[2];
+    out[0] = x;
+    out[1] = y;
+    out[2] = z;
+    out[3] = w;
+}
+
+static void quat_lerp(float *out, const float *in1, const float *in2, float time)
 {
     float dot = (in1[0]*in2[0])+(in1[1]*in2[1])+(in1[2]*in2[2])+(in1[3]*in2[3]);
     float out_scale  = (dot >= 0) ? 1.0f : -1.0f;
@@ -992,6 +1318,84 @@ static void fetch_needed_keyframes(model64_t *model, model64_anim_slot_t anim_sl
     }
 }
 
+static float *get_anim_component(node_transform_t *transform, uint32_t component)
+{
+    switch(component) {
+        case ANIM_COMPONENT_POS:
+            return transform->pos;
+            
+        case ANIM_COMPONENT_ROT:
+            return transform->rot;
+            
+        case ANIM_COMPONENT_SCALE:
+            return transform->scale;
+          
+        default:
+            return NULL;
+    }
+}
+
+static bool is_anim_node_enabled(anim_state_t *anim_state, uint32_t node)
+{
+    return anim_state->node_mask[node/32] & (1 << (node%32));
+}
+
+static bool is_anim_blended(anim_state_t *anim_state)
+{
+    return anim_state && anim_state->index != -1 && anim_state->weight > 0;
+}
+
+static void reset_anim_pose(model64_t *model, model64_anim_slot_t anim_slot)
+{
+    // Components animated by any slot start from the rest pose, so that
+    // blending does not depend on the pose of the previous update.
+    anim_state_t *anim_state = model->active_anims[anim_slot];
+    model64_anim_t *curr_anim = &model->data->anims[anim_state->index];
+    for(uint32_t i=0; i<curr_anim->num_tracks; i++) {
+        uint32_t component = curr_anim->tracks[i] >> 14;
+        uint16_t node = curr_anim->tracks[i] & 0x3FFF;
+        node_transform_state_t *xform = &model->transforms[node];
+        float *out = get_anim_component(&xform->transform, component);
+        if(out == NULL || !is_anim_node_enabled(anim_state, node) || (xform->anim_components & (1 << component))) {
+            continue;
+        }
+        float *rest = get_anim_component(&model->data->nodes[node].transform, component);
+        memcpy(out, rest, (component == ANIM_COMPONENT_ROT ? 4 : 3)*sizeof(float));
+        xform->anim_components |= 1 << component;
+    }
+}
+
+static void blend_anim_component(float *out, const float *value, const float *rest, uint32_t component, float weight, uint32_t blend_mode)
+{
+    size_t count = (component == ANIM_COMPONENT_ROT) ? 4 : 3;
+    if(blend_mode == MODEL64_ANIM_BLEND_ADDITIVE) {
+        if(component == ANIM_COMPONENT_ROT) {
+            // Apply the rotation from the rest pose to the animated pose
+            const float identity[4] = {0, 0, 0, 1};
+            const float rest_inv[4] = {-rest[0], -rest[1], -rest[2], rest[3]};
+            float delta[4];
+            quat_mul(delta, rest_inv, value);
+            if(weight < 1.0f) {
+                quat_lerp(delta, identity, delta, weight);
+            }
+            quat_mul(out, out, delta);
+            vec_normalize(out, 4);
+        } else {
+            for(size_t i=0; i<count; i++) {
+                out[i] += (value[i]-rest[i])*weight;
+            }
+        }
+    } else if(weight >= 1.0f) {
+        memcpy(out, value, count*sizeof(float));
+    } else if(component == ANIM_COMPONENT_ROT) {
+        quat_lerp(out, out, value, weight);
+    } else {
+        for(size_t i=0; i<count; i++) {
+            out[i] += (value[i]-out[i])*weight;
+        }
+    }
+}
+
 static void calc_anim_pose(model64_t *model, model64_anim_slot_t anim_slot)
 {
     anim_state_t *anim_state = model->active_anims[anim_slot];
@@ -1000,49 +1404,63 @@ static void calc_anim_pose(model64_t *model, model64_anim_slot_t anim_slot)
         decoded_keyframe_t *curr_frame = &anim_state->frames[i*4];
         uint32_t component = curr_anim->tracks[i] >> 14;
         uint16_t node = curr_anim->tracks[i] & 0x3FFF;
+        float *out = get_anim_component(&model->transforms[node].transform, component);
+        if(out == NULL || !is_anim_node_enabled(anim_state, node)) {
+            continue;
+        }
         float time = curr_frame[1].time;
         float time_next = curr_frame[2].time;
         float weight = (time == time_next) ? 0 : (anim_state->time-time)/(time_next-time);
         assert(weight <= 1.0f && weight >= 0.0f);
-        float *out;
-        size_t out_count;
-        switch(component) {
-            case ANIM_COMPONENT_POS:
-                out = model->transforms[node].transform.pos;
-                out_count = 3;
-                break;
-                
-            case ANIM_COMPONENT_ROT:
-                out = model->transforms[node].transform.rot;
-                out_count = 4;
-                break;
-                
-            case ANIM_COMPONENT_SCALE:
-                out = model->transforms[node].transform.scale;
-                out_count = 3;
-                break;
-              
-            default:
-                out = NULL;
-                break;
-        }
-        if(out == NULL) {
-            continue;
-        }
+        float value[4];
         if(component == ANIM_COMPONENT_ROT) {
-            quat_lerp(out, curr_frame[1].data, curr_frame[2].data, weight);
+            quat_lerp(value, curr_frame[1].data, curr_frame[2].data, weight);
         } else {
-            catmull_calc_vec(curr_frame[0].data, curr_frame[1].data, curr_frame[2].data, curr_frame[3].data, out, weight, out_count);
+            catmull_calc_vec(curr_frame[0].data, curr_frame[1].data, curr_frame[2].data, curr_frame[3].data, value, weight, 3);
         }
-        if(i == curr_anim->num_tracks-1 || (curr_anim->tracks[i+1] & 0x3FFF) != node) {
-            calc_node_local_matrix(model, node);
+        float *rest = get_anim_component(&model->data->nodes[node].transform, component);
+        blend_anim_component(out, value, rest, component, anim_state->weight, anim_state->blend_mode);
+    }
+}
+
+static void calc_blended_pose(model64_t *model)
+{
+    for(int i=0; i<MAX_ACTIVE_ANIMS; i++) {
+        if(is_anim_blended(model->active_anims[i])) {
+            reset_anim_pose(model, i);
+        }
+    }
+    for(int i=0; i<MAX_ACTIVE_ANIMS; i++) {
+        if(is_anim_blended(model->active_anims[i])) {
+            calc_anim_pose(model, i);
         }
     }
+    for(uint32_t i=0; i<model->data->num_nodes; i++) {
+        node_transform_state_t *xform = &model->transforms[i];
+        // Components that are not animated anymore (because the slot was
+        // stopped, its weight was set to 0 or the node was masked out) go
+        // back to the rest pose, instead of keeping the last animated value.
+        uint8_t released = xform->last_anim_components & ~xform->anim_components;
+        for(uint32_t component=0; released >> component; component++) {
+            if(released & (1 << component)) {
+                float *out = get_anim_component(&xform->transform, component);
+                float *rest = get_anim_component(&model->data->nodes[i].transform, component);
+                memcpy(out, rest, (component == ANIM_COMPONENT_ROT ? 4 : 3)*sizeof(float));
+            }
+        }
+        // Local matrices are calculated once per node, after all slots were applied
+        if(xform->anim_components || released) {
+            calc_node_local_matrix(model, i);
+        }
+        xform->last_anim_components = xform->anim_components;
+        xform->anim_components = 0;
+    }
 }
 
 void model64_update(model64_t *model, float deltatime)
 {
     assertf(deltatime >= 0, "Delta time must not be negative");
+    bool pose_changed = false;
     for(int i=0; i<MAX_ACTIVE_ANIMS; i++) {
         if(!model->active_anims[i]) {
             continue;
@@ -1055,8 +1473,8 @@ void model64_update(model64_t *model, float deltatime)
                 }
                 init_keyframes(model, i);
                 fetch_needed_keyframes(model, i);
-                calc_anim_pose(model, i);
                 model->active_anims[i]->invalid_pose = false;
+                pose_changed = true;
             }
             continue;
         }
@@ -1078,7 +1496,13 @@ void model64_update(model64_t *model, float deltatime)
             model->active_anims[i]->invalid_pose = false;
         }
         fetch_needed_keyframes(model, i);
-        calc_anim_pose(model, i);
+        pose_changed = true;
+    }
+    // Node transforms set directly already update the matrices, so they
+    // only need to be recalculated if an animation changed the pose.
+    if(pose_changed || model->anim_pose_dirty) {
+        calc_blended_pose(model);
+        update_node_matrices(model);
+        model->anim_pose_dirty = false;
     }
-    update_node_matrices(model);
 }
\ No newline at end of file
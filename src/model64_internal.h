@@ -11,7 +11,7 @@
 /** @brief model64 owned model buffer magic */
 #define MODEL64_MAGIC_OWNED     0x4D444C4F // "MDLO"
 /** @brief Current version of model64 */
-#define MODEL64_VERSION         2
+#define MODEL64_VERSION         3
 
 #define ANIM_COMPONENT_POS 0
 #define ANIM_COMPONENT_ROT 1
@@ -46,6 +46,8 @@ typedef struct primitive_s {
     uint32_t local_texture;         ///< Texture index in this model
     uint32_t shared_texture;        ///< A shared texture index between other models
     void *indices;                  ///< Pointer to the first index value. If NULL, indices are not used
+    float bounds_center[3];         ///< Center of the bounding sphere of the vertices (in mesh space)
+    float bounds_radius;            ///< Radius of the bounding sphere of the vertices
 } primitive_t;
 
 /** @brief Transform of a node of a model */
@@ -61,12 +63,20 @@ typedef struct node_transform_s {
 typedef struct node_transform_state_s {
     node_transform_t transform;     ///< Current transform state for a node
     float world_mtx[16];            ///< World matrix for a node
+    float bounds[4];                ///< Bounding sphere of the node mesh in model space (center, radius)
+    float (*skin_mtx)[16];          ///< Skinning matrix of each joint (world matrix times inverse bind matrix), NULL if the node is not skinned
+    uint8_t anim_components;        ///< Components (1<<ANIM_COMPONENT_*) written by animations in the current update
+    uint8_t last_anim_components;   ///< Components written by animations in the previous update
 } node_transform_state_t;
 
 /** @brief A mesh of the model */
 typedef struct mesh_s {
     uint32_t num_primitives;        ///< Number of primitives
     primitive_t *primitives;        ///< Pointer to the first primitive
+    float bounds_center[3];         ///< Center of the bounding sphere of all primitives and LODs (in mesh space)
+    float bounds_radius;            ///< Radius of the bounding sphere of all primitives and LODs
+    struct mesh_s *lod;             ///< Next (coarser) level of detail of this mesh. If NULL, this is the last level
+    float lod_min_size;             ///< Minimum projected size (as a fraction of the viewport height) at which this mesh is used instead of the next LOD
 } mesh_t;
 
 /** @brief A joint of the model */
@@ -159,6 +169,9 @@ typedef struct anim_state_s {
     uint32_t frame_idx;                 ///< Index of next keyframe to read
     decoded_keyframe_t *frames;         ///< Buffer for decoded keyframes
     model64_keyframe_t *curr_frame;     ///< Buffer for keyframe waiting to be copied
+    float weight;                       ///< Blending weight of this animation
+    uint32_t blend_mode;                ///< How this animation is blended with the lower slots (model64_anim_blend_t)
+    uint32_t *node_mask;                ///< Bitmask of the nodes this animation is applied to
 } anim_state_t;
 
 /** @brief A model64 instance */
@@ -166,6 +179,9 @@ typedef struct model64_s {
     model64_data_t *data;                           ///< Pointer to the model data this instance refers to
     node_transform_state_t *transforms;             ///< List of transforms for each bone in a model instance
     anim_state_t *active_anims[MAX_ACTIVE_ANIMS];   ///< List of active animations
+    float bounds[4];                                ///< Bounding sphere of all the meshes in model space (center, radius)
+    bool culling;                                   ///< Whether frustum culling and LOD selection are enabled
+    bool anim_pose_dirty;                           ///< Whether the blended pose must be recalculated on the next update
 } model64_t;
 
 #endif
@@ -409,6 +409,7 @@ rdpq_tracking_t rdpq_tracking;
 
 /** @brief Syncpoint ID at the moment of last SYNC_FULL. Used to implement #rdpq_call_deferred. */
 volatile int __rdpq_syncpoint_at_syncfull;
+void (*__rdpq_syncfull_hook)(void);
 
 /** 
  * @brief RDP interrupt handler 
@@ -424,6 +425,7 @@ static void __rdpq_interrupt(void) {
 
     // Fetch the current RDP buffer for tracing
     if (rdpq_trace_fetch) rdpq_trace_fetch(false);
+    if (__rdpq_syncfull_hook) __rdpq_syncfull_hook();
 
     // Store the current syncpoint ID. This is used to implement #rdpq_call_deferred.
     __rdpq_syncpoint_at_syncfull = rdpq_state->rspq_syncpoint_id;
@@ -472,6 +474,7 @@ void rdpq_init()
     // Clear library globals
     memset(&rdpq_block_state, 0, sizeof(rdpq_block_state));
     rdpq_config = RDPQ_CFG_DEFAULT;
+    __rdpq_tex_cache_config(false);
     rdpq_tracking.autosync = 0;
     rdpq_tracking.mode_freeze = false;
 
@@ -508,6 +511,8 @@ uint32_t rdpq_config_set(uint32_t cfg)
 {
     uint32_t prev = rdpq_config;
     rdpq_config = cfg;
+    if ((prev ^ cfg) & RDPQ_CFG_TMEM_CACHE)
+        __rdpq_tex_cache_config((cfg & RDPQ_CFG_TMEM_CACHE) != 0);
     return prev;
 }
 
@@ -597,6 +602,9 @@ extern inline void __rdpq_autosync_use(uint32_t res);
  * The SYNC command will then reset the "use" status of each respective resource.
  */
 void __rdpq_autosync_change(uint32_t res) {
+    if (__builtin_expect((res & AUTOSYNC_TMEMS) && (rdpq_config & RDPQ_CFG_TMEM_CACHE), 0))
+        __rdpq_tex_cache_tmem_changed();
+
     res &= rdpq_tracking.autosync;
     if (res) {
         if ((res & AUTOSYNC_TILES) && (rdpq_config & RDPQ_CFG_AUTOSYNCTILE))
@@ -639,6 +647,7 @@ void __rdpq_block_begin()
 
     // Save the tracking state (to be recovered when the block is done)
     rdpq_block_state.previous_tracking = rdpq_tracking;
+    rdpq_block_state.optimize = (rdpq_config & RDPQ_CFG_OPTIMIZE_BLOCKS) != 0;
 
     // Set for unknown state (like if we just run another unknown block: we lost track of the RDP state)
     __rdpq_block_run(NULL);    
@@ -665,6 +674,13 @@ void __rdpq_block_next_buffer(void)
         st->wend = st->pending_wend;
         st->pending_wptr = NULL;
         st->pending_wend = NULL;
+    } else if (st->last_node && st->last_node->next) {
+        // We are re-recording a patchable slot (see #rspq_block_patch_begin),
+        // and the next buffer was already allocated during block creation.
+        rdpq_block_t *b = st->last_node->next;
+        st->last_node = b;
+        st->wptr = b->cmds;
+        st->wend = b->cmds + st->bufsize;
     } else {
         // Configure block minimum size
         if (st->bufsize == 0) {
@@ -703,6 +719,7 @@ void __rdpq_block_next_buffer(void)
     // new buffer (though with DP_START==DP_END, as the buffer is currently empty).
     rspq_int_write(RSPQ_CMD_RDP_SET_BUFFER,
         PhysicalAddr(st->wptr), PhysicalAddr(st->wptr), PhysicalAddr(st->wend));
+    if (st->optimize) __rdpq_block_record_buffer_cmd(rspq_cur_pointer - 3);
 
     // Grow size for next buffer
     // We use doubling here to reduce overheads for large blocks
@@ -734,6 +751,11 @@ rdpq_block_t* __rdpq_block_end()
     if (st->first_node)
         st->first_node->tracking = rdpq_tracking;
 
+    // Run the peephole optimizer, if requested
+    if (st->optimize)
+        __rdpq_block_optimize();
+    __rdpq_block_optimize_free();
+
     // Recover tracking state before the block creation started
     rdpq_tracking = st->previous_tracking;
 
@@ -751,6 +773,10 @@ rdpq_block_t* __rdpq_block_end()
 /** @brief Notify that a rspq block was run (called by #rspq_block_run). */
 void __rdpq_block_run(rdpq_block_t *block)
 {
+    // The block might have loaded anything into TMEM
+    if (rdpq_config & RDPQ_CFG_TMEM_CACHE)
+        __rdpq_tex_cache_tmem_changed();
+
     if (block) {
         // We have run a block that contains rdpq commands.
         // During creation, we tracked some state for the block 
@@ -836,6 +862,10 @@ void __rdpq_block_reserve(int num_rdp_commands)
             // Disable internal RDP static buffer
             st->wptr = NULL;
             st->wend = NULL;
+            // The RSP will generate RDP commands in the dynamic buffer, so
+            // the next static commands must not extend the last append
+            // command (nor its region for the optimizer).
+            st->last_rdp_append_buffer = NULL;
 
             // Force a switch to next dynamic buffer.
             rspq_int_write(RSPQ_CMD_RDP_SET_BUFFER, 0, 0, 0);
@@ -844,10 +874,12 @@ void __rdpq_block_reserve(int num_rdp_commands)
         if (__builtin_expect(st->wptr + num_rdp_commands*2 > st->wend, 0))
             __rdpq_block_next_buffer();
 
+        volatile uint32_t *start = st->wptr;
         for (int i=0; i<num_rdp_commands; i++) {
             *st->wptr++ = 0xC0000000;
             *st->wptr++ = 0;
         }
+        if (st->optimize) __rdpq_block_record_region(start, st->wptr, true, NULL);
 
         // Make sure we don't coalesce with the last append command anymore,
         // as there will be other RDP commands inbetween.
@@ -875,6 +907,7 @@ void __rdpq_block_update(volatile uint32_t *wptr)
     struct rdpq_block_state_s *st = &rdpq_block_state;
     uint32_t phys_old = PhysicalAddr(st->wptr);
     uint32_t phys_new = PhysicalAddr(wptr);
+    volatile uint32_t *wptr_old = st->wptr;
     st->wptr = wptr;
 
     assertf((phys_old & 0x7) == 0, "old not aligned to 8 bytes: %lx", phys_old);
@@ -885,6 +918,7 @@ void __rdpq_block_update(volatile uint32_t *wptr)
         // It can be either a RSPQ_CMD_RDP_SET_BUFFER or RSPQ_CMD_RDP_APPEND_BUFFER,
         // but we still need to update it to the new END pointer.
         *st->last_rdp_append_buffer = (*st->last_rdp_append_buffer & 0xFF000000) | phys_new;
+        if (st->optimize) __rdpq_block_record_region(wptr_old, wptr, false, st->last_rdp_append_buffer);
     } else {
         // A RSP command has emitted some commands since last time we emit
         // RSPQ_CMD_RDP_APPEND_BUFFER. Thus we can't coalesce with the last one
@@ -893,6 +927,10 @@ void __rdpq_block_update(volatile uint32_t *wptr)
         extern volatile uint32_t *rspq_cur_pointer;
         st->last_rdp_append_buffer = rspq_cur_pointer;
         rspq_int_write(RSPQ_CMD_RDP_APPEND_BUFFER, phys_new);
+        if (st->optimize) {
+            __rdpq_block_record_buffer_cmd(rspq_cur_pointer - 1);
+            __rdpq_block_record_region(wptr_old, wptr, false, st->last_rdp_append_buffer);
+        }
     }
 }
 
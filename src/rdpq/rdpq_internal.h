@@ -76,6 +76,15 @@ typedef struct rdpq_block_s {
     uint32_t cmds[] __attribute__((aligned(8)));  ///< RDP commands
 } rdpq_block_t;
 
+/** @brief A region of a RDP block buffer, recorded for the block optimizer (see rdpq_optimize.c) */
+typedef struct {
+    rdpq_block_t *node;                 ///< RDP buffer containing the region
+    volatile uint32_t *start;           ///< Start of the region
+    volatile uint32_t *end;             ///< End of the region
+    bool reserved;                      ///< True if the space is reserved for commands generated by RSP
+    volatile uint32_t *cmd;             ///< rspq command that sends the region to the RDP (NULL if reserved)
+} rdpq_block_region_t;
+
 /** 
  * @brief RDP block management state 
  * 
@@ -106,10 +115,26 @@ typedef struct rdpq_block_state_s {
      * @brief Tracking state before starting building the block.
      */
     rdpq_tracking_t previous_tracking;
+    /** @brief True if the block must be optimized when finished (#RDPQ_CFG_OPTIMIZE_BLOCKS) */
+    bool optimize;
+    /** @brief Regions of the RDP buffers written so far (only if optimizing) */
+    rdpq_block_region_t *regions;
+    int num_regions;                    ///< Number of recorded regions
+    int max_regions;                    ///< Capacity of the regions array
+    /** @brief RSPQ_CMD_RDP_SET_BUFFER / RSPQ_CMD_RDP_APPEND_BUFFER commands in the block (only if optimizing) */
+    volatile uint32_t **rdp_buffer_cmds;
+    int num_rdp_buffer_cmds;            ///< Number of recorded rspq commands
+    int max_rdp_buffer_cmds;            ///< Capacity of the rdp_buffer_cmds array
 } rdpq_block_state_t;
 
+extern rdpq_block_state_t rdpq_block_state;
+
 void __rdpq_block_begin();
 rdpq_block_t* __rdpq_block_end();
+void __rdpq_block_record_region(volatile uint32_t *start, volatile uint32_t *end, bool reserved, volatile uint32_t *cmd);
+void __rdpq_block_record_buffer_cmd(volatile uint32_t *cmd);
+void __rdpq_block_optimize(void);
+void __rdpq_block_optimize_free(void);
 void __rdpq_block_free(rdpq_block_t *block);
 void __rdpq_block_run(rdpq_block_t *block);
 void __rdpq_block_next_buffer(void);
@@ -125,6 +150,11 @@ inline void __rdpq_autosync_use(uint32_t res)
 }
 void __rdpq_autosync_change(uint32_t res);
 
+/** @brief Enable or disable the TMEM residency cache (see #RDPQ_CFG_TMEM_CACHE) */
+void __rdpq_tex_cache_config(bool enable);
+/** @brief Notify the TMEM residency cache that TMEM is being written */
+void __rdpq_tex_cache_tmem_changed(void);
+
 void __rdpq_write8(uint32_t cmd_id, uint32_t arg0, uint32_t arg1);
 void __rdpq_write16(uint32_t cmd_id, uint32_t arg0, uint32_t arg1, uint32_t arg2, uint32_t arg3);
 
@@ -133,6 +163,9 @@ void rdpq_triangle_rsp(const rdpq_trifmt_t *fmt, const float *v1, const float *v
 
 extern volatile int __rdpq_syncpoint_at_syncfull;
 
+/** @brief Hook called (under interrupt) each time the RDP reaches a SYNC_FULL. Used by the rspq profiler. */
+extern void (*__rdpq_syncfull_hook)(void);
+
 
 ///@cond
 /* Helpers for rdpq_passthrough_write / rdpq_fixup_write */
@@ -0,0 +1,333 @@
+/**
+ * @file rdpq_optimize.c
+ * @brief RDP Command queue: peephole optimizer for blocks
+ * @ingroup rdpq
+ *
+ * When #RDPQ_CFG_OPTIMIZE_BLOCKS is enabled, the RDP commands recorded in a
+ * block are post-processed by #__rdpq_block_optimize when the block is closed.
+ * The optimizer works on the static RDP buffers of the block (see
+ * #rdpq_block_t) and removes commands that are provably useless:
+ *
+ *  * State commands (SET_OTHER_MODES, SET_COMBINE, SET_TILE, colors, etc.)
+ *    that set a register to the value it already has.
+ *  * SYNC_PIPE / SYNC_LOAD / SYNC_TILE that are issued again without any
+ *    RDP work (drawing or loading) since the previous identical sync.
+ *  * Texture loads that reload exactly the same data in TMEM (same texture
+ *    image, same tile descriptor, same load command), when no other load
+ *    and no drawing (which might have overwritten the texture) happened
+ *    inbetween.
+ *
+ * The static buffers also contain space reserved for commands that will be
+ * generated by RSP at runtime (fixups, see #__rdpq_block_reserve). Their
+ * contents are unknown at this time, so the optimizer resets its knowledge
+ * of the RDP state at each of them, and in general at the start of each
+ * region of passthrough commands (as other RSP commands might have run in
+ * between). This also preserves autosync semantics: the syncs generated
+ * by the autosync engine are only dropped if they are duplicated within
+ * the same run of commands.
+ *
+ * After removing commands, the remaining ones are compacted, and all the
+ * rspq commands of the block that refer to addresses in the RDP buffers
+ * (#RSPQ_CMD_RDP_SET_BUFFER and #RSPQ_CMD_RDP_APPEND_BUFFER) are relocated.
+ * Blocks with patchable slots (see #rspq_block_slot_begin) are never
+ * optimized, as their layout must be preserved.
+ */
+
+#include "rdpq.h"
+#include "rdpq_internal.h"
+#include "rdpq_debug.h"
+#include "rspq/rspq_internal.h"
+#include "utils.h"
+#include <string.h>
+#include <stdlib.h>
+
+/** @brief Known RDP registers tracked by the optimizer */
+enum {
+    REG_OTHER_MODES,
+    REG_COMBINE,
+    REG_TEX_IMAGE,
+    REG_COLOR_IMAGE,
+    REG_Z_IMAGE,
+    REG_PRIM_COLOR,
+    REG_ENV_COLOR,
+    REG_BLEND_COLOR,
+    REG_FOG_COLOR,
+    REG_FILL_COLOR,
+    REG_PRIM_DEPTH,
+    REG_SCISSOR,
+    REG_CONVERT,
+    REG_KEY_GB,
+    REG_KEY_R,
+    REG_TILE,                           ///< SET_TILE (8 registers, one per tile)
+    REG_TILE_SIZE = REG_TILE + 8,       ///< SET_TILE_SIZE (8 registers, one per tile)
+    REG_COUNT = REG_TILE_SIZE + 8
+};
+
+/** @brief Flags for syncs issued since the last RDP work */
+enum {
+    SYNCED_PIPE = 1<<0,
+    SYNCED_LOAD = 1<<1,
+    SYNCED_TILE = 1<<2,
+};
+
+/** @brief State of the RDP tracked by the optimizer */
+typedef struct {
+    uint64_t regs[REG_COUNT];       ///< Values of the registers
+    uint64_t known;                 ///< Bitmask of known registers
+    int synced;                     ///< Syncs issued since the last RDP work (SYNCED_*)
+    bool drawn;                     ///< True if something was drawn since the last load
+    struct {
+        bool valid;                 ///< True if a load was performed
+        uint64_t cmd;               ///< Load command
+        uint64_t tex_image;         ///< Texture image used by the load
+        uint64_t tile;              ///< Tile descriptor used by the load
+    } last_load;                    ///< Last texture load
+} opt_state_t;
+
+/** @brief A block of removed commands, for relocation */
+typedef struct {
+    uint32_t old_end;               ///< Physical address of the end of the removed command
+    uint32_t removed;               ///< Total bytes removed so far (including this command)
+} opt_reloc_t;
+
+/** @brief Map an opcode to the register that it sets (or -1) */
+static int opt_state_reg(uint64_t cmd)
+{
+    switch ((cmd >> 56) & 0x3F) {
+    case RDPQ_CMD_SET_OTHER_MODES:      return REG_OTHER_MODES;
+    case RDPQ_CMD_SET_COMBINE_MODE_RAW: return REG_COMBINE;
+    case RDPQ_CMD_SET_TEXTURE_IMAGE:    return REG_TEX_IMAGE;
+    case RDPQ_CMD_SET_COLOR_IMAGE:      return REG_COLOR_IMAGE;
+    case RDPQ_CMD_SET_Z_IMAGE:          return REG_Z_IMAGE;
+    case RDPQ_CMD_SET_PRIM_COLOR:       return REG_PRIM_COLOR;
+    case RDPQ_CMD_SET_ENV_COLOR:        return REG_ENV_COLOR;
+    case RDPQ_CMD_SET_BLEND_COLOR:      return REG_BLEND_COLOR;
+    case RDPQ_CMD_SET_FOG_COLOR:        return REG_FOG_COLOR;
+    case RDPQ_CMD_SET_FILL_COLOR:       return REG_FILL_COLOR;
+    case RDPQ_CMD_SET_PRIM_DEPTH:       return REG_PRIM_DEPTH;
+    case RDPQ_CMD_SET_SCISSOR:          return REG_SCISSOR;
+    case RDPQ_CMD_SET_CONVERT:          return REG_CONVERT;
+    case RDPQ_CMD_SET_KEY_GB:           return REG_KEY_GB;
+    case RDPQ_CMD_SET_KEY_R:            return REG_KEY_R;
+    case RDPQ_CMD_SET_TILE:             return REG_TILE + ((cmd >> 24) & 7);
+    case RDPQ_CMD_SET_TILE_SIZE:        return REG_TILE_SIZE + ((cmd >> 24) & 7);
+    default:                            return -1;
+    }
+}
+
+/** @brief Check whether the value of a register is known */
+static bool opt_state_known(opt_state_t *st, int reg)
+{
+    return (st->known & (1ull << reg)) != 0;
+}
+
+/** @brief Check whether the register is known to have the specified value */
+static bool opt_state_has(opt_state_t *st, int reg, uint64_t value)
+{
+    return opt_state_known(st, reg) && st->regs[reg] == value;
+}
+
+/**
+ * @brief Process a RDP command, updating the state.
+ *
+ * @return true if the command is redundant and can be removed
+ */
+static bool opt_command(opt_state_t *st, uint64_t *cmd)
+{
+    uint64_t w = cmd[0];
+    int op = (w >> 56) & 0x3F;
+
+    // State commands: drop them if they don't change the register
+    int reg = opt_state_reg(w);
+    if (reg >= 0) {
+        if (opt_state_has(st, reg, w))
+            return true;
+        st->regs[reg] = w;
+        st->known |= 1ull << reg;
+        return false;
+    }
+
+    switch (op) {
+    case RDPQ_CMD_SYNC_PIPE:
+    case RDPQ_CMD_SYNC_LOAD:
+    case RDPQ_CMD_SYNC_TILE: {
+        // A sync is redundant if the same sync was issued and the RDP
+        // has not been given any work since then.
+        int flag = op == RDPQ_CMD_SYNC_PIPE ? SYNCED_PIPE :
+                   op == RDPQ_CMD_SYNC_LOAD ? SYNCED_LOAD : SYNCED_TILE;
+        if (st->synced & flag)
+            return true;
+        st->synced |= flag;
+        return false;
+    }
+    case RDPQ_CMD_SYNC_FULL:
+        st->synced = SYNCED_PIPE | SYNCED_LOAD | SYNCED_TILE;
+        return false;
+
+    case RDPQ_CMD_LOAD_BLOCK:
+    case RDPQ_CMD_LOAD_TILE:
+    case RDPQ_CMD_LOAD_TLUT: {
+        int tile = (w >> 24) & 7;
+        bool known = opt_state_known(st, REG_TEX_IMAGE) && opt_state_known(st, REG_TILE + tile);
+
+        // If anything was drawn since the last load, the texture might have been
+        // overwritten (render to texture), so we cannot skip the load. We don't
+        // know the size of the texture, so we can't check for overlaps.
+        if (known && !st->drawn && st->last_load.valid && st->last_load.cmd == w &&
+            st->last_load.tex_image == st->regs[REG_TEX_IMAGE] &&
+            st->last_load.tile == st->regs[REG_TILE + tile])
+            return true;
+
+        st->synced = 0;
+        st->drawn = false;
+        st->last_load.valid = known;
+        st->last_load.cmd = w;
+        st->last_load.tex_image = st->regs[REG_TEX_IMAGE];
+        st->last_load.tile = st->regs[REG_TILE + tile];
+        // Loads also change the size of the tile
+        st->known &= ~(1ull << (REG_TILE_SIZE + tile));
+        return false;
+    }
+
+    case 0x00:                  // NOP
+    case RDPQ_CMD_DEBUG:
+        return false;
+
+    default:
+        // Any other command is RDP work (drawing).
+        st->synced = 0;
+        st->drawn = true;
+        return false;
+    }
+}
+
+/** @brief Map an address through the relocation table */
+static uint32_t opt_reloc(opt_reloc_t *relocs, int num_relocs, uint32_t addr)
+{
+    uint32_t removed = 0;
+    for (int i = 0; i < num_relocs && relocs[i].old_end <= addr; i++)
+        removed = relocs[i].removed;
+    return addr - removed;
+}
+
+/** @brief Optimize the regions of a single RDP buffer */
+static int opt_node(rdpq_block_state_t *bst, int first, int last)
+{
+    opt_reloc_t *relocs = NULL;
+    int num_relocs = 0, max_relocs = 0;
+    uint32_t removed = 0;
+
+    uint32_t node_start = PhysicalAddr(bst->regions[first].start);
+    uint32_t node_end = PhysicalAddr(bst->regions[last-1].end);
+    volatile uint32_t *out = bst->regions[first].start;
+
+    opt_state_t st;
+    for (int r = first; r < last; r++) {
+        rdpq_block_region_t *reg = &bst->regions[r];
+
+        // Reset the state at the start of each region: RSP might have
+        // generated any RDP command since the previous one.
+        memset(&st, 0, sizeof(st));
+
+        volatile uint32_t *cur = reg->start;
+        while (cur < reg->end) {
+            int nwords = reg->reserved ? reg->end - cur : rdpq_debug_disasm_size((uint64_t*)cur) * 2;
+            if (!reg->reserved && opt_command(&st, (uint64_t*)cur)) {
+                removed += nwords * 4;
+                if (num_relocs == max_relocs) {
+                    max_relocs = max_relocs ? max_relocs * 2 : 16;
+                    relocs = realloc(relocs, max_relocs * sizeof(opt_reloc_t));
+                }
+                relocs[num_relocs++] = (opt_reloc_t){ PhysicalAddr(cur + nwords), removed };
+            } else {
+                if (out != cur)
+                    memmove((void*)out, (void*)cur, nwords * 4);
+                out += nwords;
+            }
+            cur += nwords;
+        }
+    }
+
+    // Relocate all the rspq commands referencing this buffer
+    if (num_relocs) {
+        for (int i = 0; i < bst->num_rdp_buffer_cmds; i++) {
+            volatile uint32_t *cmd = bst->rdp_buffer_cmds[i];
+            uint32_t end = cmd[0] & 0xFFFFFF;
+            if (end < node_start || end > node_end)
+                continue;
+            cmd[0] = (cmd[0] & 0xFF000000) | opt_reloc(relocs, num_relocs, end);
+            if (((cmd[0] >> 24) & 0xFF) == RSPQ_CMD_RDP_SET_BUFFER)
+                cmd[1] = opt_reloc(relocs, num_relocs, cmd[1]);
+        }
+    }
+
+    free(relocs);
+    return removed;
+}
+
+void __rdpq_block_optimize(void)
+{
+    rdpq_block_state_t *bst = &rdpq_block_state;
+
+    // Process regions grouped by RDP buffer. Regions are recorded in order,
+    // and each buffer is filled completely before moving to the next one.
+    int first = 0;
+    while (first < bst->num_regions) {
+        int last = first + 1;
+        while (last < bst->num_regions && bst->regions[last].node == bst->regions[first].node)
+            last++;
+        opt_node(bst, first, last);
+        first = last;
+    }
+}
+
+/** @brief Grow a dynamic array, doubling its capacity */
+static void* opt_grow(void *arr, int count, int *cap, int elemsize)
+{
+    if (count == *cap) {
+        *cap = *cap ? *cap * 2 : 64;
+        arr = realloc(arr, *cap * elemsize);
+    }
+    return arr;
+}
+
+void __rdpq_block_record_region(volatile uint32_t *start, volatile uint32_t *end, bool reserved, volatile uint32_t *cmd)
+{
+    rdpq_block_state_t *bst = &rdpq_block_state;
+
+    // Coalesce with the previous region only if the new commands were appended
+    // by extending the same rspq command. Being contiguous in the buffer is not
+    // enough: RSP commands might have generated RDP commands inbetween (e.g.
+    // triangles, via a switch to the dynamic buffer), changing the RDP state.
+    if (bst->num_regions > 0) {
+        rdpq_block_region_t *prev = &bst->regions[bst->num_regions-1];
+        if (!reserved && !prev->reserved && prev->cmd == cmd && prev->end == start) {
+            prev->end = end;
+            return;
+        }
+    }
+
+    bst->regions = opt_grow(bst->regions, bst->num_regions, &bst->max_regions, sizeof(rdpq_block_region_t));
+    bst->regions[bst->num_regions++] = (rdpq_block_region_t){
+        .node = bst->last_node, .start = start, .end = end, .reserved = reserved, .cmd = cmd,
+    };
+}
+
+void __rdpq_block_record_buffer_cmd(volatile uint32_t *cmd)
+{
+    rdpq_block_state_t *bst = &rdpq_block_state;
+    bst->rdp_buffer_cmds = opt_grow(bst->rdp_buffer_cmds, bst->num_rdp_buffer_cmds, &bst->max_rdp_buffer_cmds, sizeof(uint32_t*));
+    bst->rdp_buffer_cmds[bst->num_rdp_buffer_cmds++] = cmd;
+}
+
+void __rdpq_block_optimize_free(void)
+{
+    rdpq_block_state_t *bst = &rdpq_block_state;
+    free(bst->regions);
+    free(bst->rdp_buffer_cmds);
+    bst->regions = NULL;
+    bst->rdp_buffer_cmds = NULL;
+    bst->num_regions = bst->max_regions = 0;
+    bst->num_rdp_buffer_cmds = bst->max_rdp_buffer_cmds = 0;
+    bst->optimize = false;
+}
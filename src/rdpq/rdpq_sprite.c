@@ -10,8 +10,11 @@
 #include "rdpq_sprite_internal.h"
 #include "rdpq_mode.h"
 #include "rdpq_tex.h"
+#include "rdpq_tex_internal.h"
 #include "sprite.h"
 #include "sprite_internal.h"
+#include <stdlib.h>
+#include <string.h>
 
 static void sprite_upload_palette(sprite_t *sprite, int palidx, bool set_mode)
 {
@@ -144,3 +147,190 @@ void rdpq_sprite_blit(sprite_t *sprite, float x0, float y0, const rdpq_blitparms
     surface_t surf = sprite_get_pixels(sprite);
     rdpq_tex_blit(&surf, x0, y0, parms);
 }
+
+/** @brief A blit recorded in a sprite batch */
+typedef struct {
+    sprite_t *sprite;           ///< Sprite to blit
+    void *pixels;               ///< Pixels of the sprite (sort key)
+    uint16_t *palette;          ///< Palette of the sprite (sort key)
+    rdpq_tlut_t tlut;           ///< TLUT mode required by the sprite (sort key)
+    rspq_block_t *mode;         ///< Render mode block (sort key)
+    int layer;                  ///< Layer (sort key)
+    int seq;                    ///< Sequence number, to keep the sort stable
+    float x0, y0;               ///< Position on the framebuffer
+    rdpq_blitparms_t parms;     ///< Blit parameters
+} spritebatch_item_t;
+
+/** @brief A batch of sprite blits */
+typedef struct rdpq_spritebatch_s {
+    spritebatch_item_t *items;  ///< Blits recorded so far
+    int num_items;              ///< Number of blits
+    int max_items;              ///< Allocated size of the items array
+    int layer;                  ///< Current layer
+    rspq_block_t *mode;         ///< Current render mode block
+} rdpq_spritebatch_t;
+
+rdpq_spritebatch_t* rdpq_spritebatch_new(void)
+{
+    return calloc(1, sizeof(rdpq_spritebatch_t));
+}
+
+void rdpq_spritebatch_free(rdpq_spritebatch_t *batch)
+{
+    free(batch->items);
+    free(batch);
+}
+
+void rdpq_spritebatch_set_layer(rdpq_spritebatch_t *batch, int layer)
+{
+    batch->layer = layer;
+}
+
+void rdpq_spritebatch_set_mode(rdpq_spritebatch_t *batch, rspq_block_t *mode)
+{
+    batch->mode = mode;
+}
+
+void rdpq_spritebatch_blit(rdpq_spritebatch_t *batch, sprite_t *sprite, float x0, float y0, const rdpq_blitparms_t *parms)
+{
+    assertf(!sprite_is_shq(sprite), "SHQ sprites only work with rdpq_sprite_upload, not rdpq_spritebatch_blit");
+
+    if (batch->num_items == batch->max_items) {
+        batch->max_items = batch->max_items ? batch->max_items * 2 : 64;
+        batch->items = realloc(batch->items, batch->max_items * sizeof(spritebatch_item_t));
+    }
+
+    spritebatch_item_t *item = &batch->items[batch->num_items];
+    *item = (spritebatch_item_t){
+        .sprite = sprite,
+        .pixels = sprite_get_pixels(sprite).buffer,
+        .palette = sprite_get_palette(sprite),
+        .tlut = rdpq_tlut_from_format(sprite_get_format(sprite)),
+        .mode = batch->mode,
+        .layer = batch->layer,
+        .seq = batch->num_items,
+        .x0 = x0, .y0 = y0,
+    };
+    if (parms) item->parms = *parms;
+    batch->num_items++;
+}
+
+static int spritebatch_cmp(const void *a, const void *b)
+{
+    const spritebatch_item_t *ia = a, *ib = b;
+    #define CMP(field)  if (ia->field != ib->field) return ia->field < ib->field ? -1 : 1
+    CMP(layer);
+    CMP(mode);
+    CMP(tlut);
+    CMP(palette);
+    CMP(pixels);
+    CMP(parms.tile);
+    CMP(seq);
+    #undef CMP
+    return 0;
+}
+
+/** 
+ * @brief Implement large_tex_draw protocol for a texture already in TMEM
+ * 
+ * The whole texture has already been uploaded by #rdpq_spritebatch_flush,
+ * so the requested rectangle can be drawn directly.
+ */
+static void ltd_preloaded(rdpq_tile_t tile, const surface_t *tex, int s0, int t0, int s1, int t1, 
+    void (*draw_cb)(rdpq_tile_t tile, int s0, int t0, int s1, int t1), bool filtering)
+{
+    draw_cb(tile, s0, t0, s1, t1);
+}
+
+void rdpq_spritebatch_flush(rdpq_spritebatch_t *batch)
+{
+    qsort(batch->items, batch->num_items, sizeof(spritebatch_item_t), spritebatch_cmp);
+
+    rdpq_tlut_t cur_tlut = -1;
+    uint16_t *cur_palette = NULL;
+    rspq_block_t *cur_mode = NULL;
+
+    // If any blit has its own render mode, save the caller's one, so that
+    // each mode can be applied on top of it, and it can be restored at the end.
+    bool has_modes = false;
+    for (int i = 0; i < batch->num_items && !has_modes; i++)
+        has_modes = batch->items[i].mode != NULL;
+    if (has_modes) rdpq_mode_push();
+
+    for (int i = 0; i < batch->num_items; ) {
+        spritebatch_item_t *first = &batch->items[i];
+
+        // Find all consecutive blits of the same texture within the same layer
+        int n = 1;
+        while (i+n < batch->num_items && 
+               batch->items[i+n].pixels == first->pixels &&
+               batch->items[i+n].palette == first->palette &&
+               batch->items[i+n].mode == first->mode &&
+               batch->items[i+n].layer == first->layer)
+            n++;
+
+        // Switch render mode, only if changed
+        if (first->mode != cur_mode) {
+            rdpq_mode_pop();
+            rdpq_mode_push();
+            if (first->mode) rspq_block_run(first->mode);
+            cur_mode = first->mode;
+            cur_tlut = -1;
+            // The mode block might have loaded its own palette
+            if (first->mode) cur_palette = NULL;
+        }
+
+        // Configure TLUT mode and upload the palette, only if changed
+        if (first->tlut != cur_tlut) {
+            rdpq_mode_tlut(first->tlut);
+            cur_tlut = first->tlut;
+        }
+        if (first->tlut != TLUT_NONE && first->palette && first->palette != cur_palette) {
+            rdpq_tex_upload_tlut(first->palette, 0, sprite_get_format(first->sprite) == FMT_CI4 ? 16 : 256);
+            cur_palette = first->palette;
+        }
+
+        // Check if the whole texture fits in TMEM. If so, upload it once and
+        // draw all blits from TMEM. Otherwise, go through the standard blit
+        // that splits it in chunks.
+        surface_t surf = sprite_get_pixels(first->sprite);
+        tex_loader_t tload = tex_loader_init(first->parms.tile, &surf);
+        bool fits = tex_loader_calc_max_height(&tload, surf.width) >= surf.height;
+
+        if (fits) {
+            rdpq_tex_multi_begin();
+            rdpq_tex_upload(first->parms.tile, &surf, NULL);
+            uint32_t tiles = 1 << first->parms.tile;
+            for (int j = 0; j < n; j++) {
+                spritebatch_item_t *item = &batch->items[i+j];
+                if (!(tiles & (1 << item->parms.tile))) {
+                    rdpq_tex_reuse(item->parms.tile, NULL);
+                    tiles |= 1 << item->parms.tile;
+                }
+                __rdpq_tex_blit(&surf, item->x0, item->y0, &item->parms, ltd_preloaded);
+            }
+            rdpq_tex_multi_end();
+
+            // Only CI textures are guaranteed to stay in the lower half of
+            // TMEM. Other formats can overwrite the palette.
+            tex_format_t fmt = surface_get_format(&surf);
+            if (fmt != FMT_CI4 && fmt != FMT_CI8)
+                cur_palette = NULL;
+        } else {
+            for (int j = 0; j < n; j++) {
+                spritebatch_item_t *item = &batch->items[i+j];
+                rdpq_tex_blit(&surf, item->x0, item->y0, &item->parms);
+            }
+            // The chunked blit reuses the whole TMEM
+            cur_palette = NULL;
+        }
+
+        i += n;
+    }
+
+    if (has_modes) rdpq_mode_pop();
+
+    batch->num_items = 0;
+    batch->layer = 0;
+    batch->mode = NULL;
+}
@@ -12,9 +12,12 @@
 #include "rdpq_rect.h"
 #include "rdpq_tex.h"
 #include "rdpq_tex_internal.h"
+#include "rdpq_internal.h"
 #include "utils.h"
 #include "fmath.h"
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
 
 /** @brief Non-zero if we are doing a multi-texture upload */
 typedef struct rdpq_multi_upload_s {
@@ -29,6 +32,38 @@ tex_loader_t last_tload;
 /** @brief Address in TMEM where the palettes must be loaded */
 #define TMEM_PALETTE_ADDR   0x800
 
+/** @brief Number of uploads tracked by the TMEM residency cache */
+#define TMEM_CACHE_ENTRIES  8
+
+/** @brief An upload tracked by the TMEM residency cache */
+typedef struct {
+    void *buffer;               ///< Pixels of the uploaded surface (NULL if the entry is free)
+    uint16_t stride;            ///< Stride of the uploaded surface
+    tex_format_t fmt;           ///< Format of the uploaded surface
+    int16_t s0, t0, s1, t1;     ///< Uploaded region
+    int16_t tmem_addr;          ///< Address in TMEM
+    int16_t tmem_size;          ///< Bytes used in TMEM (in each half, for RGBA32 and YUV)
+} tmem_cache_entry_t;
+
+/** 
+ * @brief TMEM residency cache (see #RDPQ_CFG_TMEM_CACHE)
+ * 
+ * The cache mirrors which surface regions are currently in TMEM, as uploaded
+ * by #rdpq_tex_upload_sub. Since commands are executed in order, the state
+ * tracked at enqueue time is the state the RDP will see.
+ * 
+ * All TMEM writes go through #__rdpq_autosync_change, which notifies the cache.
+ * Writes done by the cache itself (own_write) just replace the overlapping
+ * entries; any other write invalidates the whole cache, as we do not know
+ * which portion of TMEM it touched.
+ */
+static struct {
+    bool enabled;               ///< True if the cache is enabled
+    bool own_write;             ///< True while the cache is loading TMEM itself
+    int next;                   ///< Next entry to replace (FIFO)
+    tmem_cache_entry_t entries[TMEM_CACHE_ENTRIES];  ///< Tracked uploads
+} tmem_cache;
+
 /// @brief Calculates the first power of 2 that is equal or larger than size
 /// @param x input in units
 /// @return Power of 2 that is equal or larger than x
@@ -315,6 +350,84 @@ static void texload_settile(tex_loader_t *tload, int s0, int t0, int s1, int t1)
     rdpq_set_tile_size_fx(tload->tile, s0, t0, s1, t1);
 }
 
+/** @brief Check whether a TMEM range overlaps the footprint of a cache entry */
+static bool tmem_cache_overlaps(tmem_cache_entry_t *e, int addr, int size)
+{
+    int e_addr = e->tmem_addr, e_size = e->tmem_size;
+    if (addr < e_addr + e_size && e_addr < addr + size)
+        return true;
+    // RGBA32 and YUV also occupy the same range in the upper half of TMEM
+    if (e->fmt == FMT_RGBA32 || e->fmt == FMT_YUV16)
+        return addr < e_addr + 0x800 + e_size && e_addr + 0x800 < addr + size;
+    return false;
+}
+
+/** @brief Drop cache entries that overlap a TMEM write of the specified format */
+static void tmem_cache_evict(tex_format_t fmt, int addr, int size)
+{
+    bool split = fmt == FMT_RGBA32 || fmt == FMT_YUV16;
+    for (int i=0; i<TMEM_CACHE_ENTRIES; i++) {
+        tmem_cache_entry_t *e = &tmem_cache.entries[i];
+        if (!e->buffer) continue;
+        if (tmem_cache_overlaps(e, addr, size) ||
+            (split && tmem_cache_overlaps(e, addr + 0x800, size)))
+            e->buffer = NULL;
+    }
+}
+
+/** @brief Load a rect via the texloader, skipping the load if it is already resident in TMEM */
+static int tmem_cache_load(tex_loader_t *tload, int s0, int t0, int s1, int t1)
+{
+    const surface_t *tex = tload->tex;
+    for (int i=0; i<TMEM_CACHE_ENTRIES; i++) {
+        tmem_cache_entry_t *e = &tmem_cache.entries[i];
+        if (e->buffer == tex->buffer && e->stride == tex->stride && e->fmt == tload->fmt &&
+            e->s0 == s0 && e->t0 == t0 && e->s1 == s1 && e->t1 == t1 &&
+            e->tmem_addr == tload->tmem_addr) {
+            // The data is already there: just configure the tile descriptor.
+            int nbytes = texload_set_rect(tload, s0, t0, s1, t1);
+            if (TEX_FORMAT_BITDEPTH(tload->fmt) == 4) {
+                s0 &= ~1; s1 = (s1+1) & ~1;
+            }
+            texload_settile(tload, s0, t0, s1, t1);
+            return nbytes;
+        }
+    }
+
+    tmem_cache.own_write = true;
+    int nbytes = tex_loader_load(tload, s0, t0, s1, t1);
+    tmem_cache.own_write = false;
+
+    // The returned size is already the footprint in each half for split
+    // formats: RGBA32 uses half the pitch, while YUV uses the full pitch but
+    // only the first half of each line in both the UV (lower) and Y (upper) half.
+    tmem_cache_evict(tload->fmt, tload->tmem_addr, nbytes);
+    tmem_cache.entries[tmem_cache.next] = (tmem_cache_entry_t){
+        .buffer = tex->buffer, .stride = tex->stride, .fmt = tload->fmt,
+        .s0 = s0, .t0 = t0, .s1 = s1, .t1 = t1,
+        .tmem_addr = tload->tmem_addr, .tmem_size = nbytes,
+    };
+    tmem_cache.next = (tmem_cache.next + 1) % TMEM_CACHE_ENTRIES;
+    return nbytes;
+}
+
+void rdpq_tex_cache_invalidate(void)
+{
+    memset(tmem_cache.entries, 0, sizeof(tmem_cache.entries));
+}
+
+void __rdpq_tex_cache_config(bool enable)
+{
+    tmem_cache.enabled = enable;
+    rdpq_tex_cache_invalidate();
+}
+
+void __rdpq_tex_cache_tmem_changed(void)
+{
+    if (!tmem_cache.own_write)
+        rdpq_tex_cache_invalidate();
+}
+
 ///@cond
 // Tex loader API, not yet documented
 int tex_loader_load(tex_loader_t *tload, int s0, int t0, int s1, int t1)
@@ -377,7 +490,14 @@ int rdpq_tex_upload_sub(rdpq_tile_t tile, const surface_t *tex, const rdpq_texpa
         tex_loader_set_tmem_addr(&last_tload, parms ? parms->tmem_addr : 0);
     }
 
-    int nbytes = tex_loader_load(&last_tload, s0, t0, s1, t1);
+    // Use the TMEM residency cache if enabled. It cannot be used while recording
+    // a block (the TMEM contents at playback are unknown), nor with auto-TMEM
+    // (the address is only known to RSP).
+    int nbytes;
+    if (tmem_cache.enabled && !multi_upload.used && !rspq_in_block())
+        nbytes = tmem_cache_load(&last_tload, s0, t0, s1, t1);
+    else
+        nbytes = tex_loader_load(&last_tload, s0, t0, s1, t1);
 
     if (multi_upload.used) {
         rdpq_set_tile_autotmem(nbytes);
@@ -685,6 +805,218 @@ void rdpq_tex_blit(const surface_t *surf, float x0, float y0, const rdpq_blitpar
     __rdpq_tex_blit(surf, x0, y0, parms, ltd_texloader);
 }
 
+/** @brief A strip of a #rdpq_blitplan_t */
+typedef struct {
+    int16_t s0, t0, s1, t1;     ///< Rectangle of the surface loaded in TMEM (t0 == t1 if not visible)
+    int16_t dt0, dt1;           ///< Rows drawn from the loaded rectangle
+    bool changed;               ///< True if the rectangle changed at the last update
+    rspq_block_t *block;        ///< Recorded load commands (or NULL)
+} blitplan_strip_t;
+
+/** @brief Blocks of a #rdpq_blitplan_t waiting to be freed */
+typedef struct {
+    int count;                  ///< Number of blocks
+    rspq_block_t *blocks[];     ///< Blocks to free
+} blitplan_garbage_t;
+
+/** @brief A precomputed blit (see #rdpq_blitplan_new) */
+struct rdpq_blitplan_s {
+    surface_t surf;             ///< Surface to draw
+    rdpq_blitparms_t parms;     ///< Blit parameters (with width and height resolved)
+    float x0, y0;               ///< Position on the framebuffer
+    int grid_t0;                ///< First row of strip #1 (strip #0 ends there)
+    int strip_h;                ///< Number of rows drawn by each strip
+    int num_strips;             ///< Number of strips covering the surface
+    bool changed;               ///< True if the plan changed since the last run
+    rspq_block_t *block;        ///< Recorded blit (or NULL)
+    blitplan_garbage_t *garbage;    ///< Blocks to free after the next run
+    blitplan_strip_t strips[];  ///< Strips
+};
+
+/** @brief Plan being drawn by #ltd_blitplan */
+static rdpq_blitplan_t *cur_blitplan;
+
+/** 
+ * @brief Implement large_tex_draw protocol via a blit plan
+ * 
+ * Instead of computing the strips, go through those precomputed by the plan,
+ * running the recorded load commands when available.
+ */
+static void ltd_blitplan(rdpq_tile_t tile, const surface_t *tex, int s0, int t0, int s1, int t1, 
+    void (*draw_cb)(rdpq_tile_t tile, int s0, int t0, int s1, int t1), bool filtering)
+{
+    rdpq_blitplan_t *plan = cur_blitplan;
+    for (int i=0; i<plan->num_strips; i++) {
+        blitplan_strip_t *strip = &plan->strips[i];
+        if (strip->dt0 == strip->dt1) continue;
+
+        if (strip->block) {
+            rspq_block_run(strip->block);
+        } else {
+            tex_loader_t tload = tex_loader_init(tile, tex);
+            tex_loader_load(&tload, strip->s0, strip->t0, strip->s1, strip->t1);
+        }
+        draw_cb(tile, s0, strip->dt0, s1, strip->dt1);
+    }
+}
+
+/** @brief Queue a block of a plan to be freed once the RDP has finished with it */
+static void blitplan_discard(rdpq_blitplan_t *plan, rspq_block_t *block)
+{
+    if (!block) return;
+    if (!plan->garbage) {
+        plan->garbage = malloc(sizeof(blitplan_garbage_t) + (plan->num_strips + 1) * sizeof(rspq_block_t*));
+        plan->garbage->count = 0;
+    }
+    plan->garbage->blocks[plan->garbage->count++] = block;
+}
+
+/** @brief Free the blocks queued by #blitplan_discard (deferred callback) */
+static void blitplan_garbage_free(void *arg)
+{
+    blitplan_garbage_t *garbage = arg;
+    for (int i=0; i<garbage->count; i++)
+        rspq_block_free(garbage->blocks[i]);
+    free(garbage);
+}
+
+/** @brief Recalculate the rectangle loaded by each strip, after the plan changed */
+static void blitplan_update(rdpq_blitplan_t *plan)
+{
+    const rdpq_blitparms_t *parms = &plan->parms;
+    int ws0 = parms->s0, ws1 = parms->s0 + parms->width;
+    int wt0 = parms->t0, wt1 = parms->t0 + parms->height;
+
+    for (int i=0; i<plan->num_strips; i++) {
+        blitplan_strip_t *strip = &plan->strips[i];
+
+        // Calculate the rows of the strip that are visible in the current window
+        int b0 = MAX(plan->grid_t0 + (i-1) * plan->strip_h, 0);
+        int b1 = plan->grid_t0 + i * plan->strip_h;
+        int dt0 = MAX(b0, wt0), dt1 = MIN(b1, wt1);
+        int s0 = ws0, s1 = ws1, t0 = dt0, t1 = dt1;
+        if (dt0 >= dt1) {
+            dt0 = dt1 = s0 = s1 = t0 = t1 = 0;
+        } else if (parms->filtering) {
+            // Load one additional row on each side, for bilinear filtering
+            t0 = MAX(dt0 - 1, 0);
+            if (dt1 < wt1) t1 = dt1 + 1;
+        }
+
+        strip->changed = s0 != strip->s0 || t0 != strip->t0 || s1 != strip->s1 || t1 != strip->t1;
+        if (strip->changed) {
+            blitplan_discard(plan, strip->block);
+            strip->block = NULL;
+        }
+        strip->s0 = s0; strip->t0 = t0; strip->s1 = s1; strip->t1 = t1;
+        strip->dt0 = dt0; strip->dt1 = dt1;
+    }
+}
+
+rdpq_blitplan_t* rdpq_blitplan_new(const surface_t *surf, float x0, float y0, const rdpq_blitparms_t *parms)
+{
+    static const rdpq_blitparms_t default_parms = {0};
+    if (!parms) parms = &default_parms;
+
+    int width = parms->width ? parms->width : surf->width;
+    int height = parms->height ? parms->height : surf->height;
+
+    // Calculate the height of a strip, like ltd_texloader does. For 4bpp textures,
+    // account for the rounding of the horizontal range, which depends on scrolling.
+    tex_loader_t tload = tex_loader_init(parms->tile, surf);
+    bool is_4bpp = TEX_FORMAT_BITDEPTH(surface_get_format(surf)) == 4;
+    int tile_h = tex_loader_calc_max_height(&tload, width + (is_4bpp ? 2 : 0));
+    int strip_h = parms->filtering ? tile_h - 2 : tile_h;
+    assertf(strip_h > 0, "surface is too wide to be drawn with a blit plan");
+
+    // Align the strips to the initial window, so that the plan matches what
+    // rdpq_tex_blit would do until it is scrolled vertically.
+    int grid_t0 = parms->t0 % strip_h;
+    int num_strips = (surf->height - grid_t0 + strip_h - 1) / strip_h + 1;
+
+    rdpq_blitplan_t *plan = calloc(1, sizeof(rdpq_blitplan_t) + num_strips * sizeof(blitplan_strip_t));
+    plan->surf = *surf;
+    plan->parms = *parms;
+    plan->parms.width = width;
+    plan->parms.height = height;
+    plan->x0 = x0;
+    plan->y0 = y0;
+    plan->grid_t0 = grid_t0;
+    plan->strip_h = strip_h;
+    plan->num_strips = num_strips;
+    plan->changed = true;
+    return plan;
+}
+
+void rdpq_blitplan_free(rdpq_blitplan_t *plan)
+{
+    blitplan_discard(plan, plan->block);
+    for (int i=0; i<plan->num_strips; i++)
+        blitplan_discard(plan, plan->strips[i].block);
+    if (plan->garbage)
+        rdpq_call_deferred(blitplan_garbage_free, plan->garbage);
+    free(plan);
+}
+
+void rdpq_blitplan_scroll(rdpq_blitplan_t *plan, int s0, int t0)
+{
+    assertf(s0 >= 0 && t0 >= 0 && s0 + plan->parms.width <= plan->surf.width && t0 + plan->parms.height <= plan->surf.height,
+        "blit plan scrolled outside of the surface: (%d,%d)", s0, t0);
+    if (s0 == plan->parms.s0 && t0 == plan->parms.t0)
+        return;
+    plan->parms.s0 = s0;
+    plan->parms.t0 = t0;
+    plan->changed = true;
+}
+
+void rdpq_blitplan_run(rdpq_blitplan_t *plan)
+{
+    assertf(!rspq_in_block(), "rdpq_blitplan_run cannot be called while recording a block");
+
+    if (plan->changed) {
+        blitplan_update(plan);
+        blitplan_discard(plan, plan->block);
+        plan->block = NULL;
+    }
+
+    // Record the load commands of the visible strips that did not change. Strips
+    // that just changed are loaded directly instead, as they are likely to change
+    // again in the next frame (eg: during scrolling).
+    for (int i=0; i<plan->num_strips; i++) {
+        blitplan_strip_t *strip = &plan->strips[i];
+        if (strip->dt0 == strip->dt1 || strip->changed || strip->block)
+            continue;
+        tex_loader_t tload = tex_loader_init(plan->parms.tile, &plan->surf);
+        rspq_block_begin();
+        tex_loader_load(&tload, strip->s0, strip->t0, strip->s1, strip->t1);
+        strip->block = rspq_block_end();
+    }
+
+    // If the plan did not change since the last run, record the whole blit
+    cur_blitplan = plan;
+    if (!plan->changed && !plan->block) {
+        rspq_block_begin();
+        __rdpq_tex_blit(&plan->surf, plan->x0, plan->y0, &plan->parms, ltd_blitplan);
+        plan->block = rspq_block_end();
+    }
+
+    if (plan->block)
+        rspq_block_run(plan->block);
+    else
+        __rdpq_tex_blit(&plan->surf, plan->x0, plan->y0, &plan->parms, ltd_blitplan);
+    cur_blitplan = NULL;
+
+    // Strips are now stable: they will be recorded at the next run, unless scrolled again
+    plan->changed = false;
+    for (int i=0; i<plan->num_strips; i++)
+        plan->strips[i].changed = false;
+
+    if (plan->garbage) {
+        rdpq_call_deferred(blitplan_garbage_free, plan->garbage);
+        plan->garbage = NULL;
+    }
+}
+
 void rdpq_tex_upload_tlut(uint16_t *tlut, int color_idx, int num_colors)
 {
     // TODO: this is a conservative limit. It should be possible to workaround
@@ -693,7 +1025,13 @@ void rdpq_tex_upload_tlut(uint16_t *tlut, int color_idx, int num_colors)
     assertf((PhysicalAddr(tlut) & 7) == 0, "TLUT pointer must be 8-byte aligned");
     rdpq_set_texture_image_raw(0, PhysicalAddr(tlut), FMT_RGBA16, 256, 1);
     rdpq_set_tile(RDPQ_TILE_INTERNAL, FMT_I4, TMEM_PALETTE_ADDR + color_idx*4*2, 256, NULL);
+    if (tmem_cache.enabled) {
+        // Only the palette area is written, so we can keep cached textures
+        tmem_cache.own_write = true;
+        tmem_cache_evict(FMT_RGBA16, TMEM_PALETTE_ADDR + color_idx*4*2, num_colors*4*2);
+    }
     rdpq_load_tlut_raw(RDPQ_TILE_INTERNAL, 0, num_colors);
+    tmem_cache.own_write = false;
 }
 
 void rdpq_tex_multi_begin(void)
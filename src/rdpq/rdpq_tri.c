@@ -3,7 +3,8 @@
  * @brief RDP Command queue: triangle drawing routine
  * @ingroup rdpq
  * 
- * This file contains the implementation of a single function: #rdpq_triangle.
+ * This file contains the implementation of #rdpq_triangle, and of the batched
+ * variants (#rdpq_triangle_list, #rdpq_triangle_strip, #rdpq_triangle_fan).
  * 
  * The RDP triangle commands are complex to assemble because they are designed
  * for the hardware that will be drawing them, rather than for the programmer
@@ -462,8 +463,11 @@ void rdpq_triangle_cpu(const rdpq_trifmt_t *fmt, const float *v1, const float *v
     rspq_write_end(&w);
 }
 
-/** @brief RDP triangle primitive assembled on the RSP */
-void rdpq_triangle_rsp(const rdpq_trifmt_t *fmt, const float *v1, const float *v2, const float *v3)
+/** @brief Size in bytes of a vertex in the RSP vertex cache */
+#define TRI_DATA_LEN    ROUND_UP((2+1+1+3)*4, 16)
+
+/** @brief Autosync and compute the RDP triangle command ID for a triangle assembled by RSP */
+static uint32_t __rdpq_triangle_rsp_begin(const rdpq_trifmt_t *fmt)
 {
     uint32_t res = AUTOSYNC_PIPE;
     if (fmt->tex_offset >= 0) {
@@ -480,54 +484,148 @@ void rdpq_triangle_rsp(const rdpq_trifmt_t *fmt, const float *v1, const float *v
     if (fmt->tex_offset >= 0)   cmd_id |= 0x2;
     if (fmt->z_offset >= 0)     cmd_id |= 0x1;
 
-    const int TRI_DATA_LEN = ROUND_UP((2+1+1+3)*4, 16);
+    return 0xC000 | (cmd_id << 8) | 
+        (fmt->tex_mipmaps ? (fmt->tex_mipmaps-1) << 3 : 0) | 
+        (fmt->tex_tile & 7);
+}
+
+/** @brief Convert a vertex and send it to the specified slot of the RSP vertex cache */
+static void __rdpq_triangle_rsp_vertex(const rdpq_trifmt_t *fmt, int slot, const float *v, const float *v_shade)
+{
+    // X,Y: s13.2
+    int16_t x = floorf(v[fmt->pos_offset+0] * 4.0f);
+    int16_t y = floorf(v[fmt->pos_offset+1] * 4.0f);
+    
+    int16_t z = 0;
+    if (fmt->z_offset >= 0) {
+        z = v[fmt->z_offset+0] * 0x7FFF;
+    } 
+
+    int32_t rgba = 0;
+    if (fmt->shade_offset >= 0) {
+        uint32_t r = v_shade[fmt->shade_offset+0] * 255.0;
+        uint32_t g = v_shade[fmt->shade_offset+1] * 255.0;
+        uint32_t b = v_shade[fmt->shade_offset+2] * 255.0;
+        uint32_t a = v_shade[fmt->shade_offset+3] * 255.0;
+        rgba = (r << 24) | (g << 16) | (b << 8) | a;
+    }
+
+    int16_t s=0, t=0;
+    int32_t w=0, inv_w=0;
+    if (fmt->tex_offset >= 0) {
+        s     = v[fmt->tex_offset+0] * 32.0f;
+        t     = v[fmt->tex_offset+1] * 32.0f;
+        w     = float_to_s16_16(1.0f / v[fmt->tex_offset+2]);
+        inv_w = float_to_s16_16(       v[fmt->tex_offset+2]);
+    }
+
+    rspq_write(RDPQ_OVL_ID, RDPQ_CMD_TRIANGLE_DATA,
+        TRI_DATA_LEN * slot, 
+        (x << 16) | (y & 0xFFFF), 
+        (z << 16), 
+        rgba, 
+        (s << 16) | (t & 0xFFFF), 
+        w,
+        inv_w);
+}
+
+/** @brief RDP triangle primitive assembled on the RSP */
+void rdpq_triangle_rsp(const rdpq_trifmt_t *fmt, const float *v1, const float *v2, const float *v3)
+{
+    uint32_t tricmd = __rdpq_triangle_rsp_begin(fmt);
 
     const float *vtx[3] = {v1, v2, v3};
-    for (int i=0;i<3;i++) {
-        const float *v = vtx[i];
-
-        // X,Y: s13.2
-        int16_t x = floorf(v[fmt->pos_offset+0] * 4.0f);
-        int16_t y = floorf(v[fmt->pos_offset+1] * 4.0f);
-        
-        int16_t z = 0;
-        if (fmt->z_offset >= 0) {
-            z = v[fmt->z_offset+0] * 0x7FFF;
-        } 
-
-        int32_t rgba = 0;
-        if (fmt->shade_offset >= 0) {
-            const float *v_shade = fmt->shade_flat ? v1 : v;
-            uint32_t r = v_shade[fmt->shade_offset+0] * 255.0;
-            uint32_t g = v_shade[fmt->shade_offset+1] * 255.0;
-            uint32_t b = v_shade[fmt->shade_offset+2] * 255.0;
-            uint32_t a = v_shade[fmt->shade_offset+3] * 255.0;
-            rgba = (r << 24) | (g << 16) | (b << 8) | a;
-        }
+    for (int i=0;i<3;i++)
+        __rdpq_triangle_rsp_vertex(fmt, i, vtx[i], fmt->shade_flat ? v1 : vtx[i]);
+
+    // The RSP generates the RDP commands: in a block, they must go to the
+    // dynamic buffer, after the static commands recorded so far.
+    rdpq_write(-1, RDPQ_OVL_ID, RDPQ_CMD_TRIANGLE, tricmd);
+}
+
+/** @brief Topology of a batch of indexed triangles */
+typedef enum {
+    TRI_LIST,               ///< Each 3 indices form a triangle
+    TRI_STRIP,              ///< Each index forms a triangle with the previous two
+    TRI_FAN,                ///< Each index forms a triangle with the previous one and the first one
+} tri_topology_t;
+
+/** @brief Draw a batch of indexed triangles, using the RSP vertex cache */
+static void __rdpq_triangle_batch(const rdpq_trifmt_t *fmt, const float *vertices, int stride,
+    const uint16_t *indices, int num_indices, tri_topology_t topology)
+{
+    int num_tris = topology == TRI_LIST ? num_indices / 3 : num_indices - 2;
+    if (num_tris <= 0) return;
+
+#if !RDPQ_TRIANGLE_REFERENCE
+    uint32_t tricmd = __rdpq_triangle_rsp_begin(fmt);
 
-        int16_t s=0, t=0;
-        int32_t w=0, inv_w=0;
-        if (fmt->tex_offset >= 0) {
-            s     = v[fmt->tex_offset+0] * 32.0f;
-            t     = v[fmt->tex_offset+1] * 32.0f;
-            w     = float_to_s16_16(1.0f / v[fmt->tex_offset+2]);
-            inv_w = float_to_s16_16(       v[fmt->tex_offset+2]);
+    // Mirror of the RSP vertex cache: index of the vertex stored in each slot.
+    // Slots are replaced in FIFO order.
+    int cache[RDPQ_TRI_VTX_CACHE_SIZE];
+    for (int i=0; i<RDPQ_TRI_VTX_CACHE_SIZE; i++) cache[i] = -1;
+    int victim = 0;
+#endif
+
+    for (int i=0; i<num_tris; i++) {
+        int idx[3];
+        switch (topology) {
+        case TRI_LIST:  idx[0] = 3*i; idx[1] = 3*i+1; idx[2] = 3*i+2; break;
+        case TRI_STRIP: idx[0] = i;   idx[1] = i+1;   idx[2] = i+2;   break;
+        case TRI_FAN:   idx[0] = 0;   idx[1] = i+1;   idx[2] = i+2;   break;
+        }
+        if (indices) {
+            for (int j=0; j<3; j++) idx[j] = indices[idx[j]];
+        }
+        if (idx[0] == idx[1] || idx[1] == idx[2] || idx[0] == idx[2])
+            continue;
+
+    #if RDPQ_TRIANGLE_REFERENCE
+        rdpq_triangle_cpu(fmt, vertices + idx[0]*stride, vertices + idx[1]*stride, vertices + idx[2]*stride);
+    #else
+        int slot[3];
+        for (int j=0; j<3; j++) {
+            int s = -1;
+            if (!fmt->shade_flat) {
+                for (int k=0; k<RDPQ_TRI_VTX_CACHE_SIZE; k++)
+                    if (cache[k] == idx[j]) { s = k; break; }
+            }
+            if (s < 0) {
+                // Evict the oldest vertex, skipping those used by this triangle
+                do {
+                    s = victim;
+                    victim = (victim + 1) % RDPQ_TRI_VTX_CACHE_SIZE;
+                } while ((j > 0 && s == slot[0]) || (j > 1 && s == slot[1]));
+
+                // With flat shading, the vertex color depends on the triangle,
+                // so the vertex cannot be reused.
+                cache[s] = fmt->shade_flat ? -1 : idx[j];
+                const float *v = vertices + idx[j]*stride;
+                __rdpq_triangle_rsp_vertex(fmt, s, v, fmt->shade_flat ? vertices + idx[0]*stride : v);
+            }
+            slot[j] = s;
         }
 
-        rspq_write(RDPQ_OVL_ID, RDPQ_CMD_TRIANGLE_DATA,
-            TRI_DATA_LEN * i, 
-            (x << 16) | (y & 0xFFFF), 
-            (z << 16), 
-            rgba, 
-            (s << 16) | (t & 0xFFFF), 
-            w,
-            inv_w);
+        rdpq_write(-1, RDPQ_OVL_ID, RDPQ_CMD_TRIANGLE_INDEXED, 
+            (slot[0] << 16) | tricmd, (slot[1] << 16) | slot[2]);
+    #endif
     }
+}
 
-    rspq_write(RDPQ_OVL_ID, RDPQ_CMD_TRIANGLE, 
-        0xC000 | (cmd_id << 8) | 
-        (fmt->tex_mipmaps ? (fmt->tex_mipmaps-1) << 3 : 0) | 
-        (fmt->tex_tile & 7));
+void rdpq_triangle_list(const rdpq_trifmt_t *fmt, const float *vertices, int stride, const uint16_t *indices, int num_indices)
+{
+    assertf(num_indices % 3 == 0, "number of indices must be a multiple of 3 (%d)", num_indices);
+    __rdpq_triangle_batch(fmt, vertices, stride, indices, num_indices, TRI_LIST);
+}
+
+void rdpq_triangle_strip(const rdpq_trifmt_t *fmt, const float *vertices, int stride, const uint16_t *indices, int num_indices)
+{
+    __rdpq_triangle_batch(fmt, vertices, stride, indices, num_indices, TRI_STRIP);
+}
+
+void rdpq_triangle_fan(const rdpq_trifmt_t *fmt, const float *vertices, int stride, const uint16_t *indices, int num_indices)
+{
+    __rdpq_triangle_batch(fmt, vertices, stride, indices, num_indices, TRI_FAN);
 }
 
 void rdpq_triangle(const rdpq_trifmt_t *fmt, const float *v1, const float *v2, const float *v3)
@@ -143,6 +143,36 @@
  * is then used as call slot in both all future calls to the block, and by
  * the RSPQ_CMD_RET command placed at the end of the block itself.
  * 
+ * Blocks can contain patchable slots (#rspq_block_slot_begin). When a slot
+ * begins, a snapshot of the whole write state is saved into the block. To
+ * patch the slot, the snapshot is restored and the caller writes commands
+ * again: since the write state is the same, the same sequence of commands,
+ * RDP buffer switches and chunk switches happens, overwriting the slot in
+ * place. Chunk switches are replayed by following the existing JUMP commands
+ * (and the existing chain of RDP buffers), instead of allocating new memory.
+ * Coalescing of #RSPQ_CMD_RDP_APPEND_BUFFER across the slot boundaries is
+ * disabled, so that the slot contents do not depend on surrounding commands.
+ * 
+ * ## Streams
+ * 
+ * Streams allow multiple kernel threads to generate commands at the same time.
+ * A stream is simply a block that is recorded by a specific thread. The whole
+ * write state (#rspq_cur_pointer, #rspq_cur_sentinel, #rspq_ctx, the block
+ * being built, and the rdpq block and tracking state) is saved into the stream
+ * structure (#rspq_stream_t) and restored by the kernel scheduler on every
+ * context switch, via the #__kthread_rspq_switch hook. Threads that are not
+ * recording a stream share a single write state (#rspq_direct), which is the
+ * standard RSP queue.
+ * 
+ * Since the inline write functions do not take any lock, it is not possible
+ * for a recording thread to append its stream to the queue, as the thread
+ * driving the queue might have been preempted in the middle of writing a
+ * command. Instead, completed streams are added to a FIFO of pending streams,
+ * that is merged into the queue (via #RSPQ_CMD_CALL, as in #rspq_block_run)
+ * by the driving thread itself in #rspq_flush and #rspq_wait, which are always
+ * called between commands. Each stream is freed by a deferred call once the
+ * RSP (and RDP, if the stream contains RDP commands) has processed it.
+ * 
  * ## Highpri queue
  * 
  * The high priority queue is implemented as an alternative couple of buffers,
@@ -195,6 +225,8 @@
 #include "rdpq/rdpq_internal.h"
 #include "rdpq/rdpq_debug_internal.h"
 #include "interrupt.h"
+#include "kernel.h"
+#include "kernel/kernel_internal.h"
 #include "utils.h"
 #include "n64sys.h"
 #include "debug.h"
@@ -343,18 +375,71 @@ static int rspq_syncpoints_genid;
 /** @brief ID of the last syncpoint reached by RSP (plus padding). */
 volatile int __rspq_syncpoints_done[4]  __attribute__((aligned(16)));
 
+/** @brief CPU ticks spent waiting for RSP/RDP (see #rspq_profile_dump) */
+uint32_t __rspq_profile_cpu_wait;
+
 /** @brief True if the RSP queue engine is running in the RSP. */
 static bool rspq_is_running;
 
 /** @brief Dummy state used for overlay 0 */
 static uint64_t dummy_overlay_state[2] __attribute__((aligned(16)));
 
+/** 
+ * @brief Write state of a thread recording a stream.
+ * 
+ * See the "Streams" section in the documentation at the top of this file.
+ */
+typedef struct rspq_stream_s {
+    volatile uint32_t *cur;             ///< Saved #rspq_cur_pointer
+    volatile uint32_t *sentinel;        ///< Saved #rspq_cur_sentinel
+    rspq_ctx_t *ctx;                    ///< Saved #rspq_ctx
+    rspq_block_t *block;                ///< Saved #rspq_block
+    int block_size;                     ///< Saved #rspq_block_size
+    rdpq_block_state_t rdp_block_state; ///< Saved rdpq block state
+    rdpq_tracking_t rdp_tracking;       ///< Saved rdpq tracking state
+    struct rspq_block_slot_s *patch;    ///< Saved #rspq_patch
+    int slot_open;                      ///< Saved #rspq_slot_open
+    struct rspq_stream_s *next;         ///< Next stream in the pending list
+} rspq_stream_t;
+
+/**
+ * @brief A patchable slot within a block.
+ * 
+ * The slot stores a snapshot of the whole write state at the beginning of
+ * the slot, so that the slot contents can be recorded again in place, and
+ * the write pointers at the end of the slot, to check that the new contents
+ * have exactly the same layout.
+ */
+typedef struct rspq_block_slot_s {
+    rspq_stream_t start;                ///< Write state at the start of the slot
+    volatile uint32_t *end;             ///< RSP write pointer at the end of the slot
+    volatile uint32_t *rdp_end;         ///< RDP write pointer at the end of the slot
+    bool defined;                       ///< True if the slot was recorded
+    rspq_stream_t patch_saved;          ///< Write state to restore at the end of a patch
+    uint32_t patch_nesting_level;       ///< Nesting level of the block before the patch
+} rspq_block_slot_t;
+
+/** @brief Slot being patched (see #rspq_block_patch_begin), or NULL */
+static rspq_block_slot_t *rspq_patch;
+/** @brief Slot being recorded (see #rspq_block_slot_begin), or -1 */
+static int rspq_slot_open = -1;
+
+/** @brief Stream recorded by the current thread (or NULL if writing to the queue) */
+static rspq_stream_t *rspq_cur_stream;
+/** @brief Saved write state of threads writing directly to the queue */
+static rspq_stream_t rspq_direct = { .slot_open = -1 };
+/** @brief Streams pending submission: head of list */
+static rspq_stream_t *rspq_pending_head;
+/** @brief Streams pending submission: tail of list */
+static rspq_stream_t *rspq_pending_tail;
+
 /** @brief Deferred calls: head of list */
 rspq_deferred_call_t *__rspq_defcalls_head;
 /** @brief Deferred calls: tail of list */
 rspq_deferred_call_t *__rspq_defcalls_tail;
 
 static void rspq_flush_internal(void);
+static void rspq_stream_merge(void);
 
 /** @brief RSP interrupt handler, used for syncpoints. */
 static void rspq_sp_interrupt(void) 
@@ -936,6 +1021,15 @@ void rspq_next_buffer(void) {
         // and at the same time start small.
         if (rspq_block_size < RSPQ_BLOCK_MAX_SIZE) rspq_block_size *= 2;
 
+        // If we are patching a slot, the chunk was already allocated when
+        // the block was recorded: just follow the JUMP that links to it.
+        if (rspq_patch) {
+            uint32_t cmd = *rspq_cur_pointer;
+            assertf(cmd>>24 == RSPQ_CMD_JUMP, "patched slot contents do not match the recorded ones");
+            rspq_switch_buffer(UncachedAddr(0x80000000 | (cmd & 0xFFFFFF)), rspq_block_size, false);
+            return;
+        }
+
         // Allocate a new chunk of the block and switch to it.
         uint32_t *rspq2 = malloc_uncached(rspq_block_size*sizeof(uint32_t));
         volatile uint32_t *prev = rspq_switch_buffer(rspq2, rspq_block_size, true);
@@ -1018,6 +1112,7 @@ void rspq_flush(void)
     // If we are recording a block, flushes can be ignored.
     if (rspq_block) return;
 
+    rspq_stream_merge();
     rspq_flush_internal();
     if (rdpq_trace) rdpq_trace();
 }
@@ -1110,6 +1205,8 @@ void rspq_block_begin(void)
     rspq_block = malloc_uncached(sizeof(rspq_block_t) + rspq_block_size*sizeof(uint32_t));
     rspq_block->nesting_level = 0;
     rspq_block->rdp_block = NULL;
+    rspq_block->slots = NULL;
+    rspq_block->num_slots = 0;
 
     // Switch to the block buffer. From now on, all rspq_writes will
     // go into the block.
@@ -1122,6 +1219,7 @@ void rspq_block_begin(void)
 rspq_block_t* rspq_block_end(void)
 {
     assertf(rspq_block, "a block was not being created");
+    assertf(rspq_slot_open < 0, "slot %d was not closed", rspq_slot_open);
 
     // Terminate the block with a RET command, encoding
     // the nesting level which is used as stack slot by RSP.
@@ -1143,6 +1241,7 @@ void rspq_block_free(rspq_block_t *block)
 {
     // Free RDP blocks first
     __rdpq_block_free(block->rdp_block);
+    free(block->slots);
 
     // Start from the commands in the first chunk of the block
     int size = RSPQ_BLOCK_MIN_SIZE;
@@ -1212,6 +1311,210 @@ void rspq_block_run_rsp(int nesting_level)
     }    
 }
 
+/** @brief Save the current write state into a stream structure */
+static void rspq_stream_save(rspq_stream_t *s)
+{
+    s->cur = rspq_cur_pointer;
+    s->sentinel = rspq_cur_sentinel;
+    s->ctx = rspq_ctx;
+    s->block = rspq_block;
+    s->block_size = rspq_block_size;
+    s->rdp_block_state = rdpq_block_state;
+    s->rdp_tracking = rdpq_tracking;
+    s->patch = rspq_patch;
+    s->slot_open = rspq_slot_open;
+}
+
+/** @brief Restore the write state from a stream structure */
+static void rspq_stream_load(rspq_stream_t *s)
+{
+    rspq_cur_pointer = s->cur;
+    rspq_cur_sentinel = s->sentinel;
+    rspq_ctx = s->ctx;
+    rspq_block = s->block;
+    rspq_block_size = s->block_size;
+    rdpq_block_state = s->rdp_block_state;
+    rdpq_tracking = s->rdp_tracking;
+    rspq_patch = s->patch;
+    rspq_slot_open = s->slot_open;
+}
+
+/** 
+ * @brief Switch the active stream (called by the scheduler on context switch) 
+ * 
+ * @param stream    Stream of the thread being scheduled, or NULL if the
+ *                  thread writes directly to the queue.
+ */
+static void rspq_stream_switch(void *stream)
+{
+    if (stream == rspq_cur_stream)
+        return;
+    rspq_stream_save(rspq_cur_stream ? rspq_cur_stream : &rspq_direct);
+    rspq_cur_stream = stream;
+    rspq_stream_load(rspq_cur_stream ? rspq_cur_stream : &rspq_direct);
+}
+
+/** @brief Deferred callback that frees a submitted stream */
+static void rspq_stream_free_cb(void *arg)
+{
+    rspq_block_free(arg);
+}
+
+/**
+ * @brief Merge the pending streams into the queue.
+ * 
+ * This must be called only between full commands, by a thread writing
+ * directly to the lowpri queue. It is a no-op otherwise.
+ */
+static void rspq_stream_merge(void)
+{
+    if (!rspq_pending_head || rspq_cur_stream || rspq_block || rspq_ctx != &lowpri)
+        return;
+
+    disable_interrupts();
+    rspq_stream_t *s = rspq_pending_head;
+    rspq_pending_head = rspq_pending_tail = NULL;
+    enable_interrupts();
+
+    while (s) {
+        rspq_stream_t *next = s->next;
+        rspq_block_t *block = s->block;
+        free(s);
+
+        rspq_block_run(block);
+        __rspq_call_deferred(rspq_stream_free_cb, block, block->rdp_block != NULL);
+        s = next;
+    }
+}
+
+void rspq_stream_begin(void)
+{
+    assertf(__kernel, "rspq streams require the kernel (call kernel_init first)");
+    kthread_t *th = kthread_current();
+    assertf(!th->tls.rspq_stream, "a stream is already being recorded by this thread");
+    assertf(!rspq_block, "cannot record a stream while creating a block");
+    assertf(rspq_ctx != &highpri, "cannot record a stream in highpri mode");
+
+    // Install the kernel hook that switches streams on context switch.
+    __kthread_rspq_switch = rspq_stream_switch;
+
+    // Activate an empty write state for this thread. Interrupts are disabled
+    // so that the scheduler does not see the state half-switched.
+    rspq_stream_t *s = calloc(1, sizeof(rspq_stream_t));
+    s->slot_open = -1;
+    disable_interrupts();
+    th->tls.rspq_stream = s;
+    rspq_stream_switch(s);
+    enable_interrupts();
+
+    // Start recording a block in the private write state.
+    rspq_block_begin();
+}
+
+void rspq_stream_end(void)
+{
+    kthread_t *th = kthread_current();
+    rspq_stream_t *s = th->tls.rspq_stream;
+    assertf(s, "a stream was not being recorded by this thread");
+    assertf(rspq_block, "block not terminated within the stream");
+
+    // Terminate the block. Notice that this also switches rspq to the lowpri
+    // context, but that is going to be discarded right away.
+    rspq_block_t *block = rspq_block_end();
+
+    disable_interrupts();
+    th->tls.rspq_stream = NULL;
+    rspq_stream_switch(NULL);
+
+    // Append the stream to the pending list, reusing the stream structure.
+    s->block = block;
+    s->next = NULL;
+    if (rspq_pending_tail)
+        rspq_pending_tail->next = s;
+    else
+        rspq_pending_head = s;
+    rspq_pending_tail = s;
+    enable_interrupts();
+}
+
+void rspq_block_slot_begin(int slot)
+{
+    assertf(rspq_block, "slots can only be defined while creating a block");
+    assertf(rspq_slot_open < 0, "slot %d was not closed", rspq_slot_open);
+    assertf(slot >= 0, "invalid slot index %d", slot);
+
+    if (slot >= rspq_block->num_slots) {
+        rspq_block->slots = realloc(rspq_block->slots, (slot+1) * sizeof(rspq_block_slot_t));
+        memset(rspq_block->slots + rspq_block->num_slots, 0,
+            (slot+1 - rspq_block->num_slots) * sizeof(rspq_block_slot_t));
+        rspq_block->num_slots = slot+1;
+    }
+    rspq_block_slot_t *s = &rspq_block->slots[slot];
+    assertf(!s->defined, "slot %d already defined in this block", slot);
+
+    // Patching relies on the layout of the RDP static buffers not changing
+    // after recording, so the rdpq block optimizer cannot be used.
+    __rdpq_block_optimize_free();
+
+    // Make sure the RDP static buffer has been allocated. When the slot is
+    // patched, buffers allocated within the slot are found by following the
+    // chain of RDP buffers, which must thus be non-empty.
+    if (__rdpq_inited && !rdpq_block_state.last_node)
+        __rdpq_block_next_buffer();
+
+    // Do not coalesce the first RDP command of the slot with a previous
+    // RSPQ_CMD_RDP_APPEND_BUFFER, so that the slot is self-contained.
+    rdpq_block_state.last_rdp_append_buffer = NULL;
+
+    rspq_stream_save(&s->start);
+    rspq_slot_open = slot;
+}
+
+void rspq_block_slot_end(void)
+{
+    assertf(rspq_slot_open >= 0, "a slot was not being defined");
+    rspq_block_slot_t *s = &rspq_block->slots[rspq_slot_open];
+    s->end = rspq_cur_pointer;
+    s->rdp_end = rdpq_block_state.wptr;
+    s->defined = true;
+    rspq_slot_open = -1;
+
+    // Same as above: commands after the slot must not extend the last
+    // RSPQ_CMD_RDP_APPEND_BUFFER of the slot.
+    rdpq_block_state.last_rdp_append_buffer = NULL;
+}
+
+void rspq_block_patch_begin(rspq_block_t *block, int slot)
+{
+    assertf(!rspq_patch, "a slot is already being patched");
+    assertf(!rspq_block, "cannot patch a block while creating a block");
+    assertf(rspq_ctx != &highpri, "cannot patch a block in highpri mode");
+    assertf(slot >= 0 && slot < block->num_slots && block->slots[slot].defined,
+        "slot %d is not defined in this block", slot);
+
+    // Save the current write state, and go back to the state at the beginning
+    // of the slot. From now on, all writes will overwrite the slot contents.
+    // The saved state is kept in the slot itself (which cannot be patched
+    // twice at the same time), so that each thread can patch its own slots.
+    rspq_block_slot_t *s = &block->slots[slot];
+    rspq_stream_save(&s->patch_saved);
+    rspq_stream_load(&s->start);
+    s->patch_nesting_level = block->nesting_level;
+    rspq_patch = s;
+}
+
+void rspq_block_patch_end(void)
+{
+    rspq_block_slot_t *s = rspq_patch;
+    assertf(s, "a slot was not being patched");
+    assertf(rspq_cur_pointer == s->end && rdpq_block_state.wptr == s->rdp_end,
+        "patched slot contents do not match the recorded ones");
+    assertf(rspq_block->nesting_level == s->patch_nesting_level,
+        "cannot run a block with higher nesting level in a patched slot");
+
+    rspq_stream_load(&s->patch_saved);
+}
+
 void rspq_noop()
 {
     rspq_int_write(RSPQ_CMD_NOOP);
@@ -1256,6 +1559,10 @@ void rspq_syncpoint_wait(rspq_syncpoint_t sync_id)
     // Make sure the RSP is running, otherwise we might be blocking forever.
     rspq_flush_internal();
 
+    #if RSPQ_PROFILE
+    uint32_t t0 = TICKS_READ();
+    #endif
+
     // Spinwait until the the syncpoint is reached.
     // TODO: with the kernel, it will be possible to wait for the RSP interrupt
     // to happen, without spinwaiting.
@@ -1264,6 +1571,10 @@ void rspq_syncpoint_wait(rspq_syncpoint_t sync_id)
         if (rspq_syncpoint_check(sync_id))
             break;
     }
+
+    #if RSPQ_PROFILE
+    __rspq_profile_cpu_wait += TICKS_SINCE(t0);
+    #endif
 }
 
 /**
@@ -1353,6 +1664,9 @@ rspq_syncpoint_t rspq_syncpoint_new_cb(void (*func)(void *), void *arg)
 
 void rspq_wait(void)
 {
+    // Merge pending streams, so that they are waited for as well.
+    rspq_stream_merge();
+
     // Check if the RDPQ module was initialized.
     if (__rdpq_inited) {
         // If so, a full sync requires also waiting for RDP to finish.
@@ -160,6 +160,8 @@ typedef struct rdpq_block_s rdpq_block_t;
 typedef struct rspq_block_s {
     uint32_t nesting_level;     ///< Nesting level of the block
     rdpq_block_t *rdp_block;    ///< Option RDP static buffer (with RDP commands)
+    struct rspq_block_slot_s *slots; ///< Patchable slots (see #rspq_block_slot_begin)
+    int num_slots;              ///< Number of entries in the slots array
     uint32_t cmds[];            ///< Block contents (commands)
 } rspq_block_t;
 
@@ -223,6 +225,11 @@ typedef struct rsp_queue_s {
     uint32_t rspq_profile_start_time;
     rspq_profile_slot_dmem_t rspq_profile_cslots[RSPQ_PROFILE_CSLOT_COUNT];
     rspq_profile_slot_dmem_t rspq_profile_builtin_slot;
+    uint32_t rspq_profile_cur_cmd;                          ///< First word of the command being profiled
+    uint32_t rspq_profile_trace_rdram;                      ///< RDRAM write pointer of the trace buffer (0: tracing disabled)
+    uint32_t rspq_profile_trace_rdram_end;                  ///< RDRAM end pointer of the trace buffer
+    uint32_t rspq_profile_trace_ptr;                        ///< Number of bytes of trace events in DMEM
+    uint64_t rspq_profile_trace[RSPQ_PROFILE_TRACE_SIZE/8]; ///< Trace events not yet flushed to RDRAM
 #endif
  } __attribute__((aligned(16), packed)) rsp_queue_t;
 
@@ -235,6 +242,9 @@ extern volatile int __rspq_syncpoints_done[4];
 /** @brief Registered overlays */
 extern rsp_ucode_t *rspq_overlay_ucodes[RSPQ_MAX_OVERLAYS];
 
+/** @brief CPU ticks spent waiting for RSP/RDP (only updated if RSPQ_PROFILE is enabled) */
+extern uint32_t __rspq_profile_cpu_wait;
+
 /** @brief Flag to mark deferred calls that needs to wait for RDP SYNC_FULL */
 #define RSPQ_DCF_WAITRDP                 (1<<0)
 
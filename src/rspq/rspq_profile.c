@@ -5,6 +5,10 @@
 #include "rsp.h"
 #include "rspq.h"
 #include "rspq_internal.h"
+#include "rdpq/rdpq_internal.h"
+#include "rdp.h"
+#include "interrupt.h"
+#include "utils.h"
 
 #if RSPQ_PROFILE
 
@@ -12,9 +16,39 @@ DEFINE_RSP_UCODE(rsp_profile);
 
 #define CMD_PROFILE_FRAME 0x0
 
+/** @brief Number of trace buffers (one being written by RSP, the others waiting to be processed) */
+#define TRACE_BUFFERS       3
+/** @brief Maximum number of trace events recorded per frame */
+#define TRACE_EVENTS        4096
+
 static rspq_profile_data_t profile_data;
 static uint32_t ovl_id;
 
+/** @brief RDP counters sampled by CPU */
+static volatile uint32_t * const rdp_counter_regs[4] = { DP_CLOCK, DP_BUSY, DP_PIPE_BUSY, DP_TMEM_BUSY };
+/** @brief Accumulated values of the RDP counters, and last values read from the registers */
+static struct {
+    uint32_t last[4];
+    uint64_t total[4];
+} rdp_counters;
+/** @brief CPU time of the last frame boundary */
+static uint32_t cpu_frame_last;
+
+/** @brief Trace buffers written by RSP (uncached) */
+static uint64_t *trace_bufs[TRACE_BUFFERS];
+/** @brief Trace buffer the RSP will write to during the current frame */
+static int trace_cur;
+
+/** @brief Timeline recorded by #rspq_profile_trace_start */
+static struct {
+    int max_frames;             ///< Number of frames to record
+    int num_frames;             ///< Number of frames recorded so far
+    struct {
+        int num_events;         ///< Number of events in this frame
+        uint64_t *events;       ///< Events of this frame
+    } *frames;
+} trace;
+
 typedef struct {
     uint32_t cntr1;
     uint32_t padding1;
@@ -27,7 +61,7 @@ typedef struct {
     uint32_t frame_last;
     uint32_t busy_last;
 
-    uint32_t padding2;
+    uint32_t trace_end;
     uint32_t cntr2;
 
     uint32_t padding[2];
@@ -40,10 +74,28 @@ static profile_buffer_t last_profile_buffer __attribute__((aligned(16)));
 
 #define PROFILE_DATA_DMEM_ADDRESS (RSPQ_DATA_ADDRESS + offsetof(rsp_queue_t, rspq_profile_data))
 
+/** @brief Sample the RDP counters, accumulating their increment since the last sample */
+static void rspq_profile_sample_rdp(void)
+{
+    for (int i = 0; i < 4; i++) {
+        // Counters are 24-bit and wrap around
+        uint32_t value = *rdp_counter_regs[i] & 0xFFFFFF;
+        rdp_counters.total[i] += (value - rdp_counters.last[i]) & 0xFFFFFF;
+        rdp_counters.last[i] = value;
+    }
+}
+
 void rspq_profile_reset(void)
 {
     memset(&profile_data, 0, sizeof(profile_data));
 
+    disable_interrupts();
+    rspq_profile_sample_rdp();
+    memset(rdp_counters.total, 0, sizeof(rdp_counters.total));
+    enable_interrupts();
+    cpu_frame_last = TICKS_READ();
+    __rspq_profile_cpu_wait = 0;
+
     profile_data.slots[0].name = "Builtin cmds";
     for (int i = 1; i < RSPQ_MAX_OVERLAYS; i++)
     {
@@ -63,15 +115,72 @@ void rspq_profile_reset(void)
 void rspq_profile_start()
 {
     ovl_id = rspq_overlay_register(&rsp_profile);
+    __rdpq_syncfull_hook = rspq_profile_sample_rdp;
+    for (int i = 0; i < TRACE_BUFFERS; i++)
+        trace_bufs[i] = malloc_uncached(TRACE_EVENTS * sizeof(uint64_t));
+    trace_cur = 0;
     rspq_profile_reset();
 }
 
+static void rspq_profile_trace_free(void)
+{
+    for (int i = 0; i < trace.num_frames; i++)
+        free(trace.frames[i].events);
+    free(trace.frames);
+    memset(&trace, 0, sizeof(trace));
+}
+
 void rspq_profile_stop()
 {
+    // Disable tracing on the RSP before releasing the trace buffers
+    rspq_write(ovl_id, CMD_PROFILE_FRAME, PhysicalAddr(&cur_profile_buffer), 0, 0);
+    rspq_wait();
     rspq_overlay_unregister(ovl_id);
+    __rdpq_syncfull_hook = NULL;
+
+    for (int i = 0; i < TRACE_BUFFERS; i++) {
+        free_uncached(trace_bufs[i]);
+        trace_bufs[i] = NULL;
+    }
+    rspq_profile_trace_free();
 }
 
-static void rspq_profile_accumulate(void*)
+static void rspq_profile_accumulate_trace(int idx, uint32_t trace_end)
+{
+    // Check that the end pointer refers to the expected buffer. If the CPU
+    // is lagging behind, the RSP might have already switched to another
+    // buffer, in which case the events of this frame are lost.
+    uint64_t *events = trace_bufs[idx];
+    uint32_t start = PhysicalAddr(events);
+    if (trace_end < start || trace_end > start + TRACE_EVENTS * sizeof(uint64_t))
+        return;
+
+    int num_events = (trace_end - start) / sizeof(uint64_t);
+    // When the buffer is almost full, some events were probably dropped by RSP
+    if (num_events > TRACE_EVENTS - RSPQ_PROFILE_TRACE_SIZE / sizeof(uint64_t))
+        profile_data.overflow_frames++;
+
+    for (int i = 0; i < num_events; i++) {
+        uint32_t w0 = events[i] >> 32;
+        uint32_t w1 = events[i];
+        int kind = w1 >> 24;
+        if (kind == RSPQ_PROFILE_TRACE_KIND_BUILTIN || kind == RSPQ_PROFILE_TRACE_KIND_OVERLAY) {
+            rspq_profile_slot_t *cmd = &profile_data.commands[w0 >> 24];
+            cmd->total_ticks += w1 & 0xFFFFFF;
+            cmd->sample_count++;
+        }
+    }
+
+    if (trace.num_frames < trace.max_frames) {
+        uint64_t *copy = malloc(num_events * sizeof(uint64_t));
+        memcpy(copy, events, num_events * sizeof(uint64_t));
+        trace.frames[trace.num_frames].num_events = num_events;
+        trace.frames[trace.num_frames].events = copy;
+        trace.num_frames++;
+    }
+}
+
+static void rspq_profile_accumulate(void *arg)
 {
     profile_buffer_t buf;
     do {
@@ -95,13 +204,88 @@ static void rspq_profile_accumulate(void*)
     profile_data.rdp_busy_ticks += buf.busy_time - last_profile_buffer.busy_time;
     profile_data.frame_count++;
 
+    if (buf.trace_end)
+        rspq_profile_accumulate_trace((intptr_t)arg, buf.trace_end);
+
     last_profile_buffer = buf;
 }
 
 void rspq_profile_next_frame()
 {
-    rspq_write(ovl_id, CMD_PROFILE_FRAME, PhysicalAddr(&cur_profile_buffer));
-    rspq_call_deferred(rspq_profile_accumulate, NULL);
+    // Sample the CPU-side counters at the frame boundary
+    disable_interrupts();
+    rspq_profile_sample_rdp();
+    profile_data.rdp_clock_ticks += rdp_counters.total[0];
+    profile_data.rdp_pipe_busy_ticks += rdp_counters.total[2];
+    profile_data.rdp_tmem_busy_ticks += rdp_counters.total[3];
+    memset(rdp_counters.total, 0, sizeof(rdp_counters.total));
+    enable_interrupts();
+
+    uint32_t now = TICKS_READ();
+    profile_data.cpu_total_ticks += TICKS_DISTANCE(cpu_frame_last, now);
+    profile_data.cpu_wait_ticks += __rspq_profile_cpu_wait;
+    __rspq_profile_cpu_wait = 0;
+    cpu_frame_last = now;
+
+    // Hand the next trace buffer to RSP. The events of the frame that
+    // just ended will be processed by rspq_profile_accumulate.
+    int next = (trace_cur + 1) % TRACE_BUFFERS;
+    uint32_t trace_start = PhysicalAddr(trace_bufs[next]);
+    rspq_write(ovl_id, CMD_PROFILE_FRAME, PhysicalAddr(&cur_profile_buffer),
+        trace_start, trace_start + TRACE_EVENTS * sizeof(uint64_t));
+    rspq_call_deferred(rspq_profile_accumulate, (void*)(intptr_t)trace_cur);
+    trace_cur = next;
+}
+
+void rspq_profile_trace_start(int max_frames)
+{
+    rspq_profile_trace_free();
+    trace.max_frames = max_frames;
+    trace.frames = calloc(max_frames, sizeof(trace.frames[0]));
+}
+
+/** @brief Get the name of an overlay and the index of a command within it */
+static const char* rspq_profile_cmd_name(int cmd_id, int *cmd_index)
+{
+    int id = cmd_id >> 4;
+    *cmd_index = cmd_id & 0xF;
+    if (id == 0)
+        return "rspq";
+    if (!rspq_overlay_ucodes[id])
+        return "???";
+    // Overlays with more than 16 commands use multiple consecutive IDs
+    while (id > 1 && rspq_overlay_ucodes[id-1] == rspq_overlay_ucodes[id]) {
+        id--;
+        *cmd_index += 16;
+    }
+    return rspq_overlay_ucodes[id]->name;
+}
+
+void rspq_profile_trace_dump(void)
+{
+    // Make sure all the recorded frames were processed
+    rspq_wait();
+
+    debugf("RSPQTRACE H %d\n", RCP_FREQUENCY);
+    for (int id = 0; id < RSPQ_MAX_OVERLAYS; id++) {
+        int idx;
+        const char *name = rspq_profile_cmd_name(id << 4, &idx);
+        debugf("RSPQTRACE O %x %x %s\n", id, idx, name);
+    }
+
+    for (int f = 0; f < trace.num_frames; f++) {
+        debugf("RSPQTRACE F %d %d\n", f, trace.frames[f].num_events);
+        uint64_t *events = trace.frames[f].events;
+        for (int i = 0; i < trace.frames[f].num_events; i += 4) {
+            char line[128]; char *p = line;
+            for (int j = i; j < MIN(i+4, trace.frames[f].num_events); j++)
+                p += sprintf(p, " %016llx", events[j]);
+            debugf("RSPQTRACE E%s\n", line);
+        }
+    }
+    debugf("RSPQTRACE END\n");
+
+    rspq_profile_trace_free();
 }
 
 #define RCP_TICKS_TO_USECS(ticks) (((ticks) * 1000000ULL) / RCP_FREQUENCY)
@@ -123,6 +307,45 @@ static void rspq_profile_dump_overlay(rspq_profile_slot_t *slot, uint64_t frame_
         buf);
 }
 
+/** @brief Print the utilization of CPU, RSP and RDP, and the most likely bottleneck */
+static void rspq_profile_dump_bottleneck(void)
+{
+    // CPU: time not spent waiting for RSP/RDP
+    float cpu_util = 100.0f - PERCENT(profile_data.cpu_wait_ticks, profile_data.cpu_total_ticks);
+
+    // RSP: time not spent waiting for CPU or RDP
+    uint64_t rsp_idle = 0;
+    for (int i = RSPQ_PROFILE_CSLOT_WAIT_CPU; i <= RSPQ_PROFILE_CSLOT_WAIT_RDP_SYNCFULL_MULTI; i++)
+        rsp_idle += profile_data.slots[i].total_ticks;
+    float rsp_util = 100.0f - PERCENT(rsp_idle, profile_data.total_ticks);
+
+    // RDP: time in which the RDP was busy. The pipe/tmem counters are sampled
+    // by the CPU, so they are relative to the DP_CLOCK also sampled by the CPU.
+    float rdp_util = PERCENT(profile_data.rdp_busy_ticks, profile_data.total_ticks);
+    float rdp_pipe = PERCENT(profile_data.rdp_pipe_busy_ticks, profile_data.rdp_clock_ticks);
+    float rdp_tmem = PERCENT(profile_data.rdp_tmem_busy_ticks, profile_data.rdp_clock_ticks);
+
+    debugf("CPU utilization:    %10.2f%%\n", cpu_util);
+    debugf("RSP utilization:    %10.2f%%\n", rsp_util);
+    debugf("RDP utilization:    %10.2f%% (pipe: %.2f%%, tmem: %.2f%%)\n", rdp_util, rdp_pipe, rdp_tmem);
+
+    // Classify the bottleneck as the most used processor. If none of them is
+    // close to saturation, the frame rate is limited by something else
+    // (typically, vsync).
+    const char *bottleneck;
+    float max_util = MAX(cpu_util, MAX(rsp_util, rdp_util));
+    if (max_util < 80.0f)
+        bottleneck = "none (limited by vsync or other waits)";
+    else if (max_util == rdp_util)
+        bottleneck = rdp_tmem > rdp_pipe ? "RDP (texture loads)" : "RDP (rasterization)";
+    else if (max_util == rsp_util)
+        bottleneck = "RSP";
+    else
+        bottleneck = "CPU";
+    debugf("Bottleneck:         %s\n", bottleneck);
+    debugf("\n");
+}
+
 void rspq_profile_dump()
 {
     if (profile_data.frame_count == 0)
@@ -154,12 +377,41 @@ void rspq_profile_dump()
     }
 
 	debugf("------------------------------------------------------------\n");
+
+    // Print the most expensive commands
+    int order[256], num_cmds = 0;
+    for (int i = 0; i < 256; i++)
+        if (profile_data.commands[i].sample_count) order[num_cmds++] = i;
+    for (int i = 1; i < num_cmds; i++) {
+        int c = order[i], j = i;
+        for (; j > 0 && profile_data.commands[order[j-1]].total_ticks < profile_data.commands[c].total_ticks; j--)
+            order[j] = order[j-1];
+        order[j] = c;
+    }
+    if (num_cmds > 0) {
+        debugf("%-25s %10s %12s %10s\n", "Command", "Cnt/Frame", "Avg/Frame", "Rel/Frame");
+        debugf("------------------------------------------------------------\n");
+        for (int i = 0; i < MIN(num_cmds, 16); i++) {
+            int idx;
+            const char *name = rspq_profile_cmd_name(order[i], &idx);
+            rspq_profile_slot_t slot = profile_data.commands[order[i]];
+            char buf[32];
+            snprintf(buf, sizeof(buf), "%.18s 0x%02x", name, idx);
+            slot.name = buf;
+            rspq_profile_dump_overlay(&slot, frame_avg);
+        }
+        debugf("------------------------------------------------------------\n");
+        if (profile_data.overflow_frames)
+            debugf("WARNING: per-command data incomplete in %lld frames\n", profile_data.overflow_frames);
+    }
+
     debugf("Profiled frames:    %12lld\n", profile_data.frame_count);
     debugf("Frames per second:  %12.1f\n", (float)RCP_FREQUENCY/(float)frame_avg);
     debugf("Average frame time: %10lldus\n", frame_avg_us);
     debugf("RDP busy time:      %10lldus (%2.2f%%)\n", rdp_busy_us, rdp_utilisation);
     debugf("Unrecorded time:    %10lldus (%2.2f%%)\n", overhead_us, overhead_relative);
     debugf("\n");
+    rspq_profile_dump_bottleneck();
 }
 
 void rspq_profile_get_data(rspq_profile_data_t *data)
@@ -175,4 +427,6 @@ void rspq_profile_reset(void) { }
 void rspq_profile_next_frame(void) { }
 void rspq_profile_dump(void) { }
 void rspq_profile_get_data(rspq_profile_data_t *data) { }
+void rspq_profile_trace_start(int max_frames) { }
+void rspq_profile_trace_dump(void) { }
 #endif
\ No newline at end of file
@@ -0,0 +1,94 @@
+void test_asset_prefetch(TestContext *ctx) {
+	timer_init();
+	DEFER(timer_close());
+	kernel_init();
+	DEFER(kernel_close());
+
+	int counter_sz, random_sz;
+	uint8_t *counter = asset_load("rom:/counter.dat", &counter_sz);
+	DEFER(free(counter));
+	uint8_t *random = asset_load("rom:/random.dat", &random_sz);
+	DEFER(free(random));
+
+	// Run the loading thread at a lower priority than the main thread, so
+	// that it can only make progress while the main thread is blocked.
+	kthread_set_pri(NULL, 5);
+	DEFER(kthread_set_pri(NULL, 0));
+
+	uint8_t small_buf[16] __attribute__((aligned(16)));
+	asset_prefetch_item_t items[] = {
+		{ .fn = "rom:/counter.dat" },
+		{ .fn = "rom:/random.dat" },
+		{ .fn = "rom:/random.dat", .buf = small_buf, .buf_size = sizeof(small_buf) },
+	};
+	asset_prefetch_t *pf = asset_prefetch(items, 3, &(asset_prefetch_parms_t){ .priority = 3 });
+
+	// Prefetch miss: nothing can be loaded yet
+	ASSERT_EQUAL_SIGNED(asset_prefetch_next(pf, false), -1, "asset returned before loading");
+
+	// Wait for the first asset
+	ASSERT_EQUAL_SIGNED(asset_prefetch_next(pf, true), 0, "invalid first asset");
+	ASSERT_EQUAL_SIGNED(items[0].size, counter_sz, "invalid size of counter.dat");
+	ASSERT_EQUAL_MEM((uint8_t*)items[0].buf, counter, counter_sz, "invalid contents of counter.dat");
+
+	// Prefetch hit: after giving the thread some time, the remaining assets
+	// are already loaded and must be returned without waiting
+	kthread_sleep(TICKS_FROM_MS(100));
+	ASSERT_EQUAL_SIGNED(asset_prefetch_next(pf, false), 1, "second asset not loaded in background");
+	ASSERT_EQUAL_SIGNED(items[1].size, random_sz, "invalid size of random.dat");
+	ASSERT_EQUAL_MEM((uint8_t*)items[1].buf, random, random_sz, "invalid contents of random.dat");
+	ASSERT_EQUAL_SIGNED(asset_prefetch_next(pf, false), 2, "third asset not loaded in background");
+	ASSERT_EQUAL_SIGNED(items[2].size, -1, "asset loaded into a buffer that is too small");
+	ASSERT_EQUAL_SIGNED(items[2].buf_size, random_sz, "required buffer size not reported");
+
+	// All assets were returned
+	ASSERT_EQUAL_SIGNED(asset_prefetch_next(pf, true), -1, "asset returned twice");
+	asset_prefetch_free(pf);
+	free(items[0].buf);
+	free(items[1].buf);
+
+	// Free the operation while the loading is still in flight: this must wait
+	// for all the assets to be loaded into the arena.
+	static uint8_t arena[16384] __attribute__((aligned(16)));
+	asset_prefetch_item_t items2[] = {
+		{ .fn = "rom:/random.dat" },
+		{ .fn = "rom:/counter.dat" },
+	};
+	pf = asset_prefetch(items2, 2, &(asset_prefetch_parms_t){
+		.arena = arena, .arena_size = sizeof(arena), .priority = 3 });
+	asset_prefetch_free(pf);
+
+	ASSERT((uint8_t*)items2[0].buf >= arena && (uint8_t*)items2[0].buf + random_sz <= arena + sizeof(arena),
+		"random.dat not loaded into the arena");
+	ASSERT((uint8_t*)items2[1].buf >= (uint8_t*)items2[0].buf + random_sz && (uint8_t*)items2[1].buf + counter_sz <= arena + sizeof(arena),
+		"counter.dat not loaded into the arena after random.dat");
+	ASSERT_EQUAL_MEM((uint8_t*)items2[0].buf, random, random_sz, "invalid contents of random.dat in arena");
+	ASSERT_EQUAL_MEM((uint8_t*)items2[1].buf, counter, counter_sz, "invalid contents of counter.dat in arena");
+}
+
+void test_asset_map_rom(TestContext *ctx) {
+	// Reference contents, read through the standard filesystem layers
+	FILE *f = fopen("rom:/random.dat", "rb");
+	ASSERT(f, "random.dat not found");
+	static uint8_t ref[8192] __attribute__((aligned(16)));
+	int ref_sz = fread(ref, 1, sizeof(ref), f);
+	fclose(f);
+	ASSERT_EQUAL_SIGNED(ref_sz, 8192, "invalid size of random.dat");
+
+	// Uncompressed assets in DragonFS are loaded with a single DMA
+	int sz;
+	uint8_t *data = asset_load("rom:/random.dat", &sz);
+	DEFER(free(data));
+	ASSERT_EQUAL_SIGNED(sz, ref_sz, "invalid size of loaded asset");
+	ASSERT_EQUAL_MEM(data, ref, ref_sz, "invalid contents of loaded asset");
+
+	// The same asset can be accessed in place, without loading it
+	int rom_sz;
+	const void *rom = asset_map_rom("rom:/random.dat", &rom_sz);
+	ASSERT(rom, "uncompressed asset could not be mapped");
+	ASSERT_EQUAL_SIGNED(rom_sz, sz, "invalid size of mapped asset");
+	for (int i=0; i<rom_sz; i+=4) {
+		uint32_t word = io_read((uint32_t)rom + i);
+		ASSERT_EQUAL_HEX(word, *(uint32_t*)(data + i), "invalid mapped word at offset %d", i);
+	}
+}
@@ -6,7 +6,7 @@ void test_cache_invalidate(TestContext *ctx) {
 	DEFER(enable_interrupts());
 
 	uint8_t buf[128] __attribute__((aligned(16)));
-	const char *dfs_header = "\xde\xad\xbe\xef\xff\xff\xff\xff""DragonFS 2.0\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00";
+	const char *dfs_header = "\xde\xad\xbe\xef\xff\xff\xff\xff""DragonFS 3.0\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00";
 	const char *aaa = "\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa\xaa";
 
 	for (int i=0;i<32;i++) {
@@ -67,6 +67,95 @@ void test_dfs_read(TestContext *ctx) {
 	ASSERT_EQUAL_MEM(abuf-2, (uint8_t*)"\xaa\xaa", 2, "buffer underflow #3");	
 }
 
+static volatile int dfs_async_completed;
+static void dfs_async_cb(dfs_aio_t *aio) {
+	dfs_async_completed++;
+}
+
+void test_dfs_read_async(TestContext *ctx) {
+	int fh = dfs_open("counter.dat");
+	ASSERT(fh >= 0, "counter.dat not found");
+	DEFER(dfs_close(fh));
+
+	enum { NUM_READS = 4 };
+	uint8_t buf[NUM_READS][256+32] __attribute__((aligned(16)));
+	dfs_aio_t aio[NUM_READS];
+
+	for (int i=0;i<64;i++) {
+		uint8_t *ubuf[NUM_READS];
+		int to_read[NUM_READS], seek[NUM_READS];
+
+		// Queue several reads back-to-back, with random alignments
+		memset(buf, 0xAA, sizeof(buf));
+		dfs_async_completed = 0;
+		for (int j=0;j<NUM_READS;j++) {
+			seek[j] = RANDN(512);
+			ubuf[j] = buf[j]+8+RANDN(16);
+			to_read[j] = RANDN(256)+1;
+			aio[j] = (dfs_aio_t){ .callback = dfs_async_cb };
+
+			dfs_seek(fh, seek[j], SEEK_SET);
+			int n = dfs_read_async(ubuf[j], 1, to_read[j], fh, &aio[j]);
+			ASSERT_EQUAL_SIGNED(n, to_read[j], "invalid async read size");
+		}
+
+		ASSERT_EQUAL_SIGNED(dfs_aio_wait(&aio[NUM_READS-1]), to_read[NUM_READS-1], "invalid async read result");
+		for (int j=0;j<NUM_READS;j++)
+			ASSERT(aio[j].done, "async reads completed out of order");
+		ASSERT_EQUAL_SIGNED(dfs_async_completed, NUM_READS, "callback not called");
+
+		for (int j=0;j<NUM_READS;j++) {
+			for (int k=0;k<to_read[j];k++) {
+				if (ubuf[j][k] != (uint8_t)(seek[j]+k))
+					ASSERT_EQUAL_HEX(ubuf[j][k], (uint8_t)(seek[j]+k), "invalid async read (%d/%d/%d) at %d", 
+						(int)(ubuf[j]-buf[j]), seek[j], to_read[j], k);
+			}
+			ASSERT_EQUAL_MEM(ubuf[j]+to_read[j], (uint8_t*)"\xaa\xaa", 2, "async buffer overflow");
+			ASSERT_EQUAL_MEM(ubuf[j]-2, (uint8_t*)"\xaa\xaa", 2, "async buffer underflow");
+		}
+	}
+}
+
+void test_dfs_read_async_kqueue(TestContext *ctx) {
+	kernel_init();
+	DEFER(kernel_close());
+
+	int fh = dfs_open("counter.dat");
+	ASSERT(fh >= 0, "counter.dat not found");
+	DEFER(dfs_close(fh));
+
+	enum { NUM_READS = 4 };
+	kqueue_t *q = kqueue_new(NUM_READS);
+	DEFER(kqueue_destroy(q));
+
+	uint8_t buf[NUM_READS][64] __attribute__((aligned(16)));
+	dfs_aio_t aio[NUM_READS];
+
+	for (int i=0;i<16;i++) {
+		memset(buf, 0xAA, sizeof(buf));
+		for (int j=0;j<NUM_READS;j++) {
+			aio[j] = (dfs_aio_t){ .queue = q, .user = (void*)j };
+			dfs_seek(fh, j*64 + i, SEEK_SET);
+			int n = dfs_read_async(buf[j], 1, 32, fh, &aio[j]);
+			ASSERT_EQUAL_SIGNED(n, 32, "invalid async read size");
+		}
+
+		// Requests must be delivered into the queue in order
+		for (int j=0;j<NUM_READS;j++) {
+			dfs_aio_t *done = kqueue_get(q);
+			ASSERT(done == &aio[j], "request %d delivered out of order", j);
+			ASSERT(done->done, "request %d delivered before completion", j);
+			ASSERT_EQUAL_SIGNED((int)done->user, j, "user data modified");
+			for (int k=0;k<32;k++) {
+				if (buf[j][k] != (uint8_t)(j*64+i+k))
+					ASSERT_EQUAL_HEX(buf[j][k], (uint8_t)(j*64+i+k), "invalid async read %d at %d", j, k);
+			}
+			ASSERT_EQUAL_MEM(buf[j]+32, (uint8_t*)"\xaa\xaa", 2, "async buffer overflow");
+		}
+		ASSERT(kqueue_empty(q), "spurious requests in the queue");
+	}
+}
+
 void test_dfs_rom_addr(TestContext *ctx) {
 	int fh = dfs_open("counter.dat");
 	ASSERT(fh >= 0, "counter.dat not found");
@@ -88,6 +88,129 @@ void test_gl_draw_elements(TestContext *ctx)
     ASSERT_EQUAL_UNSIGNED(tri_count, 1, "Wrong number of triangles!");
 }
 
+void test_gl_static_buffer(TestContext *ctx)
+{
+    GL_INIT();
+
+    debug_rdp_stream_init();
+
+    static const GLfloat vertices[] = {
+        0.0f, 0.0f,   1.0f, 0.0f, 0.0f,
+        0.5f, 0.0f,   0.0f, 1.0f, 0.0f,
+        0.5f, 0.5f,   0.0f, 0.0f, 1.0f,
+        0.0f, 0.5f,   1.0f, 1.0f, 1.0f,
+    };
+    static const GLushort indices[] = {0, 1, 2, 0, 2, 3};
+
+    // Draw either from client memory, or from the bound buffer (base=NULL)
+    void draw(const uint8_t *base) {
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_COLOR_ARRAY);
+        glVertexPointer(2, GL_FLOAT, 5*sizeof(GLfloat), base);
+        glColorPointer(3, GL_FLOAT, 5*sizeof(GLfloat), base + 2*sizeof(GLfloat));
+        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, indices);
+        glFinish();
+    }
+
+    // Draw from client memory, to get the reference RDP stream. The first
+    // draw also configures the render mode, so skip it.
+    draw((const uint8_t*)vertices);
+    debug_rdp_stream_reset();
+    draw((const uint8_t*)vertices);
+
+    int ref_count = rdp_stream_ctx.idx;
+    uint64_t ref_stream[ref_count];
+    memcpy(ref_stream, rdp_stream, sizeof(ref_stream));
+
+    GLuint buffer;
+    glGenBuffersARB(1, &buffer);
+    DEFER(glDeleteBuffersARB(1, &buffer));
+    glBindBufferARB(GL_ARRAY_BUFFER_ARB, buffer);
+    glBufferDataARB(GL_ARRAY_BUFFER_ARB, sizeof(vertices), vertices, GL_STATIC_DRAW_ARB);
+
+    // Static buffers are pre-converted at the first draw, and must produce the same output
+    gl_buffer_object_t *obj = (gl_buffer_object_t*)buffer;
+    for (int i=0; i<2; i++) {
+        debug_rdp_stream_reset();
+        draw(NULL);
+        ASSERT(obj->rsp_vertices.data != NULL, "Static buffer should have been pre-converted");
+        ASSERT_EQUAL_UNSIGNED(obj->rsp_vertex_count, 4, "Wrong number of pre-converted vertices");
+        ASSERT_EQUAL_SIGNED(rdp_stream_ctx.idx, ref_count, "Wrong number of RDP commands");
+        ASSERT_EQUAL_MEM((uint8_t*)rdp_stream, (uint8_t*)ref_stream, sizeof(ref_stream), "RDP stream does not match");
+    }
+
+    // Modifying the buffer discards the pre-converted data
+    glBufferSubDataARB(GL_ARRAY_BUFFER_ARB, 0, sizeof(vertices), vertices);
+    ASSERT(obj->rsp_vertices.data == NULL, "Pre-converted data should be discarded after modifications");
+
+    // Dynamic buffers are not pre-converted
+    glBufferDataARB(GL_ARRAY_BUFFER_ARB, sizeof(vertices), vertices, GL_DYNAMIC_DRAW_ARB);
+    debug_rdp_stream_reset();
+    draw(NULL);
+    ASSERT(obj->rsp_vertices.data == NULL, "Dynamic buffer should not be pre-converted");
+    ASSERT_EQUAL_SIGNED(rdp_stream_ctx.idx, ref_count, "Wrong number of RDP commands");
+    ASSERT_EQUAL_MEM((uint8_t*)rdp_stream, (uint8_t*)ref_stream, sizeof(ref_stream), "RDP stream does not match");
+}
+
+void test_gl_static_buffer_list(TestContext *ctx)
+{
+    GL_INIT();
+
+    GLfloat vertices[] = {
+        0.0f, 0.0f,   1.0f, 0.0f, 0.0f,
+        0.5f, 0.0f,   0.0f, 1.0f, 0.0f,
+        0.5f, 0.5f,   0.0f, 0.0f, 1.0f,
+        0.0f, 0.5f,   1.0f, 1.0f, 1.0f,
+    };
+    static const GLushort indices[] = {0, 1, 2, 0, 2, 3};
+
+    void draw(const uint8_t *base) {
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_COLOR_ARRAY);
+        glVertexPointer(2, GL_FLOAT, 5*sizeof(GLfloat), base);
+        glColorPointer(3, GL_FLOAT, 5*sizeof(GLfloat), base + 2*sizeof(GLfloat));
+        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, indices);
+    }
+
+    // Draw from client memory, to get the reference image
+    glClear(GL_COLOR_BUFFER_BIT);
+    draw((const uint8_t*)vertices);
+    glFinish();
+    uint32_t fb_size = test_surf.stride * test_surf.height;
+    uint8_t ref_fb[fb_size];
+    memcpy(ref_fb, test_surf.buffer, fb_size);
+
+    GLuint buffer;
+    glGenBuffersARB(1, &buffer);
+    DEFER(glDeleteBuffersARB(1, &buffer));
+    glBindBufferARB(GL_ARRAY_BUFFER_ARB, buffer);
+    glBufferDataARB(GL_ARRAY_BUFFER_ARB, sizeof(vertices), vertices, GL_STATIC_DRAW_ARB);
+    gl_buffer_object_t *obj = (gl_buffer_object_t*)buffer;
+
+    GLuint list = glGenLists(1);
+    DEFER(glDeleteLists(list, 1));
+    glNewList(list, GL_COMPILE);
+    draw(NULL);
+    glEndList();
+    ASSERT(obj->rsp_vertices.data == NULL, "Static buffer should not be pre-converted while compiling a list");
+
+    // Modify the buffer, and draw it so that it is converted again (possibly
+    // reusing the same memory). The list must keep the original vertices.
+    for (int i=0; i<4; i++) {
+        vertices[i*5+0] -= 0.5f;
+        vertices[i*5+1] -= 0.5f;
+    }
+    glBufferSubDataARB(GL_ARRAY_BUFFER_ARB, 0, sizeof(vertices), vertices);
+    draw(NULL);
+    glFinish();
+    ASSERT(obj->rsp_vertices.data != NULL, "Static buffer should have been pre-converted");
+
+    glClear(GL_COLOR_BUFFER_BIT);
+    glCallList(list);
+    glFinish();
+    ASSERT_EQUAL_MEM((uint8_t*)test_surf.buffer, ref_fb, fb_size, "List does not draw the vertices captured at compile time");
+}
+
 void test_gl_texture_completeness(TestContext *ctx)
 {
     GL_INIT();
@@ -203,6 +326,186 @@ void test_gl_list(TestContext *ctx)
     ASSERT(glIsList(100), "List index should be used after glEndList without allocating it first with glGenLists");
 }
 
+void test_gl_list_compile_and_execute(TestContext *ctx)
+{
+    GL_INIT();
+    debug_rdp_stream_init();
+
+    void draw_tri(void) {
+        glBegin(GL_TRIANGLES);
+        glVertex3f(0, 0, 0);
+        glVertex3f(0.5f, 0, 0);
+        glVertex3f(0, 0.5f, 0);
+        glEnd();
+    }
+
+    GLuint list = glGenLists(1);
+    DEFER(glDeleteLists(list, 1));
+
+    // GL_COMPILE_AND_EXECUTE runs the commands while recording them
+    debug_rdp_stream_reset();
+    glNewList(list, GL_COMPILE_AND_EXECUTE);
+    draw_tri();
+    glEndList();
+    rspq_wait();
+    uint32_t tri_count = debug_rdp_stream_count_cmd(RDPQ_CMD_TRI_SHADE + 0xC0);
+    ASSERT_EQUAL_UNSIGNED(tri_count, 1, "Triangle should be drawn while compiling the list");
+
+    debug_rdp_stream_reset();
+    glCallList(list);
+    rspq_wait();
+    tri_count = debug_rdp_stream_count_cmd(RDPQ_CMD_TRI_SHADE + 0xC0);
+    ASSERT_EQUAL_UNSIGNED(tri_count, 1, "Triangle should be drawn when calling the list");
+
+    // State changes made within a list are applied only when the list is executed
+    glNewList(list, GL_COMPILE);
+    glEnable(GL_CULL_FACE);
+    glCullFace(GL_FRONT);
+    glEndList();
+
+    debug_rdp_stream_reset();
+    draw_tri();
+    rspq_wait();
+    tri_count = debug_rdp_stream_count_cmd(RDPQ_CMD_TRI_SHADE + 0xC0);
+    ASSERT_EQUAL_UNSIGNED(tri_count, 1, "Triangle should not be culled after compiling the list");
+
+    glCallList(list);
+    debug_rdp_stream_reset();
+    draw_tri();
+    rspq_wait();
+    tri_count = debug_rdp_stream_count_cmd(RDPQ_CMD_TRI_SHADE + 0xC0);
+    ASSERT_EQUAL_UNSIGNED(tri_count, 0, "Triangle should be culled after calling the list");
+    glDisable(GL_CULL_FACE);
+
+    // Consecutive matrix operations within a list are collapsed, and must
+    // produce the same result as executing them one by one.
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+    glTranslatef(0.25f, 0.5f, 0);
+    glScalef(0.5f, 0.5f, 1);
+    draw_tri();
+    glFinish();
+
+    debug_rdp_stream_reset();
+    draw_tri();
+    glFinish();
+    int ref_count = rdp_stream_ctx.idx;
+    uint64_t ref_stream[ref_count];
+    memcpy(ref_stream, rdp_stream, sizeof(ref_stream));
+
+    extern volatile uint32_t *rspq_cur_pointer;
+    uint32_t matrix_load_id = (gl_overlay_id + (GL_CMD_MATRIX_LOAD << 24)) >> 24;
+
+    glLoadIdentity();
+    glNewList(list, GL_COMPILE);
+    volatile uint32_t *list_start = rspq_cur_pointer;
+    glLoadIdentity();
+    glTranslatef(0.25f, 0.5f, 0);
+    glScalef(0.5f, 0.5f, 1);
+    int list_words = rspq_cur_pointer - list_start;
+    uint32_t list_cmd = *list_start >> 24;
+    glEndList();
+    ASSERT_EQUAL_SIGNED(list_words, 17, "Matrix operations should be folded into a single command");
+    ASSERT_EQUAL_HEX(list_cmd, matrix_load_id, "The folded command should be a MATRIX_LOAD");
+
+    glCallList(list);
+
+    debug_rdp_stream_reset();
+    draw_tri();
+    glFinish();
+    ASSERT_EQUAL_SIGNED(rdp_stream_ctx.idx, ref_count, "Wrong number of RDP commands");
+    ASSERT_EQUAL_MEM((uint8_t*)rdp_stream, (uint8_t*)ref_stream, sizeof(ref_stream), "RDP stream does not match");
+
+    // Consecutive changes to the same state are collapsed as well: only the
+    // last one is kept.
+    glNewList(list, GL_COMPILE);
+    list_start = rspq_cur_pointer;
+    glEnable(GL_CULL_FACE);
+    glDisable(GL_CULL_FACE);
+    glEnable(GL_CULL_FACE);
+    list_words = rspq_cur_pointer - list_start;
+    glEndList();
+    ASSERT_EQUAL_SIGNED(list_words, 2, "State changes should be folded into a single command");
+
+    glCallList(list);
+    debug_rdp_stream_reset();
+    draw_tri();
+    rspq_wait();
+    tri_count = debug_rdp_stream_count_cmd(RDPQ_CMD_TRI_SHADE + 0xC0);
+    ASSERT_EQUAL_UNSIGNED(tri_count, 0, "Triangle should be culled after calling the folded list");
+    glDisable(GL_CULL_FACE);
+}
+
+void test_gl_list_relative_state(TestContext *ctx)
+{
+    GL_INIT();
+    debug_rdp_stream_init();
+
+    void draw_tri(void) {
+        glBegin(GL_TRIANGLES);
+        glVertex3f(0, 0, 0);
+        glVertex3f(0.5f, 0, 0);
+        glVertex3f(0, 0.5f, 0);
+        glEnd();
+    }
+
+    GLuint list = glGenLists(1);
+    DEFER(glDeleteLists(list, 1));
+
+    // Matrix operations in a list are relative to the matrix that is current
+    // when the list is called, not to the one that was current when compiling.
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+    glNewList(list, GL_COMPILE);
+    glTranslatef(0.25f, 0.125f, 0);
+    glEndList();
+
+    glScalef(0.5f, 0.5f, 1);
+    glTranslatef(0.25f, 0.125f, 0);
+    GLfloat ref_matrix[16];
+    glGetFloatv(GL_MODELVIEW_MATRIX, ref_matrix);
+
+    debug_rdp_stream_reset();
+    draw_tri();
+    glFinish();
+    int ref_count = rdp_stream_ctx.idx;
+    uint64_t ref_stream[ref_count];
+    memcpy(ref_stream, rdp_stream, sizeof(ref_stream));
+
+    glLoadIdentity();
+    glScalef(0.5f, 0.5f, 1);
+    glCallList(list);
+    GLfloat matrix[16];
+    glGetFloatv(GL_MODELVIEW_MATRIX, matrix);
+    ASSERT_EQUAL_MEM((uint8_t*)matrix, (uint8_t*)ref_matrix, sizeof(matrix), "Modelview matrix does not match");
+
+    debug_rdp_stream_reset();
+    draw_tri();
+    glFinish();
+    ASSERT_EQUAL_SIGNED(rdp_stream_ctx.idx, ref_count, "Wrong number of RDP commands");
+    ASSERT_EQUAL_MEM((uint8_t*)rdp_stream, (uint8_t*)ref_stream, sizeof(ref_stream), "RDP stream does not match");
+    glLoadIdentity();
+
+    // A state set by a list must be applied when calling it, even if it had
+    // the same value while compiling. Spotlights force the CPU pipeline, which
+    // culls triangles based on the CPU-side state.
+    glEnable(GL_LIGHTING);
+    glLightf(GL_LIGHT0, GL_SPOT_CUTOFF, 45);
+    glCullFace(GL_FRONT);
+    glEnable(GL_CULL_FACE);
+    glNewList(list, GL_COMPILE);
+    glEnable(GL_CULL_FACE);
+    glEndList();
+    glDisable(GL_CULL_FACE);
+
+    glCallList(list);
+    debug_rdp_stream_reset();
+    draw_tri();
+    rspq_wait();
+    uint32_t tri_count = debug_rdp_stream_count_cmd(RDPQ_CMD_TRI_SHADE + 0xC0);
+    ASSERT_EQUAL_UNSIGNED(tri_count, 0, "Triangle should be culled after calling the list");
+}
+
 void test_gl_cull(TestContext *ctx)
 {
     GL_INIT();
@@ -0,0 +1,107 @@
+#include <model64.h>
+
+void test_model64_culling(TestContext *ctx)
+{
+    GL_INIT();
+    debug_rdp_stream_init();
+
+    // lod.model64 contains a single quad in [-0.5, 0.5], with a LOD made of
+    // one of its two triangles
+    model64_t *model = model64_load("rom:/lod.model64");
+    DEFER(model64_free(model));
+
+    uint32_t draw(void) {
+        debug_rdp_stream_reset();
+        model64_draw(model);
+        rspq_wait();
+        return debug_rdp_stream_count_cmd(RDPQ_CMD_TRI_SHADE + 0xC0);
+    }
+
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+    ASSERT_EQUAL_UNSIGNED(draw(), 2, "Full detail mesh should be drawn when inside the frustum");
+
+    glTranslatef(3, 0, 0);
+    ASSERT_EQUAL_UNSIGNED(draw(), 0, "Mesh should be culled when outside of the frustum");
+    glTranslatef(-6, 0, 0);
+    ASSERT_EQUAL_UNSIGNED(draw(), 0, "Mesh should be culled when outside of the frustum");
+    glLoadIdentity();
+    glTranslatef(0, 0, 3);
+    ASSERT_EQUAL_UNSIGNED(draw(), 0, "Mesh should be culled when behind the far plane");
+
+    // The projected size of the bounding sphere drops below the LOD threshold
+    glLoadIdentity();
+    glScalef(0.1f, 0.1f, 0.1f);
+    ASSERT_EQUAL_UNSIGNED(draw(), 1, "LOD mesh should be drawn when small on screen");
+
+    model64_set_culling(model, false);
+    ASSERT_EQUAL_UNSIGNED(draw(), 2, "Full detail mesh should be drawn when culling is disabled");
+}
+
+void test_model64_anim_blend(TestContext *ctx)
+{
+    GL_INIT();
+
+    // anim.model64 contains a "root" node at (1,0,0) with a "child" at (0,1,0).
+    // Animation "a" moves root to (3,0,0) and child to (0,3,0), animation "b"
+    // moves root to (1,4,0). Both are constant over time.
+    model64_t *model = model64_load("rom:/anim.model64");
+    DEFER(model64_free(model));
+    model64_node_t *root = model64_search_node(model, "root");
+    model64_node_t *child = model64_search_node(model, "child");
+    ASSERT(root && child, "Nodes not found");
+
+    #define ASSERT_NODE_POS(node, x, y, z, msg) ({ \
+        float mtx[16]; \
+        model64_get_node_world_mtx(model, node, mtx); \
+        if (fabsf(mtx[12]-(x)) > 0.001f || fabsf(mtx[13]-(y)) > 0.001f || fabsf(mtx[14]-(z)) > 0.001f) \
+            ASSERT(0, msg ": expected (%.3f,%.3f,%.3f), got (%.3f,%.3f,%.3f)", \
+                (float)(x), (float)(y), (float)(z), mtx[12], mtx[13], mtx[14]); \
+    })
+
+    model64_update(model, 0);
+    ASSERT_NODE_POS(root, 1, 0, 0, "Invalid rest pose of root");
+    ASSERT_NODE_POS(child, 1, 1, 0, "Invalid rest pose of child");
+
+    // Two slots at weight 0.5: slot 0 blends from the rest pose to "a", and
+    // slot 1 blends from the result to "b".
+    model64_anim_play(model, "a", MODEL64_ANIM_SLOT_0, true, 0.5f);
+    model64_anim_play(model, "b", MODEL64_ANIM_SLOT_1, true, 0.5f);
+    model64_anim_set_weight(model, MODEL64_ANIM_SLOT_0, 0.5f);
+    model64_anim_set_weight(model, MODEL64_ANIM_SLOT_1, 0.5f);
+    model64_update(model, 0);
+    ASSERT_NODE_POS(root, 1.5f, 2, 0, "Invalid root position with two slots at weight 0.5");
+    ASSERT_NODE_POS(child, 1.5f, 4, 0, "Invalid child position with two slots at weight 0.5");
+
+    // Additive slot: the difference between "b" and the rest pose is added to "a"
+    model64_anim_set_weight(model, MODEL64_ANIM_SLOT_0, 1);
+    model64_anim_set_weight(model, MODEL64_ANIM_SLOT_1, 1);
+    model64_anim_set_blend_mode(model, MODEL64_ANIM_SLOT_1, MODEL64_ANIM_BLEND_ADDITIVE);
+    model64_update(model, 0);
+    ASSERT_NODE_POS(root, 3, 4, 0, "Invalid root position with an additive slot");
+    ASSERT_NODE_POS(child, 3, 7, 0, "Invalid child position with an additive slot");
+    model64_anim_set_weight(model, MODEL64_ANIM_SLOT_1, 0.5f);
+    model64_update(model, 0);
+    ASSERT_NODE_POS(root, 3, 2, 0, "Invalid root position with an additive slot at weight 0.5");
+    model64_anim_stop(model, MODEL64_ANIM_SLOT_1);
+    model64_anim_set_blend_mode(model, MODEL64_ANIM_SLOT_1, MODEL64_ANIM_BLEND_OVERRIDE);
+
+    // Masked subtree: the child goes back to its rest pose
+    model64_anim_set_node_mask(model, MODEL64_ANIM_SLOT_0, child, false);
+    model64_update(model, 0);
+    ASSERT_NODE_POS(root, 3, 0, 0, "Invalid root position with a masked child");
+    ASSERT_NODE_POS(child, 3, 1, 0, "Masked child should be in its rest pose");
+    model64_anim_set_node_mask(model, MODEL64_ANIM_SLOT_0, NULL, true);
+    model64_update(model, 0);
+    ASSERT_NODE_POS(child, 3, 3, 0, "Invalid child position after removing the mask");
+
+    // Weight dropping to 0: all the released components go back to the rest pose
+    model64_anim_set_weight(model, MODEL64_ANIM_SLOT_0, 0);
+    model64_update(model, 0);
+    ASSERT_NODE_POS(root, 1, 0, 0, "Root should be in its rest pose at weight 0");
+    ASSERT_NODE_POS(child, 1, 1, 0, "Child should be in its rest pose at weight 0");
+
+    #undef ASSERT_NODE_POS
+}
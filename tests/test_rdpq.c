@@ -451,6 +451,122 @@ void test_rdpq_block_dynamic(TestContext *ctx)
     if (ctx->result == TEST_FAILED) return;
 }
 
+void test_rdpq_block_optimize(TestContext *ctx)
+{
+    RDPQ_INIT();
+    debug_rdp_stream_init();
+
+    const int WIDTH = 16;
+    surface_t fb = surface_alloc(FMT_RGBA16, WIDTH, WIDTH);
+    DEFER(surface_free(&fb));
+
+    uint16_t expected_fb[WIDTH*WIDTH];
+    memset(expected_fb, 0xFF, sizeof(expected_fb));
+
+    uint32_t old_cfg = rdpq_config_disable(RDPQ_CFG_OPTIMIZE_BLOCKS);
+    DEFER(rdpq_config_set(old_cfg));
+
+    int num_env[2], num_blend[2], num_sync[2];
+
+    for (int opt = 0; opt < 2; opt++) {
+        if (opt) rdpq_config_enable(RDPQ_CFG_OPTIMIZE_BLOCKS);
+        else     rdpq_config_disable(RDPQ_CFG_OPTIMIZE_BLOCKS);
+
+        surface_clear(&fb, 0);
+        rdpq_set_color_image(&fb);
+        rdpq_set_mode_fill(RGBA32(0,0,0,0));
+        rspq_wait();
+
+        rspq_block_begin();
+            // Redundant state changes and syncs
+            rdpq_set_env_color(RGBA32(0x11,0x11,0x11,0x11));
+            rdpq_set_env_color(RGBA32(0x11,0x11,0x11,0x11));
+            rdpq_set_blend_color(RGBA32(0x22,0x22,0x22,0x22));
+            rdpq_set_env_color(RGBA32(0x11,0x11,0x11,0x11));
+            rdpq_sync_pipe();
+            rdpq_sync_pipe();
+            // This is a fixup, that leaves a hole in the RDP buffer. The commands
+            // after it must be correctly relocated.
+            rdpq_set_fill_color(RGBA32(0xFF,0xFF,0xFF,0xFF));
+            // The RDP state is unknown after a fixup, so only the second
+            // command is redundant.
+            rdpq_set_env_color(RGBA32(0x11,0x11,0x11,0x11));
+            rdpq_set_env_color(RGBA32(0x11,0x11,0x11,0x11));
+            rdpq_fill_rectangle(0, 0, WIDTH, WIDTH);
+        rspq_block_t *block = rspq_block_end();
+        DEFER(rspq_block_free(block));
+
+        debug_rdp_stream_reset();
+        rspq_block_run(block);
+        rspq_wait();
+
+        num_env[opt] = debug_rdp_stream_count_cmd(0xFB);    // SET_ENV_COLOR
+        num_blend[opt] = debug_rdp_stream_count_cmd(0xF9);  // SET_BLEND_COLOR
+        num_sync[opt] = debug_rdp_stream_count_cmd(0xE7);   // SYNC_PIPE
+
+        ASSERT_EQUAL_MEM((uint8_t*)fb.buffer, (uint8_t*)expected_fb, WIDTH*WIDTH*2, 
+            "Framebuffer contains wrong data (optimize:%d)", opt);
+    }
+
+    ASSERT_EQUAL_SIGNED(num_env[0] - num_env[1], 3, "invalid number of SET_ENV_COLOR removed");
+    ASSERT_EQUAL_SIGNED(num_blend[0] - num_blend[1], 0, "invalid number of SET_BLEND_COLOR removed");
+    ASSERT_EQUAL_SIGNED(num_sync[0] - num_sync[1], 2, "invalid number of SYNC_PIPE removed");
+}
+
+void test_rdpq_block_optimize_rsp(TestContext *ctx)
+{
+    RDPQ_INIT();
+    debug_rdp_stream_init();
+
+    const int WIDTH = 16;
+    surface_t fb = surface_alloc(FMT_RGBA16, WIDTH, WIDTH);
+    DEFER(surface_free(&fb));
+
+    uint32_t old_cfg = rdpq_config_disable(RDPQ_CFG_OPTIMIZE_BLOCKS);
+    DEFER(rdpq_config_set(old_cfg));
+
+    int num_prim[2], num_sync[2];
+    uint16_t fbs[2][WIDTH*WIDTH];
+
+    for (int opt = 0; opt < 2; opt++) {
+        if (opt) rdpq_config_enable(RDPQ_CFG_OPTIMIZE_BLOCKS);
+        else     rdpq_config_disable(RDPQ_CFG_OPTIMIZE_BLOCKS);
+
+        surface_clear(&fb, 0);
+        rdpq_set_color_image(&fb);
+        rdpq_set_mode_fill(RGBA32(0xFF,0xFF,0xFF,0xFF));
+        rspq_wait();
+
+        rspq_block_begin();
+            rdpq_fill_rectangle(0, 0, WIDTH/2, WIDTH/2);
+            rdpq_sync_pipe();
+            rdpq_set_prim_color(RGBA32(0x11,0x11,0x11,0x11));
+            // The RDP commands of this triangle are generated by the RSP,
+            // so the optimizer must not consider the following commands
+            // part of the same run as the previous ones.
+            rdpq_triangle(&TRIFMT_FILL,
+                (float[]){ WIDTH/2, 0 }, (float[]){ WIDTH, 0 }, (float[]){ WIDTH, WIDTH/2 });
+            rdpq_sync_pipe();
+            rdpq_set_prim_color(RGBA32(0x11,0x11,0x11,0x11));
+            rdpq_fill_rectangle(0, WIDTH/2, WIDTH/2, WIDTH);
+        rspq_block_t *block = rspq_block_end();
+        DEFER(rspq_block_free(block));
+
+        debug_rdp_stream_reset();
+        rspq_block_run(block);
+        rspq_wait();
+
+        num_prim[opt] = debug_rdp_stream_count_cmd(0xFA);   // SET_PRIM_COLOR
+        num_sync[opt] = debug_rdp_stream_count_cmd(0xE7);   // SYNC_PIPE
+        memcpy(fbs[opt], fb.buffer, sizeof(fbs[opt]));
+    }
+
+    ASSERT_EQUAL_MEM((uint8_t*)fbs[1], (uint8_t*)fbs[0], WIDTH*WIDTH*2,
+        "Framebuffer differs when optimizing");
+    ASSERT_EQUAL_SIGNED(num_sync[0] - num_sync[1], 0, "SYNC_PIPE removed across a RSP triangle");
+    ASSERT_EQUAL_SIGNED(num_prim[0] - num_prim[1], 0, "SET_PRIM_COLOR removed across a RSP triangle");
+}
+
 void test_rdpq_block_nested(TestContext *ctx)
 {
     RDPQ_INIT();
@@ -505,6 +621,58 @@ void test_rdpq_block_nested(TestContext *ctx)
     ASSERT_EQUAL_HEX(rdp_stream[5]>>56, 0xFB, "SET_ENV_COLOR not in position 3");
 }
 
+void test_rdpq_block_patch(TestContext *ctx)
+{
+    RDPQ_INIT();
+
+    const int FULL_CVG = 7 << 5;
+    const int FBWIDTH = 16;
+    surface_t fb = surface_alloc(FMT_RGBA32, FBWIDTH, FBWIDTH);
+    DEFER(surface_free(&fb));
+    rdpq_set_color_image(&fb);
+
+    rspq_block_begin();
+        rdpq_set_mode_standard();
+        rdpq_mode_combiner(RDPQ_COMBINER_FLAT);
+        rspq_block_slot_begin(0);
+            rdpq_set_prim_color(RGBA32(255,128,255,0));
+        rspq_block_slot_end();
+        rdpq_fill_rectangle(4, 4, FBWIDTH-4, FBWIDTH-4);
+    rspq_block_t *block = rspq_block_end();
+    DEFER(rspq_block_free(block));
+
+    surface_clear(&fb, 0);
+    rspq_block_run(block);
+    rspq_wait();
+    ASSERT_SURFACE(&fb, {
+        return (x >= 4 && y >= 4 && x < FBWIDTH-4 && y < FBWIDTH-4) ?
+            RGBA32(255,128,255,FULL_CVG) : RGBA32(0,0,0,0);
+    });
+
+    // Patch the color in place, and run the block again
+    rspq_block_patch_begin(block, 0);
+        rdpq_set_prim_color(RGBA32(0,255,64,0));
+    rspq_block_patch_end();
+
+    surface_clear(&fb, 0);
+    rspq_block_run(block);
+    rspq_wait();
+    ASSERT_SURFACE(&fb, {
+        return (x >= 4 && y >= 4 && x < FBWIDTH-4 && y < FBWIDTH-4) ?
+            RGBA32(0,255,64,FULL_CVG) : RGBA32(0,0,0,0);
+    });
+
+    // Commands written after the patch must go to the queue again
+    surface_clear(&fb, 0);
+    rdpq_set_prim_color(RGBA32(64,0,255,0));
+    rdpq_fill_rectangle(4, 4, FBWIDTH-4, FBWIDTH-4);
+    rspq_wait();
+    ASSERT_SURFACE(&fb, {
+        return (x >= 4 && y >= 4 && x < FBWIDTH-4 && y < FBWIDTH-4) ?
+            RGBA32(64,0,255,FULL_CVG) : RGBA32(0,0,0,0);
+    });
+}
+
 void test_rdpq_change_other_modes(TestContext *ctx)
 {
     RDPQ_INIT();
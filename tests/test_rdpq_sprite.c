@@ -77,3 +77,162 @@ void test_rdpq_sprite_lod(TestContext *ctx)
         return color_from_packed32(0);
     });
 }
+
+void test_rdpq_spritebatch(TestContext *ctx)
+{
+    RDPQ_INIT();
+    debug_rdp_stream_init();
+
+    sprite_t *s1 = sprite_load("rom:/grass1sq.rgba32.sprite");
+    DEFER(sprite_free(s1));
+    sprite_t *s2 = sprite_load("rom:/grass1.ci8.sprite");
+    DEFER(sprite_free(s2));
+
+    const int FBWIDTH = 128;
+    surface_t fb1 = surface_alloc(FMT_RGBA32, FBWIDTH, FBWIDTH);
+    DEFER(surface_free(&fb1));
+    surface_clear(&fb1, 0);
+    surface_t fb2 = surface_alloc(FMT_RGBA32, FBWIDTH, FBWIDTH);
+    DEFER(surface_free(&fb2));
+    surface_clear(&fb2, 0);
+
+    // Interleave blits of two different sprites, at non-overlapping positions
+    // so that the final image does not depend on the drawing order.
+    sprite_t *sprites[8] = { s1, s2, s1, s2, s1, s2, s1, s2 };
+
+    rdpq_attach(&fb1, NULL);
+    rdpq_set_mode_standard();
+    for (int i=0; i<8; i++)
+        rdpq_sprite_blit(sprites[i], (i%4)*32, (i/4)*32, &(rdpq_blitparms_t){ .flip_x = i&1 });
+    rdpq_detach_wait();
+
+    rdpq_spritebatch_t *batch = rdpq_spritebatch_new();
+    DEFER(rdpq_spritebatch_free(batch));
+
+    debug_rdp_stream_reset();
+    rdpq_attach(&fb2, NULL);
+    rdpq_set_mode_standard();
+    for (int i=0; i<8; i++)
+        rdpq_spritebatch_blit(batch, sprites[i], (i%4)*32, (i/4)*32, &(rdpq_blitparms_t){ .flip_x = i&1 });
+    rdpq_spritebatch_flush(batch);
+    rdpq_detach_wait();
+
+    // Each texture must have been loaded only once, plus the palette
+    int num_loads = 0, num_tluts = 0;
+    for (int i=0; i<rdp_stream_ctx.idx; i++) {
+        int cmd = BITS(rdp_stream[i], 56, 61);
+        if (cmd == RDPQ_CMD_LOAD_BLOCK || cmd == RDPQ_CMD_LOAD_TILE) num_loads++;
+        if (cmd == RDPQ_CMD_LOAD_TLUT) num_tluts++;
+    }
+    ASSERT_EQUAL_SIGNED(num_loads, 2, "invalid number of texture loads");
+    ASSERT_EQUAL_SIGNED(num_tluts, 1, "invalid number of palette loads");
+
+    ASSERT_EQUAL_MEM((uint8_t*)fb2.buffer, (uint8_t*)fb1.buffer, FBWIDTH*FBWIDTH*4, "batched blits differ from standard blits");
+}
+
+void test_rdpq_spritebatch_mode(TestContext *ctx)
+{
+    RDPQ_INIT();
+
+    sprite_t *s1 = sprite_load("rom:/grass1sq.rgba32.sprite");
+    DEFER(sprite_free(s1));
+
+    const int FBWIDTH = 128;
+    surface_t fb1 = surface_alloc(FMT_RGBA32, FBWIDTH, FBWIDTH);
+    DEFER(surface_free(&fb1));
+    surface_clear(&fb1, 0);
+    surface_t fb2 = surface_alloc(FMT_RGBA32, FBWIDTH, FBWIDTH);
+    DEFER(surface_free(&fb2));
+    surface_clear(&fb2, 0);
+
+    // Odd blits are drawn with a flat color instead of the texture
+    rdpq_attach(&fb1, NULL);
+    rdpq_set_mode_standard();
+    rdpq_set_prim_color(RGBA32(255,0,0,255));
+    for (int i=0; i<8; i++) {
+        if (i&1) {
+            rdpq_mode_push();
+            rdpq_mode_combiner(RDPQ_COMBINER_FLAT);
+        }
+        rdpq_sprite_blit(s1, (i%4)*32, (i/4)*32, NULL);
+        if (i&1) rdpq_mode_pop();
+    }
+    rdpq_detach_wait();
+
+    rspq_block_begin();
+        rdpq_mode_combiner(RDPQ_COMBINER_FLAT);
+    rspq_block_t *flat = rspq_block_end();
+    DEFER(rspq_block_free(flat));
+
+    rdpq_spritebatch_t *batch = rdpq_spritebatch_new();
+    DEFER(rdpq_spritebatch_free(batch));
+
+    rdpq_attach(&fb2, NULL);
+    rdpq_set_mode_standard();
+    rdpq_set_prim_color(RGBA32(255,0,0,255));
+    for (int i=0; i<8; i++) {
+        rdpq_spritebatch_set_mode(batch, (i&1) ? flat : NULL);
+        rdpq_spritebatch_blit(batch, s1, (i%4)*32, (i/4)*32, NULL);
+    }
+    rdpq_spritebatch_flush(batch);
+    // The caller's render mode must be restored after the flush
+    rdpq_sprite_blit(s1, 0, 64, NULL);
+    rdpq_detach_wait();
+
+    rdpq_attach(&fb1, NULL);
+    rdpq_sprite_blit(s1, 0, 64, NULL);
+    rdpq_detach_wait();
+
+    ASSERT_EQUAL_MEM((uint8_t*)fb2.buffer, (uint8_t*)fb1.buffer, FBWIDTH*FBWIDTH*4, "batched blits differ from standard blits");
+}
+
+void test_rdpq_spritebatch_palette(TestContext *ctx)
+{
+    RDPQ_INIT();
+    debug_rdp_stream_init();
+
+    sprite_t *s1 = sprite_load("rom:/grass1.ci8.sprite");
+    DEFER(sprite_free(s1));
+    sprite_t *s2 = sprite_load("rom:/gradient.rgba16.sprite");
+    DEFER(sprite_free(s2));
+
+    const int FBWIDTH = 128, FBHEIGHT = 64;
+    surface_t fb1 = surface_alloc(FMT_RGBA32, FBWIDTH, FBHEIGHT);
+    DEFER(surface_free(&fb1));
+    surface_clear(&fb1, 0);
+    surface_t fb2 = surface_alloc(FMT_RGBA32, FBWIDTH, FBHEIGHT);
+    DEFER(surface_free(&fb2));
+    surface_clear(&fb2, 0);
+
+    // The 32x64 RGBA16 sprite fills the whole TMEM, so it overwrites the
+    // palette of the CI8 sprite, which must be uploaded again afterwards.
+    sprite_t *sprites[3] = { s1, s2, s1 };
+
+    rdpq_attach(&fb1, NULL);
+    rdpq_set_mode_standard();
+    for (int i=0; i<3; i++)
+        rdpq_sprite_blit(sprites[i], i*32, 0, NULL);
+    rdpq_detach_wait();
+
+    rdpq_spritebatch_t *batch = rdpq_spritebatch_new();
+    DEFER(rdpq_spritebatch_free(batch));
+
+    debug_rdp_stream_reset();
+    rdpq_attach(&fb2, NULL);
+    rdpq_set_mode_standard();
+    for (int i=0; i<3; i++) {
+        rdpq_spritebatch_set_layer(batch, i);
+        rdpq_spritebatch_blit(batch, sprites[i], i*32, 0, NULL);
+    }
+    rdpq_spritebatch_flush(batch);
+    rdpq_detach_wait();
+
+    int num_tluts = 0;
+    for (int i=0; i<rdp_stream_ctx.idx; i++) {
+        int cmd = BITS(rdp_stream[i], 56, 61);
+        if (cmd == RDPQ_CMD_LOAD_TLUT) num_tluts++;
+    }
+    ASSERT_EQUAL_SIGNED(num_tluts, 2, "palette not reloaded after being overwritten");
+
+    ASSERT_EQUAL_MEM((uint8_t*)fb2.buffer, (uint8_t*)fb1.buffer, FBWIDTH*FBHEIGHT*4, "batched blits differ from standard blits");
+}
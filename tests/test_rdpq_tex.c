@@ -467,3 +467,148 @@ void test_rdpq_tex_upload_tlut(TestContext *ctx)
         }
     }
 }
+
+static int count_tmem_loads(void)
+{
+    int n = 0;
+    for (int i=0; i<rdp_stream_ctx.idx; i++) {
+        int cmd = BITS(rdp_stream[i], 56, 61);
+        if (cmd == RDPQ_CMD_LOAD_BLOCK || cmd == RDPQ_CMD_LOAD_TILE) n++;
+    }
+    return n;
+}
+
+void test_rdpq_tex_cache(TestContext *ctx)
+{
+    RDPQ_INIT();
+    debug_rdp_stream_init();
+    uint32_t old_cfg = rdpq_config_enable(RDPQ_CFG_TMEM_CACHE);
+    DEFER(rdpq_config_set(old_cfg));
+
+    const int FBWIDTH = 16;
+    surface_t fb = surface_alloc(FMT_RGBA16, FBWIDTH, FBWIDTH);
+    DEFER(surface_free(&fb));
+    surface_t tex1 = surface_create_random(FBWIDTH, FBWIDTH, FMT_RGBA16);
+    DEFER(surface_free(&tex1));
+    surface_t tex2 = surface_create_random(FBWIDTH, FBWIDTH, FMT_RGBA16);
+    DEFER(surface_free(&tex2));
+
+    rdpq_set_color_image(&fb);
+    rdpq_set_mode_copy(false);
+    rspq_wait();
+
+    // Upload tex1 and draw it, checking whether it was loaded or not
+    #define DRAW_TEX1(expected_loads, msg) ({ \
+        surface_clear(&fb, 0); \
+        debug_rdp_stream_reset(); \
+        rdpq_tex_upload(TILE0, &tex1, NULL); \
+        rdpq_texture_rectangle(TILE0, 0, 0, FBWIDTH, FBWIDTH, 0, 0); \
+        rspq_wait(); \
+        ASSERT_EQUAL_SIGNED(count_tmem_loads(), expected_loads, msg); \
+        ASSERT_EQUAL_MEM((uint8_t*)fb.buffer, (uint8_t*)tex1.buffer, FBWIDTH*FBWIDTH*2, msg); \
+    })
+
+    DRAW_TEX1(1, "first upload must load TMEM");
+    DRAW_TEX1(0, "second upload must be skipped");
+
+    // Upload another texture in a different portion of TMEM: tex1 is still resident
+    rdpq_tex_upload(TILE1, &tex2, &(rdpq_texparms_t){ .tmem_addr = 2048 });
+    DRAW_TEX1(0, "upload must be skipped after a non-overlapping upload");
+
+    // Upload another texture over tex1: it must be reloaded
+    rdpq_tex_upload(TILE1, &tex2, NULL);
+    DRAW_TEX1(1, "upload must not be skipped after an overlapping upload");
+
+    // A load done outside of the cache (auto-TMEM) invalidates everything
+    rdpq_tex_multi_begin();
+    rdpq_tex_upload(TILE1, &tex2, NULL);
+    rdpq_tex_multi_end();
+    DRAW_TEX1(1, "upload must not be skipped after a foreign TMEM write");
+
+    // Explicit invalidation (eg: after modifying the surface)
+    rdpq_tex_cache_invalidate();
+    DRAW_TEX1(1, "upload must not be skipped after invalidation");
+
+    #undef DRAW_TEX1
+
+    // RGBA32 textures are split in both halves of TMEM. Check that overlaps
+    // are detected in both halves, for both cached and new uploads.
+    surface_t tex3 = surface_create_random(32, 32, FMT_RGBA32);
+    DEFER(surface_free(&tex3));
+    surface_t tex4 = surface_create_random(FBWIDTH, FBWIDTH, FMT_RGBA32);
+    DEFER(surface_free(&tex4));
+
+    #define UPLOAD(tex, addr, expected_loads, msg) ({ \
+        debug_rdp_stream_reset(); \
+        rdpq_tex_upload(TILE1, tex, &(rdpq_texparms_t){ .tmem_addr = addr }); \
+        rspq_wait(); \
+        ASSERT_EQUAL_SIGNED(count_tmem_loads(), expected_loads, msg); \
+    })
+
+    // tex3 uses 2048 bytes in each half: 0-2047 and 2048-4095
+    rdpq_tex_cache_invalidate();
+    UPLOAD(&tex3, 0, 1, "first RGBA32 upload must load TMEM");
+    UPLOAD(&tex3, 0, 0, "second RGBA32 upload must be skipped");
+    UPLOAD(&tex1, 1024, 1, "RGBA16 upload must load TMEM");
+    UPLOAD(&tex3, 0, 1, "RGBA32 upload must not be skipped after an overlap in the lower half");
+    UPLOAD(&tex1, 3072, 1, "RGBA16 upload must load TMEM");
+    UPLOAD(&tex3, 0, 1, "RGBA32 upload must not be skipped after an overlap in the upper half");
+
+    // tex4 uses 512 bytes in each half: 256-767 and 2304-2815. Its lower half
+    // does not overlap tex1, but the upper half does.
+    rdpq_tex_cache_invalidate();
+    UPLOAD(&tex1, 2304, 1, "RGBA16 upload must load TMEM");
+    UPLOAD(&tex4, 256, 1, "RGBA32 upload must load TMEM");
+    UPLOAD(&tex1, 2304, 1, "RGBA16 upload must not be skipped after an RGBA32 write to the upper half");
+    UPLOAD(&tex4, 256, 1, "RGBA32 upload must not be skipped after an overlap in the upper half");
+
+    #undef UPLOAD
+}
+
+void test_rdpq_blitplan(TestContext *ctx)
+{
+    RDPQ_INIT();
+
+    const int FBWIDTH = 128, FBHEIGHT = 48;
+    surface_t fb = surface_alloc(FMT_RGBA32, FBWIDTH, FBHEIGHT);
+    DEFER(surface_free(&fb));
+    surface_clear(&fb, 0);
+
+    rdpq_attach(&fb, NULL);
+    DEFER(rdpq_detach());
+    rdpq_set_mode_standard();
+
+    for (int filtering=0; filtering<2; filtering++) {
+        LOG("filtering: %d\n", filtering);
+        SRAND(filtering);
+        surface_t surf = surface_create_random(160, 160, FMT_RGBA16);
+        DEFER(surface_free(&surf));
+
+        // The window needs several strips, which will be shifted by scrolling
+        rdpq_blitplan_t *plan = rdpq_blitplan_new(&surf, 0, 0, &(rdpq_blitparms_t){
+            .width = 120, .height = FBHEIGHT, .filtering = filtering,
+        });
+        DEFER(rdpq_blitplan_free(plan));
+
+        // Scroll around, running each position twice: the first run emits
+        // the commands directly, the second one uses the recorded blocks.
+        static const int scroll[][2] = {
+            {0,0}, {0,1}, {0,7}, {0,40}, {3,40}, {3,41}, {40,112}, {0,0},
+        };
+        for (int i=0; i<sizeof(scroll) / sizeof(scroll[0]); i++) {
+            int s0 = scroll[i][0], t0 = scroll[i][1];
+            rdpq_blitplan_scroll(plan, s0, t0);
+            for (int j=0; j<2; j++) {
+                LOG("  s0/t0: %d %d (run %d)\n", s0, t0, j);
+                surface_clear(&fb, 0);
+                rdpq_blitplan_run(plan);
+                rspq_wait();
+
+                ASSERT_SURFACE(&fb, {
+                    if (x >= 120) return color_from_packed32(0);
+                    return surface_debug_expected_color(&surf, x+s0, y+t0);
+                });
+            }
+        }
+    }
+}
@@ -193,3 +193,84 @@ void test_rdpq_triangle_w1(TestContext *ctx) {
     ASSERT_EQUAL_HEX(BITS(rdp_stream[0],56,61), RDPQ_CMD_TRI_TEX, "invalid command");
     ASSERT_EQUAL_HEX(BITS(rdp_stream[4],16,31), 0x7FFF, "invalid W coordinate");
 }
+
+void test_rdpq_triangle_batch(TestContext *ctx) {
+    RDPQ_INIT();
+    debug_rdp_stream_init();
+
+    const int FBWIDTH = 32;
+    surface_t fb = surface_alloc(FMT_RGBA16, FBWIDTH, FBWIDTH);
+    DEFER(surface_free(&fb));
+    surface_clear(&fb, 0);
+
+    rdpq_set_color_image(&fb);
+    rdpq_set_mode_standard();
+    rdpq_mode_combiner(RDPQ_COMBINER_SHADE);
+    rspq_wait();
+
+    // A 4x3 grid of shaded vertices. It has more vertices than the RSP
+    // vertex cache, so that the eviction logic is exercised too.
+    float vtx[12][6];
+    for (int i=0;i<12;i++) {
+        vtx[i][0] = (i%4) * 8 + i * 0.25f;
+        vtx[i][1] = (i/4) * 8 + i * 0.5f;
+        vtx[i][2] = (i*20) / 255.0f;
+        vtx[i][3] = (255-i*20) / 255.0f;
+        vtx[i][4] = (i&1) ? 1.0f : 0.0f;
+        vtx[i][5] = 1.0f;
+    }
+
+    static uint64_t expected[1024];
+    int expected_size;
+
+    // Two rows of three quads each, drawn as a list of 12 triangles
+    uint16_t list[36];
+    for (int q=0;q<6;q++) {
+        int v = (q/3)*4 + (q%3);
+        uint16_t quad[6] = { v, v+1, v+5, v, v+5, v+4 };
+        memcpy(&list[q*6], quad, sizeof(quad));
+    }
+
+    debug_rdp_stream_reset();
+    for (int t=0;t<12;t++)
+        rdpq_triangle(&TRIFMT_SHADE, vtx[list[t*3+0]], vtx[list[t*3+1]], vtx[list[t*3+2]]);
+    rspq_wait();
+    expected_size = rdp_stream_ctx.idx;
+    memcpy(expected, rdp_stream, expected_size * 8);
+
+    debug_rdp_stream_reset();
+    rdpq_triangle_list(&TRIFMT_SHADE, &vtx[0][0], 6, list, 36);
+    rspq_wait();
+    ASSERT_EQUAL_SIGNED(rdp_stream_ctx.idx, expected_size, "invalid RDP stream size for triangle list");
+    ASSERT_EQUAL_MEM((uint8_t*)rdp_stream, (uint8_t*)expected, expected_size*8, "invalid RDP stream for triangle list");
+
+    // The first row as a strip, followed by a degenerate triangle that must be skipped
+    uint16_t strip[9] = { 0, 4, 1, 5, 2, 6, 3, 7, 7 };
+
+    debug_rdp_stream_reset();
+    for (int t=0;t<6;t++)
+        rdpq_triangle(&TRIFMT_SHADE, vtx[strip[t+0]], vtx[strip[t+1]], vtx[strip[t+2]]);
+    rspq_wait();
+    expected_size = rdp_stream_ctx.idx;
+    memcpy(expected, rdp_stream, expected_size * 8);
+
+    debug_rdp_stream_reset();
+    rdpq_triangle_strip(&TRIFMT_SHADE, &vtx[0][0], 6, strip, 9);
+    rspq_wait();
+    ASSERT_EQUAL_SIGNED(rdp_stream_ctx.idx, expected_size, "invalid RDP stream size for triangle strip");
+    ASSERT_EQUAL_MEM((uint8_t*)rdp_stream, (uint8_t*)expected, expected_size*8, "invalid RDP stream for triangle strip");
+
+    // A fan around the first vertex, with no index buffer
+    debug_rdp_stream_reset();
+    for (int t=0;t<10;t++)
+        rdpq_triangle(&TRIFMT_SHADE, vtx[0], vtx[t+1], vtx[t+2]);
+    rspq_wait();
+    expected_size = rdp_stream_ctx.idx;
+    memcpy(expected, rdp_stream, expected_size * 8);
+
+    debug_rdp_stream_reset();
+    rdpq_triangle_fan(&TRIFMT_SHADE, &vtx[0][0], 6, NULL, 12);
+    rspq_wait();
+    ASSERT_EQUAL_SIGNED(rdp_stream_ctx.idx, expected_size, "invalid RDP stream size for triangle fan");
+    ASSERT_EQUAL_MEM((uint8_t*)rdp_stream, (uint8_t*)expected, expected_size*8, "invalid RDP stream for triangle fan");
+}
@@ -868,3 +868,99 @@ void test_rspq_deferred_call(TestContext *ctx)
 
     ASSERT_EQUAL_UNSIGNED(num_call_found, num_call_expected, "invalid number of deferred calls");
 }
+
+void test_rspq_stream(TestContext *ctx)
+{
+    TEST_RSPQ_PROLOG();
+    test_ovl_init();
+    DEFER(test_ovl_close());
+    kernel_init();
+    DEFER(kernel_close());
+
+    uint64_t actual_sum[2] __attribute__((aligned(16))) = {0};
+    data_cache_hit_writeback_invalidate(actual_sum, 16);
+
+    int func_th(void *arg)
+    {
+        int count = (int)arg;
+        rspq_stream_begin();
+        for (int i=0; i<count; i++) {
+            rspq_test_8(1);
+            if (i % 64 == 0) kthread_yield();
+        }
+        rspq_stream_end();
+        return 0;
+    }
+
+    rspq_test_reset();
+
+    // Record two streams while also writing directly to the queue from
+    // the main thread. All threads have the same priority, so they are
+    // interleaved at each yield.
+    kthread_t *th1 = kthread_new("stream1", 8192, 0, func_th, (void*)1000);
+    kthread_t *th2 = kthread_new("stream2", 8192, 0, func_th, (void*)300);
+    for (int i=0; i<100; i++) {
+        rspq_test_8(1);
+        kthread_yield();
+    }
+    kthread_join(th1);
+    kthread_join(th2);
+
+    // Merge the streams and check that all commands were run.
+    rspq_flush();
+    rspq_test_output(actual_sum);
+    rspq_wait();
+    ASSERT_EQUAL_UNSIGNED(*actual_sum, 1400, "sum is not correct");
+
+    TEST_RSPQ_EPILOG(0, rspq_timeout);
+}
+
+void test_rspq_block_patch(TestContext *ctx)
+{
+    TEST_RSPQ_PROLOG();
+    test_ovl_init();
+    DEFER(test_ovl_close());
+
+    rspq_block_begin();
+    for (uint32_t i = 0; i < 16; i++)
+        rspq_test_8(1);
+    rspq_block_slot_begin(0);
+    rspq_test_8(5);
+    rspq_block_slot_end();
+    for (uint32_t i = 0; i < 16; i++)
+        rspq_test_8(1);
+    // Large slot, spanning multiple chunks of the block
+    rspq_block_slot_begin(3);
+    for (uint32_t i = 0; i < 200; i++)
+        rspq_test_8(1);
+    rspq_block_slot_end();
+    rspq_test_8(1);
+    rspq_block_t *block = rspq_block_end();
+    DEFER(rspq_block_free(block));
+
+    uint64_t actual_sum[2] __attribute__((aligned(16))) = {0};
+    data_cache_hit_writeback_invalidate(actual_sum, 16);
+
+    rspq_test_reset();
+    rspq_block_run(block);
+    rspq_test_output(actual_sum);
+    rspq_wait();
+    ASSERT_EQUAL_UNSIGNED(*actual_sum, 238, "sum #1 is not correct");
+    data_cache_hit_invalidate(actual_sum, 16);
+
+    rspq_block_patch_begin(block, 0);
+    rspq_test_8(100);
+    rspq_block_patch_end();
+    rspq_block_patch_begin(block, 3);
+    for (uint32_t i = 0; i < 200; i++)
+        rspq_test_8(2);
+    rspq_block_patch_end();
+
+    rspq_test_reset();
+    rspq_block_run(block);
+    rspq_test_output(actual_sum);
+    rspq_wait();
+    ASSERT_EQUAL_UNSIGNED(*actual_sum, 533, "sum #2 is not correct");
+
+    TEST_RSPQ_EPILOG(0, rspq_timeout);
+}
@@ -195,6 +195,7 @@ int assert_equal_mem(TestContext *ctx, const char *file, int line, const uint8_t
 
 #include "test_kernel.c"
 #include "test_dfs.c"
+#include "test_asset.c"
 #include "test_eepromfs.c"
 #include "test_cache.c"
 #include "test_ticks.c"
@@ -214,6 +215,7 @@ int assert_equal_mem(TestContext *ctx, const char *file, int line, const uint8_t
 #include "test_rdpq_sprite.c"
 #include "test_mpeg1.c"
 #include "test_gl.c"
+#include "test_model64.c"
 #include "test_dl.c"
 #include "test_math.c"
 
@@ -258,9 +260,13 @@ static const struct Testsuite
 	TEST_FUNC(test_kernel_libc2,               5, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_kernel_thread_local,        5, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_dfs_read,                 948, TEST_FLAGS_IO),
+	TEST_FUNC(test_dfs_read_async,             0, TEST_FLAGS_IO | TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_dfs_read_async_kqueue,      0, TEST_FLAGS_IO | TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_dfs_rom_addr,              25, TEST_FLAGS_IO),
 	TEST_FUNC(test_dfs_rom_size,              25, TEST_FLAGS_IO),
 	TEST_FUNC(test_dfs_ioctl,                  0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_asset_prefetch,             0, TEST_FLAGS_IO | TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_asset_map_rom,              0, TEST_FLAGS_IO | TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_eepromfs,                   0, TEST_FLAGS_IO),
 	TEST_FUNC(test_cache_invalidate,        1763, TEST_FLAGS_NONE),
 	TEST_FUNC(test_debug_sdfs,                 0, TEST_FLAGS_NO_BENCHMARK),
@@ -294,6 +300,8 @@ static const struct Testsuite
 	TEST_FUNC(test_rspq_rdp_dynamic,           0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_rdp_dynamic_switch,    0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rspq_deferred_call,         0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rspq_stream,                0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rspq_block_patch,           0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_rspqwait,              0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_clear,                 0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_dynamic,               0, TEST_FLAGS_NO_BENCHMARK),
@@ -302,7 +310,10 @@ static const struct Testsuite
 	TEST_FUNC(test_rdpq_block_coalescing,      0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_block_contiguous,      0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_block_dynamic,         0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rdpq_block_optimize,        0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rdpq_block_optimize_rsp,    0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_block_nested,          0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rdpq_block_patch,           0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_change_other_modes,    0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_fixup_setfillcolor,    0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_fixup_setscissor,      0, TEST_FLAGS_NO_BENCHMARK),
@@ -328,15 +339,21 @@ static const struct Testsuite
 	TEST_FUNC(test_rdpq_texrect_passthrough,   0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_triangle,              0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_triangle_w1,           0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rdpq_triangle_batch,        0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_attach_clear,             0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_attach_stack,             0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_tex_upload,            0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_tex_upload_multi,      0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_tex_blit_normal,       0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rdpq_blitplan,              0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_tex_multi_i4,          0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_tex_upload_tlut,       0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rdpq_tex_cache,             0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_sprite_upload,         0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_rdpq_sprite_lod,            0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rdpq_spritebatch,           0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rdpq_spritebatch_mode,      0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_rdpq_spritebatch_palette,   0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_mpeg1_idct,                 0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_mpeg1_block_decode,         0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_mpeg1_block_dequant,        0, TEST_FLAGS_NO_BENCHMARK),
@@ -344,9 +361,15 @@ static const struct Testsuite
 	TEST_FUNC(test_gl_clear,                   0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_gl_draw_arrays,             0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_gl_draw_elements,           0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_gl_static_buffer,           0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_gl_static_buffer_list,      0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_gl_texture_completeness,    0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_gl_list,					   0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_gl_list_compile_and_execute, 0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_gl_list_relative_state,     0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_gl_cull,					   0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_model64_culling,            0, TEST_FLAGS_NO_BENCHMARK),
+	TEST_FUNC(test_model64_anim_blend,         0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_dl_syms,                   0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_dladdr,             0, TEST_FLAGS_NO_BENCHMARK),
 	TEST_FUNC(test_dl_relocs,             0, TEST_FLAGS_NO_BENCHMARK),
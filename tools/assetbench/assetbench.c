@@ -0,0 +1,554 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdalign.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "../common/binout.c"
+#include "../common/assetcomp.h"
+#include "../common/utils.h"
+#include "asset.h"
+#include "../../src/asset_internal.h"
+#include "../../src/compress/lz4_dec_internal.h"
+#include "../../src/compress/aplib_dec_internal.h"
+#include "../../src/compress/shrinkler_dec_internal.h"
+
+#ifndef assertf
+#define assertf(x, ...) assert(x)
+#endif
+#define memalign(a, b) malloc(b)
+#undef MIN
+#undef MAX
+#include "../../src/compress/lzh5_internal.h"   // LZH5 decompression
+#include "../../src/compress/lzh5.c"
+#include "../common/lzh5_compress.h"            // LZH5 compression
+#include "../common/lzh5_compress.c"
+
+// Defined in shrinkler_dec.c (part of assetcomp.a)
+int shr_unpack(uint8_t *dst, uint8_t *src);
+
+bool flag_verbose = false;
+int flag_iterations = 3;
+int flag_fuzz = 8;
+int flag_winsize = DEFAULT_WINSIZE_STREAMING;
+uint32_t flag_seed = 1;
+
+/** @brief A codec being benchmarked */
+typedef struct {
+    const char *name;   ///< Name of the codec
+    int level;          ///< Asset compression level (0 = not available via asset_load)
+    int state_size;     ///< Size of the streaming state (0 = streaming not supported)
+    bool inplace;       ///< Whether the host decoder can run in-place
+    bool enabled;       ///< Whether the codec was selected on the command line
+} codec_t;
+
+static codec_t codecs[] = {
+    { "lz4",       1, DECOMPRESS_LZ4_STATE_SIZE,   true  },
+    { "aplib",     2, DECOMPRESS_APLIB_STATE_SIZE, false },
+    { "shrinkler", 3, 0,                           true  },
+    { "lzh5",      0, DECOMPRESS_LZH5_STATE_SIZE,  false },
+};
+#define NUM_CODECS  (sizeof(codecs) / sizeof(codecs[0]))
+
+/** @brief Statistics accumulated for a codec over the whole corpus */
+typedef struct {
+    int files;
+    int64_t dec_bytes, cmp_bytes;
+    double comp_time, full_time, stream_time;
+    int64_t stream_bytes;
+    int max_load_mem, max_stream_mem;
+    int errors;                 ///< Decompression errors (output mismatch)
+    int margin_violations;      ///< In-place decompression failures
+} codec_stats_t;
+
+static codec_stats_t stats[NUM_CODECS];
+static FILE *csv = NULL;
+static FILE *profile = NULL;
+float flag_host_mhz = 0;
+
+/** @brief Clock of the N64 CPU (VR4300) in MHz, used to scale the profile */
+#define N64_CPU_MHZ     93.75f
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint32_t rand_next(void)
+{
+    // xorshift32, so that fuzzing is reproducible across platforms
+    flag_seed ^= flag_seed << 13;
+    flag_seed ^= flag_seed >> 17;
+    flag_seed ^= flag_seed << 5;
+    return flag_seed;
+}
+
+static uint32_t rbe32(const uint8_t *p) { return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+static uint16_t rbe16(const uint8_t *p) { return (p[0] << 8) | p[1]; }
+
+static uint8_t *read_file(FILE *f, int *size)
+{
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    rewind(f);
+    uint8_t *buf = malloc(*size ? *size : 1);
+    fread(buf, 1, *size, f);
+    rewind(f);
+    return buf;
+}
+
+static double mbps(int64_t bytes, double time)
+{
+    return time > 0 ? bytes / time / 1e6 : 0;
+}
+
+/**
+ * @brief Read a whole stream via a streaming decoder, using random chunk sizes.
+ *
+ * @return true if the decompressed data matches the original
+ */
+static bool stream_read(codec_t *codec, void *state, const uint8_t *orig, int size, int max_chunk)
+{
+    uint8_t *out = malloc(size + 1);
+    int pos = 0;
+    while (pos < size) {
+        int chunk = max_chunk > 0 ? 1 + rand_next() % max_chunk : 4096;
+        if (chunk > size - pos) chunk = size - pos;
+        ssize_t n;
+        switch (codec->level) {
+        case 1: n = decompress_lz4_read(state, out+pos, chunk); break;
+        case 2: n = decompress_aplib_read(state, out+pos, chunk); break;
+        default: n = decompress_lzh5_read(state, out+pos, chunk); break;
+        }
+        if (n <= 0) break;
+        pos += n;
+    }
+    bool ok = pos == size && memcmp(out, orig, size) == 0;
+    free(out);
+    return ok;
+}
+
+static void stream_init(codec_t *codec, void *state, FILE *f, int payload_offset, int winsize)
+{
+    fseek(f, payload_offset, SEEK_SET);
+    switch (codec->level) {
+    case 1: lseek(fileno(f), payload_offset, SEEK_SET); decompress_lz4_init(state, fileno(f), winsize); break;
+    case 2: lseek(fileno(f), payload_offset, SEEK_SET); decompress_aplib_init(state, fileno(f), winsize); break;
+    default: decompress_lzh5_init(state, f, winsize); break;
+    }
+}
+
+static void bench_codec(const char *fn, const uint8_t *data, int size, int cidx)
+{
+    codec_t *codec = &codecs[cidx];
+    codec_stats_t *st = &stats[cidx];
+    bool ok = true, margin_ok = true, inplace_tested = false;
+    int winsize = flag_winsize;
+
+    // Compress the file. Asset levels go through the asset format, so that
+    // we also exercise the header and the margin computation.
+    FILE *cmp = tmpfile();
+    double t0 = now();
+    if (codec->level) {
+        asset_compress_mem((void*)data, size, cmp, codec->level, winsize);
+    } else {
+        FILE *in = tmpfile();
+        fwrite(data, 1, size, in);
+        rewind(in);
+        unsigned int crc, csize, dsize;
+        lzh5_init(LZHUFF5_METHOD_NUM);
+        lzh5_encode(in, cmp, &crc, &csize, &dsize);
+        fclose(in);
+        winsize = DECOMPRESS_LZH5_DEFAULT_WINDOW_SIZE;
+    }
+    double comp_time = now() - t0;
+    fflush(cmp);
+
+    int file_size;
+    uint8_t *file = read_file(cmp, &file_size);
+    int payload_offset = 0, cmp_size = file_size, margin = 0;
+    bool blocks = false;
+    if (codec->level) {
+        assert(file_size >= sizeof(asset_header_t) && !memcmp(file, "DCA3", 4));
+        winsize = asset_winsize_from_flags(rbe16(file+6));
+        blocks = rbe16(file+6) & ASSET_FLAG_BLOCKS;
+        cmp_size = rbe32(file+8);
+        margin = rbe32(file+16);
+        payload_offset = sizeof(asset_header_t);
+    }
+
+    // Full decompression. For asset levels, use asset_loadfd() which is
+    // the same function used at runtime (including in-place decompression
+    // for the codecs that support it on the host).
+    double full_time = 0;
+    int load_mem = size;
+    for (int it=0; it<flag_iterations; it++) {
+        void *out;
+        rewind(cmp);
+        lseek(fileno(cmp), 0, SEEK_SET);
+        t0 = now();
+        if (codec->level) {
+            int sz = file_size;
+            out = asset_loadfd(fileno(cmp), &sz);
+            load_mem = asset_buf_size(size, cmp_size, margin, NULL);
+        } else {
+            out = decompress_lzh5_full(fn, cmp, cmp_size, size);
+        }
+        double t = now() - t0;
+        if (it == 0 || t < full_time) full_time = t;
+        if (memcmp(out, data, size) != 0) ok = false;
+        free(out);
+    }
+
+    // In-place decompression with the buffer layout used by asset_load():
+    // the compressed data is placed at the end of the buffer, and the margin
+    // stored in the header must be enough to never overwrite it before
+    // it is consumed. The rest of the buffer is poisoned. Block-compressed
+    // assets are decompressed one block after the other, like asset_load().
+    if (codec->inplace) {
+        int cmp_offset;
+        int bufsize = asset_buf_size(size, cmp_size, margin, &cmp_offset);
+        uint8_t *buf = malloc(bufsize);
+        memset(buf, 0xAA, bufsize);
+        memcpy(buf + cmp_offset, file + payload_offset, cmp_size);
+
+        const uint8_t *table = file + payload_offset;
+        int num_blocks = blocks ? rbe32(table+4) : 1;
+        int block_size = blocks ? rbe32(table+0) : size;
+        margin_ok = true;
+        for (int i=0; i<num_blocks; i++) {
+            int blk_offset = blocks ? rbe32(table + 8 + i*8 + 0) : 0;
+            int blk_size = blocks ? rbe32(table + 8 + i*8 + 4) : cmp_size;
+            int dec_size = MIN(block_size, size - i*block_size);
+            uint8_t *in = buf + cmp_offset + blk_offset, *out = buf + i*block_size;
+            int n;
+            if (codec->level == 1)
+                n = decompress_lz4_full_inplace(in, blk_size, out, dec_size);
+            else
+                n = shr_unpack(out, (uint8_t*)in);
+            if (n != dec_size) margin_ok = false;
+        }
+        if (memcmp(buf, data, size) != 0) margin_ok = false;
+        inplace_tested = true;
+        free(buf);
+    }
+
+    // Streaming decompression (as done by asset_fopen()). First, measure
+    // the throughput with fixed-size reads, then fuzz with random read sizes,
+    // also testing the reset (rewind) path.
+    double stream_time = 0;
+    int stream_mem = 0;
+    if (codec->state_size && !blocks) {
+        stream_mem = codec->state_size + winsize;
+        void *state = malloc(stream_mem);
+
+        stream_init(codec, state, cmp, payload_offset, winsize);
+        t0 = now();
+        if (!stream_read(codec, state, data, size, 0)) ok = false;
+        stream_time = now() - t0;
+
+        for (int i=0; i<flag_fuzz; i++) {
+            int max_chunk = (i & 1) ? winsize * 2 : 64;
+            if (i == 1 && codec->level) {
+                // Test the reset function, as used by rewind() on a file
+                // opened with asset_fopen().
+                lseek(fileno(cmp), payload_offset, SEEK_SET);
+                if (codec->level == 1) decompress_lz4_reset(state);
+                else decompress_aplib_reset(state);
+            } else {
+                stream_init(codec, state, cmp, payload_offset, winsize);
+            }
+            if (!stream_read(codec, state, data, size, max_chunk)) ok = false;
+        }
+        free(state);
+    }
+
+    fclose(cmp);
+    free(file);
+
+    st->files++;
+    st->dec_bytes += size;
+    st->cmp_bytes += file_size;
+    st->comp_time += comp_time;
+    st->full_time += full_time;
+    if (stream_mem) {
+        st->stream_time += stream_time;
+        st->stream_bytes += size;
+    }
+    if (load_mem > st->max_load_mem) st->max_load_mem = load_mem;
+    if (stream_mem > st->max_stream_mem) st->max_stream_mem = stream_mem;
+    if (!ok) st->errors++;
+    if (!margin_ok) st->margin_violations++;
+
+    const char *inplace_str = !inplace_tested ? "-" : margin_ok ? "ok" : "VIOLATION";
+    if (flag_verbose || !ok || !margin_ok) {
+        char stream_str[16] = "-";
+        if (stream_mem) snprintf(stream_str, sizeof(stream_str), "%.2f", mbps(size, stream_time));
+        printf("%-40s %-9s %9d -> %9d (%5.1f%%)  comp %7.2f  full %7.2f  stream %7s MB/s  mem %7d/%7d  inplace %s%s\n",
+            fn, codec->name, size, file_size, 100.0 * file_size / size,
+            mbps(size, comp_time), mbps(size, full_time), stream_str,
+            load_mem, stream_mem, inplace_str, ok ? "" : "  MISMATCH");
+    }
+    if (csv) {
+        fprintf(csv, "%s,%s,%d,%d,%d,%.3f,%.3f,%.3f,%d,%d,%s,%s\n",
+            fn, codec->name, size, file_size, margin,
+            mbps(size, comp_time), mbps(size, full_time), mbps(size, stream_time),
+            load_mem, stream_mem, inplace_str, ok ? "ok" : "mismatch");
+    }
+}
+
+static void bench_file(const char *fn)
+{
+    FILE *f = fopen(fn, "rb");
+    if (!f) {
+        fprintf(stderr, "error: cannot open file: %s\n", fn);
+        return;
+    }
+    int size;
+    uint8_t *data = read_file(f, &size);
+    fclose(f);
+
+    // Skip files already compressed in the asset format: we would be
+    // benchmarking random-looking data.
+    if (size >= 4 && !memcmp(data, "DCA", 3)) {
+        if (flag_verbose) printf("%s: skipped (already compressed)\n", fn);
+        free(data);
+        return;
+    }
+    // Empty files are not supported by all compressors
+    if (size == 0) {
+        free(data);
+        return;
+    }
+
+    for (int i=0; i<NUM_CODECS; i++)
+        if (codecs[i].enabled)
+            bench_codec(fn, data, size, i);
+    free(data);
+}
+
+static void walk(const char *path)
+{
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        fprintf(stderr, "error: cannot access: %s\n", path);
+        return;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        bench_file(path);
+        return;
+    }
+
+    DIR *d = opendir(path);
+    struct dirent *de;
+    while ((de = readdir(d))) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+            continue;
+        char *sub;
+        asprintf(&sub, "%s/%s", path, de->d_name);
+        walk(sub);
+        free(sub);
+    }
+    closedir(d);
+}
+
+void print_args(char *name)
+{
+    fprintf(stderr, "%s -- Libdragon asset compression benchmark\n\n", name);
+    fprintf(stderr, "This tool round-trips a corpus of files through all the compressors and\n");
+    fprintf(stderr, "decompressors used by libdragon, verifying that the data is decompressed\n");
+    fprintf(stderr, "correctly via full, in-place and streaming decompression, and measuring\n");
+    fprintf(stderr, "the throughput of the host versions of the decompressors.\n\n");
+    fprintf(stderr, "Usage: %s [flags] <files or directories...>\n", name);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Command-line flags:\n");
+    fprintf(stderr, "   -v/--verbose            Print statistics for each file\n");
+    fprintf(stderr, "   -c/--codecs <list>      Comma-separated list of codecs (default: lz4,aplib,shrinkler,lzh5)\n");
+    fprintf(stderr, "   -w/--winsize <window>   Window size in KiB used for compression (default: %d)\n", DEFAULT_WINSIZE_STREAMING/1024);
+    fprintf(stderr, "   -b/--blocks <size>      Compress in independent blocks of this size in KiB (see mkasset)\n");
+    fprintf(stderr, "   -i/--iterations <N>     Number of full decompression runs to time (default: %d)\n", flag_iterations);
+    fprintf(stderr, "   -f/--fuzz <N>           Number of streaming passes with random read sizes (default: %d)\n", flag_fuzz);
+    fprintf(stderr, "   -s/--seed <N>           Seed for the random read sizes (default: %u)\n", flag_seed);
+    fprintf(stderr, "   --csv <file>            Write per-file statistics to a CSV file\n");
+    fprintf(stderr, "   --profile <file>        Write a throughput profile for mkasset --throughput\n");
+    fprintf(stderr, "   --host-mhz <MHz>        Clock of the host CPU, used to scale the profile to the N64\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "The tool exits with an error if any file fails to round-trip, or if in-place\n");
+    fprintf(stderr, "decompression fails with the margin computed by the compressor.\n");
+    fprintf(stderr, "In-place decompression is verified only for the codecs whose host decoder\n");
+    fprintf(stderr, "can run in-place (lz4, shrinkler). Memory is reported as load/stream, that\n");
+    fprintf(stderr, "is the buffer allocated by asset_load() and the state of asset_fopen().\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "The profile written by --profile contains the full decompression throughput of\n");
+    fprintf(stderr, "each level, scaled by the ratio between the N64 CPU clock (%.2f MHz) and the\n", N64_CPU_MHZ);
+    fprintf(stderr, "host clock. This is a first-order estimate; if you measured the decompressors on\n");
+    fprintf(stderr, "real hardware, edit the profile with those figures instead.\n");
+    fprintf(stderr, "\n");
+}
+
+static bool parse_int(int argc, char *argv[], int *i, int *value)
+{
+    if (++*i == argc) {
+        fprintf(stderr, "missing argument for %s\n", argv[*i-1]);
+        return false;
+    }
+    char extra;
+    if (sscanf(argv[*i], "%d%c", value, &extra) != 1 || *value < 0) {
+        fprintf(stderr, "invalid argument for %s: %s\n", argv[*i-1], argv[*i]);
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    // Initialize all compression levels
+    asset_init_compression(2);
+    asset_init_compression(3);
+
+    if (argc < 2) {
+        print_args(argv[0]);
+        return 1;
+    }
+
+    for (int i=0; i<NUM_CODECS; i++)
+        codecs[i].enabled = true;
+
+    int num_inputs = 0;
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] == '-') {
+            int value;
+            if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+                print_args(argv[0]);
+                return 0;
+            } else if (!strcmp(argv[i], "-v") || !strcmp(argv[i], "--verbose")) {
+                flag_verbose = true;
+            } else if (!strcmp(argv[i], "-c") || !strcmp(argv[i], "--codecs")) {
+                if (++i == argc) {
+                    fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                for (int j=0; j<NUM_CODECS; j++)
+                    codecs[j].enabled = false;
+                char *list = strdup(argv[i]);
+                for (char *tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) {
+                    int j;
+                    for (j=0; j<NUM_CODECS; j++)
+                        if (!strcmp(tok, codecs[j].name)) break;
+                    if (j == NUM_CODECS) {
+                        fprintf(stderr, "invalid codec: %s\n", tok);
+                        return 1;
+                    }
+                    codecs[j].enabled = true;
+                }
+                free(list);
+            } else if (!strcmp(argv[i], "-w") || !strcmp(argv[i], "--winsize")) {
+                if (!parse_int(argc, argv, &i, &value)) return 1;
+                flag_winsize = value * 1024;
+                if (asset_winsize_to_flags(flag_winsize) < 0) {
+                    fprintf(stderr, "unsupported window size: %d\n", flag_winsize);
+                    fprintf(stderr, "supported window sizes: 2, 4, 8, 16, 32, 64, 128, 256\n");
+                    return 1;
+                }
+            } else if (!strcmp(argv[i], "-b") || !strcmp(argv[i], "--blocks")) {
+                if (!parse_int(argc, argv, &i, &value)) return 1;
+                asset_compress_block_size = value * 1024;
+            } else if (!strcmp(argv[i], "-i") || !strcmp(argv[i], "--iterations")) {
+                if (!parse_int(argc, argv, &i, &flag_iterations)) return 1;
+                if (flag_iterations < 1) flag_iterations = 1;
+            } else if (!strcmp(argv[i], "-f") || !strcmp(argv[i], "--fuzz")) {
+                if (!parse_int(argc, argv, &i, &flag_fuzz)) return 1;
+            } else if (!strcmp(argv[i], "-s") || !strcmp(argv[i], "--seed")) {
+                if (!parse_int(argc, argv, &i, &value)) return 1;
+                flag_seed = value ? value : 1;
+            } else if (!strcmp(argv[i], "--csv")) {
+                if (++i == argc) {
+                    fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                csv = fopen(argv[i], "w");
+                if (!csv) {
+                    fprintf(stderr, "error opening CSV file: %s\n", argv[i]);
+                    return 1;
+                }
+                fprintf(csv, "file,codec,size,cmp_size,margin,comp_mbps,full_mbps,stream_mbps,load_mem,stream_mem,inplace,result\n");
+            } else if (!strcmp(argv[i], "--profile")) {
+                if (++i == argc) {
+                    fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                profile = fopen(argv[i], "w");
+                if (!profile) {
+                    fprintf(stderr, "error opening profile file: %s\n", argv[i]);
+                    return 1;
+                }
+            } else if (!strcmp(argv[i], "--host-mhz")) {
+                if (++i == argc) {
+                    fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                char extra;
+                if (sscanf(argv[i], "%f%c", &flag_host_mhz, &extra) != 1 || flag_host_mhz <= 0) {
+                    fprintf(stderr, "invalid argument for %s: %s\n", argv[i-1], argv[i]);
+                    return 1;
+                }
+            } else {
+                fprintf(stderr, "invalid flag: %s\n", argv[i]);
+                return 1;
+            }
+            continue;
+        }
+
+        if (profile && !flag_host_mhz) {
+            fprintf(stderr, "error: --profile requires --host-mhz\n");
+            return 1;
+        }
+        walk(argv[i]);
+        num_inputs++;
+    }
+
+    if (!num_inputs) {
+        fprintf(stderr, "error: no input files\n");
+        return 1;
+    }
+
+    int failures = 0;
+    printf("\n%-9s %6s %11s %11s %6s %9s %9s %9s %9s %9s %7s %7s\n",
+        "codec", "files", "size", "compressed", "ratio", "comp", "full", "stream", "load mem", "str mem", "errors", "margin");
+    for (int i=0; i<NUM_CODECS; i++) {
+        codec_stats_t *st = &stats[i];
+        if (!codecs[i].enabled || !st->files) continue;
+        char stream_str[16] = "-";
+        if (st->stream_bytes) snprintf(stream_str, sizeof(stream_str), "%.2f", mbps(st->stream_bytes, st->stream_time));
+        printf("%-9s %6d %11lld %11lld %5.1f%% %9.2f %9.2f %9s %9d %9d %7d %7d\n",
+            codecs[i].name, st->files, (long long)st->dec_bytes, (long long)st->cmp_bytes,
+            100.0 * st->cmp_bytes / st->dec_bytes,
+            mbps(st->dec_bytes, st->comp_time), mbps(st->dec_bytes, st->full_time),
+            stream_str,
+            st->max_load_mem, st->max_stream_mem, st->errors, st->margin_violations);
+        failures += st->errors + st->margin_violations;
+    }
+    printf("(throughput in MB/s of decompressed data, measured on the host)\n");
+
+    if (profile) {
+        float scale = N64_CPU_MHZ / flag_host_mhz;
+        fprintf(profile, "# mkasset throughput profile (MB/s of decompressed data), generated by assetbench.\n");
+        fprintf(profile, "# Host full decompression throughput, scaled by %.2f / %.2f MHz.\n", N64_CPU_MHZ, flag_host_mhz);
+        for (int i=0; i<NUM_CODECS; i++) {
+            codec_stats_t *st = &stats[i];
+            if (!codecs[i].enabled || !codecs[i].level || !st->files) continue;
+            fprintf(profile, "%s %.3f\n", codecs[i].name, mbps(st->dec_bytes, st->full_time) * scale);
+        }
+        fclose(profile);
+    }
+
+    if (csv) fclose(csv);
+    return failures ? 1 : 0;
+}
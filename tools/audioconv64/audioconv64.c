@@ -8,6 +8,7 @@
 #include <dirent.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#include "../common/assetcache.h"
 
 bool flag_verbose = false;
 bool flag_debug = false;
@@ -103,21 +104,46 @@ void convert(char *infn, char *outfn1) {
 		return;
 	}
 
+	int (*conv)(const char *infn, const char *outfn);
+	const char *type;
+	char *outfn;
 	if (strcasecmp(ext, ".wav") == 0 || strcasecmp(ext, ".aiff") == 0 || strcasecmp(ext, ".mp3") == 0) {
-		char *outfn = changeext(outfn1, ".wav64");
-		wav_convert(infn, outfn);
-		free(outfn);
+		outfn = changeext(outfn1, ".wav64");
+		conv = wav_convert;
+		type = "wav64";
 	} else if (strcasecmp(ext, ".xm") == 0) {
-		char *outfn = changeext(outfn1, ".xm64");
-		xm_convert(infn, outfn);
-		free(outfn);
+		outfn = changeext(outfn1, ".xm64");
+		conv = xm_convert;
+		type = "xm64";
 	} else if (strcasecmp(ext, ".ym") == 0) {
-		char *outfn = changeext(outfn1, ".ym64");
-		ym_convert(infn, outfn);
-		free(outfn);
+		outfn = changeext(outfn1, ".ym64");
+		conv = ym_convert;
+		type = "ym64";
 	} else {
 		fprintf(stderr, "WARNING: ignoring unknown file: %s\n", infn);
+		return;
+	}
+
+	// Check if we already converted this very same file with the same flags
+	assetcache_key_t cache_key;
+	bool use_cache = false;
+	if (assetcache_enabled() && !flag_debug) {
+		assetcache_key_init(&cache_key);
+		assetcache_key_addf(&cache_key, "type=%s wav=%d,%d,%d,%d,%d xm=%d ym=%d", type,
+			flag_wav_looping, flag_wav_looping_offset, flag_wav_compress, flag_wav_resample, flag_wav_mono,
+			flag_xm_8bit, flag_ym_compress);
+		use_cache = assetcache_key_add_file(&cache_key, infn);
 	}
+	if (use_cache && assetcache_fetch(&cache_key, outfn)) {
+		if (flag_verbose)
+			fprintf(stderr, "cached: %s => %s\n", infn, outfn);
+		free(outfn);
+		return;
+	}
+
+	if (conv(infn, outfn) == 0 && use_cache)
+		assetcache_store(&cache_key, outfn, NULL);
+	free(outfn);
 }
 
 bool exists(const char *path) {
@@ -192,6 +218,8 @@ int main(int argc, char *argv[]) {
 
 	char *outdir = ".";
 
+	assetcache_init("audioconv64", argv[0]);
+
 	int i;
 	for (i=1; i<argc; i++) {
 		if (argv[i][0] == '-') {	
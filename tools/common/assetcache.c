@@ -0,0 +1,296 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#ifdef __APPLE__
+#include <mach-o/dyld.h>
+#endif
+#include "assetcache.h"
+
+#define CACHE_MAGIC         "N64C"
+#define CACHE_MAX_FILES     64
+
+static bool cache_enabled = false;
+static char *cache_dir = NULL;
+static assetcache_key_t cache_tool_key;
+static _Atomic int cache_tmp_counter = 0;
+
+// 128-bit FNV-1a
+static const unsigned __int128 FNV128_PRIME =
+    ((unsigned __int128)0x0000000001000000ull << 64) | 0x000000000000013Bull;
+static const unsigned __int128 FNV128_OFFSET =
+    ((unsigned __int128)0x6c62272e07bb0142ull << 64) | 0x62b821756295c58dull;
+
+static void fnv128_update(assetcache_key_t *key, const void *data, size_t size)
+{
+    unsigned __int128 h = ((unsigned __int128)key->hi << 64) | key->lo;
+    const uint8_t *p = data;
+    for (size_t i=0; i<size; i++) {
+        h ^= p[i];
+        h *= FNV128_PRIME;
+    }
+    key->lo = (uint64_t)h;
+    key->hi = (uint64_t)(h >> 64);
+}
+
+static void key_add_file_contents(assetcache_key_t *key, FILE *f)
+{
+    uint8_t buf[64*1024];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        fnv128_update(key, buf, n);
+}
+
+static bool self_exe_path(const char *argv0, char *path, size_t size)
+{
+    #if defined(_WIN32)
+    DWORD n = GetModuleFileNameA(NULL, path, size);
+    if (n > 0 && n < size) return true;
+    #elif defined(__APPLE__)
+    uint32_t sz = size;
+    if (_NSGetExecutablePath(path, &sz) == 0) return true;
+    #else
+    ssize_t n = readlink("/proc/self/exe", path, size-1);
+    if (n > 0) { path[n] = 0; return true; }
+    #endif
+    if (!argv0 || strlen(argv0) >= size) return false;
+    strcpy(path, argv0);
+    return true;
+}
+
+static void mkdir_one(const char *path)
+{
+    #ifndef __MINGW32__
+    mkdir(path, 0777);
+    #else
+    mkdir(path);
+    #endif
+}
+
+static void mkdir_p(const char *path)
+{
+    char *p = strdup(path);
+    for (char *s = p+1; *s; s++) {
+        if (*s == '/' || *s == '\\') {
+            char c = *s; *s = 0;
+            mkdir_one(p);
+            *s = c;
+        }
+    }
+    mkdir_one(p);
+    free(p);
+}
+
+static char* entry_path(const assetcache_key_t *key)
+{
+    char *path;
+    asprintf(&path, "%s/%02x/%016llx%016llx.bin", cache_dir, (unsigned)(key->hi >> 56),
+        (unsigned long long)key->hi, (unsigned long long)key->lo);
+    return path;
+}
+
+static void w32le(FILE *f, uint32_t v)
+{
+    uint8_t b[4] = { v, v>>8, v>>16, v>>24 };
+    fwrite(b, 1, 4, f);
+}
+
+static bool r32le(FILE *f, uint32_t *v)
+{
+    uint8_t b[4];
+    if (fread(b, 1, 4, f) != 4) return false;
+    *v = b[0] | (b[1]<<8) | (b[2]<<16) | ((uint32_t)b[3]<<24);
+    return true;
+}
+
+static uint8_t* slurp(const char *fn, uint32_t *size)
+{
+    FILE *f = fopen(fn, "rb");
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    long sz = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *buf = malloc(sz ? sz : 1);
+    if (fread(buf, 1, sz, f) != sz) {
+        free(buf); fclose(f);
+        return NULL;
+    }
+    fclose(f);
+    *size = sz;
+    return buf;
+}
+
+bool assetcache_init(const char *tool, const char *argv0)
+{
+    cache_enabled = false;
+    const char *dir = getenv("N64_ASSET_CACHE");
+    if (!dir || !dir[0])
+        return false;
+
+    // Seed the tool key with the tool name and the contents of its executable,
+    // so that rebuilding the tool automatically invalidates the cache.
+    char exe[4096];
+    FILE *f = self_exe_path(argv0, exe, sizeof(exe)) ? fopen(exe, "rb") : NULL;
+    if (!f) {
+        fprintf(stderr, "WARNING: cannot read tool executable, asset cache disabled\n");
+        return false;
+    }
+    cache_tool_key = (assetcache_key_t){ .lo = (uint64_t)FNV128_OFFSET, .hi = (uint64_t)(FNV128_OFFSET >> 64) };
+    assetcache_key_addf(&cache_tool_key, "%s", tool);
+    key_add_file_contents(&cache_tool_key, f);
+    fclose(f);
+
+    free(cache_dir);
+    cache_dir = strdup(dir);
+    cache_enabled = true;
+    return true;
+}
+
+bool assetcache_enabled(void)
+{
+    return cache_enabled;
+}
+
+void assetcache_key_init(assetcache_key_t *key)
+{
+    *key = cache_tool_key;
+}
+
+void assetcache_key_add(assetcache_key_t *key, const void *data, size_t size)
+{
+    // Prefix each component with its size, so that the concatenation of
+    // different components can't produce the same key.
+    uint64_t sz = size;
+    fnv128_update(key, &sz, sizeof(sz));
+    fnv128_update(key, data, size);
+}
+
+void assetcache_key_addf(assetcache_key_t *key, const char *fmt, ...)
+{
+    char *str;
+    va_list va;
+    va_start(va, fmt);
+    int n = vasprintf(&str, fmt, va);
+    va_end(va);
+    if (n < 0) return;
+    assetcache_key_add(key, str, n);
+    free(str);
+}
+
+bool assetcache_key_add_file(assetcache_key_t *key, const char *fn)
+{
+    FILE *f = fopen(fn, "rb");
+    if (!f) return false;
+    fseek(f, 0, SEEK_END);
+    uint64_t sz = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    fnv128_update(key, &sz, sizeof(sz));
+    key_add_file_contents(key, f);
+    fclose(f);
+    return true;
+}
+
+bool assetcache_fetch(const assetcache_key_t *key, const char *outfn)
+{
+    if (!cache_enabled) return false;
+
+    char *path = entry_path(key);
+    FILE *f = fopen(path, "rb");
+    free(path);
+    if (!f) return false;
+
+    bool ok = false;
+    char magic[4]; uint32_t count;
+    if (fread(magic, 1, 4, f) != 4 || memcmp(magic, CACHE_MAGIC, 4) != 0)
+        goto end;
+    if (!r32le(f, &count) || count == 0 || count > CACHE_MAX_FILES)
+        goto end;
+
+    for (int i=0; i<count; i++) {
+        uint32_t suffix_len, size;
+        char suffix[256];
+        if (!r32le(f, &suffix_len) || suffix_len >= sizeof(suffix)) goto end;
+        if (fread(suffix, 1, suffix_len, f) != suffix_len) goto end;
+        suffix[suffix_len] = 0;
+        if (!r32le(f, &size)) goto end;
+
+        uint8_t *data = malloc(size ? size : 1);
+        if (fread(data, 1, size, f) != size) { free(data); goto end; }
+
+        char *fn;
+        asprintf(&fn, "%s%s", outfn, suffix);
+        FILE *out = fopen(fn, "wb");
+        free(fn);
+        if (!out) { free(data); goto end; }
+        fwrite(data, 1, size, out);
+        fclose(out);
+        free(data);
+    }
+    ok = true;
+
+end:
+    fclose(f);
+    return ok;
+}
+
+void assetcache_store(const assetcache_key_t *key, const char *outfn, const char **suffixes)
+{
+    if (!cache_enabled) return;
+
+    const char *files[CACHE_MAX_FILES] = { "" };
+    int count = 1;
+    for (int i=0; suffixes && suffixes[i] && count < CACHE_MAX_FILES; i++) {
+        struct stat st;
+        char *fn;
+        asprintf(&fn, "%s%s", outfn, suffixes[i]);
+        if (stat(fn, &st) == 0)
+            files[count++] = suffixes[i];
+        free(fn);
+    }
+
+    char *path = entry_path(key);
+    char *dir = strdup(path);
+    *strrchr(dir, '/') = 0;
+    mkdir_p(dir);
+    free(dir);
+
+    // Write to a temporary file and then rename it, so that concurrent
+    // builds never observe a partially written entry.
+    char *tmppath;
+    asprintf(&tmppath, "%s.%d.%d.tmp", path, (int)getpid(), cache_tmp_counter++);
+    FILE *f = fopen(tmppath, "wb");
+    if (!f) goto end;
+
+    fwrite(CACHE_MAGIC, 1, 4, f);
+    w32le(f, count);
+    for (int i=0; i<count; i++) {
+        char *fn;
+        asprintf(&fn, "%s%s", outfn, files[i]);
+        uint32_t size;
+        uint8_t *data = slurp(fn, &size);
+        free(fn);
+        if (!data) {
+            fclose(f);
+            remove(tmppath);
+            goto end;
+        }
+        w32le(f, strlen(files[i]));
+        fwrite(files[i], 1, strlen(files[i]), f);
+        w32le(f, size);
+        fwrite(data, 1, size, f);
+        free(data);
+    }
+
+    if (fclose(f) != 0 || rename(tmppath, path) != 0)
+        remove(tmppath);
+
+end:
+    free(tmppath);
+    free(path);
+}
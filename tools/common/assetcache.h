@@ -0,0 +1,93 @@
+#ifndef COMMON_ASSETCACHE_H
+#define COMMON_ASSETCACHE_H
+
+/**
+ * @file assetcache.h
+ * @brief Content-addressed on-disk cache for asset conversion tools
+ *
+ * Asset tools (mksprite, mkfont, mkmodel, audioconv64) can use this cache
+ * to skip a conversion when the very same input was already converted with
+ * the very same tool binary and flags. The cache is enabled by setting the
+ * N64_ASSET_CACHE environment variable to a directory (n64.mk exports it).
+ *
+ * Each conversion computes a key by hashing:
+ *
+ *  * The name of the tool and the contents of its executable (so that
+ *    rebuilding the tool invalidates all its entries).
+ *  * The normalized flags that affect the output (added by the tool with
+ *    #assetcache_key_addf).
+ *  * The contents of all the input files (#assetcache_key_add_file).
+ *
+ * The cache entry stores the output file, plus optional side outputs named
+ * after it (eg: "foo.model64.anim"), and can be restored with a different
+ * output path.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Key of a cache entry (128-bit FNV-1a hash) */
+typedef struct {
+    uint64_t lo, hi;
+} assetcache_key_t;
+
+/**
+ * @brief Initialize the cache for the current tool.
+ *
+ * @param tool      Name of the tool (eg: "mksprite")
+ * @param argv0     argv[0] of the tool, used to locate the executable if
+ *                  the OS doesn't provide a better way.
+ * @return true     The cache is enabled
+ * @return false    The cache is disabled (N64_ASSET_CACHE not set, or
+ *                  the tool executable cannot be read)
+ */
+bool assetcache_init(const char *tool, const char *argv0);
+
+/** @brief Return true if the cache was successfully initialized */
+bool assetcache_enabled(void);
+
+/** @brief Start a new key, seeded with the tool identity */
+void assetcache_key_init(assetcache_key_t *key);
+
+/** @brief Add a binary blob to the key */
+void assetcache_key_add(assetcache_key_t *key, const void *data, size_t size);
+
+/** @brief Add a formatted string (typically, normalized flags) to the key */
+__attribute__((format(printf, 2, 3)))
+void assetcache_key_addf(assetcache_key_t *key, const char *fmt, ...);
+
+/** @brief Add the contents of a file to the key. Returns false if the file cannot be read. */
+bool assetcache_key_add_file(assetcache_key_t *key, const char *fn);
+
+/**
+ * @brief Restore a cache entry, if present.
+ *
+ * @param key       Key of the entry
+ * @param outfn     Output file to write. Side outputs are written next to it.
+ * @return true     The entry was found and restored
+ * @return false    The entry is not in cache (or cache is disabled)
+ */
+bool assetcache_fetch(const assetcache_key_t *key, const char *outfn);
+
+/**
+ * @brief Store the result of a conversion in the cache.
+ *
+ * @param key       Key of the entry
+ * @param outfn     Output file produced by the conversion
+ * @param suffixes  NULL-terminated list of suffixes of side outputs, which
+ *                  are named outfn+suffix (eg: ".anim"). Side outputs which
+ *                  do not exist are skipped. Can be NULL.
+ */
+void assetcache_store(const assetcache_key_t *key, const char *outfn, const char **suffixes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
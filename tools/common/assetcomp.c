@@ -21,6 +21,11 @@
 #undef LZ4_DECOMPRESS_INPLACE_MARGIN
 
 #include "lz4_compress.h"
+#include "thread_utils.h"
+
+#define MIN(a,b)            ((a) < (b) ? (a) : (b))
+
+int asset_compress_block_size = 0;
 
 static uint8_t* slurp(const char *fn, int *size)
 {
@@ -36,21 +41,49 @@ static uint8_t* slurp(const char *fn, int *size)
     return buf;
 }
 
-void asset_compress_mem_raw(int compression, const uint8_t *data, int sz, uint8_t **output, int *cmp_size, int *winsize, int *margin)
+/**
+ * @brief Return the window size used to compress data of the specified size.
+ * 
+ * @param compression   Compression level
+ * @param sz            Size of the data compressed as a single stream
+ * @param winsize       Window size requested by the caller, or 0 to use the
+ *                      default for the compression level
+ */
+static int asset_compress_winsize(int compression, int sz, int winsize)
 {
     switch (compression) {
-    case 1: { // lz4hc
+    case 1: // lz4hc
         // Default for LZ4HC is 8 KiB, which makes sense given the little
         // data cache of VR4300 to improve decompression speed.
-        if (*winsize == 0) {
-            *winsize = 8*1024;
-            while (sz < *winsize && *winsize > 2*1024)
-                *winsize /= 2;
+        if (winsize == 0) {
+            winsize = 8*1024;
+            while (sz < winsize && winsize > 2*1024)
+                winsize /= 2;
         }
-
         // The actual max distance of the LZ4 format is 64KiB-1, make sure we
         // don't go over that.
-        if (*winsize > 64*1024) *winsize = 64*1024;
+        if (winsize > 64*1024) winsize = 64*1024;
+        return winsize;
+    case 2: // aplib
+        if (winsize == 0) {
+            winsize = 256*1024;
+            while (sz < winsize && winsize > 2*1024)
+                winsize /= 2;
+        }
+        return winsize;
+    case 3: // shrinkler
+        return 256*1024; // FIXME
+    default:
+        return winsize;
+    }
+}
+
+void asset_compress_mem_raw(int compression, const uint8_t *data, int sz, uint8_t **output, int *cmp_size, int *winsize, int *margin)
+{
+    *winsize = asset_compress_winsize(compression, sz, *winsize);
+
+    switch (compression) {
+    case 1: { // lz4hc
         lz4_distance_max = *winsize;
         if (lz4_distance_max > 65535) lz4_distance_max = 65535;
 
@@ -69,12 +102,6 @@ void asset_compress_mem_raw(int compression, const uint8_t *data, int sz, uint8_
         *margin = LZ4_DECOMPRESS_INPLACE_MARGIN(*cmp_size);
     }   break;
     case 2: { // aplib
-        if (*winsize == 0) {
-            *winsize = 256*1024;
-            while (sz < *winsize && *winsize > 2*1024)
-                *winsize /= 2;
-        }
-    
         apultra_stats stats;
         int max_cmp_size = apultra_get_max_compressed_size(sz);
         *output = calloc(1, max_cmp_size);  // note: apultra.c clears the buffer, not sure why
@@ -88,7 +115,6 @@ void asset_compress_mem_raw(int compression, const uint8_t *data, int sz, uint8_
         *margin = stats.safe_dist + *cmp_size - sz;
     }   break;
     case 3: { // shrinkler
-        *winsize = 256*1024; // FIXME
         int inplace_margin;
         *output = shrinkler_compress(data, sz, 3, cmp_size, &inplace_margin);
         // Shrinkler seems to return negative margin values because we asked to
@@ -135,6 +161,94 @@ bool asset_compress(const char *infn, const char *outfn, int compression, int wi
     return (cmp_size >= 0);
 }
 
+typedef struct {
+    int compression;
+    const uint8_t *data;
+    int sz;
+    int block_size;
+    int winsize;
+    uint8_t **output;
+    int *cmp_size;
+    int *margin;
+} block_compress_t;
+
+static void block_compress(int i, void *arg)
+{
+    block_compress_t *bc = arg;
+    int offset = i * bc->block_size;
+    int dec_size = MIN(bc->block_size, bc->sz - offset);
+    int winsize = bc->winsize;
+    asset_compress_mem_raw(bc->compression, bc->data + offset, dec_size,
+        &bc->output[i], &bc->cmp_size[i], &winsize, &bc->margin[i]);
+}
+
+static int asset_compress_mem_blocks(void *data, int sz, FILE *out, int compression, int winsize, int block_size)
+{
+    int num_blocks = (sz + block_size - 1) / block_size;
+    uint8_t **output = calloc(num_blocks, sizeof(uint8_t*));
+    int *cmp_size = calloc(num_blocks, sizeof(int));
+    int *margin = calloc(num_blocks, sizeof(int));
+
+    // Compress all blocks in parallel. Each block is an independent stream,
+    // so the result does not depend on the number of threads.
+    winsize = asset_compress_winsize(compression, block_size, winsize);
+    block_compress_t bc = {
+        .compression = compression, .data = data, .sz = sz, .block_size = block_size,
+        .winsize = winsize, .output = output, .cmp_size = cmp_size, .margin = margin,
+    };
+    thParaLoopC(num_blocks, block_compress, &bc, 0);
+
+    // Layout the blocks after the table. Each block is 4-byte aligned, as
+    // required by the shrinkler decompressor.
+    int table_size = sizeof(asset_block_table_t) + num_blocks * sizeof(asset_block_t);
+    int *cmp_offset = calloc(num_blocks, sizeof(int));
+    int total_size = table_size;
+    for (int i=0; i<num_blocks; i++) {
+        cmp_offset[i] = total_size;
+        total_size = ROUND_UP(total_size + cmp_size[i], 4);
+    }
+
+    // Compute the margin required for in-place decompression of the whole
+    // asset. Blocks are decompressed in order, so it is sufficient that each
+    // block can be decompressed in place, given that its compressed data ends
+    // at least "margin[i]" bytes after the end of its own decompressed data.
+    // Notice that the compressed data is placed at the end of the buffer, so
+    // it starts at "sz + inplace_margin - total_size".
+    int inplace_margin = 0;
+    for (int i=0; i<num_blocks; i++) {
+        int dec_end = MIN((i+1) * block_size, sz);
+        int cmp_end = cmp_offset[i] + cmp_size[i];
+        int m = dec_end + margin[i] - cmp_end + total_size - sz;
+        if (m > inplace_margin) inplace_margin = m;
+    }
+
+    fwrite("DCA3", 1, 4, out);
+    w16(out, compression); // algo
+    w16(out, asset_winsize_to_flags(winsize) | ASSET_FLAG_INPLACE | ASSET_FLAG_BLOCKS); // flags
+    w32(out, total_size); // cmp_size
+    w32(out, sz); // dec_size
+    w32(out, inplace_margin); // inplace margin
+    w32(out, block_size);
+    w32(out, num_blocks);
+    for (int i=0; i<num_blocks; i++) {
+        w32(out, cmp_offset[i]);
+        w32(out, cmp_size[i]);
+    }
+    for (int i=0; i<num_blocks; i++) {
+        int next_offset = i+1 < num_blocks ? cmp_offset[i+1] : total_size;
+        fwrite(output[i], 1, cmp_size[i], out);
+        for (int j=cmp_offset[i]+cmp_size[i]; j<next_offset; j++)
+            w8(out, 0);
+        free(output[i]);
+    }
+
+    free(cmp_offset);
+    free(output);
+    free(cmp_size);
+    free(margin);
+    return total_size + 20;
+}
+
 int asset_compress_mem(void *data, int sz, FILE *out, int compression, int winsize)
 {
     if (winsize && asset_winsize_to_flags(winsize) < 0) {
@@ -151,98 +265,28 @@ int asset_compress_mem(void *data, int sz, FILE *out, int compression, int winsi
             winsize /= 2;
     }
 
-    // FIXME: use asset_compress_mem_raw() instead of duplicating the code here
-    switch (compression) {
-    case 0: { // none
+    if (compression == 0) {
         fwrite(data, 1, sz, out);
         return sz;
-    }   break;
-    case 3: { // shrinkler
-        winsize = 256*1024; // FIXME
-        int cmp_size; int inplace_margin;
-        uint8_t *output = shrinkler_compress(data, sz, 3, &cmp_size, &inplace_margin);
-        // Shrinkler seems to return negative margin values because we asked to
-        // verify using 4 byte reads. Just clamp to zero.
-        inplace_margin = inplace_margin > 0 ? inplace_margin : 0;
-
-        fwrite("DCA3", 1, 4, out);
-        w16(out, 3); // algo
-        w16(out, asset_winsize_to_flags(winsize) | ASSET_FLAG_INPLACE); // flags
-        w32(out, cmp_size); // cmp_size
-        w32(out, sz); // dec_size
-        w32(out, inplace_margin); // inplace margin
-        fwrite(output, 1, cmp_size, out);
-        free(output);
-        return cmp_size + 20;
-    }   break;
-    case 2: { // aplib
-        if (winsize == 0) {
-            winsize = 256*1024;
-            while (sz < winsize && winsize > 2*1024)
-                winsize /= 2;
-        }
-    
-        apultra_stats stats;
-        int max_cmp_size = apultra_get_max_compressed_size(sz);
-        void *output = calloc(1, max_cmp_size);  // note: apultra.c clears the buffer, not sure why
-        int cmp_size = apultra_compress(data, output, sz, max_cmp_size, 
-            0,          // flags
-            winsize,    // window size
-            0,          // dictionary size
-            NULL,       // progress callback
-            &stats);
-
-        int inplace_margin = stats.safe_dist + cmp_size - sz;
-        fwrite("DCA3", 1, 4, out);
-        w16(out, 2); // algo
-        w16(out, asset_winsize_to_flags(winsize) | ASSET_FLAG_INPLACE); // flags
-        w32(out, cmp_size); // cmp_size
-        w32(out, sz); // dec_size
-        w32(out, inplace_margin); // inplace margin
-        fwrite(output, 1, cmp_size, out);
-        free(output);
-        return cmp_size + 20;
-    }   break;
-    case 1: { // lz4hc
-        // Default for LZ4HC is 8 KiB, which makes sense given the little
-        // data cache of VR4300 to improve decompression speed.
-        if (winsize == 0) {
-            winsize = 8*1024;
-            while (sz < winsize && winsize > 2*1024)
-                winsize /= 2;
-        }
+    }
 
-        // The actual max distance of the LZ4 format is 64KiB-1, make sure we
-        // don't go over that.
-        if (winsize > 64*1024) winsize = 64*1024;
-        lz4_distance_max = winsize;
-        if (lz4_distance_max > 65535) lz4_distance_max = 65535;
+    // Split in blocks only the slow compressors, as LZ4 is fast enough already.
+    // Notice that block-compressed assets cannot be streamed via asset_fopen(),
+    // which requires a single stream: this drops asset_fopen() support for
+    // aPLib (level 2) assets, which can otherwise be streamed.
+    if (asset_compress_block_size > 0 && compression >= 2 && sz > asset_compress_block_size)
+        return asset_compress_mem_blocks(data, sz, out, compression, winsize, asset_compress_block_size);
 
-        int cmp_max_size = LZ4_COMPRESSBOUND(sz);
-        void *output = malloc(cmp_max_size);
+    uint8_t *output; int cmp_size, margin;
+    asset_compress_mem_raw(compression, data, sz, &output, &cmp_size, &winsize, &margin);
 
-        // Compress the file. Use compression level LZ4HC_CLEVEL_MAX and
-        // "favor decompression speed", as we prefer to leave a bit of
-        // compression ratio on the table in exchange for faster decompression.
-        LZ4_streamHC_t* state = LZ4_createStreamHC();
-        LZ4_setCompressionLevel(state, LZ4HC_CLEVEL_MAX);
-        LZ4_favorDecompressionSpeed(state, 1);
-        int cmp_size = LZ4_compress_HC_continue(state, (char*)data, output, sz, cmp_max_size);
-        LZ4_freeStreamHC(state);
-        assert(cmp_size <= cmp_max_size);
-
-        fwrite("DCA3", 1, 4, out);
-        w16(out, 1); // algo
-        w16(out, asset_winsize_to_flags(winsize) | ASSET_FLAG_INPLACE); // flags
-        w32(out, cmp_size); // cmp_size
-        w32(out, sz); // dec_size
-        w32(out, LZ4_DECOMPRESS_INPLACE_MARGIN(cmp_size)); // inplace margin
-        fwrite(output, 1, cmp_size, out);
-        free(output);
-        return cmp_size + 20;
-    }   break;
-    default:
-        assert(0);
-        return -1;
-    }
+    fwrite("DCA3", 1, 4, out);
+    w16(out, compression); // algo
+    w16(out, asset_winsize_to_flags(winsize) | ASSET_FLAG_INPLACE); // flags
+    w32(out, cmp_size); // cmp_size
+    w32(out, sz); // dec_size
+    w32(out, margin); // inplace margin
+    fwrite(output, 1, cmp_size, out);
+    free(output);
+    return cmp_size + 20;
 }
@@ -13,6 +13,12 @@
 extern "C" {
 #endif
 
+// If not zero, asset_compress() and asset_compress_mem() split data bigger than
+// this size in independent blocks (ASSET_FLAG_BLOCKS), that are compressed in
+// parallel using all the available cores. This only affects the slow
+// compression levels (2 and 3), at the cost of a slightly worse ratio.
+extern int asset_compress_block_size;
+
 bool asset_compress(const char *infn, const char *outfn, int compression, int winsize);
 int asset_compress_mem(void *data, int sz, FILE *out, int compression, int winsize);
 void asset_compress_mem_raw(int compression, const uint8_t *inbuf, int size, uint8_t **outbuf, int *cmp_size, int *winsize, int *margin);
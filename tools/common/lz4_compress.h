@@ -1,5 +1,7 @@
 
-extern int lz4_distance_max;
+// Thread-local so that multiple assets can be compressed in parallel with
+// different window sizes.
+extern __thread int lz4_distance_max;
 
 #define LZ4_HC_STATIC_LINKING_ONLY
 #include "lz4/lz4.h"
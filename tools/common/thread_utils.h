@@ -1,3 +1,8 @@
+#ifndef COMMON_THREAD_UTILS_H
+#define COMMON_THREAD_UTILS_H
+
+#ifdef __cplusplus
+
 #include <atomic>
 #include <thread>
 #include <functional>
@@ -15,7 +20,7 @@ inline void thParaLoop(std::function<void()> f, int threads_count=std::thread::h
 
 // paraLoop(h, f) runs a sequence of "h" tasks using multiple tasks. The function
 // will spawn the requested number of work thread, and call f(i) for each value
-// in the range [0, h-1] using all available threads in parallel. 
+// in the range [0, h-1] using all available threads in parallel.
 inline void thParaLoop(int h, std::function<void(int)> f, int threads_count=std::thread::hardware_concurrency()) {
     std::atomic_int gy(0);
     thParaLoop([&](){
@@ -24,3 +29,71 @@ inline void thParaLoop(int h, std::function<void(int)> f, int threads_count=std:
         }
     }, std::min(threads_count, h));
 }
+
+#else
+
+// C version of the above, for tools written in C. Tasks are handed out through
+// an atomic counter, so the order of execution is not deterministic: callers
+// must write the result of task i into slot i and combine them afterwards.
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+typedef struct {
+    atomic_int next;
+    int h;
+    void (*f)(int i, void *arg);
+    void *arg;
+} th_paraloop_t;
+
+static void *th_paraloop_worker(void *p) {
+    th_paraloop_t *pl = (th_paraloop_t*)p;
+    for (int y=pl->next++; y<pl->h; y=pl->next++)
+        pl->f(y, pl->arg);
+    return NULL;
+}
+
+// Return the number of hardware threads available on the host.
+static inline int thHardwareConcurrency(void) {
+    #ifdef _WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return si.dwNumberOfProcessors;
+    #else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? n : 1;
+    #endif
+}
+
+// thParaLoopC(h, f, arg, threads) calls f(i, arg) for each value in the range
+// [0, h-1] using up to the requested number of threads (0 = all available),
+// and waits for all of them to finish.
+static inline void thParaLoopC(int h, void (*f)(int i, void *arg), void *arg, int threads_count) {
+    if (threads_count <= 0) threads_count = thHardwareConcurrency();
+    if (threads_count > h) threads_count = h;
+
+    th_paraloop_t pl = { .h = h, .f = f, .arg = arg };
+    atomic_init(&pl.next, 0);
+    if (threads_count <= 1) {
+        th_paraloop_worker(&pl);
+        return;
+    }
+
+    pthread_t *workers = malloc((threads_count-1) * sizeof(pthread_t));
+    for (int i=0; i<threads_count-1; i++)
+        pthread_create(&workers[i], NULL, th_paraloop_worker, &pl);
+    th_paraloop_worker(&pl);
+    for (int i=0; i<threads_count-1; i++)
+        pthread_join(workers[i], NULL);
+    free(workers);
+}
+
+#endif /* __cplusplus */
+
+#endif /* COMMON_THREAD_UTILS_H */
@@ -14,9 +14,10 @@
 #define SWAPLONG(i) (((uint32_t)((i) & 0xFF000000) >> 24) | ((uint32_t)((i) & 0x00FF0000) >>  8) | ((uint32_t)((i) & 0x0000FF00) <<  8) | ((uint32_t)((i) & 0x000000FF) << 24))
 #endif
 
-struct directory_entry root_dirent = {
-    .flags = SWAPLONG(ROOT_FLAGS),
-    .path = ROOT_PATH,
+/* Root sectors of the supported versions, used to locate the filesystem in a ROM */
+struct directory_entry root_dirents[] = {
+    { .flags = SWAPLONG(ROOT_FLAGS), .path = ROOT_PATH_V3 },
+    { .flags = SWAPLONG(ROOT_FLAGS), .path = ROOT_PATH_V2 },
 };
 
 /* Directory walking flags */
@@ -417,7 +418,8 @@ int dfs_init_pc(void *base_fs_loc, int tries)
         directory_entry_t id_node;
         grab_sector(base_fs_loc, &id_node);
 
-        if(SWAPLONG(id_node.flags) == ROOT_FLAGS && !strcmp(id_node.path, ROOT_PATH))
+        if(SWAPLONG(id_node.flags) == ROOT_FLAGS &&
+           (!strcmp(id_node.path, ROOT_PATH_V3) || !strcmp(id_node.path, ROOT_PATH_V2)))
         {
             /* Passes, set up the FS */
             base_ptr = base_fs_loc;
@@ -747,6 +749,19 @@ void list_dir( char *directory, int depth )
     } while( (dir = dumpdfs_dir_findnext( path )) != FLAGS_EOF );
 }
 
+/* Find the root sector of a DragonFS within a ROM image */
+static void *find_root(void *rom, int size)
+{
+    for (int i = 0; i < sizeof(root_dirents) / sizeof(root_dirents[0]); i++)
+    {
+        //Exclude ROOT_NEXT_ENTRY and root file_pointer
+        void *fs = memmem(rom, size, ((uint8_t *)&root_dirents[i])+4, sizeof(root_dirents[i])-8);
+        if (fs)
+            return fs;
+    }
+    return NULL;
+}
+
 void usage(void)
 {
     printf("dumpdfs - Dump the contents of a Dragon FS\n\n");
@@ -792,7 +807,7 @@ int main( int argc, char *argv[] )
             int offset = 0;
             if (!strstr(argv[2], ".dfs"))
             {
-                void *fs = memmem(filesystem, lSize, ((uint8_t *)&root_dirent)+4, sizeof(root_dirent)-8); //Exclude ROOT_NEXT_ENTRY and root file_pointer
+                void *fs = find_root(filesystem, lSize);
                 if (!fs)
                 {
                     fprintf(stderr, "cannot find DragonFS in ROM\n");
@@ -835,7 +850,7 @@ int main( int argc, char *argv[] )
             int offset = 0;
             if (!strstr(argv[2], ".dfs"))
             {
-                void *fs = memmem(filesystem, lSize, ((uint8_t *)&root_dirent)+4, sizeof(root_dirent)-8); //Exclude ROOT_NEXT_ENTRY and root file_pointer
+                void *fs = find_root(filesystem, lSize);
                 if (!fs)
                 {
                     fprintf(stderr, "cannot find DragonFS in ROM\n");
@@ -11,7 +11,157 @@
 #include "asset.h"
 #include "../../src/asset_internal.h"
 
+#include "../common/thread_utils.h"
+
+// Pseudo compression level that selects the best level for each file
+#define COMPRESSION_BEST        -1
+
+// Default value of --rom-cost: how many microseconds of loading time we are
+// willing to spend to save 1 KiB of ROM.
+#define DEFAULT_ROM_COST        1000
+
 bool flag_verbose = false;
+float flag_rom_cost = DEFAULT_ROM_COST;
+
+/**
+ * @brief PI timings for ROM (domain 1) configured by IPL3 (see boot/ipl3.c).
+ * 
+ * Each 16-bit transfer takes PWD+1 + RLS+1 RCP cycles, and each page of
+ * 2^(PGS+2) bytes adds a latency of LAT+1 cycles.
+ */
+#define PI_DOM1_LAT             0x40
+#define PI_DOM1_PWD             0x12
+#define PI_DOM1_PGS             0x07
+#define PI_DOM1_RLS             0x03
+#define RCP_CLOCK               62.5e6
+
+/** @brief ROM throughput in bytes per second, derived from the PI timings */
+#define ROM_THROUGHPUT          ((1 << (PI_DOM1_PGS+2)) * RCP_CLOCK / \
+                                 ((PI_DOM1_LAT+1) + ((1 << (PI_DOM1_PGS+2)) / 2) * ((PI_DOM1_PWD+1) + (PI_DOM1_RLS+1))))
+
+/**
+ * @brief Throughput of the N64 runtime, in bytes per second.
+ * 
+ * The first entry is the ROM throughput, the others are the throughput of
+ * the decompressors (in decompressed bytes) for each compression level.
+ * 
+ * The decompressor figures were generated by assetbench, running the
+ * decompressors over the assets of the examples (2.9 MB in 34 files):
+ * 
+ *     cd examples
+ *     assetbench -f 0 -w 256 -i 5 --host-mhz 2100 --profile <file> \
+ *         brew-volley/assets customfont/assets fontdemo/assets gldemo/assets \
+ *         micro-ui/assets mixertest/assets pixelshader/assets rdpqdemo/assets \
+ *         spriteanim/assets vifx/assets
+ * 
+ * assetbench scales the host throughput by the ratio between the N64 and the
+ * host CPU clocks. This does not account for the slower N64 memory and caches,
+ * so the figures are optimistic. The effect is largest for LZ4: its scaled
+ * figure (~150 MB/s) would make decompression look free and LZ4 always win
+ * over level 0. LZ4 therefore uses a conservative figure below the ROM
+ * throughput (~5.4 MB/s), so that it is only selected when the smaller
+ * transfer actually saves loading time. All figures can be overridden with
+ * --throughput, for instance with figures measured on hardware.
+ */
+static float n64_throughput[MAX_COMPRESSION+1] = {
+    ROM_THROUGHPUT,
+    4.000e6,    // LZ4 (conservative, see above)
+    4.676e6,    // aPLib
+    0.673e6,    // Shrinkler
+};
+
+static const char *throughput_names[MAX_COMPRESSION+1] = { "rom", "lz4", "aplib", "shrinkler" };
+
+/** @brief Load a throughput profile (as written by assetbench --profile) */
+static bool load_throughput(const char *fn)
+{
+    FILE *f = fopen(fn, "r");
+    if (!f) {
+        fprintf(stderr, "error opening throughput profile: %s\n", fn);
+        return false;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        char name[64]; float mbps;
+        if (line[0] == '#' || sscanf(line, "%63s %f", name, &mbps) != 2)
+            continue;
+        int level;
+        for (level=0; level<=MAX_COMPRESSION; level++)
+            if (!strcmp(name, throughput_names[level])) break;
+        if (level > MAX_COMPRESSION || mbps <= 0) {
+            fprintf(stderr, "invalid entry in throughput profile %s: %s", fn, line);
+            fclose(f);
+            return false;
+        }
+        n64_throughput[level] = mbps * 1e6f;
+    }
+    fclose(f);
+    return true;
+}
+
+/** @brief Estimated time in microseconds to load an asset with asset_load() */
+static float estimate_load_time(int compression, int dec_size, int cmp_size)
+{
+    float dma_time = cmp_size / n64_throughput[0];
+    if (compression == 0)
+        return dma_time * 1e6f;
+
+    // asset_load() decompresses racing with the DMA, so the loading time
+    // is bound by the slowest of the two.
+    float dec_time = dec_size / n64_throughput[compression];
+    return (dma_time > dec_time ? dma_time : dec_time) * 1e6f;
+}
+
+typedef struct {
+    void *data;
+    int sz;
+    int winsize;
+    FILE *out[MAX_COMPRESSION+1];
+    int cmp_size[MAX_COMPRESSION+1];
+    float load_time[MAX_COMPRESSION+1];
+} compress_best_t;
+
+static void compress_level(int level, void *arg)
+{
+    compress_best_t *cb = arg;
+    cb->out[level] = tmpfile();
+    asset_compress_mem(cb->data, cb->sz, cb->out[level], level, cb->winsize);
+    cb->cmp_size[level] = ftell(cb->out[level]);
+    cb->load_time[level] = estimate_load_time(level, cb->sz, cb->cmp_size[level]);
+}
+
+/**
+ * @brief Compress a file with all levels, and write the one with the lowest cost.
+ * 
+ * The cost of each level is the estimated loading time plus the ROM size,
+ * weighted by #flag_rom_cost. All levels are tried in parallel.
+ * 
+ * @return The selected compression level
+ */
+static int compress_best(compress_best_t *cb, FILE *out)
+{
+    thParaLoopC(MAX_COMPRESSION+1, compress_level, cb, 0);
+
+    int best = 0;
+    float best_cost = 0;
+    for (int level=0; level<=MAX_COMPRESSION; level++) {
+        float cost = cb->load_time[level] + flag_rom_cost * cb->cmp_size[level] / 1024.0f;
+        if (level == 0 || cost < best_cost) {
+            best = level;
+            best_cost = cost;
+        }
+    }
+
+    FILE *f = cb->out[best];
+    char buf[64*1024]; int n;
+    rewind(f);
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        fwrite(buf, 1, n, out);
+
+    for (int level=0; level<=MAX_COMPRESSION; level++)
+        fclose(cb->out[level]);
+    return best;
+}
 
 void print_args(char * name)
 {
@@ -24,11 +174,23 @@ void print_args(char * name)
     fprintf(stderr, "Command-line flags:\n");
     fprintf(stderr, "   -v/--verbose            Verbose output\n");
     fprintf(stderr, "   -o/--output <dir>       Specify output directory (default: .)\n");
-    fprintf(stderr, "   -c/--compress <algo>    Compression level 0-%d (default: %d)\n", MAX_COMPRESSION, DEFAULT_COMPRESSION);
+    fprintf(stderr, "   -c/--compress <algo>    Compression level 0-%d, or \"best\" (default: %d)\n", MAX_COMPRESSION, DEFAULT_COMPRESSION);
     fprintf(stderr, "   -w/--winsize <window>   Maximum size of the matching window in KiB. (default: %d)\n", DEFAULT_WINSIZE_STREAMING/1024);
+    fprintf(stderr, "   -b/--blocks <size>      Split files in independent blocks of this size in KiB, compressed\n");
+    fprintf(stderr, "                           in parallel (levels 2-3 only, default: 0 = no split).\n");
+    fprintf(stderr, "                           Block-compressed files cannot be streamed with asset_fopen(),\n");
+    fprintf(stderr, "                           so level 2 files lose streaming support.\n");
+    fprintf(stderr, "   --rom-cost <us>         With -c best: loading time in microseconds worth saving 1 KiB of ROM (default: %d)\n", DEFAULT_ROM_COST);
+    fprintf(stderr, "   --throughput <file>     With -c best: throughput profile of the N64 decompressors (see assetbench --profile)\n");
+    fprintf(stderr, "   --report <file.csv>     Write a CSV report with the compressed size and estimated loading time\n");
     fprintf(stderr, "\nSupported window sizes: 2, 4, 8, 16, 32, 64, 128, 256\n");
     fprintf(stderr, "The window size affects the memory used by asset_fopen() only.\n");
     fprintf(stderr, "If you only use asset_load(), use the biggest window (256 KiB) to improve ratio.\n");
+    fprintf(stderr, "Block-compressed files can only be loaded with asset_load(), not asset_fopen().\n");
+    fprintf(stderr, "\nWith -c best, each file is compressed with all levels, and the level with the lowest\n");
+    fprintf(stderr, "cost is selected. The cost is the estimated loading time on N64 plus the ROM size\n");
+    fprintf(stderr, "weighted by --rom-cost. Remember to call asset_init_compression() for the selected\n");
+    fprintf(stderr, "levels (see the report), and that level 3 does not support asset_fopen().\n");
     fprintf(stderr, "\n");
 }
 
@@ -37,6 +199,7 @@ int main(int argc, char *argv[])
     char *infn = NULL, *outdir = ".", *outfn = NULL;
     int compression = DEFAULT_COMPRESSION;
     int winsize = DEFAULT_WINSIZE_STREAMING;
+    FILE *report = NULL;
 
     // Initialize all compression levels
     asset_init_compression(2);
@@ -82,6 +245,10 @@ int main(int argc, char *argv[])
                     return 1;
                 }
                 char extra;
+                if (!strcmp(argv[i], "best")) {
+                    compression = COMPRESSION_BEST;
+                    continue;
+                }
                 if (sscanf(argv[i], "%d%c", &compression, &extra) != 1) {
                     fprintf(stderr, "invalid argument for %s: %s\n", argv[i-1], argv[i]);
                     return 1;
@@ -90,6 +257,48 @@ int main(int argc, char *argv[])
                     fprintf(stderr, "invalid compression algorithm: %d\n", compression);
                     return 1;
                 }
+            } else if (!strcmp(argv[i], "-b") || !strcmp(argv[i], "--blocks")) {
+                if (++i == argc) {
+                    fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                char extra; int block_size;
+                if (sscanf(argv[i], "%d%c", &block_size, &extra) != 1 || block_size < 0) {
+                    fprintf(stderr, "invalid argument for %s: %s\n", argv[i-1], argv[i]);
+                    return 1;
+                }
+                asset_compress_block_size = block_size * 1024;
+            } else if (!strcmp(argv[i], "--rom-cost")) {
+                if (++i == argc) {
+                    fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                char extra;
+                if (sscanf(argv[i], "%f%c", &flag_rom_cost, &extra) != 1 || flag_rom_cost < 0) {
+                    fprintf(stderr, "invalid argument for %s: %s\n", argv[i-1], argv[i]);
+                    return 1;
+                }
+            } else if (!strcmp(argv[i], "--throughput")) {
+                if (++i == argc) {
+                    fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                if (!load_throughput(argv[i]))
+                    return 1;
+            } else if (!strcmp(argv[i], "--report")) {
+                if (++i == argc) {
+                    fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                report = fopen(argv[i], "w");
+                if (!report) {
+                    fprintf(stderr, "error opening report file: %s\n", argv[i]);
+                    return 1;
+                }
+                fprintf(report, "file,size");
+                for (int level=0; level<=MAX_COMPRESSION; level++)
+                    fprintf(report, ",level%d_size,level%d_load_us", level, level);
+                fprintf(report, ",level\n");
             } else {
                 fprintf(stderr, "invalid flag: %s\n", argv[i]);
                 return 1;
@@ -103,8 +312,12 @@ int main(int argc, char *argv[])
 
         asprintf(&outfn, "%s/%s", outdir, basename);
 
-        if (flag_verbose)
-            printf("Compressing: %s => %s [algo=%d]\n", infn, outfn, compression);
+        if (flag_verbose) {
+            if (compression == COMPRESSION_BEST)
+                printf("Compressing: %s => %s [algo=best]\n", infn, outfn);
+            else
+                printf("Compressing: %s => %s [algo=%d]\n", infn, outfn, compression);
+        }
 
         if (!file_exists(infn)) {
             fprintf(stderr, "error: input file not found: %s\n", infn);
@@ -121,9 +334,37 @@ int main(int argc, char *argv[])
             fprintf(stderr, "error opening output file: %s\n", outfn);
             return 1;
         }
-        asset_compress_mem(data, sz, out, compression, winsize);
+
+        // Compress the file and collect the statistics for the report. For
+        // a fixed level, only that level is reported.
+        compress_best_t cb = { .data = data, .sz = sz, .winsize = winsize };
+        int level = compression;
+        if (compression == COMPRESSION_BEST) {
+            level = compress_best(&cb, out);
+        } else {
+            cb.cmp_size[level] = asset_compress_mem(data, sz, out, level, winsize);
+            cb.load_time[level] = estimate_load_time(level, sz, cb.cmp_size[level]);
+        }
         fclose(out);
+        free(data);
+
+        if (flag_verbose && compression == COMPRESSION_BEST)
+            printf("  selected level %d (%d => %d bytes, ~%.0f us)\n", level, sz, cb.cmp_size[level], cb.load_time[level]);
+
+        if (report) {
+            fprintf(report, "%s,%d", infn, sz);
+            for (int l=0; l<=MAX_COMPRESSION; l++) {
+                if (compression == COMPRESSION_BEST || l == level)
+                    fprintf(report, ",%d,%.0f", cb.cmp_size[l], cb.load_time[l]);
+                else
+                    fprintf(report, ",,");
+            }
+            fprintf(report, ",%d\n", level);
+        }
 
         free(outfn);
     }
+
+    if (report) fclose(report);
+    return 0;
 }
@@ -9,8 +9,10 @@
 #include <sys/types.h>
 #include <sys/param.h>
 #include <stdbool.h>
+#include <inttypes.h>
 #include "dragonfs.h"
 #include "dfsinternal.h"
+#include "../common/thread_utils.h"
 
 #define STBDS_NO_SHORT_NAMES
 #define STB_DS_IMPLEMENTATION //Hack to get tools to compile
@@ -23,6 +25,53 @@ typedef struct dfs_file_s {
     uint32_t data_len;
 } dfs_file_t;
 
+/** @brief Kind of a region of the image, as recorded in the manifest */
+typedef enum {
+    REGION_ROOT,            ///< Root sector (identifier)
+    REGION_DIRENT,          ///< Directory entry of a file or directory
+    REGION_FILE,            ///< File contents
+    REGION_LOOKUP,          ///< Lookup table
+    REGION_PATHS,           ///< Path strings of the lookup table
+    REGION_FREE,            ///< Unused space (left by an incremental update)
+} region_kind_t;
+
+static const char *region_kind_names[] = { "root", "dirent", "file", "lookup", "paths", "free" };
+
+/** @brief A region of the image (a contiguous extent) */
+typedef struct {
+    region_kind_t kind;
+    uint32_t ofs;           ///< Offset in the image (aligned to dfs_align)
+    uint32_t capacity;      ///< Allocated size (multiple of dfs_align)
+    uint32_t size;          ///< Size of the file (REGION_FILE only)
+    int64_t mtime;          ///< Modification time of the file in ns (REGION_FILE only)
+    uint64_t hash;          ///< Hash of the file contents (REGION_FILE only)
+    char *path;             ///< Path relative to the root (REGION_FILE and REGION_DIRENT)
+    bool dirty;             ///< Region must be written to the image
+    bool used;              ///< Old region reused by the new image
+} region_t;
+
+/** @brief A file that must be read into the image */
+typedef struct {
+    char *fn;               ///< Path of the file on disk
+    int region;             ///< Index of the REGION_FILE in regions
+    uint64_t old_hash;      ///< Hash of the previous contents (if patching in place)
+    bool patch;             ///< Region existed in the previous image
+    bool error;             ///< Reading failed
+} read_job_t;
+
+/** @brief Regions of the image being built */
+region_t *regions = NULL;
+/** @brief Regions of the previous image (incremental mode) */
+region_t *old_regions = NULL;
+/** @brief Files to read */
+read_job_t *read_jobs = NULL;
+
+/** @brief Alignment of extents: DFS_V3_ALIGN, or SECTOR_SIZE for DFS v2 */
+uint32_t dfs_align = DFS_V3_ALIGN;
+bool flag_incremental = false;
+int flag_jobs = 1;
+uint32_t old_fs_size = 0;
+
 #if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
 #define SWAPLONG(i) (i)
 #else
@@ -50,7 +99,7 @@ static inline void *sector_to_memory(uint32_t offset)
 uint32_t dfs_alloc(int size)
 {
     void *end;
-    int rsize = (size + SECTOR_SIZE - 1) / SECTOR_SIZE * SECTOR_SIZE;
+    int rsize = (size + dfs_align - 1) / dfs_align * dfs_align;
 
     if(!dfs)
     {
@@ -84,64 +133,245 @@ uint32_t new_blob(int size)
     return dfs_alloc(size);    
 }
 
+/** @brief Free space of the previous image, available for reuse (incremental mode) */
+typedef struct {
+    uint32_t ofs;
+    uint32_t capacity;
+} free_space_t;
+
+free_space_t *free_dirents = NULL;
+free_space_t *free_space = NULL;
+/** @brief Map from relative path to index of its REGION_FILE in old_regions */
+struct { char *key; int value; } *old_files = NULL;
+
+static inline uint32_t round_extent(uint32_t size)
+{
+    return (size + dfs_align - 1) / dfs_align * dfs_align;
+}
+
+/* Allocate space from the free space of the previous image (first fit), or
+   append it at the end of the image. */
+static uint32_t alloc_space(free_space_t *pool, int size)
+{
+    uint32_t rsize = round_extent(size);
+    for (int i = 0; i < stbds_arrlen(pool); i++)
+    {
+        if (pool[i].capacity >= rsize)
+        {
+            uint32_t ofs = pool[i].ofs;
+            pool[i].ofs += rsize;
+            pool[i].capacity -= rsize;
+            memset(sector_to_memory(ofs), 0, rsize);
+            return ofs;
+        }
+    }
+    return dfs_alloc(size);
+}
+
+static int add_region(region_kind_t kind, uint32_t ofs, uint32_t capacity, const char *path)
+{
+    region_t r = {
+        .kind = kind, .ofs = ofs, .capacity = capacity,
+        .path = path ? strdup(path) : NULL, .dirty = true,
+    };
+    stbds_arrpush(regions, r);
+    return stbds_arrlen(regions) - 1;
+}
+
+/* Allocate a directory entry. In incremental mode, directory entries are always
+   rewritten, reusing the space of the previous ones in order: this keeps the
+   first entry of the root directory right after the root sector, where the
+   runtime expects it. */
+uint32_t new_dirent(const char *rel)
+{
+    uint32_t ofs;
+    if (stbds_arrlen(free_dirents) > 0)
+    {
+        ofs = free_dirents[0].ofs;
+        stbds_arrdel(free_dirents, 0);
+        memset(sector_to_memory(ofs), 0, SECTOR_SIZE);
+    }
+    else
+    {
+        ofs = alloc_space(free_space, SECTOR_SIZE);
+    }
+    add_region(REGION_DIRENT, ofs, SECTOR_SIZE, rel);
+    return ofs;
+}
+
+static int64_t file_mtime(const struct stat *st)
+{
+    #if defined(__APPLE__)
+    return (int64_t)st->st_mtimespec.tv_sec * 1000000000 + st->st_mtimespec.tv_nsec;
+    #elif defined(_WIN32)
+    return (int64_t)st->st_mtime * 1000000000;
+    #else
+    return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+    #endif
+}
+
+static uint64_t fnv64(const uint8_t *data, uint32_t size)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (uint32_t i = 0; i < size; i++)
+        hash = (hash ^ data[i]) * 0x100000001b3ull;
+    return hash;
+}
+
 void kill_fs()
 {
     if(dfs)
     {
         free(dfs);
     }
+    dfs = NULL;
+    fs_size = 0;
     for(size_t i=0; i<stbds_arrlenu(dfs_files); i++) {
         free(dfs_files[i].path);
     }
     stbds_arrfree(dfs_files);
+    for(int i=0; i<stbds_arrlen(regions); i++) {
+        free(regions[i].path);
+    }
+    stbds_arrfree(regions);
+    for(int i=0; i<stbds_arrlen(read_jobs); i++) {
+        free(read_jobs[i].fn);
+    }
+    stbds_arrfree(read_jobs);
+    stbds_arrfree(free_space);
+    stbds_arrfree(free_dirents);
+}
+
+void kill_manifest()
+{
+    for(int i=0; i<stbds_arrlen(old_regions); i++) {
+        free(old_regions[i].path);
+    }
+    stbds_arrfree(old_regions);
+    stbds_shfree(old_files);
+    old_fs_size = 0;
 }
 
 void print_help(const char * const prog_name)
 {
-    fprintf(stderr, "Usage: %s <File> <Directory>\n", prog_name);
+    fprintf(stderr, "Usage: %s [flags] <File> <Directory>\n", prog_name);
     fprintf(stderr, "  where <File> is the resulting filesystem image\n");
     fprintf(stderr, "  and <Directory> is the directory (including subdirectories) to include\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Command-line flags:\n");
+    fprintf(stderr, "   -j/--jobs <N>           Read files using N parallel threads (0 = all cores, default: 1)\n");
+    fprintf(stderr, "   -i/--incremental        Update the existing image in place, rewriting only the files\n");
+    fprintf(stderr, "                           that changed since the last build (requires the manifest)\n");
+    fprintf(stderr, "   -m/--manifest <file>    Manifest describing the image layout (default: <File>.manifest)\n");
+    fprintf(stderr, "   --v2                    Create a DFS v2 image (256-byte sectors), for older libdragon versions\n");
 }
 
-uint32_t add_file(const char * const file, uint32_t *size)
+uint32_t add_file(const char * const file, const char * const rel, uint32_t *size)
 {
-    FILE *fp;
-
-    printf("Adding '%s' to filesystem image.\n", file);
-
-    fp = fopen(file, "rb");
+    struct stat st;
 
-    if(!fp)
+    if(stat(file, &st) != 0)
     {
         fprintf(stderr, "Cannot open file '%s' for read!\n", file);
         return 0;
     }
 
-    fseek(fp, 0, SEEK_END);
-    *size = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
+    *size = st.st_size;
 
-    if (*size > 0x0FFFFFFF)
+    if (st.st_size > 0x0FFFFFFF)
     {
         fprintf(stderr, "File '%s' too big for the filesystem!\n", file);
         return 0;
     }
 
-    uint32_t blob = new_blob(*size);
-    uint8_t *data = sector_to_memory(blob);
+    int64_t mtime = file_mtime(&st);
+    read_job_t job = { .fn = strdup(file) };
 
-    int read = fread(data, 1, *size, fp);
-    if (read < 0) {
-        /* Wat? */
-        fprintf(stderr, "Cannot add all contents of file '%s' to filesystem!\n", file);
-        fclose(fp);
-        return 0;    
+    /* In incremental mode, keep the file where it was if it still fits. If it
+       was not even modified, there is nothing to read. */
+    int old_idx = stbds_shgeti(old_files, rel);
+    region_t *old = old_idx >= 0 ? &old_regions[old_files[old_idx].value] : NULL;
+    uint32_t blob;
+    int r;
+    if(old && round_extent(*size) <= old->capacity)
+    {
+        blob = old->ofs;
+        r = add_region(REGION_FILE, blob, old->capacity, rel);
+        old->used = true;
+        if(old->size == *size && old->mtime == mtime)
+        {
+            regions[r].size = *size;
+            regions[r].mtime = mtime;
+            regions[r].hash = old->hash;
+            regions[r].dirty = false;
+            free(job.fn);
+            return blob;
+        }
+        job.patch = true;
+        job.old_hash = old->hash;
+    }
+    else
+    {
+        if(old)
+        {
+            /* The file grew: move it, and recycle its previous space */
+            free_space_t fs = { old->ofs, old->capacity };
+            stbds_arrpush(free_space, fs);
+            old->used = true;
+        }
+        blob = alloc_space(free_space, *size);
+        r = add_region(REGION_FILE, blob, round_extent(*size), rel);
     }
 
-    fclose(fp);
+    printf("Adding '%s' to filesystem image.\n", file);
+
+    regions[r].size = *size;
+    regions[r].mtime = mtime;
+    job.region = r;
+    stbds_arrpush(read_jobs, job);
     return blob;
 }
 
+static void read_file_job(int i, void *arg)
+{
+    read_job_t *job = &read_jobs[i];
+    region_t *r = &regions[job->region];
+    uint8_t *data = sector_to_memory(r->ofs);
+
+    FILE *fp = fopen(job->fn, "rb");
+    if(!fp || fread(data, 1, r->size, fp) != r->size)
+    {
+        job->error = true;
+        if(fp) fclose(fp);
+        return;
+    }
+    fclose(fp);
+
+    /* Skip writing files whose contents did not change (just touched) */
+    r->hash = fnv64(data, r->size);
+    if(job->patch && r->hash == job->old_hash)
+        r->dirty = false;
+}
+
+/* Read all queued files into the image, in parallel */
+bool read_files(void)
+{
+    thParaLoopC(stbds_arrlen(read_jobs), read_file_job, NULL, flag_jobs);
+
+    bool ok = true;
+    for(int i = 0; i < stbds_arrlen(read_jobs); i++)
+    {
+        if(read_jobs[i].error)
+        {
+            fprintf(stderr, "Cannot add all contents of file '%s' to filesystem!\n", read_jobs[i].fn);
+            ok = false;
+        }
+        free(read_jobs[i].fn);
+    }
+    stbds_arrfree(read_jobs);
+    return ok;
+}
+
 static uint32_t prime_hash(const char *str, uint32_t prime)
 {
     uint32_t hash = 0;
@@ -213,9 +443,11 @@ uint32_t add_directory(const char * const base_path, const char * const path)
         /* Figure out if it is a directory or regular (windows doesn't include d_type in dirent) */
         stat( file, &stats );
 
+        const char *rel = file+strlen(base_path)+1;
+
         if(S_ISREG(stats.st_mode))
         {
-            uint32_t new_entry = new_sector();
+            uint32_t new_entry = new_dirent(rel);
             uint32_t file_size = 0;
 
             tmp_entry = sector_to_memory(new_entry);
@@ -225,7 +457,7 @@ uint32_t add_directory(const char * const base_path, const char * const path)
             strncpy(tmp_entry->path, mybasename(file), MAX_FILENAME_LEN);
             tmp_entry->path[MAX_FILENAME_LEN] = 0;
 
-            uint32_t new_file = add_file(file, &file_size);
+            uint32_t new_file = add_file(file, rel, &file_size);
 
             if(!new_file)
             {
@@ -233,7 +465,7 @@ uint32_t add_directory(const char * const base_path, const char * const path)
                 return 0;
             }
             dfs_file_t temp_file;
-            temp_file.path = strdup(file+strlen(base_path)+1);
+            temp_file.path = strdup(rel);
             temp_file.path_hash = prime_hash(temp_file.path, DFS_LOOKUP_PRIME);
             temp_file.data_ofs = new_file;
             temp_file.data_len = file_size;
@@ -255,7 +487,7 @@ uint32_t add_directory(const char * const base_path, const char * const path)
         }
         else if(S_ISDIR(stats.st_mode))
         {
-            uint32_t new_entry = new_sector();
+            uint32_t new_entry = new_dirent(rel);
 
             tmp_entry = sector_to_memory(new_entry);
             tmp_entry->flags = SWAPLONG(FLAGS_DIR << 28); /* Size doesn't matter for directories */
@@ -333,15 +565,26 @@ uint32_t dfs_get_path_size(void)
 void write_dfs_lookup(void)
 {
     uint32_t num_files = stbds_arrlenu(dfs_files);
+
+    /* Recycle the space of the files that were removed from the filesystem */
+    for(int i=0; i<stbds_arrlen(old_regions); i++) {
+        if(old_regions[i].kind == REGION_FILE && !old_regions[i].used) {
+            free_space_t fs = { old_regions[i].ofs, old_regions[i].capacity };
+            stbds_arrpush(free_space, fs);
+        }
+    }
+
     qsort(&dfs_files[0], num_files, sizeof(dfs_file_t), compare_dfs_entry_hash);
     uint32_t lookup_size = sizeof(dfs_lookup_t);
     lookup_size += num_files*sizeof(dfs_lookup_file_t);
-    uint32_t lookup_ptr = new_blob(lookup_size);
+    uint32_t lookup_ptr = alloc_space(free_space, lookup_size);
+    add_region(REGION_LOOKUP, lookup_ptr, round_extent(lookup_size), NULL);
     directory_entry_t *id_dir = sector_to_memory(0);
     id_dir->next_entry = SWAPLONG(lookup_size);
     id_dir->file_pointer = SWAPLONG(lookup_ptr);
     uint32_t path_size = dfs_get_path_size();
-    uint32_t path_ofs = new_blob(path_size);
+    uint32_t path_ofs = alloc_space(free_space, path_size);
+    add_region(REGION_PATHS, path_ofs, round_extent(path_size), NULL);
     dfs_lookup_t *rom_lookup = sector_to_memory(lookup_ptr);
     rom_lookup->num_files = SWAPLONG(num_files);
     rom_lookup->path_ofs = SWAPLONG(path_ofs);
@@ -372,60 +615,298 @@ void write_dfs_lookup(void)
     }
 }
 
-int main(int argc, char *argv[])
+/* Load the manifest written by the previous build. Returns false if the
+   manifest is missing or does not describe the current image. */
+bool load_manifest(const char *manifest, const char *image)
 {
-    if(argc != 3)
+    FILE *f = fopen(manifest, "r");
+    if(!f)
+        return false;
+
+    int version = 0;
+    uint32_t align = 0;
+    bool ok = fscanf(f, "mkdfs-manifest %d\n", &version) == 1 && version == 1 &&
+              fscanf(f, "image %u\n", &old_fs_size) == 1 &&
+              fscanf(f, "align %u\n", &align) == 1 && align == dfs_align;
+
+    char kind[16], path[4096];
+    region_t r;
+    while(ok && fscanf(f, "%15s %u %u %u %" SCNd64 " %" SCNx64 " %4095[^\n]\n",
+            kind, &r.ofs, &r.capacity, &r.size, &r.mtime, &r.hash, path) == 7)
     {
-        print_help(argv[0]);
-        return -1;
+        int k = -1;
+        for(int i=0; i<sizeof(region_kind_names)/sizeof(region_kind_names[0]); i++)
+            if(strcmp(kind, region_kind_names[i]) == 0)
+                k = i;
+        if(k == -1 || r.ofs % dfs_align || r.capacity % dfs_align || r.ofs + r.capacity > old_fs_size)
+        {
+            ok = false;
+            break;
+        }
+        r.kind = k;
+        r.path = strcmp(path, "-") ? strdup(path) : NULL;
+        r.dirty = r.used = false;
+        stbds_arrpush(old_regions, r);
     }
+    ok = ok && feof(f);
+    fclose(f);
 
-    /* Add in identifier */
-    directory_entry_t *id = sector_to_memory(new_sector());
+    /* Make sure the image was not modified or rebuilt without the manifest */
+    struct stat st;
+    if(ok && (stat(image, &st) != 0 || st.st_size != old_fs_size))
+        ok = false;
 
-    if(!id)
+    if(!ok)
     {
-        fprintf(stderr, "Out of memory!\n");
+        kill_manifest();
+        return false;
+    }
 
-        return -1;
+    stbds_sh_new_strdup(old_files);
+    for(int i=0; i<stbds_arrlen(old_regions); i++)
+    {
+        region_t *r = &old_regions[i];
+        free_space_t fs = { r->ofs, r->capacity };
+        switch(r->kind)
+        {
+        case REGION_FILE:
+            stbds_shput(old_files, r->path, i);
+            break;
+        case REGION_DIRENT:
+            stbds_arrpush(free_dirents, fs);
+            break;
+        case REGION_LOOKUP: case REGION_PATHS: case REGION_FREE:
+            stbds_arrpush(free_space, fs);
+            break;
+        case REGION_ROOT:
+            break;
+        }
     }
+    return true;
+}
 
+bool write_manifest(const char *manifest)
+{
+    FILE *f = fopen(manifest, "w");
+    if(!f)
+        return false;
+
+    fprintf(f, "mkdfs-manifest 1\n");
+    fprintf(f, "image %u\n", fs_size);
+    fprintf(f, "align %u\n", dfs_align);
+    for(int i=0; i<stbds_arrlen(regions); i++)
+    {
+        region_t *r = &regions[i];
+        fprintf(f, "%s %u %u %u %" PRId64 " %016" PRIx64 " %s\n", region_kind_names[r->kind],
+            r->ofs, r->capacity, r->size, r->mtime, r->hash, r->path ? r->path : "-");
+    }
+    free_space_t *pools[2] = { free_dirents, free_space };
+    for(int p=0; p<2; p++)
+    {
+        for(int i=0; i<stbds_arrlen(pools[p]); i++)
+        {
+            if(pools[p][i].capacity)
+                fprintf(f, "free %u %u 0 0 0 -\n", pools[p][i].ofs, pools[p][i].capacity);
+        }
+    }
+    return fclose(f) == 0;
+}
+
+/* Amount of unused space in the image */
+uint32_t wasted_space(void)
+{
+    uint32_t waste = 0;
+    for(int i=0; i<stbds_arrlen(free_space); i++)
+        waste += free_space[i].capacity;
+    for(int i=0; i<stbds_arrlen(free_dirents); i++)
+        waste += free_dirents[i].capacity;
+    return waste;
+}
+
+/* Lay out the whole filesystem, and queue the files that must be read */
+bool build_fs(const char *path)
+{
+    if(old_fs_size)
+    {
+        /* Start from a blank copy of the previous image: only the regions that
+           change will be filled and written. */
+        dfs = calloc(1, old_fs_size);
+        fs_size = old_fs_size;
+    }
+    else
+    {
+        new_sector();
+    }
+    add_region(REGION_ROOT, 0, SECTOR_SIZE, NULL);
+
+    /* Add in identifier */
+    directory_entry_t *id = sector_to_memory(0);
     id->flags = SWAPLONG(ROOT_FLAGS);
     id->next_entry = SWAPLONG(ROOT_NEXT_ENTRY);
-    strcpy(id->path, ROOT_PATH);
+    strcpy(id->path, dfs_align == SECTOR_SIZE ? ROOT_PATH_V2 : ROOT_PATH);
+
+    if(!add_directory(path, path))
+        return false;
+    write_dfs_lookup();
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *manifest = NULL;
+    int i;
+
+    for(i = 1; i < argc && argv[i][0] == '-'; i++)
+    {
+        if(!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help"))
+        {
+            print_help(argv[0]);
+            return 0;
+        }
+        else if(!strcmp(argv[i], "-j") || !strcmp(argv[i], "--jobs"))
+        {
+            if(++i == argc)
+            {
+                fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                return -1;
+            }
+            char *end;
+            flag_jobs = strtol(argv[i], &end, 10);
+            if(*end || flag_jobs < 0)
+            {
+                fprintf(stderr, "invalid argument for %s: %s\n", argv[i-1], argv[i]);
+                return -1;
+            }
+        }
+        else if(!strcmp(argv[i], "--v2"))
+        {
+            dfs_align = SECTOR_SIZE;
+        }
+        else if(!strcmp(argv[i], "-i") || !strcmp(argv[i], "--incremental"))
+        {
+            flag_incremental = true;
+        }
+        else if(!strcmp(argv[i], "-m") || !strcmp(argv[i], "--manifest"))
+        {
+            if(++i == argc)
+            {
+                fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                return -1;
+            }
+            manifest = argv[i];
+        }
+        else
+        {
+            fprintf(stderr, "invalid flag: %s\n", argv[i]);
+            return -1;
+        }
+    }
+
+    if(argc - i != 2)
+    {
+        print_help(argv[0]);
+        return -1;
+    }
+    const char *image = argv[i];
+    const char *dir = argv[i+1];
+
+    char *manifest_buf = NULL;
+    if(!manifest && flag_incremental)
+    {
+        asprintf(&manifest_buf, "%s.manifest", image);
+        manifest = manifest_buf;
+    }
+
+    if(flag_incremental && !load_manifest(manifest, image))
+        printf("No valid manifest for '%s', rebuilding the whole image.\n", image);
 
     // Remove trailing slash if present
-    char *path = strdup(argv[2]);
+    char *path = strdup(dir);
     if (path[strlen(path) - 1] == '/')
         path[strlen(path) - 1] = 0;
 
-    if(!add_directory(path, path))
+    bool incremental = old_fs_size != 0;
+    bool ok = build_fs(path);
+
+    /* Patching the image in place leaves holes where files were removed or
+       moved. Rebuild from scratch when too much space is wasted. */
+    if(ok && incremental && wasted_space() > fs_size / 4)
+    {
+        printf("Too much unused space in '%s', rebuilding the whole image.\n", image);
+        kill_fs();
+        kill_manifest();
+        incremental = false;
+        ok = build_fs(path);
+    }
+
+    if(!ok)
     {
         /* Error adding directory */
-        fprintf(stderr, "Error creating '%s': directory '%s' is empty or does not exist\n", argv[1], argv[2]);
+        fprintf(stderr, "Error creating '%s': directory '%s' is empty or does not exist\n", image, dir);
 
         kill_fs();
 
         return -1;
     }
-    write_dfs_lookup();
+
+    if(!read_files())
+    {
+        kill_fs();
+
+        return -1;
+    }
+
     /* Write out filesystem */
-    FILE *fp = fopen(argv[1], "wb");
+    if(manifest)
+        remove(manifest);
+    FILE *fp = fopen(image, incremental ? "r+b" : "wb");
 
     if(!fp)
     {
         /* Error writing file out */
-        fprintf(stderr, "Error opening '%s' for writing.\n", argv[1]);
+        fprintf(stderr, "Error opening '%s' for writing.\n", image);
+
+        kill_fs();
+
+        return -1;
+    }
+
+    if(incremental)
+    {
+        for(int i=0; i<stbds_arrlen(regions); i++)
+        {
+            if(!regions[i].dirty)
+                continue;
+            fseek(fp, regions[i].ofs, SEEK_SET);
+            fwrite(sector_to_memory(regions[i].ofs), 1, regions[i].capacity, fp);
+        }
+    }
+    else
+    {
+        fwrite(dfs, 1, fs_size, fp);
+    }
+    if(fclose(fp) != 0)
+    {
+        fprintf(stderr, "Error writing '%s'.\n", image);
+
+        kill_fs();
+
+        return -1;
+    }
+
+    if(manifest && !write_manifest(manifest))
+    {
+        fprintf(stderr, "Error writing manifest '%s'.\n", manifest);
 
         kill_fs();
 
         return -1;
     }
-    
-    fwrite(dfs, 1, fs_size, fp);
-    fclose(fp);
 
     kill_fs();
+    kill_manifest();
+    free(manifest_buf);
+    free(path);
 
     return 0;
-}
\ No newline at end of file
+}
@@ -24,6 +24,9 @@
 // Compression library
 #include "../common/assetcomp.h"
 
+// Conversion cache
+#include "../common/assetcache.h"
+
 #include "../common/binout.c"
 #include "../common/binout.h"
 #include "../common/subprocess.h"
@@ -384,6 +387,54 @@ void print_args( char * name )
 #include "mkfont_ttf.cpp"
 #include "mkfont_bmfont.cpp"
 
+bool convert_cache_key(const char *infn, int compression, assetcache_key_t *key)
+{
+    assetcache_key_init(key);
+    assetcache_key_addf(key, "compress=%d kerning=%d size=%d ellipsis=%x,%d outline=%a mono=%d spacing=%a format=%d",
+        compression, flag_kerning, flag_ttf_point_size, flag_ellipsis_cp, flag_ellipsis_repeats,
+        flag_ttf_outline, flag_ttf_monochrome, flag_ttf_char_spacing, flag_bmfont_format);
+    for (int r : flag_ranges)
+        assetcache_key_addf(key, "range=%x", r);
+    // --charset filters single glyphs within the ranges. Sort it, as the
+    // iteration order of the set is not stable.
+    std::vector<uint32_t> charset(flag_charset.begin(), flag_charset.end());
+    std::sort(charset.begin(), charset.end());
+    for (uint32_t cp : charset)
+        assetcache_key_addf(key, "char=%x", cp);
+
+    // Atlases are converted through mksprite, so its version matters too
+    char *mksprite = NULL;
+    asprintf(&mksprite, "%s/bin/mksprite", n64_inst);
+    bool ok = assetcache_key_add_file(key, mksprite);
+    free(mksprite);
+    if (!ok || !assetcache_key_add_file(key, infn))
+        return false;
+
+    // BMFont files reference the atlas pages, which are inputs as well
+    if (strcasestr(infn, ".fnt")) {
+        FILE *f = fopen(infn, "r");
+        if (!f) return false;
+        std::string basedir = infn;
+        size_t slash = basedir.find_last_of('/');
+        basedir = (slash == std::string::npos) ? "." : basedir.substr(0, slash);
+
+        char *line = NULL; size_t len = 0;
+        while (ok && getline(&line, &len, f) != -1) {
+            if (strncmp(line, "page ", 5) != 0) continue;
+            char *value = strstr(line, "file=");
+            if (!value) continue;
+            value = strtok(value + 5, " \t\r\n");
+            char *pagefn = NULL;
+            asprintf(&pagefn, "%s/%s", basedir.c_str(), unquote(value));
+            ok = assetcache_key_add_file(key, pagefn);
+            free(pagefn);
+        }
+        free(line);
+        fclose(f);
+    }
+    return ok;
+}
+
 int main(int argc, char *argv[])
 {
     char *infn = NULL, *outfn = NULL; const char *outdir = ".";
@@ -396,6 +447,8 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    assetcache_init("mkfont", argv[0]);
+
     for (int i = 1; i < argc; i++) {
         if (argv[i][0] == '-') {
             if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
@@ -601,6 +654,17 @@ int main(int argc, char *argv[])
         }
 
         asprintf(&outfn, "%s/%s.font64", outdir, basename_noext);
+
+        // Check if we already converted this very same file with the same flags
+        assetcache_key_t cache_key;
+        bool use_cache = assetcache_enabled() && !flag_debug && convert_cache_key(infn, compression, &cache_key);
+        if (use_cache && assetcache_fetch(&cache_key, outfn)) {
+            if (flag_verbose)
+                printf("cached: %s -> %s\n", infn, outfn);
+            free(outfn);
+            continue;
+        }
+
         if (flag_verbose)
             printf("Converting: %s -> %s\n",
                 infn, outfn);
@@ -633,6 +697,8 @@ int main(int argc, char *argv[])
                     printf("written: %s (%d bytes)\n", outfn, (int)st.st_size);
                 }
             }
+            if (use_cache)
+                assetcache_store(&cache_key, outfn, NULL);
         }
         free(outfn);
     }
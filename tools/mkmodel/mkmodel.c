@@ -10,6 +10,9 @@
 #include <sys/stat.h>
 #include "../common/assetcomp.h"
 
+// Conversion cache
+#include "../common/assetcache.h"
+
 #include "../../include/GL/gl_enums.h"
 #include "../../src/GL/gl_constants.h"
 #include "../../src/model64_internal.h"
@@ -32,8 +35,8 @@
 // IMPORTANT: Do not attempt to move these values to a header that is shared by mkmodel and runtime code!
 //            These values must reflect what the tool actually outputs.
 #define HEADER_SIZE         88
-#define MESH_SIZE           8
-#define PRIMITIVE_SIZE      116
+#define MESH_SIZE           32
+#define PRIMITIVE_SIZE      132
 #define NODE_SIZE           128
 #define SKIN_SIZE           8
 #define ANIM_SIZE           40
@@ -50,6 +53,8 @@
 
 #define MAX_TEXTURES 1000
 
+#define DEFAULT_LOD_SIZE    0.25f
+
 typedef void (*component_convert_func_t)(void*,float*,size_t);
 typedef void (*index_convert_func_t)(void*,cgltf_uint*,size_t);
 
@@ -97,6 +102,7 @@ struct {
 
 int flag_anim_stream = 1;
 int flag_verbose = 0;
+float flag_lod_size = DEFAULT_LOD_SIZE;
 
 uint32_t get_type_size(uint32_t type)
 {
@@ -132,9 +138,15 @@ void print_args( char * name )
     fprintf(stderr, "Command-line flags:\n");
     fprintf(stderr, "   -o/--output <dir>       Specify output directory (default: .)\n");
     fprintf(stderr, "   --anim-no-stream        Disable animation streaming\n");
+    fprintf(stderr, "   --lod-size <fraction>   Screen height fraction below which the first LOD is used (default: %.2f)\n", DEFAULT_LOD_SIZE);
     fprintf(stderr, "   -c/--compress <level>   Compress output files (default: %d)\n", DEFAULT_COMPRESSION);
     fprintf(stderr, "   -v/--verbose            Verbose output\n");
     fprintf(stderr, "\n");
+    fprintf(stderr, "Level of detail:\n");
+    fprintf(stderr, "   Mesh nodes named <name>_LOD1, <name>_LOD2, ... are used as coarser levels of detail\n");
+    fprintf(stderr, "   of the node named <name> (or <name>_LOD0). Each level is used when the projected size\n");
+    fprintf(stderr, "   of the model halves with respect to the previous one.\n");
+    fprintf(stderr, "\n");
 }
 
 model64_data_t* model64_alloc()
@@ -332,6 +344,14 @@ void write_matrix(float *mtx, FILE *out)
     }
 }
 
+void write_bounds(float *center, float radius, FILE *out)
+{
+    for(int i=0; i<3; i++) {
+        wf32(out, center[i]);
+    }
+    wf32(out, radius);
+}
+
 void model64_write_header(model64_data_t *model, FILE *out)
 {
     int start_ofs = ftell(out);
@@ -470,6 +490,13 @@ void model64_write_meshes(model64_data_t *model, FILE *out)
         placeholder_set(out, "mesh%d", i);
         w32(out, model->meshes[i].num_primitives);
         w32_placeholderf(out, "mesh%d_primitives", i);
+        write_bounds(model->meshes[i].bounds_center, model->meshes[i].bounds_radius, out);
+        if(model->meshes[i].lod) {
+            w32_placeholderf(out, "mesh%d", get_mesh_index(model, model->meshes[i].lod));
+        } else {
+            w32(out, 0);
+        }
+        wf32(out, model->meshes[i].lod_min_size);
         assert(ftell(out)-start_ofs == MESH_SIZE);
     }
     for(uint32_t i=0; i<model->num_meshes; i++) {
@@ -493,6 +520,7 @@ void model64_write_meshes(model64_data_t *model, FILE *out)
             w32(out, primitive->local_texture);
             w32(out, TEXTURE_INDEX_MISSING);
             w32_placeholderf(out, "mesh%d_primitive%d_index", i, j);
+            write_bounds(primitive->bounds_center, primitive->bounds_radius, out);
             assert(ftell(out)-start_ofs == PRIMITIVE_SIZE);
         }
     }
@@ -791,6 +819,59 @@ uint32_t texture_table_find_or_add(const char* path)
     return idx;
 }
 
+void sphere_merge(float *center, float *radius, const float *other_center, float other_radius)
+{
+    if(*radius < 0) {
+        memcpy(center, other_center, 3*sizeof(float));
+        *radius = other_radius;
+        return;
+    }
+    float d[3] = {other_center[0]-center[0], other_center[1]-center[1], other_center[2]-center[2]};
+    float dist = sqrtf(d[0]*d[0] + d[1]*d[1] + d[2]*d[2]);
+    if(dist + other_radius <= *radius) {
+        return;
+    }
+    if(dist + *radius <= other_radius) {
+        memcpy(center, other_center, 3*sizeof(float));
+        *radius = other_radius;
+        return;
+    }
+    float new_radius = (dist + *radius + other_radius) * 0.5f;
+    float t = (new_radius - *radius) / dist;
+    for(int i=0; i<3; i++) {
+        center[i] += d[i]*t;
+    }
+    *radius = new_radius;
+}
+
+void calc_primitive_bounds(cgltf_accessor *position, primitive_t *out_primitive)
+{
+    float min[3] = {INFINITY, INFINITY, INFINITY};
+    float max[3] = {-INFINITY, -INFINITY, -INFINITY};
+    for(size_t i=0; i<position->count; i++) {
+        float v[3] = {0};
+        cgltf_accessor_read_float(position, i, v, 3);
+        for(int j=0; j<3; j++) {
+            if(v[j] < min[j]) min[j] = v[j];
+            if(v[j] > max[j]) max[j] = v[j];
+        }
+    }
+    float *center = out_primitive->bounds_center;
+    for(int j=0; j<3; j++) {
+        center[j] = (min[j] + max[j]) * 0.5f;
+    }
+    float max_dist2 = 0;
+    for(size_t i=0; i<position->count; i++) {
+        float v[3] = {0};
+        cgltf_accessor_read_float(position, i, v, 3);
+        float d[3] = {v[0]-center[0], v[1]-center[1], v[2]-center[2]};
+        float dist2 = d[0]*d[0] + d[1]*d[1] + d[2]*d[2];
+        if(dist2 > max_dist2) max_dist2 = dist2;
+    }
+    // Account for the quantization of vertex positions
+    out_primitive->bounds_radius = sqrtf(max_dist2) + 1.0f/(1<<VERTEX_PRECISION);
+}
+
 int convert_primitive(cgltf_primitive *in_primitive, primitive_t *out_primitive)
 {
     // Matches the values of GL_TRIANGLES, GL_TRIANGLE_STRIPS etc. exactly so just copy it over
@@ -865,6 +946,7 @@ int convert_primitive(cgltf_primitive *in_primitive, primitive_t *out_primitive)
     }
 
     out_primitive->num_vertices = attr_map[0]->data->count;
+    calc_primitive_bounds(attr_map[0]->data, out_primitive);
 
     uint32_t stride = 0;
 
@@ -1019,6 +1101,14 @@ int convert_mesh(cgltf_mesh *in_mesh, mesh_t *out_mesh)
         }
     }
 
+    // The bounding sphere of the mesh encloses those of all its primitives
+    out_mesh->bounds_radius = -1;
+    for (size_t i = 0; i < in_mesh->primitives_count; i++)
+    {
+        primitive_t *primitive = &out_mesh->primitives[i];
+        sphere_merge(out_mesh->bounds_center, &out_mesh->bounds_radius, primitive->bounds_center, primitive->bounds_radius);
+    }
+
     return 0;
 }
 
@@ -1088,6 +1178,112 @@ void convert_root_node(cgltf_scene *scene, cgltf_data *data, model64_data_t *mod
     }
 }
 
+int parse_lod_name(const char *name, size_t *base_len)
+{
+    const char *suffix = NULL;
+    for(const char *p = name; p && (p = strstr(p, "_LOD")); p++) {
+        suffix = p;
+    }
+    if(!suffix) {
+        return -1;
+    }
+    char *end;
+    long level = strtol(suffix+4, &end, 10);
+    if(end == suffix+4 || *end != '\0' || level < 0) {
+        return -1;
+    }
+    *base_len = suffix - name;
+    return level;
+}
+
+int find_lod_base_node(model64_data_t *model, const char *name, size_t base_len)
+{
+    for(uint32_t i=0; i<model->num_nodes; i++) {
+        const char *other = model->nodes[i].name;
+        if(!other || !model->nodes[i].mesh || strncmp(other, name, base_len) != 0) {
+            continue;
+        }
+        if(other[base_len] == '\0' || strcmp(other+base_len, "_LOD0") == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool check_lod_node_transform(cgltf_data *data, uint32_t node, uint32_t base)
+{
+    // LOD meshes are drawn with the transform of the base node, so the LOD
+    // node must be placed exactly like it and must not be animated on its own
+    float node_mtx[16], base_mtx[16];
+    cgltf_node_transform_world(&data->nodes[node], node_mtx);
+    cgltf_node_transform_world(&data->nodes[base], base_mtx);
+    for(int i=0; i<16; i++) {
+        if(fabsf(node_mtx[i] - base_mtx[i]) > 1e-4f * fmaxf(1.0f, fabsf(base_mtx[i]))) {
+            fprintf(stderr, "WARNING: LOD node \"%s\" has a different transform than node \"%s\" and will be drawn as a normal node\n", data->nodes[node].name, data->nodes[base].name);
+            return false;
+        }
+    }
+    for(size_t i=0; i<data->animations_count; i++) {
+        for(size_t j=0; j<data->animations[i].channels_count; j++) {
+            if(data->animations[i].channels[j].target_node == &data->nodes[node]) {
+                fprintf(stderr, "WARNING: LOD node \"%s\" is animated and will be drawn as a normal node\n", data->nodes[node].name);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void link_lod_meshes(cgltf_data *data, model64_data_t *model)
+{
+    // Collect the LOD levels of each base node
+    mesh_t **levels = calloc(model->num_nodes, sizeof(mesh_t*));
+    for(int level=1;; level++) {
+        bool found = false;
+        for(uint32_t i=0; i<model->num_nodes; i++) {
+            model64_node_t *node = &model->nodes[i];
+            size_t base_len;
+            if(!node->mesh || parse_lod_name(node->name, &base_len) != level) {
+                continue;
+            }
+            found = true;
+            int base = find_lod_base_node(model, node->name, base_len);
+            if(base < 0) {
+                fprintf(stderr, "WARNING: LOD node \"%s\" has no base node and will be drawn as a normal node\n", node->name);
+                continue;
+            }
+            if(!check_lod_node_transform(data, i, base)) {
+                continue;
+            }
+            mesh_t *prev = levels[base] ? levels[base] : model->nodes[base].mesh;
+            if(prev->lod) {
+                fprintf(stderr, "WARNING: mesh of node \"%s\" is already used as a LOD, ignoring\n", node->name);
+                continue;
+            }
+            if(flag_verbose) {
+                printf("Using node %s as LOD %d of node %s\n", node->name, level, model->nodes[base].name);
+            }
+            // Each level is used until the projected size halves again
+            prev->lod = node->mesh;
+            prev->lod_min_size = flag_lod_size / (1 << (level-1));
+            levels[base] = node->mesh;
+            // LOD nodes are only drawn through their base node
+            node->mesh = NULL;
+        }
+        if(!found) {
+            break;
+        }
+    }
+    free(levels);
+
+    // Culling is done with the bounds of the base mesh, so they must enclose all levels
+    for(uint32_t i=0; i<model->num_meshes; i++) {
+        for(mesh_t *lod = model->meshes[i].lod; lod; lod = lod->lod) {
+            sphere_merge(model->meshes[i].bounds_center, &model->meshes[i].bounds_radius, lod->bounds_center, lod->bounds_radius);
+        }
+    }
+}
+
 int convert_skin(cgltf_data *data, cgltf_skin *in_skin, model64_skin_t *out_skin)
 {
     if(in_skin->joints_count > MATRIX_PALETTE_SIZE) {
@@ -1847,6 +2043,7 @@ int convert(const char *infn, const char *outfn)
             printf("Converting root node\n");
         }
         convert_root_node(data->scene, data, model);
+        link_lod_meshes(data, model);
     }
     model->num_anims = data->animations_count;
     if(model->num_anims != 0) {
@@ -1903,6 +2100,33 @@ error:
     return 1;
 }
 
+bool convert_cache_key(const char *infn, int compression, assetcache_key_t *key)
+{
+    assetcache_key_init(key);
+    assetcache_key_addf(key, "compress=%d anim_stream=%d lod_size=%f", compression, flag_anim_stream, flag_lod_size);
+    if (!assetcache_key_add_file(key, infn))
+        return false;
+
+    // A .gltf file can reference external buffers, which are inputs as well
+    cgltf_options options = {0};
+    cgltf_data* data = NULL;
+    if (cgltf_parse_file(&options, infn, &data) != cgltf_result_success)
+        return false;
+    bool ok = true;
+    for (size_t i = 0; i < data->buffers_count && ok; i++) {
+        const char *uri = data->buffers[i].uri;
+        if (!uri || strncmp(uri, "data:", 5) == 0)
+            continue;
+        char *path = malloc(strlen(uri) + strlen(infn) + 1);
+        cgltf_combine_paths(path, infn, uri);
+        cgltf_decode_uri(path + strlen(path) - strlen(uri));
+        ok = assetcache_key_add_file(key, path);
+        free(path);
+    }
+    cgltf_free(data);
+    return ok;
+}
+
 int main(int argc, char *argv[])
 {
     char *infn = NULL, *outdir = ".", *outfn = NULL;
@@ -1914,6 +2138,8 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    assetcache_init("mkmodel", argv[0]);
+
     for (int i = 1; i < argc; i++) {
         if (argv[i][0] == '-') {
             if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
@@ -1943,6 +2169,16 @@ int main(int argc, char *argv[])
                 outdir = argv[i];
             } else if (!strcmp(argv[i], "--anim-no-stream")) {
                 flag_anim_stream = 0;
+            } else if (!strcmp(argv[i], "--lod-size")) {
+                if (++i == argc) {
+                    fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                char extra;
+                if (sscanf(argv[i], "%f%c", &flag_lod_size, &extra) != 1 || flag_lod_size <= 0) {
+                    fprintf(stderr, "invalid argument for %s: %s\n", argv[i-1], argv[i]);
+                    return 1;
+                }
             } else {
                 fprintf(stderr, "invalid flag: %s\n", argv[i]);
                 return 1;
@@ -1958,6 +2194,16 @@ int main(int argc, char *argv[])
         if (ext) *ext = '\0';
 
         asprintf(&outfn, "%s/%s.model64", outdir, basename_noext);
+        // Check if we already converted this very same file with the same flags
+        assetcache_key_t cache_key;
+        bool use_cache = assetcache_enabled() && convert_cache_key(infn, compression, &cache_key);
+        if (use_cache && assetcache_fetch(&cache_key, outfn)) {
+            if (flag_verbose)
+                printf("cached: %s -> %s\n", infn, outfn);
+            free(outfn);
+            continue;
+        }
+
         if (flag_verbose)
             printf("Converting: %s -> %s\n",
                 infn, outfn);
@@ -1974,6 +2220,8 @@ int main(int argc, char *argv[])
                     printf("compressed: %s (%d -> %d, ratio %.1f%%)\n", outfn,
                     (int)st_decomp.st_size, (int)st_comp.st_size, 100.0 * (float)st_comp.st_size / (float)(st_decomp.st_size == 0 ? 1 :st_decomp.st_size));
             }
+            if (use_cache)
+                assetcache_store(&cache_key, outfn, (const char*[]){ ".anim", NULL });
         }
 
         free(outfn);
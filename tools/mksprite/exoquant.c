@@ -41,7 +41,7 @@ exq_data *exq_init()
 	int i;
 	exq_data *pExq;
 
-	pExq = (exq_data*)malloc(sizeof(exq_data));
+	pExq = (exq_data*)calloc(1, sizeof(exq_data));
 	
 	for(i = 0; i < EXQ_HASH_SIZE; i++)
 		pExq->pHash[i] = NULL;
@@ -50,6 +50,7 @@ exq_data *exq_init()
 	pExq->optimized = 0;
 	pExq->transparency = 1;
 	pExq->numBitsPerChannel = 8;
+	pExq->randState = 1;
 
 	return pExq;
 }
@@ -503,7 +504,12 @@ void exq_map_image_dither(exq_data *pExq, int width, int height,
 			if(ordered)
 				d = (x & 1) + (y & 1) * 2;
 			else
-				d = rand() & 3;
+			{
+				// Per-quantizer LCG rather than rand(), so that the output
+				// does not depend on other images being dithered concurrently.
+				pExq->randState = pExq->randState * 1103515245 + 12345;
+				d = (pExq->randState >> 16) & 3;
+			}
 			pHist = exq_find_histogram(pExq, pIn);
 			p.r = *pIn++ / 255.0f * SCALE_R;
 			p.g = *pIn++ / 255.0f * SCALE_G;
@@ -696,7 +702,7 @@ exq_float exq_sort_by_a(const exq_histogram *pHist)
 	return pHist->color.a;
 }
 
-exq_color exq_sort_dir;
+__thread exq_color exq_sort_dir;   // thread-local: images may be quantized in parallel
 
 exq_float exq_sort_by_dir(const exq_histogram *pHist)
 {
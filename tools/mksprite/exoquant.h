@@ -96,6 +96,7 @@ typedef struct _exq_data
 	int						numBitsPerChannel;
 	int						optimized;
 	int						transparency;
+	unsigned int			randState;
 } exq_data;
 
 /* interface */
@@ -141,7 +142,7 @@ exq_float			exq_sort_by_b(const exq_histogram *pHist);
 exq_float			exq_sort_by_a(const exq_histogram *pHist);
 exq_float			exq_sort_by_dir(const exq_histogram *pHist);
 
-extern exq_color	exq_sort_dir;
+extern __thread exq_color	exq_sort_dir;
 
 #ifdef __cplusplus
 }
@@ -23,6 +23,12 @@
 // Compression library
 #include "../common/assetcomp.h"
 
+// Parallel loops
+#include "../common/thread_utils.h"
+
+// Conversion cache
+#include "../common/assetcache.h"
+
 // Bring in tex_format_t definition
 #include "surface.h"
 #include "sprite.h"
@@ -133,6 +139,12 @@ typedef struct {
 
 bool flag_verbose = false;
 bool flag_debug = false;
+int flag_jobs = 1;
+
+// Number of threads used to parallelize work within a single image. This is
+// flag_jobs when converting a single file, and 1 when files are being
+// converted concurrently (to avoid oversubscribing the host).
+int image_threads = 1;
 
 void print_supported_formats(void) {
     fprintf(stderr, "Supported formats: AUTO, RGBA32, RGBA16, IA16, CI8, I8, IA8, CI4, I4, IA4, ZBUF, IHQ\n");
@@ -158,6 +170,7 @@ void print_args( char * name )
     fprintf(stderr, "   -c/--compress <level> Compress output files (default: %d)\n", DEFAULT_COMPRESSION);
     fprintf(stderr, "   -g/--gamma            Adjust colors for when VI gamma correction is enabled on console (convert to linear colors)\n");
     fprintf(stderr, "   -d/--debug            Dump computed images (eg: mipmaps) as PNG files in output directory\n");
+    fprintf(stderr, "   -j/--jobs <N>         Convert using N parallel threads (0 = all cores, default: 1)\n");
     fprintf(stderr, "\nSampling flags:\n");
     fprintf(stderr, "   --texparms <x,s,r,m>          Sampling parameters:\n");
     fprintf(stderr, "                                 x=translation, s=scale, r=repetitions, m=mirror\n");
@@ -539,6 +552,25 @@ static uint8_t *image_shrink_box(uint8_t *src, int width, int height, bool half_
     return imgdst;
 }
 
+typedef struct {
+    uint8_t *src; int src_width;
+    uint8_t *dst; int dst_width;
+    int bpp;
+} lod_shrink_t;
+
+static void lod_shrink_row(int y, void *arg) {
+    lod_shrink_t *lod = arg;
+    int bpp = lod->bpp;
+    uint8_t *src1 = lod->src + y*lod->src_width*bpp*2;
+    uint8_t *src2 = src1 + lod->src_width*bpp;
+    uint8_t *dst = lod->dst + y*lod->dst_width*bpp;
+    for (int x=0;x<lod->dst_width;x++) {
+        for (int c=0;c<bpp;c++)
+            dst[c] = (src1[c] + src1[c+bpp] + src2[c] + src2[c+bpp]) / 4;
+        dst += bpp; src1 += bpp*2; src2 += bpp*2;
+    }
+}
+
 bool spritemaker_calc_lods(spritemaker_t *spr, int algo) {
     // Calculate mipmap levels
     assert(algo == MIPMAP_ALGO_BOX);
@@ -564,39 +596,17 @@ bool spritemaker_calc_lods(spritemaker_t *spr, int algo) {
                 fprintf(stderr, "mipmap: stopping because TMEM full (%d)\n", tmem_usage);
             break;
         }
-        uint8_t *mipmap = NULL;
+        int bpp = 0;
         switch (prev->ct) {
         case LCT_RGBA:
-            mipmap = malloc(mw * mh * 4);
-            for (int y=0;y<mh;y++) {
-                uint8_t *src1 = prev->image + y*prev->width*4*2;
-                uint8_t *src2 = src1 + prev->width*4;
-                uint8_t *dst = mipmap + y*mw*4;
-                for (int x=0;x<mw;x++) {
-                    dst[0] = (src1[0] + src1[4] + src2[0] + src2[4]) / 4;
-                    dst[1] = (src1[1] + src1[5] + src2[1] + src2[5]) / 4;
-                    dst[2] = (src1[2] + src1[6] + src2[2] + src2[6]) / 4;
-                    dst[3] = (src1[3] + src1[7] + src2[3] + src2[7]) / 4;
-                    dst += 4; src1 += 8; src2 += 8;
-                }
-            }
+            bpp = 4;
             break;
         case LCT_GREY:
             switch(prev->fmt){
                 case FMT_I4:
                 case FMT_I8:
-                {
-                    mipmap = malloc(mw * mh);
-                    for (int y=0;y<mh;y++) {
-                        uint8_t *src1 = prev->image + y*prev->width*2;
-                        uint8_t *src2 = src1 + prev->width;
-                        uint8_t *dst = mipmap + y*mw;
-                        for (int x=0;x<mw;x++) {
-                            dst[0] = (src1[0] + src1[1] + src2[0] + src2[1]) / 4;
-                            dst += 1; src1 += 2; src2 += 2;
-                        }
-                    }
-                break; }
+                    bpp = 1;
+                    break;
                 default: // should never happen
                 	assert(0);
             }
@@ -607,19 +617,8 @@ bool spritemaker_calc_lods(spritemaker_t *spr, int algo) {
             case FMT_IA4:
             case FMT_IA8:
             case FMT_IA16:
-                {
-                    mipmap = malloc(mw * mh * 2);
-                    for (int y=0;y<mh;y++) {
-                        uint8_t *src1 = prev->image + y*prev->width*2*2;
-                        uint8_t *src2 = src1 + prev->width*2;
-                        uint8_t *dst = mipmap + y*mw*2;
-                        for (int x=0;x<mw;x++) {
-                            dst[0] = (src1[0] + src1[2] + src2[0] + src2[2]) / 4;
-                            dst[1] = (src1[1] + src1[3] + src2[1] + src2[3]) / 4;
-                            dst += 2; src1 += 4; src2 += 4;
-                        }
-                    }
-                break; }
+                bpp = 2;
+                break;
             
             default: // should never happen
                 assert(0);
@@ -630,6 +629,16 @@ bool spritemaker_calc_lods(spritemaker_t *spr, int algo) {
             fprintf(stderr, "ERROR: mipmap calculation for format %s/%s not implemented yet\n", tex_format_name(prev->fmt), colortype_to_string(prev->ct));
             return false;
         }
+
+        // Box-filter the previous level, one row per task
+        lod_shrink_t lod = {
+            .src = prev->image, .src_width = prev->width,
+            .dst = malloc(mw * mh * bpp), .dst_width = mw,
+            .bpp = bpp,
+        };
+        thParaLoopC(mh, lod_shrink_row, &lod, image_threads);
+        uint8_t *mipmap = lod.dst;
+
         if(!done) {
             if (flag_verbose)
                 fprintf(stderr, "mipmap: generated %dx%d\n", mw, mh);
@@ -838,6 +847,104 @@ bool spritemaker_gamma_correct(spritemaker_t *spr) {
     return true;
 }
 
+// IHQ candidates: 2 shrink directions (4x2 and 2x4) times 10 blend factors.
+#define IHQ_CANDIDATES   20
+
+typedef struct {
+    uint8_t *src;           // Source RGBA image
+    int width, height;      // Source image size
+    uint8_t *img42;         // Source shrunk by 4x2 (or NULL if not possible)
+    uint8_t *img24;         // Source shrunk by 2x4 (or NULL if not possible)
+    bool alphausage;        // True if the I plane must carry alpha (IA4)
+
+    // Results, one per candidate
+    uint8_t *i_img[IHQ_CANDIDATES];
+    uint8_t *rgb_img[IHQ_CANDIDATES];
+    int rgb_w[IHQ_CANDIDATES], rgb_h[IHQ_CANDIDATES];
+    float ifactor[IHQ_CANDIDATES];
+    float mse[IHQ_CANDIDATES];
+} ihq_search_t;
+
+static void ihq_eval_candidate(int k, void *arg) {
+    ihq_search_t *s = arg;
+    int width = s->width, height = s->height;
+    int dir = k / 10, factor = k % 10 + 1;
+
+    uint8_t *img; int iw, ih;
+    if (dir == 0) {
+        if (!s->img42) return;
+        img = s->img42; iw = width/4; ih = height/2;
+    } else {
+        if (!s->img24) return;
+        img = s->img24; iw = width/2; ih = height/4;
+    }
+
+    float wstep = (float)iw / width;
+    float hstep = (float)ih / height;
+    float ifactor = 0.05f * factor;
+    float mse = 0;
+    bool alphausage = s->alphausage;
+    uint8_t *i_img = alphausage? malloc(width * height * 2) : malloc(width * height);
+
+    for (int y=0; y<height; y++) {
+        float yy = y * hstep;
+        int yy0 = (int)yy;
+        int yy1 = MIN(yy0+1, ih-1);
+        float yyf = yy - yy0;
+
+        for (int x=0; x<width; x++) {
+            uint8_t r0 = s->src[(y*width + x)*4 + 0];
+            uint8_t g0 = s->src[(y*width + x)*4 + 1];
+            uint8_t b0 = s->src[(y*width + x)*4 + 2];
+            uint8_t a0 = s->src[(y*width + x)*4 + 3];
+
+            float xx = x * wstep;
+            int xx0 = (int)xx;
+            int xx1 = MIN(xx0+1, iw-1);
+            float xxf = xx - xx0;
+
+            uint8_t rm0 = img[(yy0*iw + xx0)*4 + 0];
+            uint8_t gm0 = img[(yy0*iw + xx0)*4 + 1];
+            uint8_t bm0 = img[(yy0*iw + xx0)*4 + 2];
+
+            uint8_t rm1 = img[(yy0*iw + xx1)*4 + 0];
+            uint8_t gm1 = img[(yy0*iw + xx1)*4 + 1];
+            uint8_t bm1 = img[(yy0*iw + xx1)*4 + 2];
+
+            uint8_t rm2 = img[(yy1*iw + xx0)*4 + 0];
+            uint8_t gm2 = img[(yy1*iw + xx0)*4 + 1];
+            uint8_t bm2 = img[(yy1*iw + xx0)*4 + 2];
+
+            uint8_t rm3 = img[(yy1*iw + xx1)*4 + 0];
+            uint8_t gm3 = img[(yy1*iw + xx1)*4 + 1];
+            uint8_t bm3 = img[(yy1*iw + xx1)*4 + 2];
+
+            // Bilinear interpolate
+            uint8_t r = (uint8_t)(rm0 * (1-xxf) * (1-yyf) + rm1 * xxf * (1-yyf) + rm2 * (1-xxf) * yyf + rm3 * xxf * yyf);
+            uint8_t g = (uint8_t)(gm0 * (1-xxf) * (1-yyf) + gm1 * xxf * (1-yyf) + gm2 * (1-xxf) * yyf + gm3 * xxf * yyf);
+            uint8_t b = (uint8_t)(bm0 * (1-xxf) * (1-yyf) + bm1 * xxf * (1-yyf) + bm2 * (1-xxf) * yyf + bm3 * xxf * yyf);
+
+            float err;
+            uint8_t i = ihq_calc_best_i4(ifactor, r0, g0, b0, r, g, b, &err);
+
+            // If there's alpha present, include it in the texture as IA format
+            if(alphausage){
+                i_img[(y*width + x) * 2] = i;
+                i_img[((y*width + x) * 2) + 1] = a0;
+            }
+            else i_img[y*width + x] = i;
+            mse += err;
+        }
+    }
+
+    s->i_img[k] = i_img;
+    s->rgb_img[k] = img;
+    s->rgb_w[k] = iw;
+    s->rgb_h[k] = ih;
+    s->ifactor[k] = ifactor;
+    s->mse[k] = sqrtf(mse / (width * height));
+}
+
 bool spritemaker_convert_ihq(spritemaker_t *spr) {
     if (spr->detail.enabled || spr->detail.texparms.defined) {
         fprintf(stderr, "ERROR: detail textures are not supported in IHQ mode\n");
@@ -881,100 +988,37 @@ bool spritemaker_convert_ihq(spritemaker_t *spr) {
     if(flag_verbose && alphausage)
         fprintf(stderr, "IHQ: found transparent pixels, IA4 is used as detail\n");
 	
-    uint8_t *best_rgb_img = NULL;
-    int best_rgb_w = 0, best_rgb_h = 0;
-    float best_err = INT32_MAX;
-    float best_ifactor = 0;
-    uint8_t *best_i_img = alphausage? malloc(width * height * 2) : malloc(width * height);
-    uint8_t *i_img = alphausage? malloc(width * height * 2) : malloc(width * height);
-
-    for (int dir=0; dir<2; dir++) {
-        uint8_t *img; int iw, ih;
-        if (dir == 0) {
-            if (width % 4) continue;
-            img42 = image_shrink_box(img22, width/2, height/2, true, false);
-            img = img42; iw = width/4; ih = height/2;
-        } else {
-            if (height % 4) continue;
-            img24 = image_shrink_box(img22, width/2, height/2, false, true);
-            img = img24; iw = width/2; ih = height/4;
-        }
-
-        float wstep = (float)iw / width;
-        float hstep = (float)ih / height;
-
-        for (int factor=1; factor<=10; factor++) {
-            float ifactor = 0.05f * factor;
-            float mse = 0;
-
-            for (int y=0; y<height; y++) {
-                float yy = y * hstep;
-                int yy0 = (int)yy;
-                int yy1 = yy0+1;
-                float yyf = yy - yy0;
-
-                for (int x=0; x<width; x++) {
-                    uint8_t r0 = spr->images[0].image[(y*width + x)*4 + 0];
-                    uint8_t g0 = spr->images[0].image[(y*width + x)*4 + 1];
-                    uint8_t b0 = spr->images[0].image[(y*width + x)*4 + 2];
-                    uint8_t a0 = spr->images[0].image[(y*width + x)*4 + 3];
-
-                    float xx = x * wstep;
-                    int xx0 = (int)xx;
-                    int xx1 = xx0+1;
-                    float xxf = xx - xx0;
-
-                    uint8_t rm0 = img[(yy0*iw + xx0)*4 + 0];
-                    uint8_t gm0 = img[(yy0*iw + xx0)*4 + 1];
-                    uint8_t bm0 = img[(yy0*iw + xx0)*4 + 2];
-
-                    uint8_t rm1 = img[(yy0*iw + xx1)*4 + 0];
-                    uint8_t gm1 = img[(yy0*iw + xx1)*4 + 1];
-                    uint8_t bm1 = img[(yy0*iw + xx1)*4 + 2];
-
-                    uint8_t rm2 = img[(yy1*iw + xx0)*4 + 0];
-                    uint8_t gm2 = img[(yy1*iw + xx0)*4 + 1];
-                    uint8_t bm2 = img[(yy1*iw + xx0)*4 + 2];
-
-                    uint8_t rm3 = img[(yy1*iw + xx1)*4 + 0];
-                    uint8_t gm3 = img[(yy1*iw + xx1)*4 + 1];
-                    uint8_t bm3 = img[(yy1*iw + xx1)*4 + 2];
-
-                    // Bilinear interpolate
-                    uint8_t r = (uint8_t)(rm0 * (1-xxf) * (1-yyf) + rm1 * xxf * (1-yyf) + rm2 * (1-xxf) * yyf + rm3 * xxf * yyf);
-                    uint8_t g = (uint8_t)(gm0 * (1-xxf) * (1-yyf) + gm1 * xxf * (1-yyf) + gm2 * (1-xxf) * yyf + gm3 * xxf * yyf);
-                    uint8_t b = (uint8_t)(bm0 * (1-xxf) * (1-yyf) + bm1 * xxf * (1-yyf) + bm2 * (1-xxf) * yyf + bm3 * xxf * yyf);
-
-                    float err;
-                    uint8_t i = ihq_calc_best_i4(ifactor, r0, g0, b0, r, g, b, &err);
-
-                    // If there's alpha present, include it in the texture as IA format
-                    if(alphausage){
-                        i_img[(y*width + x) * 2] = i;
-                        i_img[((y*width + x) * 2) + 1] = a0;
-                    }
-                    else i_img[y*width + x] = i;
-                    // if (x==16 && y==0) {
-                    //     printf("IHQ: (%d,%d): %d %d %d -> %d %d %d\n", x, y, r0, g0, b0, r, g, b);
-                    //     printf("IHQ: i=%d err=%f rgb=(%d,%d,%d)\n", i, err, (int)(r*(1-ifactor)+i*ifactor), (int)(g*(1-ifactor)+i*ifactor), (int)(b*(1-ifactor)+i*ifactor));
-                    // }
-                    mse += err;
-                }
-            }
+    if (width % 4 == 0)
+        img42 = image_shrink_box(img22, width/2, height/2, true, false);
+    if (height % 4 == 0)
+        img24 = image_shrink_box(img22, width/2, height/2, false, true);
+
+    // Evaluate all the candidate (direction, factor) pairs in parallel. Each
+    // candidate writes its own I plane; the best one is then selected in the
+    // same order as a sequential search, so the result is deterministic.
+    ihq_search_t search = {
+        .src = spr->images[0].image, .width = width, .height = height,
+        .img42 = img42, .img24 = img24, .alphausage = alphausage,
+    };
+    thParaLoopC(IHQ_CANDIDATES, ihq_eval_candidate, &search, image_threads);
 
-            mse = sqrtf(mse / (width * height));
-            if (mse < best_err) {
-                best_err = mse;
-                best_ifactor = ifactor;
-                best_rgb_w = iw;
-                best_rgb_h = ih;
-                best_rgb_img = img;
-                SWAP(best_i_img, i_img);
-            }
-             if (flag_verbose)
-                fprintf(stderr, "IHQ: detail factor=%.1f mse=%f\n", ifactor, mse);
-        }
+    int best = -1;
+    for (int k=0; k<IHQ_CANDIDATES; k++) {
+        if (!search.i_img[k]) continue;
+        if (best < 0 || search.mse[k] < search.mse[best])
+            best = k;
+        if (flag_verbose)
+            fprintf(stderr, "IHQ: detail factor=%.1f mse=%f\n", search.ifactor[k], search.mse[k]);
     }
+    assert(best >= 0);
+
+    uint8_t *best_rgb_img = search.rgb_img[best];
+    int best_rgb_w = search.rgb_w[best], best_rgb_h = search.rgb_h[best];
+    float best_err = search.mse[best];
+    float best_ifactor = search.ifactor[best];
+    uint8_t *best_i_img = search.i_img[best];
+    for (int k=0; k<IHQ_CANDIDATES; k++)
+        if (k != best) free(search.i_img[k]);
 
     // We computed the best IHQ image, now copy it as detail texture
     spr->detail.blend_factor = best_ifactor;
@@ -1014,7 +1058,7 @@ bool spritemaker_convert_ihq(spritemaker_t *spr) {
 
     if (img22 && img22 != best_rgb_img) free(img22);
     if (img42 && img42 != best_rgb_img) free(img42);
-    free(i_img);
+    if (img24 && img24 != best_rgb_img) free(img24);
     return true;
 }
 
@@ -1149,6 +1193,89 @@ static float shq_optimize(shq_box *box)
     return error;
 }
 
+typedef struct {
+    uint8_t *img;           // Source RGBA image
+    int width;              // Source image width
+    uint8_t *shq_i;         // Output I plane
+    uint8_t *shq_rgb;       // Output RGBA plane (half size)
+    float *row_error;       // Output error, per row of boxes
+} shq_convert_t;
+
+static void shq_convert_row(int row, void *arg)
+{
+    shq_convert_t *conv = arg;
+    uint8_t *img = conv->img;
+    uint8_t *shq_i = conv->shq_i;
+    uint8_t *shq_rgb = conv->shq_rgb;
+    int width = conv->width;
+    int y = row*2;
+    float error = 0.0f;
+
+    for (int x=0; x<width; x+=2) {
+        shq_box box = {0};
+
+        // Fetch first 4 pixels
+        box.pix[0].r = img[(y*width + x)*4 + 0];
+        box.pix[0].g = img[(y*width + x)*4 + 1];
+        box.pix[0].b = img[(y*width + x)*4 + 2];
+
+        box.pix[1].r = img[(y*width + x+1)*4 + 0];
+        box.pix[1].g = img[(y*width + x+1)*4 + 1];
+        box.pix[1].b = img[(y*width + x+1)*4 + 2];
+
+        box.pix[2].r = img[((y+1)*width + x)*4 + 0];
+        box.pix[2].g = img[((y+1)*width + x)*4 + 1];
+        box.pix[2].b = img[((y+1)*width + x)*4 + 2];
+
+        box.pix[3].r = img[((y+1)*width + x+1)*4 + 0];
+        box.pix[3].g = img[((y+1)*width + x+1)*4 + 1];
+        box.pix[3].b = img[((y+1)*width + x+1)*4 + 2];
+
+        // Start with the I values as the maximum of the RGB values, and convert
+        // them to 4 bits, making sure we are sitll above the original value.
+        for (int i=0; i<4; i++) {
+            int i8 = MAX(box.pix[i].r, MAX(box.pix[i].g, box.pix[i].b));
+            int i4 = i8 >> 4;
+            if (i4 * 0x11 < i8) i4++;
+            box.i[i] = i4;
+        }
+
+        // Start with RGB values as the average of the subtractive blending
+        // Notice that *0x11 is just the proper conversion from 4 bit to 8 bit.
+        box.avg.r = (MAX(box.i[0]*0x11 - box.pix[0].r,0) + MAX(box.i[1]*0x11 - box.pix[1].r,0) + MAX(box.i[2]*0x11 - box.pix[2].r,0) + MAX(box.i[3]*0x11 - box.pix[3].r,0)) / 4;
+        box.avg.g = (MAX(box.i[0]*0x11 - box.pix[0].g,0) + MAX(box.i[1]*0x11 - box.pix[1].g,0) + MAX(box.i[2]*0x11 - box.pix[2].g,0) + MAX(box.i[3]*0x11 - box.pix[3].g,0)) / 4;
+        box.avg.b = (MAX(box.i[0]*0x11 - box.pix[0].b,0) + MAX(box.i[1]*0x11 - box.pix[1].b,0) + MAX(box.i[2]*0x11 - box.pix[2].b,0) + MAX(box.i[3]*0x11 - box.pix[3].b,0)) / 4;
+        box.avg.r >>= 3;
+        box.avg.g >>= 3;
+        box.avg.b >>= 3;
+
+        // Run optimization step
+        error += shq_optimize(&box);
+
+        assert(box.i[0] >= 0 && box.i[0] <= 15);
+        assert(box.i[1] >= 0 && box.i[1] <= 15);
+        assert(box.i[2] >= 0 && box.i[2] <= 15);
+        assert(box.i[3] >= 0 && box.i[3] <= 15);
+        assert(box.avg.r >= 0 && box.avg.r <= 31);
+        assert(box.avg.g >= 0 && box.avg.g <= 31);
+        assert(box.avg.b >= 0 && box.avg.b <= 31);
+
+        // Store the optimized I value, upscaled to 8 bit
+        shq_i[(y+0)*width + x+0] = box.i[0] | (box.i[0] << 4);
+        shq_i[(y+0)*width + x+1] = box.i[1] | (box.i[1] << 4);
+        shq_i[(y+1)*width + x+0] = box.i[2] | (box.i[2] << 4);
+        shq_i[(y+1)*width + x+1] = box.i[3] | (box.i[3] << 4);
+
+        // Store the average color, again upscaled to 8 bit
+        shq_rgb[(y/2*width/2 + x/2)*4 + 0] = (box.avg.r << 3) | (box.avg.r >> 2);
+        shq_rgb[(y/2*width/2 + x/2)*4 + 1] = (box.avg.g << 3) | (box.avg.g >> 2);
+        shq_rgb[(y/2*width/2 + x/2)*4 + 2] = (box.avg.b << 3) | (box.avg.b >> 2);
+        shq_rgb[(y/2*width/2 + x/2)*4 + 3] = 0xFF;
+    }
+
+    conv->row_error[row] = error;
+}
+
 bool spritemaker_convert_shq(spritemaker_t *spr)
 {
     int width = spr->images[0].width;
@@ -1159,75 +1286,22 @@ bool spritemaker_convert_shq(spritemaker_t *spr)
         return false;
     }
 
-    // Go though each 2x2 pixel box
-    uint8_t *img = spr->images[0].image;
-    uint8_t *shq_i = malloc(width * height);
-    uint8_t *shq_rgb = malloc((width/2) * (height/2) * 4);
-    float error = 0.0f;
-
-    for (int y=0; y<height; y+=2) {
-        for (int x=0; x<width; x+=2) {
-            shq_box box = {0};
-
-            // Fetch first 4 pixels
-            box.pix[0].r = img[(y*width + x)*4 + 0];
-            box.pix[0].g = img[(y*width + x)*4 + 1];
-            box.pix[0].b = img[(y*width + x)*4 + 2];
-
-            box.pix[1].r = img[(y*width + x+1)*4 + 0];
-            box.pix[1].g = img[(y*width + x+1)*4 + 1];
-            box.pix[1].b = img[(y*width + x+1)*4 + 2];
-
-            box.pix[2].r = img[((y+1)*width + x)*4 + 0];
-            box.pix[2].g = img[((y+1)*width + x)*4 + 1];
-            box.pix[2].b = img[((y+1)*width + x)*4 + 2];
-
-            box.pix[3].r = img[((y+1)*width + x+1)*4 + 0];
-            box.pix[3].g = img[((y+1)*width + x+1)*4 + 1];
-            box.pix[3].b = img[((y+1)*width + x+1)*4 + 2];
-
-            // Start with the I values as the maximum of the RGB values, and convert
-            // them to 4 bits, making sure we are sitll above the original value.
-            for (int i=0; i<4; i++) {
-                int i8 = MAX(box.pix[i].r, MAX(box.pix[i].g, box.pix[i].b));
-                int i4 = i8 >> 4;
-                if (i4 * 0x11 < i8) i4++;
-                box.i[i] = i4;
-            }
+    // Go though each 2x2 pixel box, one row of boxes per task
+    shq_convert_t conv = {
+        .img = spr->images[0].image, .width = width,
+        .shq_i = malloc(width * height),
+        .shq_rgb = malloc((width/2) * (height/2) * 4),
+        .row_error = calloc(height/2, sizeof(float)),
+    };
+    thParaLoopC(height/2, shq_convert_row, &conv, image_threads);
 
-            // Start with RGB values as the average of the subtractive blending
-            // Notice that *0x11 is just the proper conversion from 4 bit to 8 bit.
-            box.avg.r = (MAX(box.i[0]*0x11 - box.pix[0].r,0) + MAX(box.i[1]*0x11 - box.pix[1].r,0) + MAX(box.i[2]*0x11 - box.pix[2].r,0) + MAX(box.i[3]*0x11 - box.pix[3].r,0)) / 4;
-            box.avg.g = (MAX(box.i[0]*0x11 - box.pix[0].g,0) + MAX(box.i[1]*0x11 - box.pix[1].g,0) + MAX(box.i[2]*0x11 - box.pix[2].g,0) + MAX(box.i[3]*0x11 - box.pix[3].g,0)) / 4;
-            box.avg.b = (MAX(box.i[0]*0x11 - box.pix[0].b,0) + MAX(box.i[1]*0x11 - box.pix[1].b,0) + MAX(box.i[2]*0x11 - box.pix[2].b,0) + MAX(box.i[3]*0x11 - box.pix[3].b,0)) / 4;
-            box.avg.r >>= 3;
-            box.avg.g >>= 3;
-            box.avg.b >>= 3;
-
-            // Run optimization step
-            error += shq_optimize(&box);
-
-            assert(box.i[0] >= 0 && box.i[0] <= 15);
-            assert(box.i[1] >= 0 && box.i[1] <= 15);
-            assert(box.i[2] >= 0 && box.i[2] <= 15);
-            assert(box.i[3] >= 0 && box.i[3] <= 15);
-            assert(box.avg.r >= 0 && box.avg.r <= 31);
-            assert(box.avg.g >= 0 && box.avg.g <= 31);
-            assert(box.avg.b >= 0 && box.avg.b <= 31);
-
-            // Store the optimized I value, upscaled to 8 bit
-            shq_i[(y+0)*width + x+0] = box.i[0] | (box.i[0] << 4);
-            shq_i[(y+0)*width + x+1] = box.i[1] | (box.i[1] << 4);
-            shq_i[(y+1)*width + x+0] = box.i[2] | (box.i[2] << 4);
-            shq_i[(y+1)*width + x+1] = box.i[3] | (box.i[3] << 4);
-
-            // Store the average color, again upscaled to 8 bit
-            shq_rgb[(y/2*width/2 + x/2)*4 + 0] = (box.avg.r << 3) | (box.avg.r >> 2);
-            shq_rgb[(y/2*width/2 + x/2)*4 + 1] = (box.avg.g << 3) | (box.avg.g >> 2);
-            shq_rgb[(y/2*width/2 + x/2)*4 + 2] = (box.avg.b << 3) | (box.avg.b >> 2);
-            shq_rgb[(y/2*width/2 + x/2)*4 + 3] = 0xFF;
-        }
-    }
+    // Sum the error in row order, so that the result is deterministic
+    float error = 0.0f;
+    for (int y=0; y<height/2; y++)
+        error += conv.row_error[y];
+    free(conv.row_error);
+    uint8_t *shq_i = conv.shq_i;
+    uint8_t *shq_rgb = conv.shq_rgb;
 
     if (flag_verbose)
         fprintf(stderr, "computed SHQ planes (rmsd=%.4f)\n", sqrtf(error / (width * height * 3)));
@@ -1509,9 +1583,49 @@ void spritemaker_free(spritemaker_t *spr) {
     memset(spr, 0, sizeof(*spr));
 }
 
+static void texparms_cache_key(assetcache_key_t *key, const texparms_t *tp) {
+    assetcache_key_addf(key, "texparms=%d,%a,%d,%a,%d,%a,%d,%a,%d", tp->defined,
+        tp->s.translate, tp->s.scale, tp->s.repeats, tp->s.mirror,
+        tp->t.translate, tp->t.scale, tp->t.repeats, tp->t.mirror);
+}
+
+bool convert_cache_key(const char *infn, const parms_t *pm, int compression, assetcache_key_t *key) {
+    assetcache_key_init(key);
+    assetcache_key_addf(key, "fmt=%d slices=%d,%d tiles=%d,%d mipmap=%d dither=%d gamma=%d compress=%d",
+        pm->outfmt, pm->hslices, pm->vslices, pm->tilew, pm->tileh,
+        pm->mipmap_algo, pm->dither_algo, pm->gamma_correct, compression);
+    texparms_cache_key(key, &pm->texparms);
+    assetcache_key_addf(key, "detail=%d,%d,%d,%a", pm->detail.enabled, pm->detail.use_main_tex,
+        pm->detail.outfmt, pm->detail.blend_factor);
+    texparms_cache_key(key, &pm->detail.texparms);
+
+    // The format can be autodetected from the filename, so it is part of the key
+    const char *basename = strrchr(infn, '/');
+    assetcache_key_addf(key, "%s", basename ? basename+1 : infn);
+    if (!assetcache_key_add_file(key, infn))
+        return false;
+    if (pm->detail.enabled && !pm->detail.use_main_tex && pm->detail.infn) {
+        if (!assetcache_key_add_file(key, pm->detail.infn))
+            return false;
+    }
+    return true;
+}
+
 int convert(const char *infn, const char *outfn, const parms_t *pm, int compression) {
-    FILE *out = tmpfile();
     bool out_is_stdout = (strstr(outfn, "(stdout)") != NULL);
+    if (compression == -1) compression = DEFAULT_COMPRESSION;
+
+    // Check if we already converted this very same file with the same flags
+    assetcache_key_t cache_key;
+    bool use_cache = assetcache_enabled() && !out_is_stdout && !flag_debug &&
+        convert_cache_key(infn, pm, compression, &cache_key);
+    if (use_cache && assetcache_fetch(&cache_key, outfn)) {
+        if (flag_verbose)
+            fprintf(stderr, "cached: %s -> %s\n", infn, outfn);
+        return 0;
+    }
+
+    FILE *out = tmpfile();
 
     if (flag_verbose)
         fprintf(stderr, "Converting: %s -> %s [fmt=%s tiles=%d,%d mipmap=%s dither=%s]\n",
@@ -1683,7 +1797,6 @@ int convert(const char *infn, const char *outfn, const parms_t *pm, int compress
         }
     }
 
-    if (compression == -1) compression = DEFAULT_COMPRESSION;
     int cmp_size = asset_compress_mem(data, sz, out, compression, 256*1024);
     free(data);
 
@@ -1697,6 +1810,8 @@ int convert(const char *infn, const char *outfn, const parms_t *pm, int compress
     }
 
     fclose(out);
+    if (use_cache)
+        assetcache_store(&cache_key, outfn, NULL);
     return 0;
 
 error:
@@ -1745,17 +1860,33 @@ bool cli_parse_texparms(const char *opt, texparms_t *parms)
 }
 
 
+typedef struct {
+    char *infn;             // Input file name
+    char *outfn;            // Output file name
+    parms_t pm;             // Conversion parameters (as of when the file was specified)
+    int compression;        // Compression level
+    int result;             // Result of convert()
+} convert_job_t;
+
+static void convert_job(int i, void *arg) {
+    convert_job_t *job = &((convert_job_t*)arg)[i];
+    job->result = convert(job->infn, job->outfn, &job->pm, job->compression);
+}
+
 int main(int argc, char *argv[])
 {
     char *infn = NULL, *outdir = ".", *outfn = NULL;
     parms_t pm = {0}; int compression = -1;
     bool at_least_one_file = false;
+    convert_job_t *jobs = NULL; int num_jobs = 0;
 
     if (argc < 2) {
         print_args(argv[0]);
         return 1;
     }
 
+    assetcache_init("mksprite", argv[0]);
+
     // We still support (but not document) the old mksprite command line
     // syntax: mksprite <bitdepth> [hslices vslices] input output
     if ((argc == 4 || argc == 6) && (!strcmp(argv[1], "16") || !strcmp(argv[1], "32"))) {
@@ -1794,6 +1925,22 @@ int main(int argc, char *argv[])
                 flag_debug = true;
             } 
 
+            /* ---------------- JOBS console argument ------------------- */
+            /* -j/--jobs <N>         Convert using N parallel threads (0 = all cores, default: 1)             */
+            else if (!strcmp(argv[i], "-j") || !strcmp(argv[i], "--jobs")) {
+                if (++i == argc) {
+                    fprintf(stderr, "missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                char extra;
+                if (sscanf(argv[i], "%d%c", &flag_jobs, &extra) != 1 || flag_jobs < 0) {
+                    fprintf(stderr, "invalid argument for %s: %s\n", argv[i-1], argv[i]);
+                    return 1;
+                }
+                if (flag_jobs == 0)
+                    flag_jobs = thHardwareConcurrency();
+            } 
+
             /* ---------------- OUTPUT FILE console argument ------------------- */
             /* -o/--output <dir>     Specify output directory (default: .)             */
             else if (!strcmp(argv[i], "-o") || !strcmp(argv[i], "--output")) {
@@ -1979,12 +2126,34 @@ int main(int argc, char *argv[])
         if (ext) *ext = '\0';
 
         asprintf(&outfn, "%s/%s.sprite", outdir, basename_noext);
+        free(basename_noext);
 
-        if (convert(infn, outfn, &pm, compression) != 0)
-            error = true;
+        // Queue the conversion. Each job keeps a copy of the parameters, as
+        // flags only apply to the files specified after them.
+        jobs = realloc(jobs, (num_jobs+1) * sizeof(convert_job_t));
+        jobs[num_jobs++] = (convert_job_t){
+            .infn = infn, .outfn = outfn, .pm = pm, .compression = compression,
+        };
+    }
 
-        free(outfn);
+    // Run the conversions. With multiple files, parallelize across files;
+    // with a single file, parallelize the work within the image instead.
+    // Either way, each output only depends on its own input, so the result
+    // is byte-identical to a sequential run.
+    if (num_jobs > 1 && flag_jobs > 1) {
+        image_threads = 1;
+        thParaLoopC(num_jobs, convert_job, jobs, flag_jobs);
+    } else {
+        image_threads = flag_jobs;
+        for (int i=0; i<num_jobs; i++)
+            convert_job(i, jobs);
+    }
+    for (int i=0; i<num_jobs; i++) {
+        if (jobs[i].result != 0)
+            error = true;
+        free(jobs[i].outfn);
     }
+    free(jobs);
 
     if (!at_least_one_file) {
         infn = getenv("MKSPRITE_INFN");
@@ -2005,6 +2174,7 @@ int main(int argc, char *argv[])
         setmode(1, _O_BINARY);
         #endif
 
+        image_threads = flag_jobs;
         if (convert(infn, outfn, &pm, compression) != 0) {
             error = true;
         }
@@ -2,6 +2,7 @@
 #include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include "rdpq_debug.h"
 #include "../../src/rdpq/rdpq_debug_internal.h"
 #include "../../src/rdpq/rdpq_debug.c"
@@ -21,10 +22,16 @@ void usage(void) {
     printf("   -B / --binary         File is binary. Default is autodetect.\n");
     printf("   -d / --disassemble    Disassemble the file (default is off, just validate).\n");
     printf("   -t / --triangles      When disassembling, also show all triangles in the output.\n");
+    printf("   -a / --analyze        Estimate RDP cycles per primitive and print a hotspot report.\n");
+    printf("   -n / --top <N>        Number of entries in each hotspot list (default: 10).\n");
     printf("\n");
     printf("Hex format is an ASCII file: one line per RDP command, written in hexadecimal format.\n");
     printf("Lines starting with '#' are skipped.\n");
     printf("Binary format is a raw sequence of 8-bytes RDP commands.\n");
+    printf("\n");
+    printf("The analysis mode uses a simplified timing model of the RDP (fill rate per cycle type,\n");
+    printf("framebuffer/Z-buffer memory accesses, TMEM load bandwidth). Numbers are estimates meant to\n");
+    printf("rank hotspots, not to predict exact timings.\n");
 }
 
 void arr_append(uint64_t **buf, int *size, int *cap, uint64_t val)
@@ -48,6 +55,341 @@ bool detect_ascii(FILE *f) {
     return true;
 }
 
+/**
+ * @name Analysis mode
+ *
+ * The analyzer walks the command stream after the validator (so that the
+ * mirrored RDP state in #rdp is up to date), and estimates the cost of each
+ * primitive and TMEM load with a simplified timing model of the RDP.
+ * @{
+ */
+
+#define RCP_FREQUENCY           62500000    ///< RCP clock frequency (Hz)
+#define PRIM_SETUP_CYCLES       12          ///< Fixed cost of a drawing primitive (setup)
+#define SPAN_SETUP_CYCLES       2           ///< Additional cost per scanline (edge walking / span buffer)
+#define ZBUF_CYCLES_PER_PIXEL   1.0f        ///< Additional cost per pixel for Z-buffer read/write
+#define READ_CYCLES_PER_PIXEL   0.5f        ///< Additional cost per pixel for framebuffer read (blending)
+#define LOAD_SETUP_CYCLES       30          ///< Fixed cost of a TMEM load (RDRAM latency)
+#define LOAD_ROW_CYCLES         4           ///< Additional cost per row for LOAD_TILE
+#define COV_SIZE                1024        ///< Size of the coverage grid (max RDP coordinates)
+
+/** @brief A drawing primitive found in the stream */
+typedef struct {
+    int index;              ///< Index of the command in the stream (in 64-bit words)
+    uint8_t cmd;            ///< RDP command ID
+    uint64_t som, cc;       ///< Render mode used to draw it
+    int pixels;             ///< Number of pixels drawn (after scissoring)
+    float cycles;           ///< Estimated cycles
+} prim_t;
+
+/** @brief Primitives sharing the same render mode */
+typedef struct {
+    uint64_t som, cc;       ///< Render mode
+    int first;              ///< Index of the first primitive drawn with it
+    int prims;              ///< Number of primitives
+    int64_t pixels;         ///< Total number of pixels
+    float cycles;           ///< Total estimated cycles
+} group_t;
+
+static struct {
+    prim_t *prims;          ///< All primitives in the stream
+    int num_prims, max_prims;
+    group_t *groups;        ///< Render modes
+    int num_groups, max_groups;
+    float raster_cycles;    ///< Total cycles spent rasterizing
+    float load_cycles;      ///< Total cycles spent loading TMEM
+    int num_loads;          ///< Number of TMEM loads
+    int64_t load_bytes;     ///< Bytes loaded into TMEM
+    int64_t pixels;         ///< Total pixels drawn
+    int64_t unique_pixels;  ///< Pixels drawn at least once in their frame
+    int syncs[4];           ///< Number of SYNC_LOAD, SYNC_PIPE, SYNC_TILE, SYNC_FULL
+    uint64_t last_state[64];   ///< Last value for each state command
+    bool has_state[64];        ///< True if last_state is valid
+    uint64_t last_tile[2][8];  ///< Last SET_TILE / SET_TILE_SIZE for each tile
+    bool has_tile[2][8];       ///< True if last_tile is valid
+    int redundant[64];      ///< Number of redundant state changes, per command
+    uint8_t *cov;           ///< Coverage grid for overdraw (reset at each frame)
+} an;
+
+static const char *state_cmd_name(int cmd) {
+    switch (cmd) {
+    case 0x2A: return "SET_KEY_GB";      case 0x2B: return "SET_KEY_R";
+    case 0x2C: return "SET_CONVERT";     case 0x2D: return "SET_SCISSOR";
+    case 0x2E: return "SET_PRIM_DEPTH";  case 0x2F: return "SET_OTHER_MODES";
+    case 0x32: return "SET_TILE_SIZE";   case 0x35: return "SET_TILE";
+    case 0x37: return "SET_FILL_COLOR";  case 0x38: return "SET_FOG_COLOR";
+    case 0x39: return "SET_BLEND_COLOR"; case 0x3A: return "SET_PRIM_COLOR";
+    case 0x3B: return "SET_ENV_COLOR";   case 0x3C: return "SET_COMBINE";
+    case 0x3D: return "SET_TEX_IMAGE";   case 0x3E: return "SET_Z_IMAGE";
+    case 0x3F: return "SET_COLOR_IMAGE";
+    default:   return "???";
+    }
+}
+
+static const char *prim_name(int cmd) {
+    if (CMD_IS_TRI(cmd)) return tri_name[cmd & 7];
+    switch (cmd) {
+    case 0x24: return "TEX_RECT";
+    case 0x25: return "TEX_RECT_FLIP";
+    case 0x36: return "FILL_RECT";
+    default:   return "???";
+    }
+}
+
+static void mode_name(char *buf, int size, uint64_t som) {
+    static const char *cyc[4] = { "1cyc", "2cyc", "copy", "fill" };
+    setothermodes_t m = decode_som(som);
+    snprintf(buf, size, "%s%s%s%s", cyc[m.cycle_type],
+        m.cycle_type < 2 && m.z.cmp ? " zcmp" : "",
+        m.cycle_type < 2 && m.z.upd ? " zupd" : "",
+        m.cycle_type < 2 && m.read ? " read" : "");
+}
+
+/** @brief Estimated cycles per pixel in the current render mode */
+static float analyze_pixel_cycles(void) {
+    int bpp = 4 << rdp.col.size;
+    switch (rdp.som.cycle_type) {
+    default:
+    case 0: case 1: {
+        // 1-cycle mode draws one pixel per clock, 2-cycle mode one every two
+        // clocks. Accessing RDRAM for Z-buffer or blending adds extra latency.
+        float cpp = rdp.som.cycle_type == 0 ? 1.0f : 2.0f;
+        if (rdp.last_z && (rdp.som.z.cmp || rdp.som.z.upd)) cpp += ZBUF_CYCLES_PER_PIXEL;
+        if (rdp.som.read) cpp += READ_CYCLES_PER_PIXEL;
+        return cpp;
+    }
+    case 2: case 3:
+        // Copy and fill modes write 64 bits per clock
+        return bpp / 64.0f;
+    }
+}
+
+/** @brief Accumulate a span of pixels into the coverage grid, return its length after clipping */
+static int analyze_span(int y, int x0, int x1) {
+    int cx0 = 0, cy0 = 0, cx1 = COV_SIZE, cy1 = COV_SIZE;
+    if (rdp.sent_scissor) {
+        cx0 = rdp.clip.x0; cy0 = rdp.clip.y0;
+        cx1 = MIN(rdp.clip.x1, COV_SIZE); cy1 = MIN(rdp.clip.y1, COV_SIZE);
+    }
+    if (rdp.last_col)
+        cx1 = MIN(cx1, rdp.col.width);
+    if (y < cy0 || y >= cy1) return 0;
+    x0 = MAX(x0, cx0); x1 = MIN(x1, cx1);
+    if (x0 >= x1) return 0;
+
+    uint8_t *row = &an.cov[y * COV_SIZE];
+    for (int x = x0; x < x1; x++) {
+        if (!row[x]) an.unique_pixels++;
+        if (row[x] < 255) row[x]++;
+    }
+    return x1 - x0;
+}
+
+static void analyze_prim(uint64_t *buf, int index, int pixels, int rows) {
+    float cycles = PRIM_SETUP_CYCLES + rows * SPAN_SETUP_CYCLES + pixels * analyze_pixel_cycles();
+    uint64_t som = rdp.last_som_data, cc = rdp.last_cc_data;
+
+    if (an.num_prims == an.max_prims) {
+        an.max_prims = an.max_prims ? an.max_prims * 2 : 256;
+        an.prims = realloc(an.prims, an.max_prims * sizeof(prim_t));
+    }
+    an.prims[an.num_prims] = (prim_t){
+        .index = index, .cmd = CMD(buf[0]), .som = som, .cc = cc,
+        .pixels = pixels, .cycles = cycles,
+    };
+
+    group_t *g = NULL;
+    for (int i = 0; i < an.num_groups; i++) {
+        if (an.groups[i].som == som && an.groups[i].cc == cc) {
+            g = &an.groups[i];
+            break;
+        }
+    }
+    if (!g) {
+        if (an.num_groups == an.max_groups) {
+            an.max_groups = an.max_groups ? an.max_groups * 2 : 32;
+            an.groups = realloc(an.groups, an.max_groups * sizeof(group_t));
+        }
+        g = &an.groups[an.num_groups++];
+        *g = (group_t){ .som = som, .cc = cc, .first = an.num_prims };
+    }
+    g->prims++;
+    g->pixels += pixels;
+    g->cycles += cycles;
+
+    an.num_prims++;
+    an.pixels += pixels;
+    an.raster_cycles += cycles;
+}
+
+static void analyze_rect(uint64_t *buf, int index) {
+    float x0 = BITS(buf[0], 12, 23)*FX(2), y0 = BITS(buf[0],  0, 11)*FX(2);
+    float x1 = BITS(buf[0], 44, 55)*FX(2), y1 = BITS(buf[0], 32, 43)*FX(2);
+    int ix0, iy0, ix1, iy1;
+    if (rdp.som.cycle_type >= 2) {
+        // Copy and fill modes have inclusive bounds
+        ix0 = x0; iy0 = y0; ix1 = (int)x1 + 1; iy1 = (int)y1 + 1;
+    } else {
+        ix0 = ceilf(x0); iy0 = ceilf(y0); ix1 = ceilf(x1); iy1 = ceilf(y1);
+    }
+    int pixels = 0;
+    for (int y = iy0; y < iy1; y++)
+        pixels += analyze_span(y, ix0, ix1);
+    analyze_prim(buf, index, pixels, MAX(iy1 - iy0, 0));
+}
+
+static void analyze_tri(uint64_t *buf, int index) {
+    float yl = SBITS(buf[0], 32, 45)*FX(2), ym = SBITS(buf[0], 16, 29)*FX(2), yh = SBITS(buf[0], 0, 13)*FX(2);
+    float xl = (int32_t)(buf[1] >> 32) * FX(16), dxldy = (int32_t)buf[1] * FX(16);
+    float xh = (int32_t)(buf[2] >> 32) * FX(16), dxhdy = (int32_t)buf[2] * FX(16);
+    float xm = (int32_t)(buf[3] >> 32) * FX(16), dxmdy = (int32_t)buf[3] * FX(16);
+
+    // XH and XM are defined on the scanline containing YH, XL on YM.
+    float ytop = floorf(yh);
+    int pixels = 0, rows = 0;
+    for (int y = ceilf(yh); y < ceilf(yl); y++) {
+        float xmaj = xh + dxhdy * (y - ytop);
+        float xmin = y < ym ? xm + dxmdy * (y - ytop) : xl + dxldy * (y - ym);
+        pixels += analyze_span(y, ceilf(MIN(xmaj, xmin)), ceilf(MAX(xmaj, xmin)));
+        rows++;
+    }
+    analyze_prim(buf, index, pixels, rows);
+}
+
+static void analyze_load(int bytes, int rows) {
+    an.num_loads++;
+    an.load_bytes += bytes;
+    an.load_cycles += LOAD_SETUP_CYCLES + rows * LOAD_ROW_CYCLES + (bytes + 7) / 8;
+}
+
+static void analyze_state(uint64_t *buf) {
+    int cmd = CMD(buf[0]);
+    uint64_t *last; bool *valid;
+    if (cmd == 0x35 || cmd == 0x32) {
+        int tidx = BITS(buf[0], 24, 26);
+        last = &an.last_tile[cmd == 0x32][tidx];
+        valid = &an.has_tile[cmd == 0x32][tidx];
+    } else {
+        last = &an.last_state[cmd];
+        valid = &an.has_state[cmd];
+    }
+    if (*valid && *last == buf[0])
+        an.redundant[cmd]++;
+    *last = buf[0];
+    *valid = true;
+}
+
+static void analyze_reset_frame(void) {
+    memset(an.cov, 0, COV_SIZE * COV_SIZE);
+}
+
+/** @brief Analyze a command. Must be called after #rdpq_validate, with the RDP state updated. */
+static void analyze_cmd(uint64_t *buf, int index) {
+    int cmd = CMD(buf[0]);
+    int bpp = 4 << rdp.tex.size;
+
+    if (!an.cov)
+        an.cov = calloc(COV_SIZE, COV_SIZE);
+
+    if (CMD_IS_TRI(cmd)) {
+        analyze_tri(buf, index);
+        return;
+    }
+
+    switch (cmd) {
+    case 0x24: case 0x25: case 0x36:
+        analyze_rect(buf, index);
+        break;
+    case 0x33: { // LOAD_BLOCK
+        int texels = BITS(buf[0], 12, 23) - BITS(buf[0], 44, 55) + 1;
+        analyze_load(texels * bpp / 8, 0);
+    }   break;
+    case 0x34: { // LOAD_TILE
+        int width  = (BITS(buf[0], 12, 23) - BITS(buf[0], 44, 55)) / 4 + 1;
+        int height = (BITS(buf[0],  0, 11) - BITS(buf[0], 32, 43)) / 4 + 1;
+        analyze_load(width * bpp / 8 * height, height);
+    }   break;
+    case 0x30: { // LOAD_TLUT
+        // Each palette entry is replicated 4 times in TMEM, so it costs
+        // roughly one clock per entry rather than per 64-bit word.
+        int entries = (BITS(buf[0], 12, 23) >> 2) - (BITS(buf[0], 44, 55) >> 2) + 1;
+        analyze_load(entries * 8, 0);
+    }   break;
+    case 0x26: an.syncs[0]++; break;
+    case 0x27: an.syncs[1]++; break;
+    case 0x28: an.syncs[2]++; break;
+    case 0x29: an.syncs[3]++;
+        analyze_reset_frame();
+        break;
+    case 0x3F:
+        // Switching render target starts a new surface: overdraw is
+        // meaningful only within the same surface.
+        if (an.has_state[cmd] && an.last_state[cmd] != buf[0])
+            analyze_reset_frame();
+        analyze_state(buf);
+        break;
+    case 0x2A ... 0x2F: case 0x32: case 0x35: case 0x37 ... 0x3E:
+        analyze_state(buf);
+        break;
+    }
+}
+
+static int cmp_prims(const void *a, const void *b) {
+    float ca = ((const prim_t*)a)->cycles, cb = ((const prim_t*)b)->cycles;
+    return (ca < cb) - (ca > cb);
+}
+
+static int cmp_groups(const void *a, const void *b) {
+    float ca = ((const group_t*)a)->cycles, cb = ((const group_t*)b)->cycles;
+    return (ca < cb) - (ca > cb);
+}
+
+static void analyze_report(FILE *out, int num_cmds, int top) {
+    float total = an.raster_cycles + an.load_cycles;
+    char mode[64];
+
+    fprintf(out, "RDP analysis: %d commands, %d primitives\n", num_cmds, an.num_prims);
+    fprintf(out, "  Estimated cycles:  %.0f (%.3f ms)\n", total, total * 1000.0f / RCP_FREQUENCY);
+    fprintf(out, "    Rasterization:   %.0f (%.1f%%)\n", an.raster_cycles, total ? 100.0f * an.raster_cycles / total : 0);
+    fprintf(out, "    TMEM loads:      %.0f (%.1f%%) in %d loads, %lld bytes\n", an.load_cycles,
+        total ? 100.0f * an.load_cycles / total : 0, an.num_loads, (long long)an.load_bytes);
+    fprintf(out, "  Pixels drawn:      %lld (unique: %lld, overdraw: %.2fx)\n", (long long)an.pixels,
+        (long long)an.unique_pixels, an.unique_pixels ? (float)an.pixels / an.unique_pixels : 0);
+    fprintf(out, "  Syncs:             SYNC_LOAD=%d SYNC_PIPE=%d SYNC_TILE=%d SYNC_FULL=%d\n",
+        an.syncs[0], an.syncs[1], an.syncs[2], an.syncs[3]);
+
+    int redundant = 0;
+    for (int i = 0; i < 64; i++) redundant += an.redundant[i];
+    fprintf(out, "  Redundant state:   %d\n", redundant);
+    for (int i = 0; i < 64; i++) {
+        if (an.redundant[i])
+            fprintf(out, "    %-16s %d\n", state_cmd_name(i), an.redundant[i]);
+    }
+
+    qsort(an.groups, an.num_groups, sizeof(group_t), cmp_groups);
+    fprintf(out, "\nHotspots by render mode:\n");
+    fprintf(out, "   # %10s %6s %6s %9s  %-22s %-18s %s\n", "cycles", "%", "prims", "pixels", "mode", "SOM", "CC");
+    for (int i = 0; i < MIN(an.num_groups, top); i++) {
+        group_t *g = &an.groups[i];
+        mode_name(mode, sizeof(mode), g->som);
+        fprintf(out, "  %2d %10.0f %5.1f%% %6d %9lld  %-22s %016llx   %016llx\n", i+1, g->cycles,
+            total ? 100.0f * g->cycles / total : 0, g->prims, (long long)g->pixels, mode,
+            (unsigned long long)g->som, (unsigned long long)g->cc);
+    }
+
+    qsort(an.prims, an.num_prims, sizeof(prim_t), cmp_prims);
+    fprintf(out, "\nHotspots by primitive:\n");
+    fprintf(out, "   # %10s %6s %8s %9s  %-16s %s\n", "cycles", "%", "index", "pixels", "command", "mode");
+    for (int i = 0; i < MIN(an.num_prims, top); i++) {
+        prim_t *p = &an.prims[i];
+        mode_name(mode, sizeof(mode), p->som);
+        fprintf(out, "  %2d %10.0f %5.1f%% %8d %9d  %-16s %s\n", i+1, p->cycles,
+            total ? 100.0f * p->cycles / total : 0, p->index, p->pixels, prim_name(p->cmd), mode);
+    }
+}
+
+/** @} */
+
 int main(int argc, char *argv[])
 {
     if (argc < 2) {
@@ -59,6 +401,8 @@ int main(int argc, char *argv[])
 
     bool disasm = false;
     bool show_tris = false;
+    bool analyze = false;
+    int top = 10;
     int mode = MODE_AUTODETECT;
     int i;
     for (i=1; i<argc; i++) {
@@ -71,6 +415,14 @@ int main(int argc, char *argv[])
                 disasm = true;
             } else if (!strcmp(argv[i], "-t") || !strcmp(argv[i], "--triangles")) {
                 show_tris = true;
+            } else if (!strcmp(argv[i], "-a") || !strcmp(argv[i], "--analyze")) {
+                analyze = true;
+            } else if (!strcmp(argv[i], "-n") || !strcmp(argv[i], "--top")) {
+                if (++i == argc) {
+                    fprintf(stderr, "ERROR: missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                top = atoi(argv[i]);
             } else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
                 usage();
                 return 0;
@@ -138,7 +490,12 @@ int main(int argc, char *argv[])
 
         uint32_t val_flags = shown ? RDPQ_VALIDATE_FLAG_NOECHO : 0;
         rdpq_validate(cur, val_flags, NULL, NULL);
+        if (analyze)
+            analyze_cmd(cur, cur - cmds);
         
         cur += sz;
     }
+
+    if (analyze)
+        analyze_report(stdout, size, top);
 }
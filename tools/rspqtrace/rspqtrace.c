@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "rspq_constants.h"
+
+void usage(void) {
+    printf("rspqtrace -- RSP profiler timeline converter\n");
+    printf("\n");
+    printf("This tool extracts the RSP timeline dumped by rspq_profile_trace_dump() from a debug log,\n");
+    printf("and converts it into a trace in the Chrome JSON format, that can be opened with\n");
+    printf("chrome://tracing or https://ui.perfetto.dev.\n");
+    printf("\n");
+    printf("Usage:\n");
+    printf("   rspqtrace [flags] <log file>\n");
+    printf("\n");
+    printf("Options:\n");
+    printf("   -o / --output <file>  Output file (default: stdout).\n");
+    printf("\n");
+    printf("The log file can be \"-\" to read from stdin. Lines not containing RSPQTRACE are ignored,\n");
+    printf("so the whole output of the debug channel can be passed as-is.\n");
+}
+
+static const char *kind_names[] = {
+    [RSPQ_PROFILE_TRACE_KIND_WAIT_CPU] = "Wait CPU",
+    [RSPQ_PROFILE_TRACE_KIND_WAIT_RDP] = "Wait RDP",
+    [RSPQ_PROFILE_TRACE_KIND_WAIT_RDP_SYNCFULL] = "Wait SYNC_FULL",
+    [RSPQ_PROFILE_TRACE_KIND_WAIT_RDP_SYNCFULL_MULTI] = "Wait SYNC_FULLx2",
+    [RSPQ_PROFILE_TRACE_KIND_OVL_SWITCH] = "Ovl Switch",
+};
+
+/** @brief Name and index of the first command of each overlay ID */
+static struct {
+    char name[64];
+    int base;
+} overlays[RSPQ_MAX_OVERLAYS];
+
+static double freq = 62500000;    ///< RCP frequency (overridden by the trace header)
+static FILE *out;
+static bool first_event = true;
+
+static uint64_t now;            ///< Current time (in RCP ticks), unwrapped from the 24-bit timestamps
+static uint32_t last_ts;        ///< Last 24-bit timestamp seen
+static bool first_ts = true;
+static uint64_t pending_waits;  ///< Time spent waiting RDP since the last command
+static bool frame_start;        ///< True if next event is the first of a frame
+static int cur_frame;
+
+static double ticks_to_us(uint64_t ticks)
+{
+    return (double)ticks * 1000000.0 / freq;
+}
+
+static void emit(const char *name, const char *cat, int tid, uint64_t start, uint64_t dur, const char *args)
+{
+    fprintf(out, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f%s%s%s}",
+        first_event ? "" : ",", name, cat, tid, ticks_to_us(start), ticks_to_us(dur),
+        args ? ",\"args\":{" : "", args ? args : "", args ? "}" : "");
+    first_event = false;
+}
+
+static void command_name(char *buf, int size, int cmd_id)
+{
+    int id = cmd_id >> 4;
+    const char *name = overlays[id].name[0] ? overlays[id].name : "???";
+    snprintf(buf, size, "%s 0x%02x", name, overlays[id].base + (cmd_id & 0xF));
+}
+
+static void process_event(uint64_t ev)
+{
+    uint32_t w0 = ev >> 32, w1 = ev;
+    int cmd_id = w0 >> 24;
+    uint32_t ts = w0 & 0xFFFFFF;
+    int kind = w1 >> 24;
+    uint64_t dur = w1 & 0xFFFFFF;
+
+    // The RDP clock is only 24 bits, so it wraps around every few hundreds
+    // of milliseconds. Events are in chronological order, so we can unwrap it.
+    if (first_ts) {
+        now = ts;
+        first_ts = false;
+    } else {
+        now += (ts - last_ts) & 0xFFFFFF;
+    }
+    last_ts = ts;
+
+    char name[96], args[128];
+    command_name(name, sizeof(name), cmd_id);
+
+    if (frame_start) {
+        fprintf(out, "%s\n{\"name\":\"Frame %d\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":1,\"ts\":%.3f}",
+            first_event ? "" : ",", cur_frame, ticks_to_us(now - dur));
+        first_event = false;
+        frame_start = false;
+    }
+
+    switch (kind) {
+    case RSPQ_PROFILE_TRACE_KIND_WAIT_CPU:
+        pending_waits = 0;
+        emit(kind_names[kind], "idle", 1, now - dur, dur, NULL);
+        break;
+    case RSPQ_PROFILE_TRACE_KIND_WAIT_RDP:
+    case RSPQ_PROFILE_TRACE_KIND_WAIT_RDP_SYNCFULL:
+    case RSPQ_PROFILE_TRACE_KIND_WAIT_RDP_SYNCFULL_MULTI:
+        // Waits happen within a command, so they are shown nested in it
+        pending_waits += dur;
+        snprintf(args, sizeof(args), "\"command\":\"%s\"", name);
+        emit(kind_names[kind], "wait", 1, now - dur, dur, args);
+        break;
+    case RSPQ_PROFILE_TRACE_KIND_OVL_SWITCH:
+        snprintf(args, sizeof(args), "\"command\":\"%s\"", name);
+        emit(kind_names[kind], "overlay", 1, now - dur, dur, args);
+        break;
+    default:
+        // The duration of a command does not include the time spent waiting
+        // for RDP. Extend the event so that it covers the waits as well.
+        snprintf(args, sizeof(args), "\"rsp_us\":%.3f,\"wait_us\":%.3f",
+            ticks_to_us(dur), ticks_to_us(pending_waits));
+        emit(name, kind == RSPQ_PROFILE_TRACE_KIND_BUILTIN ? "builtin" : "command",
+            1, now - dur - pending_waits, dur + pending_waits, args);
+        pending_waits = 0;
+        break;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        usage();
+        return 1;
+    }
+
+    const char *outfn = NULL;
+    int i;
+    for (i=1; i<argc; i++) {
+        if (argv[i][0] == '-' && argv[i][1] != 0) {
+            if (!strcmp(argv[i], "-o") || !strcmp(argv[i], "--output"))  {
+                if (++i == argc) {
+                    fprintf(stderr, "ERROR: missing argument for %s\n", argv[i-1]);
+                    return 1;
+                }
+                outfn = argv[i];
+            } else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+                usage();
+                return 0;
+            } else {
+                fprintf(stderr, "ERROR: unknown option: %s\n", argv[i]);
+                return 1;
+            }
+        } else {
+            break;
+        }
+    }
+
+    if (i == argc) {
+        fprintf(stderr, "ERROR: missing filename to process\n");
+        return 1;
+    }
+
+    FILE *f = strcmp(argv[i], "-") ? fopen(argv[i], "r") : stdin;
+    if (!f) {
+        fprintf(stderr, "ERROR: cannot open file: %s\n", argv[i]);
+        return 1;
+    }
+
+    out = outfn ? fopen(outfn, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "ERROR: cannot create file: %s\n", outfn);
+        return 1;
+    }
+
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    fprintf(out, "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"RSP\"}}");
+    first_event = false;
+
+    char line[1024];
+    int num_frames = 0, num_events = 0;
+    bool found = false;
+    while (fgets(line, sizeof(line), f)) {
+        char *p = strstr(line, "RSPQTRACE ");
+        if (!p) continue;
+        p += strlen("RSPQTRACE ");
+
+        switch (*p) {
+        case 'H': {
+            int hz;
+            if (sscanf(p+1, "%d", &hz) == 1 && hz > 0)
+                freq = hz;
+            found = true;
+        }   break;
+        case 'O': {
+            unsigned id, base; char name[64];
+            if (sscanf(p+1, "%x %x %63s", &id, &base, name) == 3 && id < RSPQ_MAX_OVERLAYS) {
+                strcpy(overlays[id].name, name);
+                overlays[id].base = base;
+            }
+        }   break;
+        case 'F':
+            if (sscanf(p+1, "%d", &cur_frame) == 1) {
+                frame_start = true;
+                num_frames++;
+            }
+            break;
+        case 'E': {
+            if (!strncmp(p, "END", 3))
+                break;
+            p++;
+            int n;
+            unsigned long long ev;
+            while (sscanf(p, "%llx%n", &ev, &n) == 1) {
+                process_event(ev);
+                num_events++;
+                p += n;
+            }
+        }   break;
+        }
+    }
+
+    fprintf(out, "\n]}\n");
+    if (outfn) fclose(out);
+    if (f != stdin) fclose(f);
+
+    if (!found) {
+        fprintf(stderr, "ERROR: no RSP timeline found in the log (see rspq_profile_trace_dump)\n");
+        return 1;
+    }
+    fprintf(stderr, "Converted %d frames (%d events)\n", num_frames, num_events);
+    return 0;
+}